@@ -0,0 +1,220 @@
+//
+// Created by valentin on 01/30/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "memory.h"
+#include "cpu/cpu.h"
+#include "faults/fault.h"
+#include "coprocessor/coprocessor.h"
+
+// Bulk memory coprocessor
+//
+// Gives guest software host-speed memmove, memset, memcmp, CRC-32 and hashing over
+// guest memory instead of byte loops through the interpreter.
+//
+//   MCR p<BULK_CP>, 0, Rx, c<n>, c0     argument n := Rx   (c0 dst, c1 src, c2 length, c3 value/seed)
+//   MRC p<BULK_CP>, 0, Rd, c<n>, c0     Rd := argument n
+//   MRC p<BULK_CP>, <op>, Rd, c0, c0    runs BulkOp <op> and returns its result in Rd
+//
+// Ranges inside one host-backed region (one page, under the guest's MMU) are handled
+// by the host libc, anything else (region or page boundaries, ROM, MMIO) goes byte by
+// byte through the MMU and the memory map. A byte outside guest memory stops the guest
+// with FAULT_OUT_OF_BOUNDS, one the MMU refuses with its abort.
+
+#ifndef BULK_CP
+#define BULK_CP 6u
+#endif
+
+typedef enum BulkArgument {
+    BULK_ARG_DST = 0,
+    BULK_ARG_SRC,
+    BULK_ARG_LENGTH,
+    /// Fill byte of MEMSET, seed of CRC32 and HASH
+    BULK_ARG_VALUE,
+    BULK_ARG_COUNT,
+} BulkArgument;
+
+/// MRC Op1 of each operation
+typedef enum BulkOp {
+    /// Argument register access
+    BULK_OP_REGISTER = 0,
+    /// dst := src (overlap allowed), returns dst
+    BULK_OP_MEMMOVE,
+    /// dst := value, returns dst
+    BULK_OP_MEMSET,
+    /// Compares dst with src, returns -1, 0 or 1
+    BULK_OP_MEMCMP,
+    /// CRC-32 (IEEE 802.3, reflected) of src, continuing from the CRC in value (0 to start)
+    BULK_OP_CRC32,
+    /// 32-bit FNV-1a of src, starting from value (0 picks the FNV offset basis)
+    BULK_OP_HASH,
+} BulkOp;
+
+static const word_t BULK_CRC32_POLYNOMIAL = 0xEDB88320u;
+static const word_t BULK_FNV_OFFSET_BASIS = 0x811C9DC5u;
+static const word_t BULK_FNV_PRIME = 0x01000193u;
+
+/// Byte-at-a-time CRC-32 table, filled by construct_bulk_coprocessor
+static word_t BULK_CRC32_TABLE[256];
+
+typedef struct BulkCoprocessor {
+    Coprocessor coprocessor;
+    const ProgramMemory *memory;
+    word_t args[BULK_ARG_COUNT];
+} BulkCoprocessor;
+
+/// Host pointer of the whole guest range, NULL when it is not one host-backed run
+static inline byte_t *bulk_host_range(const BulkCoprocessor *bulk, const CpuState *cpu, const word_t addr,
+                                      const word_t length, const bool writable) {
+    byte_t *host;
+    if (length == 0u) return NULL;
+    return mmu_host_span(cpu->mmu, bulk->memory, addr, length, writable, &host) == length ? host : NULL;
+}
+
+/// Slow path byte read, the range was not one host-backed run
+static inline byte_t bulk_read_byte(const BulkCoprocessor *bulk, CpuState *cpu, const word_t addr) {
+    if (!mmu_enabled(cpu->mmu) && !mem_in_bounds(bulk->memory, addr, BYTE_SIZE_BYTES)) {
+        trap_raise(cpu->trap, FAULT_OUT_OF_BOUNDS, addr);
+    }
+    return (byte_t)mmu_load(cpu->mmu, bulk->memory, cpu->trap, addr, BYTE_SIZE_BYTES);
+}
+
+static inline void bulk_write_byte(const BulkCoprocessor *bulk, CpuState *cpu, const word_t addr, const byte_t value) {
+    if (!mmu_enabled(cpu->mmu) && !mem_in_bounds(bulk->memory, addr, BYTE_SIZE_BYTES)) {
+        trap_raise(cpu->trap, FAULT_OUT_OF_BOUNDS, addr);
+    }
+    mmu_store(cpu->mmu, bulk->memory, cpu->trap, addr, value, BYTE_SIZE_BYTES);
+}
+
+static inline word_t bulk_memmove(const BulkCoprocessor *bulk, CpuState *cpu) {
+    const word_t dst = bulk->args[BULK_ARG_DST];
+    const word_t src = bulk->args[BULK_ARG_SRC];
+    const word_t length = bulk->args[BULK_ARG_LENGTH];
+
+    byte_t *to = bulk_host_range(bulk, cpu, dst, length, true);
+    const byte_t *from = bulk_host_range(bulk, cpu, src, length, false);
+    if (to != NULL && from != NULL) {
+        memmove(to, from, length);
+        return dst;
+    }
+    // Copy backwards when the destination starts inside the source
+    if (dst - src < length) {
+        for (word_t i = length; i-- > 0u;) bulk_write_byte(bulk, cpu, dst + i, bulk_read_byte(bulk, cpu, src + i));
+    }
+    else {
+        for (word_t i = 0; i < length; ++i) bulk_write_byte(bulk, cpu, dst + i, bulk_read_byte(bulk, cpu, src + i));
+    }
+    return dst;
+}
+
+static inline word_t bulk_memset(const BulkCoprocessor *bulk, CpuState *cpu) {
+    const word_t dst = bulk->args[BULK_ARG_DST];
+    const word_t length = bulk->args[BULK_ARG_LENGTH];
+    const byte_t value = (byte_t)bulk->args[BULK_ARG_VALUE];
+
+    byte_t *to = bulk_host_range(bulk, cpu, dst, length, true);
+    if (to != NULL) memset(to, value, length);
+    else for (word_t i = 0; i < length; ++i) bulk_write_byte(bulk, cpu, dst + i, value);
+    return dst;
+}
+
+static inline word_t bulk_memcmp(const BulkCoprocessor *bulk, CpuState *cpu) {
+    const word_t a = bulk->args[BULK_ARG_DST];
+    const word_t b = bulk->args[BULK_ARG_SRC];
+    const word_t length = bulk->args[BULK_ARG_LENGTH];
+
+    const byte_t *left = bulk_host_range(bulk, cpu, a, length, false);
+    const byte_t *right = bulk_host_range(bulk, cpu, b, length, false);
+    int order = 0;
+    if (left != NULL && right != NULL) {
+        order = memcmp(left, right, length);
+    }
+    else {
+        for (word_t i = 0; i < length && order == 0; ++i) {
+            order = (int)bulk_read_byte(bulk, cpu, a + i) - (int)bulk_read_byte(bulk, cpu, b + i);
+        }
+    }
+    return order < 0 ? (word_t)-1 : order > 0 ? 1u : 0u;
+}
+
+static inline word_t bulk_crc32(const BulkCoprocessor *bulk, CpuState *cpu) {
+    const word_t src = bulk->args[BULK_ARG_SRC];
+    const word_t length = bulk->args[BULK_ARG_LENGTH];
+
+    word_t crc = ~bulk->args[BULK_ARG_VALUE];
+    const byte_t *from = bulk_host_range(bulk, cpu, src, length, false);
+    for (word_t i = 0; i < length; ++i) {
+        const byte_t c = from != NULL ? from[i] : bulk_read_byte(bulk, cpu, src + i);
+        crc = BULK_CRC32_TABLE[(crc ^ c) & 0xFFu] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static inline word_t bulk_hash(const BulkCoprocessor *bulk, CpuState *cpu) {
+    const word_t src = bulk->args[BULK_ARG_SRC];
+    const word_t length = bulk->args[BULK_ARG_LENGTH];
+
+    word_t hash = bulk->args[BULK_ARG_VALUE] != 0u ? bulk->args[BULK_ARG_VALUE] : BULK_FNV_OFFSET_BASIS;
+    const byte_t *from = bulk_host_range(bulk, cpu, src, length, false);
+    for (word_t i = 0; i < length; ++i) {
+        hash = (hash ^ (from != NULL ? from[i] : bulk_read_byte(bulk, cpu, src + i))) * BULK_FNV_PRIME;
+    }
+    return hash;
+}
+
+static inline bool bulk_read(void *context, CpuState *cpu, const CoprocessorCall *call, word_t *value) {
+    BulkCoprocessor *bulk = context;
+    if (call->crm != 0u || call->opcode2 != 0u) return false;
+
+    switch ((BulkOp)call->opcode1) {
+    case BULK_OP_REGISTER:
+        if (call->crn >= BULK_ARG_COUNT) return false;
+        *value = bulk->args[call->crn];
+        return true;
+    case BULK_OP_MEMMOVE: *value = bulk_memmove(bulk, cpu); return true;
+    case BULK_OP_MEMSET: *value = bulk_memset(bulk, cpu); return true;
+    case BULK_OP_MEMCMP: *value = bulk_memcmp(bulk, cpu); return true;
+    case BULK_OP_CRC32: *value = bulk_crc32(bulk, cpu); return true;
+    case BULK_OP_HASH: *value = bulk_hash(bulk, cpu); return true;
+    default:
+        return false;
+    }
+}
+
+static inline bool bulk_write(void *context, CpuState *cpu, const CoprocessorCall *call, const word_t value) {
+    BulkCoprocessor *bulk = context;
+    (void)cpu;
+    if (call->opcode1 != BULK_OP_REGISTER || call->crm != 0u || call->opcode2 != 0u ||
+        call->crn >= BULK_ARG_COUNT) {
+        return false;
+    }
+    bulk->args[call->crn] = value;
+    return true;
+}
+
+/// Bulk coprocessor over `memory`, register `&bulk->coprocessor` as CP BULK_CP
+/// Its context points to itself, it must not move once registered
+static inline void construct_bulk_coprocessor(BulkCoprocessor *bulk, const ProgramMemory *memory) {
+    assert(bulk != NULL);
+    assert(memory != NULL);
+
+    if (BULK_CRC32_TABLE[1] == 0u) {
+        for (word_t i = 0; i < 256u; ++i) {
+            word_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ ((crc & 1u) ? BULK_CRC32_POLYNOMIAL : 0u);
+            BULK_CRC32_TABLE[i] = crc;
+        }
+    }
+
+    *bulk = (BulkCoprocessor){0};
+    bulk->memory = memory;
+    bulk->coprocessor.read = bulk_read;
+    bulk->coprocessor.write = bulk_write;
+    bulk->coprocessor.context = bulk;
+}
@@ -0,0 +1,75 @@
+//
+// Created by valentin on 01/30/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "cpu/cpu.h"
+
+// Coprocessor plug-ins
+//
+// A coprocessor is a set of callbacks registered under a CP# (0-15) in the
+// CoprocessorTable of a CPU. The decoder extracts every operand of CDP, MRC/MCR and
+// LDC/STC into the slot, so the handler only indexes the table by CP# and calls.
+// A missing coprocessor, a missing callback or a callback returning false make
+// the instruction undefined, as on hardware when no coprocessor answers.
+
+#define COPROCESSOR_COUNT 16u
+
+/// Operands of a coprocessor instruction, their meaning is up to the coprocessor
+typedef struct CoprocessorCall {
+    uint8_t cp;
+    /// Op1 (CDP: 4 bits, MRC/MCR: 3 bits)
+    uint8_t opcode1;
+    /// Op2 (CDP, MRC/MCR)
+    uint8_t opcode2;
+    uint8_t crn;
+    uint8_t crm;
+    /// CRd (CDP, LDC/STC)
+    uint8_t crd;
+    /// N bit of LDC/STC
+    bool long_transfer;
+} CoprocessorCall;
+
+/// Callbacks of one coprocessor, each one may be NULL
+typedef struct Coprocessor {
+    /// CDP
+    bool (*data_operation)(void *context, CpuState *cpu, const CoprocessorCall *call);
+    /// MRC, `value` goes to Rd (to the flags when Rd is the PC)
+    bool (*read)(void *context, CpuState *cpu, const CoprocessorCall *call, word_t *value);
+    /// MCR
+    bool (*write)(void *context, CpuState *cpu, const CoprocessorCall *call, word_t value);
+    /// LDC/STC starting at guest address `address`, the coprocessor decides how many words move
+    bool (*load)(void *context, CpuState *cpu, const CoprocessorCall *call, word_t address);
+    bool (*store)(void *context, CpuState *cpu, const CoprocessorCall *call, word_t address);
+    /// Passed to every callback
+    void *context;
+} Coprocessor;
+
+typedef struct CoprocessorTable {
+    /// NULL for an absent coprocessor
+    const Coprocessor *slots[COPROCESSOR_COUNT];
+} CoprocessorTable;
+
+static inline CoprocessorTable construct_coprocessor_table(void) {
+    const CoprocessorTable table = {0};
+    return table;
+}
+
+/// Plugs `coprocessor` in as CP `cp`, replacing the previous one
+/// The coprocessor must outlive the table
+static inline void coprocessor_register(CoprocessorTable *table, const uint8_t cp, const Coprocessor *coprocessor) {
+    assert(table != NULL);
+    assert(cp < COPROCESSOR_COUNT);
+    table->slots[cp] = coprocessor;
+}
+
+/// Coprocessor answering for `cp` on this CPU, NULL when there is none
+static inline const Coprocessor *coprocessor_lookup(const CpuState *cpu, const uint8_t cp) {
+    if (cpu->coprocessors == NULL) return NULL;
+    return cpu->coprocessors->slots[cp];
+}
@@ -0,0 +1,28 @@
+//
+// Created by valentin on 01/30/26.
+//
+#pragma once
+#include <stdbool.h>
+
+#include "cpu/cpu.h"
+#include "mmu/mmu.h"
+#include "coprocessor/coprocessor.h"
+
+// CP15 on top of an Mmu, registers are reached with MRC/MCR p15, 0, Rd, CRn, CRm, Op2
+// and only from privileged modes
+
+static inline bool cp15_read(void *context, CpuState *cpu, const CoprocessorCall *call, word_t *value) {
+    if (!cpu_is_privileged(cpu) || call->opcode1 != 0u) return false;
+    return mmu_cp15_read(context, call->crn, call->crm, call->opcode2, value);
+}
+
+static inline bool cp15_write(void *context, CpuState *cpu, const CoprocessorCall *call, const word_t value) {
+    if (!cpu_is_privileged(cpu) || call->opcode1 != 0u) return false;
+    return mmu_cp15_write(context, call->crn, call->crm, call->opcode2, value);
+}
+
+/// System control coprocessor of `mmu`, to be registered as CP 15
+static inline Coprocessor construct_cp15(Mmu *mmu) {
+    const Coprocessor cp15 = {.read = cp15_read, .write = cp15_write, .context = mmu};
+    return cp15;
+}
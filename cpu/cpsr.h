@@ -5,6 +5,8 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
+
+#include "memory.h"
 /// CPSR Flag for Negative condition
 /// Bit 31
 /// Set when the result of an operation is negative
@@ -37,17 +39,46 @@
 /// Set when the CPU is in Thumb mode (16-bit instruction set)
 /// Cleared when in ARM mode (32-bit instruction set)
 #define CPSR_FLAG_T (1u << 5)
-
+/// CPSR IRQ disable
+/// Bit 7
+/// Set when IRQ interrupts are masked
+#define CPSR_FLAG_I (1u << 7)
+/// CPSR FIQ disable
+/// Bit 6
+/// Set when FIQ interrupts are masked
+#define CPSR_FLAG_F (1u << 6)
+/// Mask covering the processor mode (see CpuMode)
+/// Bits 4:0
+#define CPSR_MODE_MASK 0x1Fu
+/// Mask covering the four condition flags (N, Z, C, V)
+/// Bits 31:28
+#define CPSR_FLAGS_NZCV_MASK (CPSR_FLAG_N | CPSR_FLAG_Z | CPSR_FLAG_C | CPSR_FLAG_V)
+
+
+/// Processor modes, the values of CPSR bits 4:0
+typedef enum CpuMode {
+    MODE_USR = 0x10,
+    MODE_FIQ = 0x11,
+    MODE_IRQ = 0x12,
+    MODE_SVC = 0x13,
+    MODE_ABT = 0x17,
+    MODE_UND = 0x1B,
+    /// Privileged, but uses the USR registers
+    MODE_SYS = 0x1F,
+} CpuMode;
 
 typedef struct {
     uint32_t value;
 } Cpsr;
 
+/// CPSR after reset: SVC mode, IRQ and FIQ masked, ARM state
 static inline Cpsr construct_cpsr() {
-    const Cpsr cpsr = {0};
+    const Cpsr cpsr = {MODE_SVC | CPSR_FLAG_I | CPSR_FLAG_F};
     return cpsr;
 }
 
+static inline CpuMode cpsr_get_mode(const Cpsr* c) { return (CpuMode)(c->value & CPSR_MODE_MASK); }
+
 static inline bool cpsr_get_negative(const Cpsr* c) { return c->value & CPSR_FLAG_N; }
 static inline bool cpsr_get_zero(const Cpsr* c) { return c->value & CPSR_FLAG_Z; }
 static inline bool cpsr_get_carry(const Cpsr* c) { return c->value & CPSR_FLAG_C; }
@@ -153,3 +184,40 @@ static inline void cpsr_extract_carry_sub(Cpsr* cpsr, const word_t operand1, con
         cpsr_clear_carry(cpsr);
     }
 }
+
+// -------------------------
+// Whole-flag computation
+// -------------------------
+// The helpers below compute the NZCV bits of an operation in one go,
+// without branching and without touching the CPSR. Fused handlers use them
+// to derive the condition outcome straight from the operands and then
+// commit the architectural flags with a single masked store.
+
+static inline word_t cpsr_flags_sub(const word_t operand1, const word_t operand2) {
+    const word_t result = operand1 - operand2;
+
+    word_t flags = result & CPSR_FLAG_N;
+    flags |= (result == 0u) ? CPSR_FLAG_Z : 0u;
+    // C is "no borrow" for subtraction
+    flags |= (operand1 >= operand2) ? CPSR_FLAG_C : 0u;
+    // V: operands differ in sign and the result sign differs from operand1
+    flags |= (((operand1 ^ operand2) & (operand1 ^ result)) >> 31) ? CPSR_FLAG_V : 0u;
+    return flags;
+}
+
+static inline word_t cpsr_flags_logic(const Cpsr* cpsr, const word_t result) {
+    assert(cpsr != NULL);
+
+    // Logical operations only define N and Z, C and V are kept as they were
+    word_t flags = cpsr->value & (CPSR_FLAG_C | CPSR_FLAG_V);
+    flags |= result & CPSR_FLAG_N;
+    flags |= (result == 0u) ? CPSR_FLAG_Z : 0u;
+    return flags;
+}
+
+static inline void cpsr_write_flags(Cpsr* cpsr, const word_t flags) {
+    assert(cpsr != NULL);
+    assert((flags & ~CPSR_FLAGS_NZCV_MASK) == 0u);
+
+    cpsr->value = (cpsr->value & ~CPSR_FLAGS_NZCV_MASK) | flags;
+}
@@ -3,13 +3,19 @@
 //
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "cpsr.h"
 #include "registers.h"
+#include "faults/fault.h"
+#include "mmu/mmu.h"
 
 
 #define INITIAL_PC 0
 
+struct Semihost;
+struct CoprocessorTable;
+
 
 
 
@@ -24,10 +30,56 @@ typedef struct CpuState {
     /// bit 31\n
     /// | N | Z | C | V |...| bit 0
     Cpsr cpsr;
+    /// Cold exit path armed by the running loop
+    /// Handlers raise faults through it instead of returning fault codes
+    FaultTrap *trap;
+    /// Bank of the current mode, its registers are the ones in regs
+    RegisterBank bank;
+    /// Registers of the other banks and the SPSRs
+    BankedRegisters banks;
+    /// Services SWI semihosting calls, NULL when semihosting is disabled (every SWI traps)
+    struct Semihost *semihost;
+    /// Coprocessors answering CDP/MRC/MCR/LDC/STC, NULL when there are none
+    const struct CoprocessorTable *coprocessors;
+    /// Guest memory seen by the handlers that access it directly (idioms), may be NULL
+    const ProgramMemory *memory;
+    /// Translates the addresses of those accesses and of fetches once enabled (CP15 c1.M),
+    /// NULL when they are always physical
+    Mmu *mmu;
 } CpuState;
 
+/// Exception vectors (low vectors)
+typedef enum ExceptionVector {
+    VECTOR_RESET = 0x00,
+    VECTOR_UNDEFINED = 0x04,
+    VECTOR_SWI = 0x08,
+    VECTOR_PREFETCH_ABORT = 0x0C,
+    VECTOR_DATA_ABORT = 0x10,
+    VECTOR_IRQ = 0x18,
+    VECTOR_FIQ = 0x1C,
+} ExceptionVector;
+
+/// Bank of `mode` (CPSR bits 4:0), BANK_COUNT for reserved encodings
+static inline RegisterBank cpu_mode_bank(const word_t mode) {
+    switch (mode & CPSR_MODE_MASK) {
+    case MODE_USR: return BANK_USR;
+    case MODE_FIQ: return BANK_FIQ;
+    case MODE_IRQ: return BANK_IRQ;
+    case MODE_SVC: return BANK_SVC;
+    case MODE_ABT: return BANK_ABT;
+    case MODE_UND: return BANK_UND;
+    // SYS runs on the USR registers
+    case MODE_SYS: return BANK_USR;
+    default: return BANK_COUNT;
+    }
+}
+
+static inline bool cpu_mode_is_valid(const word_t mode) {
+    return cpu_mode_bank(mode) != BANK_COUNT;
+}
+
 static inline CpuState construct_cpu_state() {
-    const CpuState cpu = {construct_registers(), construct_cpsr()};
+    const CpuState cpu = {construct_registers(), construct_cpsr(), NULL, BANK_SVC, construct_banked_registers(), NULL, NULL, NULL, NULL};
     return cpu;
 }
 
@@ -47,3 +99,109 @@ static inline word_t cpu_get_reg(const CpuState *cpu, const RegisterIndex index)
     return regs_get(&cpu->regs, index);
 }
 
+static inline word_t cpu_get_pc(const CpuState *cpu) {
+    return cpu_get_reg(cpu, PC_REGISTER_INDEX);
+}
+
+static inline void cpu_set_pc(CpuState *cpu, const word_t address) {
+    cpu_set_reg(cpu, PC_REGISTER_INDEX, address);
+}
+
+/// Continues at `target` after a change between ARM and Thumb state.
+/// A run loop only executes one instruction set, so this leaves it through the trap
+/// and the loop of the new state takes over.
+__attribute__((noreturn))
+static inline void cpu_raise_state_switch(CpuState *cpu, const word_t target) {
+    cpu_set_pc(cpu, target);
+    trap_raise(cpu->trap, FAULT_STATE_SWITCH, target);
+}
+
+// -------------------------
+// Modes
+// -------------------------
+// Instructions always read and write regs directly, whatever the mode. Only a mode
+// change that crosses banks touches the banked copies: R13/R14 are swapped, and
+// R8-R12 too when entering or leaving FIQ.
+
+/// Changes CPSR bits 4:0 to `mode` and brings its registers into the active view
+static inline void cpu_switch_mode(CpuState *cpu, const CpuMode mode) {
+    assert(cpu != NULL);
+    assert(cpu_mode_is_valid(mode));
+
+    const RegisterBank from = cpu->bank;
+    const RegisterBank to = cpu_mode_bank(mode);
+    cpu->cpsr.value = (cpu->cpsr.value & ~CPSR_MODE_MASK) | (word_t)mode;
+    // USR and SYS share a bank, not their permissions
+    if (cpu->mmu != NULL) mmu_set_privileged(cpu->mmu, mode != MODE_USR);
+    if (from == to) return;
+
+    word_t *regs = cpu->regs.regs;
+    BankedRegisters *banks = &cpu->banks;
+    banks->sp_lr[from][0] = regs[SP_REGISTER_INDEX];
+    banks->sp_lr[from][1] = regs[LINK_REGISTER_INDEX];
+    regs[SP_REGISTER_INDEX] = banks->sp_lr[to][0];
+    regs[LINK_REGISTER_INDEX] = banks->sp_lr[to][1];
+
+    if ((from == BANK_FIQ) != (to == BANK_FIQ)) {
+        word_t *save = from == BANK_FIQ ? banks->fiq_r8_r12 : banks->usr_r8_r12;
+        const word_t *load = to == BANK_FIQ ? banks->fiq_r8_r12 : banks->usr_r8_r12;
+        for (size_t i = 0; i < FIQ_BANKED_COUNT; ++i) {
+            save[i] = regs[FIQ_BANKED_FIRST + i];
+            regs[FIQ_BANKED_FIRST + i] = load[i];
+        }
+    }
+    cpu->bank = to;
+}
+
+/// True in every mode but USR
+static inline bool cpu_is_privileged(const CpuState *cpu) {
+    return cpsr_get_mode(&cpu->cpsr) != MODE_USR;
+}
+
+/// True when the current mode has an SPSR (exception modes)
+static inline bool cpu_has_spsr(const CpuState *cpu) {
+    return cpu->bank != BANK_USR;
+}
+
+static inline word_t cpu_get_spsr(const CpuState *cpu) {
+    assert(cpu_has_spsr(cpu));
+    return cpu->banks.spsr[cpu->bank];
+}
+
+static inline void cpu_set_spsr(CpuState *cpu, const word_t value) {
+    assert(cpu_has_spsr(cpu));
+    cpu->banks.spsr[cpu->bank] = value;
+}
+
+/// Writes the whole CPSR, switching register banks when the mode bits change.
+/// A reserved mode encoding keeps the current mode.
+static inline void cpu_write_cpsr(CpuState *cpu, const word_t value) {
+    assert(cpu != NULL);
+    if (cpu_mode_is_valid(value)) cpu_switch_mode(cpu, (CpuMode)(value & CPSR_MODE_MASK));
+    cpu->cpsr.value = (value & ~CPSR_MODE_MASK) | (cpu->cpsr.value & CPSR_MODE_MASK);
+}
+
+/// CPSR = SPSR, the exception return of MOVS pc / SUBS pc, lr / LDM ^
+/// USR and SYS have no SPSR, the CPSR is then left as it is
+static inline void cpu_restore_spsr(CpuState *cpu) {
+    assert(cpu != NULL);
+    if (cpu_has_spsr(cpu)) cpu_write_cpsr(cpu, cpu_get_spsr(cpu));
+}
+
+/// Takes an exception: saves the CPSR in the SPSR of `mode`, sets LR to `return_address`,
+/// masks IRQ (and FIQ for FIQ and reset), returns to ARM state and jumps to `vector`
+static inline void cpu_enter_exception(CpuState *cpu, const CpuMode mode, const ExceptionVector vector,
+                                       const word_t return_address) {
+    assert(cpu != NULL);
+    assert(mode != MODE_USR && mode != MODE_SYS);
+
+    const word_t saved = cpu->cpsr.value;
+    cpu_switch_mode(cpu, mode);
+    cpu_set_spsr(cpu, saved);
+    cpu_set_reg(cpu, LINK_REGISTER_INDEX, return_address);
+
+    cpu->cpsr.value |= CPSR_FLAG_I;
+    if (mode == MODE_FIQ || vector == VECTOR_RESET) cpu->cpsr.value |= CPSR_FLAG_F;
+    cpsr_clear_thumb(&cpu->cpsr);
+    cpu_set_pc(cpu, (word_t)vector);
+}
@@ -7,20 +7,56 @@
 /// And uint8_t is sufficient to index them all
 typedef uint8_t register_index_t;
 typedef enum RegisterIndex {
+    SP_REGISTER_INDEX = 13,
     LINK_REGISTER_INDEX = 14,
     PC_REGISTER_INDEX  = 15,
 } RegisterIndex;
 
 
+/// First register banked by FIQ mode (R8-R12 besides R13/R14)
+#define FIQ_BANKED_FIRST 8
+#define FIQ_BANKED_COUNT 5
+
+
 typedef struct Registers {
     word_t regs[REGISTER_COUNT];
 } Registers;
 
+/// Register banks, USR and SYS share one, every exception mode has its own
+typedef enum RegisterBank {
+    BANK_USR = 0,
+    BANK_FIQ,
+    BANK_IRQ,
+    BANK_SVC,
+    BANK_ABT,
+    BANK_UND,
+    BANK_COUNT,
+} RegisterBank;
+
+/// Copies of the banked registers that are not in the active view.
+///
+/// The active mode always works on Registers.regs directly, a mode change copies
+/// its banked subset out here and the new mode's subset in (see cpu_switch_mode).
+typedef struct BankedRegisters {
+    /// R13 (SP) and R14 (LR) of every bank
+    word_t sp_lr[BANK_COUNT][2];
+    /// R8-R12 of FIQ mode and of all the other modes
+    word_t fiq_r8_r12[FIQ_BANKED_COUNT];
+    word_t usr_r8_r12[FIQ_BANKED_COUNT];
+    /// Saved program status of every exception mode, BANK_USR has none
+    word_t spsr[BANK_COUNT];
+} BankedRegisters;
+
 static inline Registers construct_registers() {
     const Registers registers = {.regs = {0}};
     return registers;
 }
 
+static inline BankedRegisters construct_banked_registers() {
+    const BankedRegisters banks = {{{0}}};
+    return banks;
+}
+
 static inline word_t regs_get(const Registers *registers, const RegisterIndex index) {
     return registers->regs[index];
 }
@@ -0,0 +1,137 @@
+//
+// Created by valentin on 01/22/26.
+//
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory.h"
+
+/// Selects the handler that executes a DecodedInst
+typedef enum HandlerId {
+    /// Not supported by the executor, raises FAULT_UNDEFINED_INSTRUCTION
+    HANDLER_UNDEFINED = 0,
+    /// Sentinel slot after the last predecoded instruction, stops execution normally
+    HANDLER_END_OF_CODE,
+    /// Does nothing, left by the block optimiser in place of a dead instruction
+    HANDLER_NOP,
+    /// B (no link)
+    HANDLER_BRANCH,
+    /// BL
+    HANDLER_BRANCH_LINK,
+    HANDLER_BRANCH_EXCHANGE,
+    /// SWI (ARM and Thumb), a semihosting call or the SWI exception
+    HANDLER_SWI,
+    /// Coprocessor instructions, answered by the CPU's CoprocessorTable
+    HANDLER_CDP,
+    HANDLER_MRC,
+    HANDLER_MCR,
+    HANDLER_LDC,
+    HANDLER_STC,
+
+    // Superinstructions
+    // A fused slot keeps the decoding of its first instruction and reads the
+    // following slot(s) for the rest, those slots are left untouched so a branch
+    // into the middle of a fused group still executes correctly.
+
+    /// CMP (or SUBS) immediately followed by B<cond>
+    HANDLER_FUSED_SUB_B,
+    /// TST immediately followed by B<cond>
+    HANDLER_FUSED_TST_B,
+    /// Two consecutive MOVs
+    HANDLER_FUSED_MOV_MOV,
+    /// Three consecutive MOVs
+    HANDLER_FUSED_MOV_MOV_MOV,
+
+    // Idioms, whole loops run on the host (see instructions/fused/idioms.h)
+
+    /// LDR{B}/STR{B} post-increment copy closed by SUBS/BNE
+    HANDLER_IDIOM_COPY,
+    /// STR{B} post-increment fill closed by SUBS/BNE
+    HANDLER_IDIOM_FILL,
+    /// LDRB post-increment scan for a byte closed by CMP/BNE (strlen, memchr)
+    HANDLER_IDIOM_SCAN,
+
+    // Thumb-only handlers
+    // Thumb data processing decodes to the ARM data processing handlers, only
+    // what has no ARM equivalent gets its own handler.
+
+    /// B<cond> and B (formats 16 and 18)
+    HANDLER_THUMB_BRANCH,
+    /// First half of BL, LR := PC + (high offset)
+    HANDLER_THUMB_BL_PREFIX,
+    /// Second half of BL, branches to LR + (low offset) and links
+    HANDLER_THUMB_BL_SUFFIX,
+    /// ADD Rd, PC, #imm (the PC is word aligned first)
+    HANDLER_THUMB_ADD_PC,
+    /// ADD/MOV with PC as the high destination register
+    HANDLER_THUMB_HI_TO_PC,
+
+    /// Data processing handlers, one per (OpCode x S x Operand2 form x Rd is PC),
+    /// generated from DATA_PROCESSING_OPS (see dp_handler_id for the layout)
+    HANDLER_DATA_PROCESSING_FIRST,
+    HANDLER_DATA_PROCESSING_LAST = HANDLER_DATA_PROCESSING_FIRST + 16 * 8 - 1,
+
+    HANDLER_COUNT,
+} HandlerId;
+
+/// Handler id of a data processing instruction
+/// Layout of the offset: [6:3] OpCode, [2] S, [1] register form, [0] Rd is PC
+static inline uint8_t dp_handler_id(const uint8_t op, const bool s, const bool register_form, const bool rd_is_pc) {
+    return (uint8_t)(HANDLER_DATA_PROCESSING_FIRST + (op << 3) + (s << 2) + (register_form << 1) + rd_is_pc);
+}
+
+static inline bool handler_is_data_processing(const uint8_t handler) {
+    return handler >= HANDLER_DATA_PROCESSING_FIRST && handler <= HANDLER_DATA_PROCESSING_LAST;
+}
+
+/// Flag stored in DecodedInst.imm of a register-form Operand2 when the shift
+/// amount comes from Rs (bits [3:0] of imm) instead of an immediate
+#define DECODED_SHIFT_BY_REG (1u << 8)
+
+/// Uniform decoded instruction, every instruction class uses this shape.
+///
+/// Packed into 8 bytes so the predecoded slots of a whole loop share a few cache
+/// lines. Fields that need work to extract (rotated immediates, sign-extended branch
+/// offsets) are resolved at decode time.
+///
+/// Field use per handler:
+/// - Data processing: cond, op, s, i, rd, rn; Operand2 is `imm` when i is set,
+///   otherwise `rm` shifted by `shift_type` and `imm` (imm5 or DECODED_SHIFT_BY_REG | Rs).
+///   In immediate form `shift_type` is 1 when the immediate was rotated, the shifter
+///   carry-out is then bit 31 of `imm` (otherwise C is left unchanged)
+/// - Branch: cond, imm (signed byte offset)
+/// - Branch and exchange: cond, rm
+/// - Thumb branch / BL halves: cond, imm (signed byte offset)
+/// - Thumb ADD Rd, PC: rd, imm
+/// - Thumb high register to PC: op (OP_ADD or OP_MOV), rn, rm
+typedef struct DecodedInst {
+    /// HandlerId
+    uint32_t handler : 8;
+    /// CondCode
+    uint32_t cond : 4;
+    /// OpCode (data processing)
+    uint32_t op : 4;
+    /// Destination register
+    uint32_t rd : 4;
+    /// First operand register
+    uint32_t rn : 4;
+    /// Second operand / target register
+    uint32_t rm : 4;
+    /// Set condition codes (S bit)
+    uint32_t s : 1;
+    /// Operand2 is an immediate (I bit)
+    uint32_t i : 1;
+    /// ShiftType of a register-form Operand2
+    uint32_t shift_type : 2;
+    /// Pre-resolved immediate (see the field use above)
+    uint32_t imm;
+} DecodedInst;
+
+_Static_assert(sizeof(DecodedInst) == 8, "DecodedInst must stay packed in 8 bytes");
+
+struct CpuState;
+
+/// Signature shared by every handler
+/// Executes the slot `inst` located at guest address `pc`, returns the address to continue at
+typedef word_t (*SlotHandler)(struct CpuState *cpu, const DecodedInst *inst, word_t pc);
@@ -0,0 +1,91 @@
+//
+// Created by valentin on 12/24/25.
+//
+#pragma once
+#include <stdint.h>
+
+#include "memory.h"
+#include "decoder/decoded_inst.h"
+#include "instructions/instructions_enums.h"
+#include "instructions/branch/b_bl.h"
+#include "instructions/branch/bx.h"
+#include "instructions/swi.h"
+#include "instructions/coprocessor.h"
+#include "instructions/data_processing/data_processing_decoder.h"
+
+/// Classifies a raw A32 word into its instruction class.
+///
+/// The checks are ordered from the most specific encoding to the most generic one,
+/// because several classes share the same top bits (e.g. multiply, swap and halfword
+/// transfers all live inside the data-processing space and are told apart by bits 7:4).
+static inline InstructionType decode_instruction_type(const word_t raw_inst) {
+    static const word_t BX_MASK = 0x0FFFFFF0;
+    static const word_t BX_PATTERN = 0x012FFF10;
+
+    static const word_t MUL_MASK = 0x0FC000F0;
+    static const word_t MUL_PATTERN = 0x00000090;
+    static const word_t MUL_LONG_MASK = 0x0F8000F0;
+    static const word_t MUL_LONG_PATTERN = 0x00800090;
+    static const word_t SWP_MASK = 0x0FB00FF0;
+    static const word_t SWP_PATTERN = 0x01000090;
+    static const word_t HALFWORD_MASK = 0x0E000090;
+    static const word_t HALFWORD_PATTERN = 0x00000090;
+
+    static const word_t CLASS_2_MASK = 0x0C000000;
+    static const word_t CLASS_3_MASK = 0x0E000000;
+    static const word_t CLASS_4_MASK = 0x0F000000;
+    static const word_t BIT4_MASK = 0x00000010;
+
+    if ((raw_inst & BX_MASK) == BX_PATTERN) return BRANCH_AND_EXCHANGE;
+    if ((raw_inst & MUL_MASK) == MUL_PATTERN) return MULTIPLY;
+    if ((raw_inst & MUL_LONG_MASK) == MUL_LONG_PATTERN) return MULTIPLY_LONG;
+    if ((raw_inst & SWP_MASK) == SWP_PATTERN) return SINGLE_DATA_SWAP;
+    if ((raw_inst & HALFWORD_MASK) == HALFWORD_PATTERN) return HALFWORD_AND_SIGNED_DATA_TRANSFER;
+
+    // [27:26] == 00, everything that is left is data processing (including PSR transfers)
+    if ((raw_inst & CLASS_2_MASK) == 0x00000000) return DATA_PROCESSING;
+
+    // [27:25] == 011 with bit 4 set is the architecturally undefined space
+    if ((raw_inst & CLASS_3_MASK) == 0x06000000 && (raw_inst & BIT4_MASK) != 0) return UNDEFINED_INSTRUCTION;
+    if ((raw_inst & CLASS_2_MASK) == 0x04000000) return SINGLE_DATA_TRANSFER;
+
+    if ((raw_inst & CLASS_3_MASK) == 0x08000000) return BLOCK_DATA_TRANSFER;
+    if ((raw_inst & CLASS_3_MASK) == 0x0A000000) return BRANCH;
+    if ((raw_inst & CLASS_3_MASK) == 0x0C000000) return COPROCESSOR_DATA_TRANSFER;
+
+    if ((raw_inst & CLASS_4_MASK) == 0x0E000000) {
+        return (raw_inst & BIT4_MASK) ? COPROCESSOR_REGISTER_TRANSFER : COPROCESSOR_DATA_OPERATION;
+    }
+    return SOFTWARE_INTERRUPT;
+}
+
+/// Decodes a raw A32 word into the uniform DecodedInst shape
+/// Classes the executor does not implement decode to HANDLER_UNDEFINED,
+/// which raises FAULT_UNDEFINED_INSTRUCTION when executed
+static inline DecodedInst decode(const word_t raw_inst) {
+    static const uint8_t COND_SHIFT = 28u;
+    const DecodedInst undefined = {.handler = HANDLER_UNDEFINED, .cond = raw_inst >> COND_SHIFT};
+
+    switch (decode_instruction_type(raw_inst)) {
+    case DATA_PROCESSING: {
+        const DecodedInst inst = decode_data_processing(raw_inst);
+        // TST/TEQ/CMP/CMN without S are the PSR transfer encodings (MRS/MSR)
+        if (inst.op >= OP_TST && inst.op <= OP_CMN && !inst.s) return undefined;
+        return inst;
+    }
+    case BRANCH:
+        return decode_b(raw_inst);
+    case BRANCH_AND_EXCHANGE:
+        return decode_bx(raw_inst);
+    case SOFTWARE_INTERRUPT:
+        return decode_swi(raw_inst);
+    case COPROCESSOR_DATA_OPERATION:
+        return decode_cdp(raw_inst);
+    case COPROCESSOR_REGISTER_TRANSFER:
+        return decode_mrc_mcr(raw_inst);
+    case COPROCESSOR_DATA_TRANSFER:
+        return decode_ldc_stc(raw_inst);
+    default:
+        return undefined;
+    }
+}
@@ -0,0 +1,259 @@
+//
+// Created by valentin on 02/03/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "decoder/decoded_inst.h"
+#include "decoder/predecoder.h"
+#include "instructions/cond.h"
+#include "instructions/opcodes.h"
+#include "instructions/data_processing/data_processing_decoder.h"
+
+// Block optimiser
+//
+// Passes over the slots of one block, the IR every tier runs: a slot is already one
+// operation with resolved operands. A block is only entered at its first slot and
+// only its last slot may branch, so a straight walk sees every path. Everything is
+// live when the block is left.
+//
+//   constants    registers set from immediates are tracked forward; a plain register
+//                Operand2 holding a known value becomes an immediate and a data
+//                processing result that only depends on known values becomes a MOV
+//   flags        an S instruction whose N/Z/C/V are all overwritten before being read
+//                drops its S; a dead TST/TEQ/CMP/CMN becomes HANDLER_NOP
+//   dead writes  a register write overwritten before being read becomes HANDLER_NOP
+//
+// Only unconditional data processing with Rd other than the PC is rewritten. Any
+// other slot (coprocessor, idiom, undefined) may fault or look at the whole CPU, the
+// passes treat it as reading and writing everything, so faults see exact state.
+// The passes run after idiom recognition and before fusion.
+
+#define FLAG_N (1u << 3)
+#define FLAG_Z (1u << 2)
+#define FLAG_C (1u << 1)
+#define FLAG_V (1u << 0)
+#define FLAGS_ALL (FLAG_N | FLAG_Z | FLAG_C | FLAG_V)
+#define REGISTERS_ALL 0xFFFFu
+/// Longest block the passes accept
+#define OPTIMISER_MAX_SLOTS 64u
+
+/// True for the slots the passes may rewrite
+static inline bool optimiser_is_plain_dp(const DecodedInst *inst) {
+    return handler_is_data_processing(inst->handler) && inst->rd != PC_REGISTER_INDEX &&
+           inst->rn != PC_REGISTER_INDEX && (inst->i || inst->rm != PC_REGISTER_INDEX);
+}
+
+static inline bool optimiser_writes_rd(const uint8_t op) {
+    return op < OP_TST || op > OP_CMN;
+}
+
+static inline bool optimiser_reads_rn(const uint8_t op) {
+    return op != OP_MOV && op != OP_MVN;
+}
+
+static inline bool optimiser_is_arith(const uint8_t op) {
+    return (op >= OP_SUB && op <= OP_RSC) || op == OP_CMP || op == OP_CMN;
+}
+
+/// Handler of `inst` after its S or operand form changed
+static inline uint8_t optimiser_handler(const DecodedInst *inst) {
+    return dp_handler_id(inst->op, inst->s, !inst->i, false);
+}
+
+/// Flags `cond` reads
+static inline uint8_t optimiser_cond_flags(const CondCode cond) {
+    switch (cond) {
+    case EQ: case NE: return FLAG_Z;
+    case CS: case CC: return FLAG_C;
+    case MI: case PL: return FLAG_N;
+    case VS: case VC: return FLAG_V;
+    case HI: case LS: return FLAG_C | FLAG_Z;
+    case GE: case LT: return FLAG_N | FLAG_V;
+    case GT: case LE: return FLAG_N | FLAG_Z | FLAG_V;
+    case AL: return 0;
+    default: return FLAGS_ALL;
+    }
+}
+
+/// Flags a plain data processing slot reads
+static inline uint8_t optimiser_flags_read(const DecodedInst *inst) {
+    uint8_t flags = optimiser_cond_flags(inst->cond);
+    if (inst->op == OP_ADC || inst->op == OP_SBC || inst->op == OP_RSC) flags |= FLAG_C;
+    // RRX shifts the carry in
+    if (!inst->i && inst->shift_type == SHIFT_ROR && inst->imm == 0u) flags |= FLAG_C;
+    return flags;
+}
+
+/// Flags a plain data processing slot may change, V is never touched by a logic operation
+static inline uint8_t optimiser_flags_changed(const DecodedInst *inst) {
+    if (!inst->s) return 0;
+    return optimiser_is_arith(inst->op) ? FLAGS_ALL : FLAG_N | FLAG_Z | FLAG_C;
+}
+
+/// Flags a plain data processing slot always overwrites
+/// A logic operation only writes C when the shifter surely produces a carry
+static inline uint8_t optimiser_flags_written(const DecodedInst *inst) {
+    if (!inst->s || inst->cond != AL) return 0;
+    if (optimiser_is_arith(inst->op)) return FLAGS_ALL;
+
+    const bool by_reg = !inst->i && (inst->imm & DECODED_SHIFT_BY_REG) != 0u;
+    const bool shifter_carry = inst->i ? inst->shift_type != 0u : !by_reg && !operand2_reg_is_plain(inst);
+    return FLAG_N | FLAG_Z | (shifter_carry ? FLAG_C : 0u);
+}
+
+/// Registers a plain data processing slot reads
+static inline uint16_t optimiser_registers_read(const DecodedInst *inst) {
+    uint16_t registers = 0;
+    if (optimiser_reads_rn(inst->op)) registers |= 1u << inst->rn;
+    if (!inst->i) {
+        registers |= 1u << inst->rm;
+        if (inst->imm & DECODED_SHIFT_BY_REG) registers |= 1u << (inst->imm & 0xFu);
+    }
+    // A skipped conditional write leaves the old value, it is read too
+    if (inst->cond != AL && optimiser_writes_rd(inst->op)) registers |= 1u << inst->rd;
+    return registers;
+}
+
+static inline DecodedInst optimiser_nop(void) {
+    const DecodedInst nop = {.handler = HANDLER_NOP, .cond = AL};
+    return nop;
+}
+
+/// Result of `op` without flags on known operands, false when it needs the carry
+static inline bool optimiser_fold(const uint8_t op, const word_t op1, const word_t op2, word_t *result) {
+    switch (op) {
+    case OP_AND: *result = op1 & op2; return true;
+    case OP_EOR: *result = op1 ^ op2; return true;
+    case OP_SUB: *result = op1 - op2; return true;
+    case OP_RSB: *result = op2 - op1; return true;
+    case OP_ADD: *result = op1 + op2; return true;
+    case OP_ORR: *result = op1 | op2; return true;
+    case OP_MOV: *result = op2; return true;
+    case OP_BIC: *result = op1 & ~op2; return true;
+    case OP_MVN: *result = ~op2; return true;
+    default: return false;
+    }
+}
+
+/// Index of the first slot of each group, returns the number of groups
+static inline size_t optimiser_groups(const DecodedInst *insts, const size_t count, size_t *groups) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i += predecoded_length(insts[i].handler)) groups[n++] = i;
+    return n;
+}
+
+// -------------------------
+// Passes
+// -------------------------
+
+static inline void optimise_constants(DecodedInst *insts, const size_t *groups, const size_t group_count) {
+    uint16_t known = 0;
+    word_t values[REGISTER_COUNT] = {0};
+
+    for (size_t g = 0; g < group_count; ++g) {
+        DecodedInst *inst = &insts[groups[g]];
+        if (!optimiser_is_plain_dp(inst)) {
+            known = 0;
+            continue;
+        }
+
+        if (!inst->i && operand2_reg_is_plain(inst) && (known & (1u << inst->rm))) {
+            // An unrotated immediate leaves C alone, as LSL #0 does
+            inst->imm = values[inst->rm];
+            inst->i = true;
+            inst->shift_type = 0;
+            inst->rm = 0;
+            inst->handler = optimiser_handler(inst);
+        }
+        if (!optimiser_writes_rd(inst->op)) continue;
+        if (inst->cond != AL) {
+            known &= ~(1u << inst->rd);
+            continue;
+        }
+
+        word_t result;
+        const bool operands_known = inst->i && (!optimiser_reads_rn(inst->op) || (known & (1u << inst->rn)));
+        if (!operands_known || !optimiser_fold(inst->op, values[inst->rn], inst->imm, &result)) {
+            known &= ~(1u << inst->rd);
+            continue;
+        }
+        if (!inst->s) {
+            const DecodedInst mov = {
+                .handler = dp_handler_id(OP_MOV, false, false, false),
+                .cond = AL, .op = OP_MOV, .rd = inst->rd, .i = true, .imm = result,
+            };
+            *inst = mov;
+        }
+        known |= 1u << inst->rd;
+        values[inst->rd] = result;
+    }
+}
+
+static inline void optimise_flags(DecodedInst *insts, const size_t *groups, const size_t group_count) {
+    uint8_t live = FLAGS_ALL;
+    for (size_t g = group_count; g-- > 0;) {
+        DecodedInst *inst = &insts[groups[g]];
+        if (!optimiser_is_plain_dp(inst)) {
+            live = FLAGS_ALL;
+            continue;
+        }
+
+        const uint8_t changed = optimiser_flags_changed(inst);
+        if (changed != 0u && (changed & live) == 0u) {
+            // Nothing it may set is read before being overwritten
+            if (optimiser_writes_rd(inst->op)) {
+                inst->s = false;
+                inst->handler = optimiser_handler(inst);
+            }
+            else {
+                *inst = optimiser_nop();
+                continue;
+            }
+        }
+        else {
+            live &= ~optimiser_flags_written(inst);
+        }
+        live |= optimiser_flags_read(inst);
+    }
+}
+
+static inline void optimise_dead_writes(DecodedInst *insts, const size_t *groups, const size_t group_count) {
+    uint16_t live = REGISTERS_ALL;
+    for (size_t g = group_count; g-- > 0;) {
+        DecodedInst *inst = &insts[groups[g]];
+        if (inst->handler == HANDLER_NOP) continue;
+        if (!optimiser_is_plain_dp(inst)) {
+            live = REGISTERS_ALL;
+            continue;
+        }
+        if (!optimiser_writes_rd(inst->op)) {
+            live |= optimiser_registers_read(inst);
+            continue;
+        }
+
+        const uint16_t rd = 1u << inst->rd;
+        if (!inst->s && inst->cond == AL && (live & rd) == 0u) {
+            *inst = optimiser_nop();
+            continue;
+        }
+        if (inst->cond == AL) live &= ~rd;
+        live |= optimiser_registers_read(inst);
+    }
+}
+
+/// Runs every pass over the `count` slots of a block
+static inline void optimise_block(DecodedInst *insts, const size_t count) {
+    assert(insts != NULL);
+    assert(count <= OPTIMISER_MAX_SLOTS);
+
+    size_t groups[OPTIMISER_MAX_SLOTS];
+    const size_t group_count = optimiser_groups(insts, count, groups);
+    optimise_constants(insts, groups, group_count);
+    optimise_flags(insts, groups, group_count);
+    optimise_dead_writes(insts, groups, group_count);
+}
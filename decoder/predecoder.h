@@ -0,0 +1,248 @@
+//
+// Created by valentin on 01/21/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "memory.h"
+#include "decoder/decoded_inst.h"
+#include "decoder/decoder.h"
+#include "instructions/fused/idioms.h"
+
+typedef struct PredecodedProgram {
+    /// One packed slot per guest word, read by the executor as one homogeneous array
+    /// Slot i holds the instruction at base_address + 4 * i
+    /// Slot `count` is a HANDLER_END_OF_CODE sentinel, so running off the end of the
+    /// code needs no bounds test in the executor
+    DecodedInst *insts;
+    /// Number of instruction slots (without the sentinel)
+    size_t count;
+    /// Guest address of the first slot
+    word_t base_address;
+} PredecodedProgram;
+
+/// Number of guest instructions a slot with the given handler executes
+static inline uint8_t predecoded_length(const HandlerId handler) {
+    switch (handler) {
+    case HANDLER_FUSED_SUB_B:
+    case HANDLER_FUSED_TST_B:
+    case HANDLER_FUSED_MOV_MOV:
+        return 2;
+    case HANDLER_FUSED_MOV_MOV_MOV:
+        return 3;
+    case HANDLER_IDIOM_COPY:
+        return IDIOM_COPY_LENGTH;
+    case HANDLER_IDIOM_FILL:
+        return IDIOM_FILL_LENGTH;
+    case HANDLER_IDIOM_SCAN:
+        return IDIOM_SCAN_LENGTH;
+    default:
+        return 1;
+    }
+}
+
+// -------------------------
+// Fusion
+// -------------------------
+
+/// True when the instruction is unconditional, its Operand2 is an immediate
+/// or an unshifted register, and it reads no PC-relative operand.
+static inline bool fusion_is_simple(const DecodedInst *inst) {
+    if (!handler_is_data_processing(inst->handler)) return false;
+    if (inst->cond != AL) return false;
+    if (inst->rn == PC_REGISTER_INDEX) return false;
+    if (inst->i) return true;
+    return inst->rm != PC_REGISTER_INDEX && operand2_reg_is_plain(inst);
+}
+
+static inline bool fusion_is_flag_sub(const DecodedInst *inst) {
+    if (!fusion_is_simple(inst)) return false;
+
+    const bool is_cmp = inst->op == OP_CMP;
+    const bool is_subs = inst->op == OP_SUB && inst->s && inst->rd != PC_REGISTER_INDEX;
+    return is_cmp || is_subs;
+}
+
+static inline bool fusion_is_tst(const DecodedInst *inst) {
+    return fusion_is_simple(inst) && inst->op == OP_TST;
+}
+
+static inline bool fusion_is_mov(const DecodedInst *inst) {
+    return fusion_is_simple(inst) && inst->op == OP_MOV && !inst->s && inst->rd != PC_REGISTER_INDEX;
+}
+
+static inline bool fusion_is_plain_branch(const DecodedInst *inst) {
+    return inst->handler == HANDLER_BRANCH;
+}
+
+/// Rewrites the first slot of every recognised instruction group into its
+/// fused kind. Groups never overlap, scanning resumes after the last fused slot.
+static inline void predecoder_fuse(PredecodedProgram *program) {
+    assert(program != NULL);
+
+    DecodedInst *insts = program->insts;
+    const size_t count = program->count;
+
+    size_t i = 0;
+    while (i + 1 < count) {
+        DecodedInst *first = &insts[i];
+        const DecodedInst *second = &insts[i + 1];
+
+        if (fusion_is_plain_branch(second) && fusion_is_flag_sub(first)) {
+            first->handler = HANDLER_FUSED_SUB_B;
+        }
+        else if (fusion_is_plain_branch(second) && fusion_is_tst(first)) {
+            first->handler = HANDLER_FUSED_TST_B;
+        }
+        else if (fusion_is_mov(first) && fusion_is_mov(second)) {
+            const bool has_third = i + 2 < count && fusion_is_mov(&insts[i + 2]);
+            first->handler = has_third ? HANDLER_FUSED_MOV_MOV_MOV : HANDLER_FUSED_MOV_MOV;
+        }
+
+        i += predecoded_length(first->handler);
+    }
+}
+
+// -------------------------
+// Idioms
+// -------------------------
+// Loads and stores have no handler, so loop bodies are matched on the raw words.
+
+/// Unconditional LDR/STR{B} Rd, [Rn], #size (post-indexed, incrementing, no PC)
+/// Returns false for any other word
+static inline bool idiom_match_transfer(const word_t raw_inst, bool *load, bool *byte, uint8_t *rn, uint8_t *rd) {
+    // cond AL, '01', I=0, P=0, U=1, W=0
+    static const word_t MASK = 0xFFA00000;
+    static const word_t PATTERN = 0xE4800000;
+    static const word_t BYTE_MASK = 0x00400000;
+    static const word_t LOAD_MASK = 0x00100000;
+
+    if ((raw_inst & MASK) != PATTERN) return false;
+    *byte = (raw_inst & BYTE_MASK) != 0u;
+    *load = (raw_inst & LOAD_MASK) != 0u;
+    *rn = (raw_inst >> 16) & 0xFu;
+    *rd = (raw_inst >> 12) & 0xFu;
+    const word_t offset = raw_inst & 0xFFFu;
+    return offset == (*byte ? BYTE_SIZE_BYTES : WORD_SIZE_BYTES) &&
+           *rn != PC_REGISTER_INDEX && *rd != PC_REGISTER_INDEX && *rn != *rd;
+}
+
+/// True when `raw_inst` is a load or store an idiom may start with
+/// Only the idioms run loads and stores, code reaching one must be translated to run.
+static inline bool idiom_may_start(const word_t raw_inst) {
+    bool load, byte;
+    uint8_t rn, rd;
+    return idiom_match_transfer(raw_inst, &load, &byte, &rn, &rd);
+}
+
+/// SUBS Rn, Rn, #step with a non-zero step
+static inline bool idiom_is_countdown(const DecodedInst *inst) {
+    return fusion_is_flag_sub(inst) && inst->op == OP_SUB && inst->i && inst->rd == inst->rn && inst->imm != 0u;
+}
+
+/// BNE back to the instruction `distance` slots before it
+static inline bool idiom_is_back_edge(const DecodedInst *inst, const size_t distance) {
+    // The branch reads PC + 8, the loop start is `distance` words back
+    return inst->handler == HANDLER_BRANCH && inst->cond == NE &&
+           inst->imm == (word_t)-(int32_t)((distance + 2u) * WORD_SIZE_BYTES);
+}
+
+/// Tries every idiom on the loop starting at slot `i`, rewrites slot `i` on a match
+static inline void idiom_match_at(PredecodedProgram *program, const word_t *raw, const size_t i) {
+    DecodedInst *insts = program->insts;
+    const size_t left = program->count - i;
+
+    bool load, byte;
+    uint8_t base, reg;
+    if (!idiom_match_transfer(raw[i], &load, &byte, &base, &reg)) return;
+
+    if (load && left >= IDIOM_COPY_LENGTH) {
+        bool store_load, store_byte;
+        uint8_t dst, temp;
+        const DecodedInst *subs = &insts[i + 2];
+        if (idiom_match_transfer(raw[i + 1], &store_load, &store_byte, &dst, &temp) &&
+            !store_load && store_byte == byte && temp == reg && dst != base &&
+            idiom_is_countdown(subs) && idiom_is_back_edge(&insts[i + 3], 3) &&
+            subs->rd != base && subs->rd != dst && subs->rd != reg) {
+            const DecodedInst copy = {
+                .handler = HANDLER_IDIOM_COPY, .cond = AL,
+                .rd = dst, .rn = base, .rm = subs->rd, .op = reg, .s = byte, .imm = subs->imm,
+            };
+            insts[i] = copy;
+            return;
+        }
+    }
+
+    if (load && byte && left >= IDIOM_SCAN_LENGTH) {
+        const DecodedInst *cmp = &insts[i + 1];
+        if (fusion_is_flag_sub(cmp) && cmp->op == OP_CMP && cmp->i && cmp->rn == reg && cmp->imm <= 0xFFu &&
+            idiom_is_back_edge(&insts[i + 2], 2)) {
+            const DecodedInst scan = {.handler = HANDLER_IDIOM_SCAN, .cond = AL, .rn = base, .rd = reg, .imm = cmp->imm};
+            insts[i] = scan;
+            return;
+        }
+    }
+
+    if (!load && left >= IDIOM_FILL_LENGTH) {
+        const DecodedInst *subs = &insts[i + 1];
+        if (idiom_is_countdown(subs) && idiom_is_back_edge(&insts[i + 2], 2) &&
+            subs->rd != base && subs->rd != reg) {
+            const DecodedInst fill = {
+                .handler = HANDLER_IDIOM_FILL, .cond = AL,
+                .rd = base, .rn = reg, .rm = subs->rd, .s = byte, .imm = subs->imm,
+            };
+            insts[i] = fill;
+        }
+    }
+}
+
+/// Rewrites the first slot of every recognised copy/fill/scan loop into its idiom handler
+/// `raw` holds the instruction words the slots were decoded from, memory is not read:
+/// it may have changed since, or belong to a guest running on another thread.
+/// Runs before predecoder_fuse, which then skips the loops as whole groups
+static inline void predecoder_recognise_idioms(PredecodedProgram *program, const word_t *raw) {
+    assert(program != NULL);
+    assert(raw != NULL);
+
+    for (size_t i = 0; i < program->count; i += predecoded_length(program->insts[i].handler)) {
+        idiom_match_at(program, raw, i);
+    }
+}
+
+/// Predecodes `count` words of memory starting at `base_address` and runs the fusion pass
+static inline PredecodedProgram construct_predecoded_program(const ProgramMemory *mem,
+                                                             const word_t base_address,
+                                                             const size_t count) {
+    assert(mem != NULL);
+    assert((base_address & WORD_ALIGN_MASK) == 0);
+
+    PredecodedProgram program = {
+        .insts = calloc(count + 1, sizeof(DecodedInst)),
+        .count = count,
+        .base_address = base_address,
+    };
+    word_t *raw = malloc((count + 1) * sizeof(word_t));
+    assert(program.insts != NULL);
+    assert(raw != NULL);
+
+    for (size_t i = 0; i < count; ++i) {
+        raw[i] = mem_read32(mem, base_address + (word_t)(i * WORD_SIZE_BYTES));
+        program.insts[i] = decode(raw[i]);
+    }
+    program.insts[count] = (DecodedInst){.handler = HANDLER_END_OF_CODE};
+
+    predecoder_recognise_idioms(&program, raw);
+    predecoder_fuse(&program);
+    free(raw);
+    return program;
+}
+
+static inline void destroy_predecoded_program(PredecodedProgram *program) {
+    assert(program != NULL);
+    free(program->insts);
+    program->insts = NULL;
+    program->count = 0;
+}
@@ -0,0 +1,90 @@
+//
+// Created by valentin on 01/26/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "decoder/decoded_inst.h"
+#include "instructions/cond.h"
+#include "instructions/branch/bx.h"
+#include "instructions/swi.h"
+#include "instructions/thumb/branch.h"
+#include "instructions/thumb/data_processing.h"
+
+/// Number of 16-bit Thumb encodings
+#define THUMB_ENCODING_COUNT (1u << 16)
+
+/// Decodes a raw T16 halfword into the uniform DecodedInst shape.
+/// Formats without an executor (loads/stores, push/pop, multiple transfers, MUL)
+/// decode to HANDLER_UNDEFINED like their ARM counterparts.
+static inline DecodedInst decode_thumb_instruction(const halfword_t raw_inst) {
+    static const halfword_t BX_MASK = 0xFF00;
+    static const halfword_t BX_PATTERN = 0x4700;
+    static const halfword_t H2_MASK = 0x0040;
+
+    const DecodedInst undefined = {.handler = HANDLER_UNDEFINED, .cond = AL};
+
+    switch (raw_inst >> 13) {
+    case 0x0:
+        // Formats 1 and 2, shift type 11 is the add/subtract form
+        if (((raw_inst >> 11) & 0x3u) == 0x3u) return decode_thumb_add_sub(raw_inst);
+        return decode_thumb_shift_imm(raw_inst);
+    case 0x1:
+        return decode_thumb_imm8(raw_inst);
+    case 0x2: {
+        if ((raw_inst & 0xFC00) == 0x4000) {
+            DecodedInst alu;
+            return decode_thumb_alu(raw_inst, &alu) ? alu : undefined;
+        }
+        if ((raw_inst & BX_MASK) == BX_PATTERN) {
+            // BX Rm, H1 must be clear
+            if (raw_inst & 0x0080) return undefined;
+            const RegisterIndex rm = ((raw_inst >> 3) & THUMB_LOW_REG_MASK) + ((raw_inst & H2_MASK) ? THUMB_HIGH_REG_OFFSET : 0u);
+            const DecodedInst bx = {.handler = HANDLER_BRANCH_EXCHANGE, .cond = AL, .rm = rm};
+            return bx;
+        }
+        if ((raw_inst & 0xFC00) == 0x4400) return decode_thumb_high_register(raw_inst);
+        // PC-relative load and register offset transfers
+        return undefined;
+    }
+    case 0x5:
+        if ((raw_inst & 0x1000) == 0) return decode_thumb_load_address(raw_inst);
+        if ((raw_inst & 0xFF00) == 0xB000) return decode_thumb_adjust_sp(raw_inst);
+        // PUSH/POP
+        return undefined;
+    case 0x6: {
+        if ((raw_inst & 0xF000) != 0xD000) return undefined; // LDMIA/STMIA
+        const CondCode cond = (raw_inst >> 8) & 0xFu;
+        // 0xF is the SWI encoding, AL is undefined here
+        if (cond == 0xFu) return decode_thumb_swi(raw_inst);
+        if (cond == AL) return undefined;
+        return decode_thumb_b_cond(raw_inst);
+    }
+    case 0x7:
+        if ((raw_inst & 0xF800) == 0xE000) return decode_thumb_b(raw_inst);
+        if ((raw_inst & 0xF000) == 0xF000) return decode_thumb_bl(raw_inst);
+        return undefined;
+    default:
+        // Immediate and halfword offset transfers, SP-relative transfers
+        return undefined;
+    }
+}
+
+/// Every T16 encoding decoded ahead of time, indexed by the raw halfword.
+/// Decoding a Thumb instruction at run time is then a single load.
+static DecodedInst THUMB_DECODE_TABLE[THUMB_ENCODING_COUNT];
+
+/// Fills THUMB_DECODE_TABLE, must run once before Thumb code executes
+static inline void thumb_decode_table_init(void) {
+    for (word_t raw = 0; raw < THUMB_ENCODING_COUNT; ++raw) {
+        THUMB_DECODE_TABLE[raw] = decode_thumb_instruction((halfword_t)raw);
+    }
+}
+
+static inline const DecodedInst *decode_thumb(const halfword_t raw_inst) {
+    // 0x0000 (LSLS r0, r0, #0) is defined, it only reads as undefined before the init
+    assert(THUMB_DECODE_TABLE[0].handler != HANDLER_UNDEFINED && "thumb_decode_table_init was not called");
+    return &THUMB_DECODE_TABLE[raw_inst];
+}
@@ -0,0 +1,356 @@
+//
+// Created by valentin on 02/04/26.
+//
+#pragma once
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "decoder/decoded_inst.h"
+#include "executor/blocks.h"
+
+// Persistent block store
+//
+// The translated blocks of a guest are written to a directory when it is done and
+// read back by the next run of the same code, which then starts with its hot blocks
+// already predecoded or optimised instead of warming them up again.
+//
+// A store file is named after a key: the fetch window, the entry address and the
+// content hash of the page holding the entry. Inside it every 4 KiB code page a
+// block covers is listed with its FNV-1a hash. Loading maps the file, hashes those
+// pages of guest memory again and only keeps the blocks whose pages all still
+// match, so a rebuilt program reuses whatever did not change and a stale file costs
+// one hash per page. Chains, heat and the return-address stack are not stored, they
+// rebuild within a few runs.
+//
+// The slots are stored as they are in memory: a file is only read back by a build
+// with the same BLOCK_STORE_VERSION, DecodedInst size and HANDLER_COUNT. Changing
+// what a handler id means requires a new BLOCK_STORE_VERSION. Files are written to
+// a temporary name and renamed, guests sharing a key never see half a file.
+//
+// File layout:
+//   BlockStoreHeader
+//   BlockStorePage[page_count], sorted by address
+//   block_count times: BlockStoreRecord, then its `length` slots
+
+#define BLOCK_STORE_MAGIC 0x4B4C4253u
+/// 2: predecoded blocks carry their idioms
+#define BLOCK_STORE_VERSION 2u
+#define BLOCK_STORE_PAGE_SIZE 4096u
+#define BLOCK_STORE_PATH_MAX 4096u
+
+static const uint64_t BLOCK_STORE_FNV_OFFSET_BASIS = 0xCBF29CE484222325u;
+static const uint64_t BLOCK_STORE_FNV_PRIME = 0x100000001B3u;
+
+typedef struct BlockStoreHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t handler_count;
+    uint32_t slot_size;
+    word_t fetch_base;
+    word_t fetch_size;
+    word_t entry;
+    uint32_t page_count;
+    uint64_t key;
+    uint32_t block_count;
+    uint32_t reserved;
+} BlockStoreHeader;
+
+typedef struct BlockStorePage {
+    uint64_t hash;
+    word_t address;
+    uint32_t reserved;
+} BlockStorePage;
+
+typedef struct BlockStoreRecord {
+    word_t start;
+    uint32_t length;
+    word_t targets[BLOCK_LINK_COUNT];
+    uint8_t exit;
+    uint8_t call;
+    uint8_t tier;
+    uint8_t reserved;
+} BlockStoreRecord;
+
+static inline uint64_t block_store_mix(uint64_t hash, const byte_t *bytes, const size_t size) {
+    for (size_t i = 0; i < size; ++i) hash = (hash ^ bytes[i]) * BLOCK_STORE_FNV_PRIME;
+    return hash;
+}
+
+/// FNV-1a of the guest page at `page` and of how much of it is RAM or ROM
+/// Hashing stops where that run ends, memory smaller than a page still has a hash.
+/// False when the page does not start in RAM or ROM.
+static inline bool block_store_page_hash(const ProgramMemory *memory, const word_t page, uint64_t *hash) {
+    uint64_t h = BLOCK_STORE_FNV_OFFSET_BASIS;
+    word_t done = 0;
+    while (done < BLOCK_STORE_PAGE_SIZE) {
+        byte_t *host;
+        const uint64_t span = mem_host_span(memory, page + done, BLOCK_STORE_PAGE_SIZE - done, false, &host);
+        if (span == 0u) break;
+        h = block_store_mix(h, host, span);
+        done += (word_t)span;
+    }
+    *hash = block_store_mix(h, (const byte_t *)&done, sizeof(done));
+    return done > 0u;
+}
+
+static inline word_t block_store_page_of(const word_t address) {
+    return address & ~(BLOCK_STORE_PAGE_SIZE - 1u);
+}
+
+/// Key of the code entered at `entry`, false when its page cannot be hashed
+static inline bool block_store_key(const ProgramMemory *memory, const word_t fetch_base, const word_t fetch_size,
+                                   const word_t entry, uint64_t *key) {
+    uint64_t page;
+    if (!block_store_page_hash(memory, block_store_page_of(entry), &page)) return false;
+    const word_t identity[] = {fetch_base, fetch_size, entry};
+    *key = block_store_mix(page, (const byte_t *)identity, sizeof(identity));
+    return true;
+}
+
+static inline void block_store_path(char *path, const char *dir, const uint64_t key) {
+    snprintf(path, BLOCK_STORE_PATH_MAX, "%s/%016llx.blocks", dir, (unsigned long long)key);
+}
+
+static inline int block_store_compare_pages(const void *a, const void *b) {
+    const word_t left = ((const BlockStorePage *)a)->address;
+    const word_t right = ((const BlockStorePage *)b)->address;
+    return left < right ? -1 : left > right;
+}
+
+/// Pages spanned by `block`, the last one may be the first
+static inline void block_store_block_pages(const Block *block, word_t *first, word_t *last) {
+    *first = block_store_page_of(block->start);
+    *last = block_store_page_of(block->start + (block->length - 1u) * WORD_SIZE_BYTES);
+}
+
+static inline const BlockStorePage *block_store_find_page(const BlockStorePage *pages, const uint32_t count,
+                                                          const word_t address) {
+    const BlockStorePage wanted = {.address = address};
+    return bsearch(&wanted, pages, count, sizeof(BlockStorePage), block_store_compare_pages);
+}
+
+// -------------------------
+// Saving
+// -------------------------
+
+/// Writes the valid blocks of `cache` to `dir`, replacing the file of the same key
+/// Blocks on pages that do not start in RAM or ROM are left out, and so are blocks the
+/// MMU fetched from elsewhere than their address: a load hashes the pages at that address.
+/// Must not run while the
+/// guest or the BlockCompiler may still change the cache. Returns false on I/O errors.
+static inline bool block_store_save(const BlockCache *cache, const char *dir, const word_t fetch_base,
+                                    const word_t fetch_size, const word_t entry) {
+    assert(cache != NULL);
+    assert(dir != NULL);
+
+    BlockStoreHeader header = {
+        .magic = BLOCK_STORE_MAGIC,
+        .version = BLOCK_STORE_VERSION,
+        .handler_count = HANDLER_COUNT,
+        .slot_size = sizeof(DecodedInst),
+        .fetch_base = fetch_base,
+        .fetch_size = fetch_size,
+        .entry = entry,
+    };
+    if (!block_store_key(cache->memory, fetch_base, fetch_size, entry, &header.key)) return false;
+
+    size_t block_count = 0;
+    for (size_t i = 0; i < BLOCK_CACHE_BUCKETS; ++i) {
+        for (const Block *block = cache->buckets[i]; block != NULL; block = block->hash_next) ++block_count;
+    }
+
+    // Two pages at most per block, sorted and deduplicated below
+    BlockStorePage *pages = calloc(block_count * 2u + 1u, sizeof(BlockStorePage));
+    if (pages == NULL) return false;
+    size_t page_count = 0;
+    for (size_t i = 0; i < BLOCK_CACHE_BUCKETS; ++i) {
+        for (const Block *block = cache->buckets[i]; block != NULL; block = block->hash_next) {
+            if (block->physical != block->start) continue;
+            word_t first, last;
+            block_store_block_pages(block, &first, &last);
+            pages[page_count++].address = first;
+            if (last != first) pages[page_count++].address = last;
+        }
+    }
+    qsort(pages, page_count, sizeof(BlockStorePage), block_store_compare_pages);
+    size_t unique = 0;
+    for (size_t i = 0; i < page_count; ++i) {
+        if (unique > 0u && pages[unique - 1u].address == pages[i].address) continue;
+        BlockStorePage page = {.address = pages[i].address};
+        // A page that cannot be hashed is dropped, and with it its blocks
+        if (block_store_page_hash(cache->memory, page.address, &page.hash)) pages[unique++] = page;
+    }
+    header.page_count = (uint32_t)unique;
+
+    char path[BLOCK_STORE_PATH_MAX];
+    char temporary[BLOCK_STORE_PATH_MAX + 32u];
+    block_store_path(path, dir, header.key);
+    snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", path, (long)getpid());
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL) {
+        free(pages);
+        return false;
+    }
+
+    // The block count is only known once the blocks are written, the header is rewritten last
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1u &&
+              fwrite(pages, sizeof(BlockStorePage), unique, file) == unique;
+    for (size_t i = 0; i < BLOCK_CACHE_BUCKETS && ok; ++i) {
+        for (const Block *block = cache->buckets[i]; block != NULL && ok; block = block->hash_next) {
+            if (block->physical != block->start) continue;
+            word_t first, last;
+            block_store_block_pages(block, &first, &last);
+            if (block_store_find_page(pages, header.page_count, first) == NULL ||
+                block_store_find_page(pages, header.page_count, last) == NULL) {
+                continue;
+            }
+
+            const BlockCode *code = atomic_load_explicit(&block->code, memory_order_acquire);
+            const BlockStoreRecord record = {
+                .start = block->start,
+                .length = block->length,
+                .targets = {block->targets[BLOCK_LINK_TAKEN], block->targets[BLOCK_LINK_NEXT]},
+                .exit = (uint8_t)block->exit,
+                .call = block->call,
+                .tier = (uint8_t)atomic_load_explicit(&block->tier, memory_order_relaxed),
+            };
+            ok = fwrite(&record, sizeof(record), 1, file) == 1u &&
+                 fwrite(code->insts, sizeof(DecodedInst), block->length, file) == block->length;
+            ++header.block_count;
+        }
+    }
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1u;
+    ok = fclose(file) == 0 && ok;
+    free(pages);
+
+    if (ok && rename(temporary, path) == 0) return true;
+    unlink(temporary);
+    return false;
+}
+
+// -------------------------
+// Loading
+// -------------------------
+
+/// True when `record` and its slots are something block_execute can run
+static inline bool block_store_record_is_sane(const BlockStoreRecord *record, const DecodedInst *insts) {
+    if (record->length == 0u || record->length > BLOCK_MAX_INSTRUCTIONS) return false;
+    if (record->exit > BLOCK_EXIT_RETURN || record->call > 1u) return false;
+    if (record->tier != TIER_PREDECODED && record->tier != TIER_OPTIMISED) return false;
+    // Handler ids index the dispatch table
+    for (uint32_t i = 0; i < record->length; ++i) {
+        if (insts[i].handler >= HANDLER_COUNT) return false;
+    }
+    // Groups are walked as block_execute walks them (see optimiser_groups), the last
+    // one must end with the block: its handler would read slots past it otherwise
+    uint32_t group = 0;
+    while (group < record->length) group += predecoded_length(insts[group].handler);
+    return group == record->length;
+}
+
+/// Adds the blocks stored in `dir` for this code to `cache`, returns how many
+/// Blocks whose pages changed since they were stored, and entries the cache already
+/// has, are skipped. A missing or foreign file loads nothing.
+static inline size_t block_store_load(BlockCache *cache, const char *dir, const word_t fetch_base,
+                                      const word_t fetch_size, const word_t entry) {
+    assert(cache != NULL);
+    assert(dir != NULL);
+
+    uint64_t key;
+    if (!block_store_key(cache->memory, fetch_base, fetch_size, entry, &key)) return 0;
+    char path[BLOCK_STORE_PATH_MAX];
+    block_store_path(path, dir, key);
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(BlockStoreHeader)) {
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    const size_t size = (size_t)status.st_size;
+    const byte_t *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) return 0;
+
+    const BlockStoreHeader *header = (const BlockStoreHeader *)file;
+    const size_t pages_end = sizeof(BlockStoreHeader) + (size_t)header->page_count * sizeof(BlockStorePage);
+    if (header->magic != BLOCK_STORE_MAGIC || header->version != BLOCK_STORE_VERSION ||
+        header->handler_count != HANDLER_COUNT || header->slot_size != sizeof(DecodedInst) ||
+        header->key != key || header->fetch_base != fetch_base || header->fetch_size != fetch_size ||
+        header->entry != entry || pages_end > size) {
+        munmap((void *)file, size);
+        return 0;
+    }
+
+    // Pages still holding the code they held when stored
+    const BlockStorePage *stored = (const BlockStorePage *)(file + sizeof(BlockStoreHeader));
+    bool *current = calloc(header->page_count + 1u, sizeof(bool));
+    if (current == NULL) {
+        munmap((void *)file, size);
+        return 0;
+    }
+    for (uint32_t i = 0; i < header->page_count; ++i) {
+        uint64_t hash;
+        current[i] = block_store_page_hash(cache->memory, stored[i].address, &hash) && hash == stored[i].hash;
+    }
+
+    size_t loaded = 0;
+    size_t offset = pages_end;
+    for (uint32_t b = 0; b < header->block_count; ++b) {
+        if (size - offset < sizeof(BlockStoreRecord)) break;
+        const BlockStoreRecord *record = (const BlockStoreRecord *)(file + offset);
+        const DecodedInst *insts = (const DecodedInst *)(file + offset + sizeof(BlockStoreRecord));
+        if (record->length > BLOCK_MAX_INSTRUCTIONS ||
+            size - offset - sizeof(BlockStoreRecord) < record->length * sizeof(DecodedInst)) {
+            break;
+        }
+        offset += sizeof(BlockStoreRecord) + record->length * sizeof(DecodedInst);
+        if (!block_store_record_is_sane(record, insts)) continue;
+
+        const word_t first = block_store_page_of(record->start);
+        const word_t last = block_store_page_of(record->start + (record->length - 1u) * WORD_SIZE_BYTES);
+        const BlockStorePage *first_page = block_store_find_page(stored, header->page_count, first);
+        const BlockStorePage *last_page = block_store_find_page(stored, header->page_count, last);
+        if (first_page == NULL || last_page == NULL || !current[first_page - stored] ||
+            !current[last_page - stored] || block_cache_lookup(cache, record->start) != NULL) {
+            continue;
+        }
+
+        Block *block = calloc(1, sizeof(Block) + record->length * sizeof(word_t));
+        if (block == NULL) break;
+        // The pages matched, memory still holds the instructions the slots were built from
+        for (uint32_t i = 0; i < record->length; ++i) {
+            block->raw[i] = mem_read32(cache->memory, record->start + i * WORD_SIZE_BYTES);
+        }
+        block->start = record->start;
+        block->physical = record->start;
+        atomic_init(&block->code, block_code_register(cache, record->start, block->raw, record->length,
+                                                      (ExecutionTier)record->tier,
+                                                      block_code_of(insts, record->length, record->start)));
+        atomic_init(&block->tier, (ExecutionTier)record->tier);
+        block->length = record->length;
+        block->exit = (BlockExitKind)record->exit;
+        block->call = record->call != 0u;
+        block->targets[BLOCK_LINK_TAKEN] = record->targets[BLOCK_LINK_TAKEN];
+        block->targets[BLOCK_LINK_NEXT] = record->targets[BLOCK_LINK_NEXT];
+        block->valid = true;
+        block_cache_insert(cache, block);
+        block_watch(cache, block);
+        ++loaded;
+    }
+
+    free(current);
+    munmap((void *)file, size);
+    cache->stats.loaded += loaded;
+    return loaded;
+}
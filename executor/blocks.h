@@ -0,0 +1,770 @@
+//
+// Created by valentin on 02/01/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "cpu/cpu.h"
+#include "decoder/decoded_inst.h"
+#include "decoder/decoder.h"
+#include "decoder/predecoder.h"
+#include "decoder/optimiser.h"
+#include "executor/dispatch.h"
+#include "executor/fetch.h"
+#include "executor/shared_code.h"
+#include "faults/fault.h"
+
+// Translated blocks
+//
+// A block is the predecoded ARM code from an entry address up to the first
+// instruction that may leave it (B/BL, BX, SWI, a data processing write to the PC),
+// kept in a BlockCache keyed by that entry.
+//
+// Code moves up through three tiers as it gets hot:
+//   interpreted  fetch, decode and execute per instruction, each entry address
+//                reached counts towards TierConfig.translate_threshold
+//   predecoded   the block's slots are decoded once, with the copy/fill/scan
+//                loops recognised as idioms, and replayed
+//   optimised    after TierConfig.optimise_threshold runs the slots are rebuilt
+//                with the block optimiser (optimiser.h) and fusion, on the
+//                BlockCompiler thread when there is one (see compiler.h)
+// Cold code is never decoded twice, and hot code pays for the passes only once.
+// Loads and stores only run inside an idiom, so the interpreter translates a loop as
+// soon as it reaches one.
+//
+// Exits are linked lazily. The first time a block leaves to one of its fixed
+// addresses (the target of its final B/BL, or the instruction after it) the successor
+// is looked up once and stored in the exit, later runs go block to block after one
+// compare. An exit only known at run time (BX, writes to R15, SWI) remembers the last
+// target and its block, a per-site cache that holds for the usual single target.
+//
+// Calls and returns are predicted apart. Leaving a block through its final BL pushes
+// that block on a small return-address stack; a block ending in BX LR or MOV PC, LR
+// compares the address it left to with the instruction after the top caller and, when
+// they match, continues at the caller's fall-through block. A misprediction takes
+// the indirect path above.
+//
+// Guests running the same code may share it through a SharedCode table (see
+// shared_code.h): a block's slots are then a reference to the code another guest
+// built from the same instructions, and a block reaching a tier some guest already
+// built for it adopts that code instead of building its own.
+//
+// Blocks are keyed by virtual address. Under the MMU a block stays within one page and
+// records the physical address of its entry. A guest changing its translations drops
+// every block (block_cache_flush), so code translated through the old mapping is
+// never run through the new one.
+//
+// The pages a block was translated from are watched in guest memory (mem_watch_code).
+// A guest write to one of them reaches block_cache_invalidate through the guest's
+// MemWriteOps, which drops the blocks of that physical page; the next entry translates
+// the new instructions.
+//
+// Every link is also recorded on the block it points to. Invalidating a block (its
+// code was overwritten) unchains it: the links pointing at it are cleared, so nothing
+// reaches it again. Invalidated blocks stay allocated until the cache is destroyed,
+// the run loop may still be inside one.
+
+/// Longest block, in guest instructions
+#define BLOCK_MAX_INSTRUCTIONS 64u
+_Static_assert(BLOCK_MAX_INSTRUCTIONS <= OPTIMISER_MAX_SLOTS, "the optimiser must take whole blocks");
+/// Hash buckets of a BlockCache, a power of two
+#define BLOCK_CACHE_BUCKETS 1024u
+/// Sets of the interpreted visit counters and counters per set, powers of two
+#define BLOCK_HEAT_SETS 256u
+#define BLOCK_HEAT_WAYS 4u
+/// Calls the return-address stack remembers, a power of two
+#define RETURN_STACK_DEPTH 16u
+
+/// Times an entry address is interpreted before its block is predecoded
+#ifndef TIER_TRANSLATE_THRESHOLD
+#define TIER_TRANSLATE_THRESHOLD 8u
+#endif
+/// Runs of a predecoded block before it is optimised
+#ifndef TIER_OPTIMISE_THRESHOLD
+#define TIER_OPTIMISE_THRESHOLD 64u
+#endif
+
+typedef enum ExecutionTier {
+    TIER_INTERPRETED = 0,
+    TIER_PREDECODED,
+    TIER_OPTIMISED,
+    TIER_COUNT,
+} ExecutionTier;
+
+/// Promotion thresholds, 0 promotes on the first visit
+typedef struct TierConfig {
+    uint32_t translate_threshold;
+    uint32_t optimise_threshold;
+} TierConfig;
+
+static inline TierConfig construct_tier_config(void) {
+    const TierConfig config = {
+        .translate_threshold = TIER_TRANSLATE_THRESHOLD,
+        .optimise_threshold = TIER_OPTIMISE_THRESHOLD,
+    };
+    return config;
+}
+
+typedef enum BlockExitKind {
+    /// Leaves to targets[TAKEN] or targets[NEXT] (final B/BL, or the block was cut short)
+    BLOCK_EXIT_DIRECT = 0,
+    /// Target only known at run time, see Block.indirect
+    BLOCK_EXIT_INDIRECT,
+    /// BX LR or MOV PC, LR: predicted by the return-address stack, indirect otherwise
+    BLOCK_EXIT_RETURN,
+} BlockExitKind;
+
+typedef enum BlockLink {
+    BLOCK_LINK_TAKEN = 0,
+    BLOCK_LINK_NEXT,
+    BLOCK_LINK_COUNT,
+    /// The per-site cache of an indirect exit, only used in BlockIncoming
+    BLOCK_LINK_INDIRECT = BLOCK_LINK_COUNT,
+} BlockLink;
+
+/// A link of `from` pointing at the block holding this record
+typedef struct BlockIncoming {
+    struct Block *from;
+    BlockLink link;
+} BlockIncoming;
+
+/// Executable slots of a block, replaced as a whole when the block is optimised
+typedef struct BlockCode {
+    /// Guest address of the last slot group, the only one that may branch
+    word_t last;
+    /// Entry of the SharedCode table holding it, NULL for code of one cache
+    SharedCodeEntry *share;
+    /// One slot per guest instruction, fused groups as in a PredecodedProgram
+    DecodedInst insts[];
+} BlockCode;
+
+/// Replaced code waiting to be released with the cache
+typedef struct RetiredCode {
+    BlockCode *code;
+    struct RetiredCode *next;
+} RetiredCode;
+
+typedef struct Block {
+    /// Guest address of the first instruction
+    word_t start;
+    /// Where it was fetched from, `start` unless the MMU translated it
+    word_t physical;
+    /// Published with release order, another thread may swap in optimised code (see compiler.h)
+    _Atomic(BlockCode *) code;
+    /// TIER_PREDECODED or TIER_OPTIMISED, stored after the code it describes
+    _Atomic(ExecutionTier) tier;
+    /// Runs counted towards the next promotion
+    uint32_t runs;
+    /// Guest instructions covered, the block spans [start, start + 4 * length)
+    uint32_t length;
+    BlockExitKind exit;
+    /// Ends in BL, its taken exit is a call returning to targets[NEXT]
+    bool call;
+    /// Cleared once invalidated, the block is then unreachable
+    bool valid;
+
+    /// Fixed exits of a BLOCK_EXIT_DIRECT block, and their chained blocks (NULL until first used)
+    word_t targets[BLOCK_LINK_COUNT];
+    struct Block *links[BLOCK_LINK_COUNT];
+    /// Last target of a BLOCK_EXIT_INDIRECT block and its block
+    word_t indirect_target;
+    struct Block *indirect;
+
+    /// Links of other blocks pointing here, cleared by block_unchain
+    BlockIncoming *incoming;
+    uint32_t incoming_count;
+    uint32_t incoming_capacity;
+
+    /// Chain of the hash bucket
+    struct Block *hash_next;
+    /// Every block ever built, valid or not
+    struct Block *all_next;
+
+    /// The `length` instruction words the block was translated from, never changed
+    /// afterwards: the passes that match on them do not read guest memory
+    word_t raw[];
+} Block;
+
+typedef struct BlockStats {
+    /// Promotions to TIER_PREDECODED, and blocks found hot enough for TIER_OPTIMISED
+    uint64_t translated;
+    uint64_t optimised;
+    /// Blocks read back from a block store (see block_store.h)
+    uint64_t loaded;
+    /// Translations that took their code from the SharedCode table
+    uint64_t shared;
+    /// Guest instructions run in each tier
+    uint64_t instructions[TIER_COUNT];
+    uint64_t invalidated;
+    /// Exits that went through a chained link
+    uint64_t chained_exits;
+    /// Indirect exits that hit / missed their per-site cache
+    uint64_t indirect_hits;
+    uint64_t indirect_misses;
+    /// Returns that went to / away from the predicted caller
+    uint64_t return_hits;
+    uint64_t return_misses;
+} BlockStats;
+
+/// Interpreted visits of one entry address, the counter is free while `visits` is 0
+typedef struct BlockHeat {
+    word_t entry;
+    uint32_t visits;
+} BlockHeat;
+
+/// Shadow stack of the blocks that made the pending calls, oldest ones are overwritten
+typedef struct ReturnStack {
+    Block *callers[RETURN_STACK_DEPTH];
+    /// Pushes so far, the top is callers[(top - 1) % RETURN_STACK_DEPTH]
+    uint32_t top;
+    /// Valid entries, at most RETURN_STACK_DEPTH
+    uint32_t depth;
+} ReturnStack;
+
+/// Blocks of one guest CPU
+typedef struct BlockCache {
+    /// Guest memory the blocks are translated from
+    const ProgramMemory *memory;
+    /// Translates the fetches once the guest enables it, NULL when they are physical
+    Mmu *mmu;
+    /// Code shared with the caches of other guests, NULL keeps it private
+    SharedCode *shared;
+    TierConfig tiers;
+    Block *buckets[BLOCK_CACHE_BUCKETS];
+    /// Interpreted visits of the entries without a block, see block_heat
+    BlockHeat heat[BLOCK_HEAT_SETS][BLOCK_HEAT_WAYS];
+    Block *blocks;
+    /// Pushed by whichever thread replaced the code
+    _Atomic(RetiredCode *) retired;
+    ReturnStack returns;
+    BlockStats stats;
+} BlockCache;
+
+/// Blocks of the guest running from `memory` through `mmu` (NULL for none), sharing code
+/// through `shared` unless it is NULL. `mmu` and `shared` must outlive the cache
+static inline BlockCache *construct_block_cache(const ProgramMemory *memory, Mmu *mmu, const TierConfig tiers,
+                                                SharedCode *shared) {
+    assert(memory != NULL);
+
+    BlockCache *cache = calloc(1, sizeof(BlockCache));
+    if (cache == NULL) return NULL;
+    cache->memory = memory;
+    cache->mmu = mmu;
+    cache->shared = shared;
+    cache->tiers = tiers;
+    return cache;
+}
+
+/// Frees private code, drops the reference to shared code
+static inline void block_code_release(BlockCode *code) {
+    if (code->share != NULL) shared_code_release(code->share);
+    else free(code);
+}
+
+static inline void destroy_block_cache(BlockCache *cache) {
+    if (cache == NULL) return;
+    Block *block = cache->blocks;
+    while (block != NULL) {
+        Block *next = block->all_next;
+        block_code_release(atomic_load(&block->code));
+        free(block->incoming);
+        free(block);
+        block = next;
+    }
+    RetiredCode *retired = atomic_load(&cache->retired);
+    while (retired != NULL) {
+        RetiredCode *next = retired->next;
+        block_code_release(retired->code);
+        free(retired);
+        retired = next;
+    }
+    free(cache);
+}
+
+static inline size_t block_bucket(const word_t pc) {
+    return (pc >> 2) & (BLOCK_CACHE_BUCKETS - 1u);
+}
+
+/// Valid block starting at `pc`, NULL when none was built
+static inline Block *block_cache_lookup(const BlockCache *cache, const word_t pc) {
+    for (Block *block = cache->buckets[block_bucket(pc)]; block != NULL; block = block->hash_next) {
+        if (block->start == pc) return block;
+    }
+    return NULL;
+}
+
+/// Visit counter of the entry `pc`, taken from the least visited entry of its set when it has none
+/// The evicted entry counts again from zero, a hot entry is rarely the least visited one.
+static inline BlockHeat *block_heat(BlockCache *cache, const word_t pc) {
+    BlockHeat *set = cache->heat[(pc >> 2) & (BLOCK_HEAT_SETS - 1u)];
+    BlockHeat *coldest = &set[0];
+    for (size_t way = 0; way < BLOCK_HEAT_WAYS; ++way) {
+        if (set[way].visits != 0u && set[way].entry == pc) return &set[way];
+        if (set[way].visits < coldest->visits) coldest = &set[way];
+    }
+    *coldest = (BlockHeat){.entry = pc};
+    return coldest;
+}
+
+/// Forgets the visits of the entries fetched from the physical range [addr, addr + size)
+static inline void block_heat_forget(BlockCache *cache, const word_t addr, const word_t size) {
+    for (size_t set = 0; set < BLOCK_HEAT_SETS; ++set) {
+        for (size_t way = 0; way < BLOCK_HEAT_WAYS; ++way) {
+            BlockHeat *heat = &cache->heat[set][way];
+            if (heat->visits == 0u) continue;
+            word_t physical = heat->entry;
+            // An entry the MMU no longer maps counts again once it is mapped
+            if (!mmu_translate(cache->mmu, heat->entry, MMU_ACCESS_FETCH, &physical) || physical - addr < size) {
+                heat->visits = 0;
+            }
+        }
+    }
+}
+
+// -------------------------
+// Translation
+// -------------------------
+
+/// True when the slot may continue anywhere but the next instruction
+static inline bool block_ends_at(const DecodedInst *inst) {
+    switch (inst->handler) {
+    case HANDLER_BRANCH:
+    case HANDLER_BRANCH_LINK:
+    case HANDLER_BRANCH_EXCHANGE:
+    case HANDLER_SWI:
+        return true;
+    default:
+        // Bit 0 of the data processing offset is "Rd is PC", see dp_handler_id
+        return handler_is_data_processing(inst->handler) &&
+               ((inst->handler - HANDLER_DATA_PROCESSING_FIRST) & 1u) != 0u;
+    }
+}
+
+/// BX LR, or an unshifted MOV PC, LR that leaves the flags alone
+static inline bool block_is_return(const DecodedInst *inst) {
+    if (inst->handler == HANDLER_BRANCH_EXCHANGE) return inst->rm == LINK_REGISTER_INDEX;
+    return inst->handler == dp_handler_id(OP_MOV, false, true, true) && inst->rm == LINK_REGISTER_INDEX &&
+           operand2_reg_is_plain(inst);
+}
+
+/// Code of `length` slots with its last group worked out
+static inline BlockCode *block_code_of(const DecodedInst *insts, const uint32_t length, const word_t start) {
+    BlockCode *code = calloc(1, sizeof(BlockCode) + length * sizeof(DecodedInst));
+    assert(code != NULL);
+    memcpy(code->insts, insts, length * sizeof(DecodedInst));
+
+    uint32_t group = 0;
+    while (group + predecoded_length(code->insts[group].handler) < length) {
+        group += predecoded_length(code->insts[group].handler);
+    }
+    code->last = start + group * WORD_SIZE_BYTES;
+    return code;
+}
+
+/// `code`, built from the `length` instructions `raw` at `start`, registered in the
+/// cache's SharedCode table. Returns the code to use: `code` itself, or the equal code
+/// registered first (`code` is then freed). Without a table `code` stays private.
+static inline BlockCode *block_code_register(const BlockCache *cache, const word_t start, const word_t *raw,
+                                             const uint32_t length, const ExecutionTier tier, BlockCode *code) {
+    if (cache->shared == NULL) return code;
+    SharedCodeEntry *entry = shared_code_register(cache->shared, start, raw, length, tier, code);
+    if (entry == NULL) return code;
+    if (entry->code != code) {
+        free(code);
+        return entry->code;
+    }
+    code->share = entry;
+    return code;
+}
+
+/// Optimised code of a predecoded block: its slots rebuilt with the optimiser and fusion passes
+/// Shared predecoded code looks for optimised code another cache registered first.
+/// Only reads the block's current code and instruction words, any thread may call it
+static inline BlockCode *block_code_optimised(const BlockCache *cache, const Block *block) {
+    const BlockCode *code = atomic_load_explicit(&block->code, memory_order_acquire);
+    const SharedCodeEntry *share = code->share;
+    if (share != NULL) {
+        const SharedCodeEntry *entry = shared_code_acquire(cache->shared, block->start, share->raw, block->length,
+                                                           TIER_OPTIMISED);
+        if (entry != NULL) return entry->code;
+    }
+
+    DecodedInst insts[BLOCK_MAX_INSTRUCTIONS];
+    memcpy(insts, code->insts, block->length * sizeof(DecodedInst));
+    // The idioms were recognised at translation
+    PredecodedProgram view = {.insts = insts, .count = block->length, .base_address = block->start};
+    optimise_block(insts, block->length);
+    predecoder_fuse(&view);
+    BlockCode *optimised = block_code_of(insts, block->length, block->start);
+    // Registered under the instructions the shared predecoded code was built from
+    return share != NULL ? block_code_register(cache, block->start, share->raw, block->length, TIER_OPTIMISED,
+                                               optimised)
+                         : optimised;
+}
+
+/// Swaps `code` in as the block's TIER_OPTIMISED code, from any thread
+/// The old code is retired, not released: the guest may still be running it
+static inline void block_publish(BlockCache *cache, Block *block, BlockCode *code) {
+    RetiredCode *retired = malloc(sizeof(RetiredCode));
+    assert(retired != NULL);
+    retired->code = atomic_exchange_explicit(&block->code, code, memory_order_acq_rel);
+    atomic_store_explicit(&block->tier, TIER_OPTIMISED, memory_order_release);
+
+    retired->next = atomic_load_explicit(&cache->retired, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&cache->retired, &retired->next, retired,
+                                                  memory_order_release, memory_order_relaxed)) {
+    }
+}
+
+/// Moves `block` to TIER_OPTIMISED on the calling thread
+static inline void block_optimise(BlockCache *cache, Block *block) {
+    block_publish(cache, block, block_code_optimised(cache, block));
+}
+
+/// Makes `block` reachable from its start address, the cache owns it from now on
+static inline void block_cache_insert(BlockCache *cache, Block *block) {
+    Block **bucket = &cache->buckets[block_bucket(block->start)];
+    block->hash_next = *bucket;
+    *bucket = block;
+    block->all_next = cache->blocks;
+    cache->blocks = block;
+}
+
+/// Watches the physical range of `block`, writes to it then invalidate the block
+static inline void block_watch(const BlockCache *cache, const Block *block) {
+    // A TLB entry filled for writing before would bypass the watch (see mem_direct_host)
+    if (mem_watch_code(cache->memory, block->physical, (uint64_t)block->length * WORD_SIZE_BYTES) &&
+        cache->mmu != NULL) {
+        tlb_flush(&cache->mmu->tlbs[MMU_ACCESS_WRITE]);
+    }
+}
+
+/// Builds the block entered at `pc` and adds it to the cache
+/// The entry is fetched like any instruction, so a bad `pc` faults through the trap.
+/// The block stops before the end of the fetch window or of guest memory, and under the
+/// MMU before the end of the page, the next block then faults at its own entry.
+static inline Block *block_translate(BlockCache *cache, const word_t pc, FaultTrap *trap) {
+    assert(cache != NULL);
+    assert(trap != NULL);
+
+    word_t raw[BLOCK_MAX_INSTRUCTIONS];
+    DecodedInst insts[BLOCK_MAX_INSTRUCTIONS];
+    uint32_t length = 0;
+    word_t address = pc;
+    word_t physical = pc;
+    const bool translated = mmu_enabled(cache->mmu);
+    do {
+        if (length == 0u) {
+            raw[0] = fetch_virtual(cache->mmu, cache->memory, pc, trap);
+            // The fetch succeeded, so does the walk
+            if (translated) mmu_translate(cache->mmu, pc, MMU_ACCESS_FETCH, &physical);
+        }
+        else {
+            const word_t next = physical + (address - pc);
+            if (address - trap->fetch_base == trap->fetch_size || (translated && (address & ~MMU_PAGE_MASK) == 0u) ||
+                !mem_in_bounds(cache->memory, next, WORD_SIZE_BYTES)) {
+                break;
+            }
+            raw[length] = mem_read32(cache->memory, next);
+        }
+        insts[length] = decode(raw[length]);
+        ++length;
+        address += WORD_SIZE_BYTES;
+    } while (length < BLOCK_MAX_INSTRUCTIONS && !block_ends_at(&insts[length - 1u]));
+    // The loads and stores of a loop only run as its idiom, every tier needs them
+    PredecodedProgram view = {.insts = insts, .count = length, .base_address = pc};
+    predecoder_recognise_idioms(&view, raw);
+
+    // Code another guest built from these instructions, optimised if it got that far
+    const SharedCodeEntry *entry = NULL;
+    if (cache->shared != NULL) {
+        entry = shared_code_acquire(cache->shared, pc, raw, length, TIER_OPTIMISED);
+        if (entry == NULL) entry = shared_code_acquire(cache->shared, pc, raw, length, TIER_PREDECODED);
+    }
+    const ExecutionTier tier = entry != NULL ? (ExecutionTier)entry->tier : TIER_PREDECODED;
+    BlockCode *code;
+    if (entry != NULL) {
+        code = entry->code;
+        ++cache->stats.shared;
+    }
+    else {
+        code = block_code_register(cache, pc, raw, length, tier, block_code_of(insts, length, pc));
+    }
+
+    Block *block = calloc(1, sizeof(Block) + length * sizeof(word_t));
+    assert(block != NULL);
+    memcpy(block->raw, raw, length * sizeof(word_t));
+    block->start = pc;
+    block->physical = physical;
+    atomic_init(&block->code, code);
+    atomic_init(&block->tier, tier);
+    block->length = length;
+    block->valid = true;
+
+    const DecodedInst *final = &insts[length - 1u];
+    const word_t final_address = address - WORD_SIZE_BYTES;
+    block->targets[BLOCK_LINK_NEXT] = address;
+    if (final->handler == HANDLER_BRANCH || final->handler == HANDLER_BRANCH_LINK) {
+        block->exit = BLOCK_EXIT_DIRECT;
+        block->targets[BLOCK_LINK_TAKEN] = final_address + PC_PREFETCH_OFFSET + final->imm;
+        block->call = final->handler == HANDLER_BRANCH_LINK;
+    }
+    else if (block_is_return(final)) {
+        block->exit = BLOCK_EXIT_RETURN;
+    }
+    else if (block_ends_at(final)) {
+        block->exit = BLOCK_EXIT_INDIRECT;
+    }
+    else {
+        // Cut short, both exits continue after the block
+        block->exit = BLOCK_EXIT_DIRECT;
+        block->targets[BLOCK_LINK_TAKEN] = address;
+    }
+
+    block_cache_insert(cache, block);
+    block_watch(cache, block);
+    ++cache->stats.translated;
+    if (tier == TIER_PREDECODED && cache->tiers.optimise_threshold == 0u) {
+        ++cache->stats.optimised;
+        block_optimise(cache, block);
+    }
+    return block;
+}
+
+/// Block entered at `pc`, NULL while the entry is still interpreted
+/// Each call for an entry without a block counts as one interpreted visit
+static inline Block *block_cache_enter(BlockCache *cache, const word_t pc, FaultTrap *trap) {
+    Block *block = block_cache_lookup(cache, pc);
+    if (block != NULL) return block;
+
+    BlockHeat *heat = block_heat(cache, pc);
+    if (heat->visits < cache->tiers.translate_threshold) {
+        ++heat->visits;
+        return NULL;
+    }
+    heat->visits = 0;
+    return block_translate(cache, pc, trap);
+}
+
+// -------------------------
+// Chaining
+// -------------------------
+
+/// Points link `link` of `from` at `to` and records it on `to`
+static inline void block_chain(Block *from, const BlockLink link, Block *to) {
+    if (link == BLOCK_LINK_INDIRECT) from->indirect = to;
+    else from->links[link] = to;
+
+    // An indirect site moving between targets is recorded once per target
+    for (uint32_t i = 0; i < to->incoming_count; ++i) {
+        if (to->incoming[i].from == from && to->incoming[i].link == link) return;
+    }
+    if (to->incoming_count == to->incoming_capacity) {
+        const uint32_t capacity = to->incoming_capacity == 0u ? 4u : to->incoming_capacity * 2u;
+        BlockIncoming *grown = realloc(to->incoming, capacity * sizeof(BlockIncoming));
+        assert(grown != NULL);
+        to->incoming = grown;
+        to->incoming_capacity = capacity;
+    }
+    to->incoming[to->incoming_count++] = (BlockIncoming){.from = from, .link = link};
+}
+
+/// Clears every link pointing at `block`
+static inline void block_unchain(Block *block) {
+    for (uint32_t i = 0; i < block->incoming_count; ++i) {
+        Block *from = block->incoming[i].from;
+        const BlockLink link = block->incoming[i].link;
+        // A site may have moved on to another target since it was recorded
+        if (link == BLOCK_LINK_INDIRECT) {
+            if (from->indirect == block) from->indirect = NULL;
+        }
+        else if (from->links[link] == block) {
+            from->links[link] = NULL;
+        }
+    }
+    block->incoming_count = 0;
+}
+
+/// Block after the fixed exit `link` of `from`, chained on first use
+static inline Block *block_follow_link(BlockCache *cache, Block *from, const BlockLink link, FaultTrap *trap) {
+    Block *to = from->links[link];
+    if (__builtin_expect(to != NULL, 1)) {
+        ++cache->stats.chained_exits;
+        return to;
+    }
+    to = block_cache_enter(cache, from->targets[link], trap);
+    // An invalidated block is left as it is, nothing leads to it anymore
+    if (to != NULL && from->valid) block_chain(from, link, to);
+    return to;
+}
+
+static inline void return_stack_push(ReturnStack *stack, Block *caller) {
+    stack->callers[stack->top++ & (RETURN_STACK_DEPTH - 1u)] = caller;
+    if (stack->depth < RETURN_STACK_DEPTH) ++stack->depth;
+}
+
+/// True when the return to `next` was predicted, `to` is then the caller's fall-through block
+/// A misprediction leaves the stack as it is
+static inline bool block_predict_return(BlockCache *cache, const word_t next, FaultTrap *trap, Block **to) {
+    ReturnStack *stack = &cache->returns;
+    Block *caller = stack->depth > 0u ? stack->callers[(stack->top - 1u) & (RETURN_STACK_DEPTH - 1u)] : NULL;
+    if (caller == NULL || caller->targets[BLOCK_LINK_NEXT] != next || !caller->valid) {
+        ++cache->stats.return_misses;
+        return false;
+    }
+    --stack->top;
+    --stack->depth;
+    ++cache->stats.return_hits;
+    *to = block_follow_link(cache, caller, BLOCK_LINK_NEXT, trap);
+    return true;
+}
+
+/// Block to run after `from` left to `next`, chaining the exit on first use
+/// NULL when `next` is still interpreted
+static inline Block *block_follow(BlockCache *cache, Block *from, const word_t next, FaultTrap *trap) {
+    if (from->exit == BLOCK_EXIT_DIRECT) {
+        BlockLink link;
+        if (next == from->targets[BLOCK_LINK_TAKEN]) link = BLOCK_LINK_TAKEN;
+        else if (next == from->targets[BLOCK_LINK_NEXT]) link = BLOCK_LINK_NEXT;
+        else return block_cache_enter(cache, next, trap);
+
+        if (link == BLOCK_LINK_TAKEN && from->call) return_stack_push(&cache->returns, from);
+        return block_follow_link(cache, from, link, trap);
+    }
+
+    Block *to;
+    if (from->exit == BLOCK_EXIT_RETURN && block_predict_return(cache, next, trap, &to)) return to;
+
+    if (from->indirect != NULL && from->indirect_target == next) {
+        ++cache->stats.indirect_hits;
+        return from->indirect;
+    }
+    ++cache->stats.indirect_misses;
+    to = block_cache_enter(cache, next, trap);
+    if (to != NULL && from->valid) {
+        from->indirect_target = next;
+        block_chain(from, BLOCK_LINK_INDIRECT, to);
+    }
+    return to;
+}
+
+/// Makes `block` unreachable: no link, exit or return prediction leads to or from it
+/// It stays allocated, a run of it in progress finishes and then leaves through the cache.
+static inline void block_discard(BlockCache *cache, Block *block) {
+    block->valid = false;
+    block_unchain(block);
+    block->links[BLOCK_LINK_TAKEN] = NULL;
+    block->links[BLOCK_LINK_NEXT] = NULL;
+    block->indirect = NULL;
+    ReturnStack *stack = &cache->returns;
+    for (uint32_t i = 0; i < RETURN_STACK_DEPTH; ++i) {
+        if (stack->callers[i] == block) stack->callers[i] = NULL;
+    }
+}
+
+/// Drops every block translated from the physical range [addr, addr + size), after the
+/// guest wrote there. Returns the number of blocks invalidated
+static inline size_t block_cache_invalidate(BlockCache *cache, const word_t addr, const word_t size) {
+    assert(cache != NULL);
+
+    size_t invalidated = 0;
+    for (size_t i = 0; i < BLOCK_CACHE_BUCKETS; ++i) {
+        Block **link = &cache->buckets[i];
+        while (*link != NULL) {
+            Block *block = *link;
+            const word_t bytes = block->length * WORD_SIZE_BYTES;
+            const bool overlaps = block->physical - addr < size || addr - block->physical < bytes;
+            if (!overlaps) {
+                link = &block->hash_next;
+                continue;
+            }
+            *link = block->hash_next;
+            block_discard(cache, block);
+            ++invalidated;
+        }
+    }
+    // The new code gets hot on its own
+    block_heat_forget(cache, addr, size);
+    cache->stats.invalidated += invalidated;
+    return invalidated;
+}
+
+/// Drops every block, after the guest changed the translations they were fetched through
+/// Returns the number of blocks invalidated
+static inline size_t block_cache_flush(BlockCache *cache) {
+    assert(cache != NULL);
+
+    size_t invalidated = 0;
+    for (size_t i = 0; i < BLOCK_CACHE_BUCKETS; ++i) {
+        for (Block *block = cache->buckets[i]; block != NULL; block = block->hash_next) {
+            block_discard(cache, block);
+            ++invalidated;
+        }
+        cache->buckets[i] = NULL;
+    }
+    cache->returns = (ReturnStack){0};
+    memset(cache->heat, 0, sizeof(cache->heat));
+    cache->stats.invalidated += invalidated;
+    return invalidated;
+}
+
+// -------------------------
+// Execution
+// -------------------------
+
+/// Runs `block` once and returns the address it left to
+/// Every group before the last one falls through, so only the last may branch
+static inline word_t block_execute(CpuState *cpu, const Block *block) {
+    // Acquire pairs with block_publish, the slots of new code are visible before it
+    const BlockCode *code = atomic_load_explicit(&block->code, memory_order_acquire);
+    const word_t start = block->start;
+    const word_t last = code->last;
+    word_t pc = start;
+    while (pc != last) pc = execute_slot(cpu, &code->insts[(pc - start) >> 2], pc);
+    return execute_slot(cpu, &code->insts[(last - start) >> 2], last);
+}
+
+/// Counts a run of `block`, true exactly once: on the run that makes it hot enough to optimise
+/// The caller then optimises it, here or on another thread
+static inline bool block_count_run(BlockCache *cache, Block *block) {
+    const ExecutionTier tier = atomic_load_explicit(&block->tier, memory_order_relaxed);
+    cache->stats.instructions[tier] += block->length;
+    if (tier != TIER_PREDECODED || ++block->runs != cache->tiers.optimise_threshold) return false;
+    ++cache->stats.optimised;
+    return true;
+}
+
+/// Interprets from `pc` up to the first instruction that does not fall through, or
+/// BLOCK_MAX_INSTRUCTIONS of them, the same cuts as a block. Returns the next address
+/// and adds the instructions run to `count`.
+/// Stops before a load or store an idiom may start with, and makes its address hot:
+/// the caller's next block_cache_enter translates the loop, which only runs as a block.
+static inline word_t block_interpret(BlockCache *cache, CpuState *cpu, word_t pc, FaultTrap *trap,
+                                     int64_t *count) {
+    uint32_t run = 0;
+    word_t next;
+    do {
+        // A fetch fault or the end of code leaves with the PC at the instruction, as before tiers
+        cpu_set_pc(cpu, pc);
+        const word_t raw = fetch_virtual(cache->mmu, cache->memory, pc, trap);
+        if (__builtin_expect(idiom_may_start(raw), 0)) {
+            block_heat(cache, pc)->visits = cache->tiers.translate_threshold;
+            next = pc;
+            break;
+        }
+        const DecodedInst inst = decode(raw);
+        next = execute_slot(cpu, &inst, pc);
+        ++run;
+    } while (next == (pc += WORD_SIZE_BYTES) && run < BLOCK_MAX_INSTRUCTIONS);
+
+    cache->stats.instructions[TIER_INTERPRETED] += run;
+    *count += run;
+    return next;
+}
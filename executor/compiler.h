@@ -0,0 +1,129 @@
+//
+// Created by valentin on 02/02/26.
+//
+#pragma once
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "executor/blocks.h"
+
+// Background block compiler
+//
+// Optimising a hot block moves off the guest's thread. The guest queues the block
+// and keeps running its predecoded code; the compiler thread builds the optimised
+// code and publishes it with one atomic swap of Block.code (block_publish). The next
+// run of the block picks it up, the guest never waits for it.
+//
+// Submission is a lock-free stack every guest thread pushes to, the compiler takes
+// the whole stack at once. The mutex and condition variable only put an idle
+// compiler to sleep and are touched by a guest only when the compiler is asleep.
+
+typedef struct CompileJob {
+    Block *block;
+    /// Cache owning the block, the old code is retired into it
+    BlockCache *cache;
+    struct CompileJob *next;
+} CompileJob;
+
+typedef struct BlockCompiler {
+    /// Lock-free stack of submitted jobs
+    _Atomic(CompileJob *) submitted;
+    /// Set while the compiler waits on `wake`
+    atomic_bool idle;
+    atomic_bool stopping;
+    /// Blocks published so far
+    atomic_uint_fast64_t compiled;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+} BlockCompiler;
+
+static inline void *block_compiler_thread(void *argument) {
+    BlockCompiler *compiler = argument;
+    for (;;) {
+        CompileJob *job = atomic_exchange(&compiler->submitted, NULL);
+        if (job == NULL) {
+            // Stops only once the stack is drained, no block is left half promoted
+            if (atomic_load(&compiler->stopping)) return NULL;
+
+            pthread_mutex_lock(&compiler->lock);
+            // Set before looking at the stack again, a guest pushing meanwhile then sees it and wakes us
+            atomic_store(&compiler->idle, true);
+            while (atomic_load(&compiler->submitted) == NULL && !atomic_load(&compiler->stopping)) {
+                pthread_cond_wait(&compiler->wake, &compiler->lock);
+            }
+            atomic_store(&compiler->idle, false);
+            pthread_mutex_unlock(&compiler->lock);
+            continue;
+        }
+
+        while (job != NULL) {
+            CompileJob *next = job->next;
+            block_publish(job->cache, job->block, block_code_optimised(job->cache, job->block));
+            atomic_fetch_add(&compiler->compiled, 1u);
+            free(job);
+            job = next;
+        }
+    }
+}
+
+/// Starts the compiler thread, NULL when it cannot be started
+static inline BlockCompiler *construct_block_compiler(void) {
+    BlockCompiler *compiler = calloc(1, sizeof(BlockCompiler));
+    if (compiler == NULL) return NULL;
+    atomic_init(&compiler->submitted, NULL);
+    atomic_init(&compiler->idle, false);
+    atomic_init(&compiler->stopping, false);
+    atomic_init(&compiler->compiled, 0u);
+    pthread_mutex_init(&compiler->lock, NULL);
+    pthread_cond_init(&compiler->wake, NULL);
+    if (pthread_create(&compiler->thread, NULL, block_compiler_thread, compiler) != 0) {
+        pthread_cond_destroy(&compiler->wake);
+        pthread_mutex_destroy(&compiler->lock);
+        free(compiler);
+        return NULL;
+    }
+    return compiler;
+}
+
+/// Publishes every submitted block and stops the thread
+/// Must be called before the caches of those blocks are destroyed
+static inline void destroy_block_compiler(BlockCompiler *compiler) {
+    if (compiler == NULL) return;
+    pthread_mutex_lock(&compiler->lock);
+    atomic_store(&compiler->stopping, true);
+    pthread_cond_signal(&compiler->wake);
+    pthread_mutex_unlock(&compiler->lock);
+    pthread_join(compiler->thread, NULL);
+    pthread_cond_destroy(&compiler->wake);
+    pthread_mutex_destroy(&compiler->lock);
+    free(compiler);
+}
+
+/// Queues `block` of `cache` for optimisation, from any guest thread
+/// Returns false when the job cannot be allocated, the caller then optimises it itself
+static inline bool block_compiler_submit(BlockCompiler *compiler, BlockCache *cache, Block *block) {
+    assert(compiler != NULL);
+
+    CompileJob *job = malloc(sizeof(CompileJob));
+    if (job == NULL) return false;
+    job->block = block;
+    job->cache = cache;
+    job->next = atomic_load_explicit(&compiler->submitted, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak(&compiler->submitted, &job->next, job)) {
+    }
+
+    // Both sides store then load (sequentially consistent): either the compiler saw the
+    // job before sleeping, or we see it idle and wake it under the lock
+    if (atomic_load(&compiler->idle)) {
+        pthread_mutex_lock(&compiler->lock);
+        pthread_cond_signal(&compiler->wake);
+        pthread_mutex_unlock(&compiler->lock);
+    }
+    return true;
+}
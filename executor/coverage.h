@@ -0,0 +1,95 @@
+//
+// Created by valentin on 02/07/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/shm.h>
+
+#include "memory.h"
+
+// Edge coverage
+//
+// An AFL-style bitmap for fuzzers: every taken branch of the guest (B/BL, BX, a
+// write to the PC, an exception) bumps the byte indexed by its edge,
+//   map[location(to) ^ previous]    previous = location(to) >> 1
+// where location hashes a guest address into the map. The shift tells A -> B from
+// B -> A and a tight loop from its body. Counters wrap, as in AFL.
+//
+// Edges are recorded where the run loop already stops: at the exit of a block, or of
+// an interpreted run, when it does not continue at the next sequential address. An
+// instruction that falls through records nothing, whichever tier runs it, so the map
+// of an input does not depend on how warm its code is. A recognised copy/fill/scan
+// loop runs as one slot and records only its exit.
+//
+// The map is calloc'ed, or attached from the System V shared memory segment a fuzzer
+// names in __AFL_SHM_ID. Guests sharing a map update it without locks, like threads
+// of an AFL target do; each guest keeps its own previous location.
+
+/// Bytes of a coverage map, a power of two (AFL's MAP_SIZE)
+#ifndef COVERAGE_MAP_SIZE
+#define COVERAGE_MAP_SIZE 65536u
+#endif
+_Static_assert((COVERAGE_MAP_SIZE & (COVERAGE_MAP_SIZE - 1u)) == 0u, "the map is indexed by mask");
+#define COVERAGE_SHM_ENV "__AFL_SHM_ID"
+
+typedef struct CoverageMap {
+    byte_t *bits;
+    /// Attached with shmat, detached instead of freed
+    bool attached;
+} CoverageMap;
+
+/// Coverage map of the process, NULL when out of memory
+static inline CoverageMap *construct_coverage_map(void) {
+    CoverageMap *map = calloc(1, sizeof(CoverageMap));
+    if (map == NULL) return NULL;
+    map->bits = calloc(COVERAGE_MAP_SIZE, 1);
+    if (map->bits == NULL) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+/// Coverage map living in the shared memory segment `shm_id` of at least COVERAGE_MAP_SIZE bytes
+/// NULL when it cannot be attached
+static inline CoverageMap *coverage_map_attach(const int shm_id) {
+    void *bits = shmat(shm_id, NULL, 0);
+    if (bits == (void *)-1) return NULL;
+    CoverageMap *map = calloc(1, sizeof(CoverageMap));
+    if (map == NULL) {
+        shmdt(bits);
+        return NULL;
+    }
+    map->bits = bits;
+    map->attached = true;
+    return map;
+}
+
+/// Coverage map of the segment named in __AFL_SHM_ID, NULL when it is unset or cannot be attached
+static inline CoverageMap *coverage_map_from_env(void) {
+    const char *id = getenv(COVERAGE_SHM_ENV);
+    return id != NULL ? coverage_map_attach(atoi(id)) : NULL;
+}
+
+static inline void destroy_coverage_map(CoverageMap *map) {
+    if (map == NULL) return;
+    if (map->attached) shmdt(map->bits);
+    else free(map->bits);
+    free(map);
+}
+
+/// Map index of a guest address, instruction addresses differ in their low bits
+static inline uint32_t coverage_location(const word_t pc) {
+    return (uint32_t)(((uint64_t)(pc >> 1) * 0x9E3779B97F4A7C15u) >> 32) & (COVERAGE_MAP_SIZE - 1u);
+}
+
+/// Records the taken branch to `to`, `previous` is the guest's previous location
+static inline void coverage_edge(const CoverageMap *map, uint32_t *previous, const word_t to) {
+    const uint32_t location = coverage_location(to);
+    ++map->bits[location ^ *previous];
+    *previous = location >> 1;
+}
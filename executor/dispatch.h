@@ -0,0 +1,275 @@
+//
+// Created by valentin on 01/21/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "cpu/cpu.h"
+#include "executor/executor.h"
+#include "decoder/decoded_inst.h"
+#include "decoder/predecoder.h"
+#include "faults/fault.h"
+#include "instructions/branch/b_bl.h"
+#include "instructions/branch/bx.h"
+#include "instructions/fused/fused.h"
+#include "instructions/fused/idioms.h"
+#include "instructions/data_processing/data_processing.h"
+#include "instructions/thumb/branch.h"
+#include "instructions/thumb/data_processing.h"
+#include "semihosting/semihost.h"
+#include "instructions/coprocessor.h"
+
+/// Prefetch bias, R15 reads as the address of the current instruction + 8
+#define PC_PREFETCH_OFFSET (2 * WORD_SIZE_BYTES)
+/// Prefetch bias in Thumb state, R15 reads as the address of the current instruction + 4
+#define THUMB_PC_PREFETCH_OFFSET (2 * HALFWORD_SIZE_BYTES)
+/// Handlers fall through to `pc + WORD_SIZE_BYTES`, a Thumb slot is dispatched with its
+/// address lowered by this much so the same handlers fall through to the next halfword
+#define THUMB_PC_DISPATCH_BIAS (WORD_SIZE_BYTES - HALFWORD_SIZE_BYTES)
+
+// -------------------------
+// Slot handlers
+// -------------------------
+// Every HandlerId maps to one SlotHandler, data processing handlers come
+// pre-specialised from DATA_PROCESSING_OPS (see data_processing.h).
+
+static inline word_t slot_undefined(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    trap_raise(cpu->trap, FAULT_UNDEFINED_INSTRUCTION, pc);
+}
+
+static inline word_t slot_end_of_code(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    trap_raise(cpu->trap, FAULT_NONE, pc);
+}
+
+static inline word_t slot_nop(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    return pc + WORD_SIZE_BYTES;
+}
+
+static inline word_t slot_branch(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    return b_op(cpu, inst) ? trap_check_jump(cpu->trap, cpu_get_pc(cpu)) : pc + WORD_SIZE_BYTES;
+}
+
+static inline word_t slot_branch_exchange(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    const bool was_thumb = cpsr_get_thumb(&cpu->cpsr);
+    if (!bx_op(cpu, inst)) return pc + WORD_SIZE_BYTES;
+
+    const word_t target = cpu_get_pc(cpu);
+    if (cpsr_get_thumb(&cpu->cpsr) != was_thumb) cpu_raise_state_switch(cpu, target);
+    return was_thumb ? trap_check_thumb_jump(cpu->trap, target) : trap_check_jump(cpu->trap, target);
+}
+
+// In both states `pc + WORD_SIZE_BYTES` is the instruction after the SWI (see execute_thumb_slot)
+static inline word_t slot_swi(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    const word_t next = pc + WORD_SIZE_BYTES;
+    if (inst->cond != AL && !cond_passed(inst->cond, &cpu->cpsr)) return next;
+
+    const bool thumb = cpsr_get_thumb(&cpu->cpsr);
+    if (cpu->semihost != NULL && inst->imm == (thumb ? SEMIHOST_SWI_THUMB : SEMIHOST_SWI_ARM)) {
+        if (semihost_call(cpu->semihost, cpu)) return next;
+        // Parked on host I/O, the run loop resumes at `next` once the call is finished
+        cpu_set_pc(cpu, next);
+        trap_raise(cpu->trap, FAULT_IO_PENDING, next);
+    }
+
+    cpu_enter_exception(cpu, MODE_SVC, VECTOR_SWI, next);
+    if (thumb) cpu_raise_state_switch(cpu, VECTOR_SWI);
+    return trap_check_jump(cpu->trap, VECTOR_SWI);
+}
+
+// Coprocessor instructions never branch, MRC to the PC only writes the flags
+static inline word_t slot_cdp(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    if (inst->cond != AL && !cond_passed(inst->cond, &cpu->cpsr)) return pc + WORD_SIZE_BYTES;
+    if (!cdp_op(cpu, inst)) trap_raise(cpu->trap, FAULT_UNDEFINED_INSTRUCTION, pc);
+    return pc + WORD_SIZE_BYTES;
+}
+
+static inline word_t slot_mrc(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    if (inst->cond != AL && !cond_passed(inst->cond, &cpu->cpsr)) return pc + WORD_SIZE_BYTES;
+    if (!mrc_op(cpu, inst)) trap_raise(cpu->trap, FAULT_UNDEFINED_INSTRUCTION, pc);
+    return pc + WORD_SIZE_BYTES;
+}
+
+static inline word_t slot_mcr(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    if (inst->cond != AL && !cond_passed(inst->cond, &cpu->cpsr)) return pc + WORD_SIZE_BYTES;
+    if (!mcr_op(cpu, inst)) trap_raise(cpu->trap, FAULT_UNDEFINED_INSTRUCTION, pc);
+    return pc + WORD_SIZE_BYTES;
+}
+
+static inline word_t slot_ldc(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    if (inst->cond != AL && !cond_passed(inst->cond, &cpu->cpsr)) return pc + WORD_SIZE_BYTES;
+    if (!ldc_stc_op(cpu, inst, true)) trap_raise(cpu->trap, FAULT_UNDEFINED_INSTRUCTION, pc);
+    return pc + WORD_SIZE_BYTES;
+}
+
+static inline word_t slot_stc(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    if (inst->cond != AL && !cond_passed(inst->cond, &cpu->cpsr)) return pc + WORD_SIZE_BYTES;
+    if (!ldc_stc_op(cpu, inst, false)) trap_raise(cpu->trap, FAULT_UNDEFINED_INSTRUCTION, pc);
+    return pc + WORD_SIZE_BYTES;
+}
+
+// Fused branches are checked whether taken or not, it is still one test per group
+static inline word_t slot_fused_sub_b(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    return trap_check_jump(cpu->trap, fused_sub_b_op(cpu, inst, pc));
+}
+
+static inline word_t slot_fused_tst_b(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    return trap_check_jump(cpu->trap, fused_tst_b_op(cpu, inst, pc));
+}
+
+static inline word_t slot_fused_mov_mov(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    return fused_mov_chain_op(cpu, inst, pc, 2);
+}
+
+static inline word_t slot_fused_mov_mov_mov(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    return fused_mov_chain_op(cpu, inst, pc, 3);
+}
+
+// Idioms end the loop in one go and continue after its closing branch
+static inline word_t slot_idiom_copy(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    return idiom_copy_op(cpu, inst, pc);
+}
+
+static inline word_t slot_idiom_fill(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    return idiom_fill_op(cpu, inst, pc);
+}
+
+static inline word_t slot_idiom_scan(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    return idiom_scan_op(cpu, inst, pc);
+}
+
+// Thumb handlers receive `pc` lowered by THUMB_PC_DISPATCH_BIAS, see execute_thumb_slot
+static inline word_t slot_thumb_branch(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    return thumb_b_op(cpu, inst) ? trap_check_thumb_jump(cpu->trap, cpu_get_pc(cpu)) : pc + WORD_SIZE_BYTES;
+}
+
+static inline word_t slot_thumb_bl_prefix(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    thumb_bl_prefix_op(cpu, inst);
+    return pc + WORD_SIZE_BYTES;
+}
+
+static inline word_t slot_thumb_bl_suffix(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    thumb_bl_suffix_op(cpu, inst);
+    return trap_check_thumb_jump(cpu->trap, cpu_get_pc(cpu));
+}
+
+static inline word_t slot_thumb_add_pc(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    thumb_add_pc_op(cpu, inst);
+    return pc + WORD_SIZE_BYTES;
+}
+
+static inline word_t slot_thumb_hi_to_pc(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    thumb_hi_to_pc_op(cpu, inst);
+    return trap_check_thumb_jump(cpu->trap, cpu_get_pc(cpu));
+}
+
+/// Handler table indexed by DecodedInst.handler
+static const SlotHandler SLOT_HANDLERS[HANDLER_COUNT] = {
+    [HANDLER_UNDEFINED] = slot_undefined,
+    [HANDLER_END_OF_CODE] = slot_end_of_code,
+    [HANDLER_NOP] = slot_nop,
+    [HANDLER_BRANCH] = slot_branch,
+    [HANDLER_BRANCH_LINK] = slot_branch,
+    [HANDLER_BRANCH_EXCHANGE] = slot_branch_exchange,
+    [HANDLER_SWI] = slot_swi,
+    [HANDLER_CDP] = slot_cdp,
+    [HANDLER_MRC] = slot_mrc,
+    [HANDLER_MCR] = slot_mcr,
+    [HANDLER_LDC] = slot_ldc,
+    [HANDLER_STC] = slot_stc,
+    [HANDLER_FUSED_SUB_B] = slot_fused_sub_b,
+    [HANDLER_FUSED_TST_B] = slot_fused_tst_b,
+    [HANDLER_FUSED_MOV_MOV] = slot_fused_mov_mov,
+    [HANDLER_FUSED_MOV_MOV_MOV] = slot_fused_mov_mov_mov,
+    [HANDLER_IDIOM_COPY] = slot_idiom_copy,
+    [HANDLER_IDIOM_FILL] = slot_idiom_fill,
+    [HANDLER_IDIOM_SCAN] = slot_idiom_scan,
+    [HANDLER_THUMB_BRANCH] = slot_thumb_branch,
+    [HANDLER_THUMB_BL_PREFIX] = slot_thumb_bl_prefix,
+    [HANDLER_THUMB_BL_SUFFIX] = slot_thumb_bl_suffix,
+    [HANDLER_THUMB_ADD_PC] = slot_thumb_add_pc,
+    [HANDLER_THUMB_HI_TO_PC] = slot_thumb_hi_to_pc,
+    DATA_PROCESSING_OPS(DP_HANDLER_ENTRIES)
+};
+
+/// Executes the slot at guest address `pc` and returns the address to continue at.
+/// Fused handlers read the slots following `inst`, so it must point into a predecoded array.
+/// Faults and the end of code leave through cpu->trap, nothing is returned for them.
+static inline word_t execute_slot(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    cpu_set_pc(cpu, pc + PC_PREFETCH_OFFSET);
+    return SLOT_HANDLERS[inst->handler](cpu, inst, pc);
+}
+
+/// Thumb counterpart of execute_slot for the Thumb slot at guest address `pc`.
+/// The handler gets `pc - THUMB_PC_DISPATCH_BIAS`: every handler uses its pc argument
+/// only to fall through to pc + WORD_SIZE_BYTES (fused handlers, which read further
+/// slots, are never decoded from Thumb), and operands see R15 = pc + 4.
+static inline word_t execute_thumb_slot(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    cpu_set_pc(cpu, pc + THUMB_PC_PREFETCH_OFFSET);
+    return SLOT_HANDLERS[inst->handler](cpu, inst, pc - THUMB_PC_DISPATCH_BIAS);
+}
+
+/// Executes a single decoded instruction located at the current PC
+/// The caller must have armed cpu->trap
+static inline ExecResult execute_instruction(CpuState *cpu, const DecodedInst *inst) {
+    assert(cpu != NULL);
+    assert(inst != NULL);
+    assert(cpu->trap != NULL);
+
+    const word_t pc = cpu_get_pc(cpu);
+    const ExecResult result = {.next_pc = execute_slot(cpu, inst, pc), .should_halt = 0, .fault = FAULT_NONE};
+    cpu_set_pc(cpu, result.next_pc);
+    return result;
+}
+
+/// Executes a single decoded Thumb instruction located at the current PC
+/// The caller must have armed cpu->trap
+static inline ExecResult execute_thumb_instruction(CpuState *cpu, const DecodedInst *inst) {
+    assert(cpu != NULL);
+    assert(inst != NULL);
+    assert(cpu->trap != NULL);
+    assert(cpsr_get_thumb(&cpu->cpsr));
+
+    const word_t pc = cpu_get_pc(cpu);
+    const ExecResult result = {.next_pc = execute_thumb_slot(cpu, inst, pc), .should_halt = 0, .fault = FAULT_NONE};
+    cpu_set_pc(cpu, result.next_pc);
+    return result;
+}
+
+/// Runs a predecoded program from the current PC until it runs off the end of
+/// the code (halt) or raises a fault.
+/// The program is ARM code, a switch to Thumb state ends the run with FAULT_STATE_SWITCH.
+static inline ExecResult execute_predecoded(CpuState *cpu, const PredecodedProgram *program) {
+    assert(cpu != NULL);
+    assert(program != NULL);
+
+    const word_t code_size = (word_t)(program->count * WORD_SIZE_BYTES);
+    FaultTrap trap = construct_fault_trap(program->base_address, code_size);
+    FaultTrap *const previous_trap = cpu->trap;
+    cpu->trap = &trap;
+
+    if (FAULT_TRAP_ENTER(&trap)) {
+        // Cold path, every exit of the loop below lands here
+        cpu->trap = previous_trap;
+        cpu_set_pc(cpu, trap.address);
+
+        const ExecResult result = {
+            .next_pc = trap.address,
+            .should_halt = trap.fault == FAULT_NONE,
+            .fault = trap.fault,
+        };
+        return result;
+    }
+
+    const DecodedInst *const insts = program->insts;
+    const word_t base_address = program->base_address;
+    word_t pc = trap_check_jump(&trap, cpu_get_pc(cpu));
+
+    // Hot loop: no bounds or fault tests, the sentinel slot and the
+    // jump checks of taken branches cover them
+    for (;;) {
+        pc = execute_slot(cpu, &insts[(pc - base_address) >> 2], pc);
+    }
+}
@@ -0,0 +1,77 @@
+//
+// Created by valentin on 01/29/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "faults/fault.h"
+#include "mmu/mmu.h"
+
+/// ARM fetch, reads one word
+/// Faults leave through the trap, the caller never checks for them
+static inline uint32_t fetch(const ProgramMemory *mem, const uint32_t pc, FaultTrap *trap) {
+    // Validate inputs
+    assert(mem != NULL);
+    assert(trap != NULL);
+
+    // Check for alignment (PC must be multiple of 4)
+    if (__builtin_expect(pc & WORD_ALIGN_MASK, 0)) {
+        trap_raise(trap, FAULT_ALIGNMENT, pc);
+    }
+
+    // Running exactly to the end of the program stops it normally
+    if (__builtin_expect(pc - trap->fetch_base == trap->fetch_size, 0)) {
+        trap_raise(trap, FAULT_NONE, pc);
+    }
+
+    // A slice read directly is RAM or ROM, only the cold path walks the regions
+    if (__builtin_expect(!mem_read_is_direct(mem, pc, WORD_SIZE_BYTES), 0) &&
+        !mem_in_bounds(mem, pc, WORD_SIZE_BYTES)) {
+        trap_raise(trap, FAULT_OUT_OF_BOUNDS, pc);
+    }
+
+    return mem_read32(mem, pc);
+}
+
+/// Thumb fetch, reads one halfword
+static inline halfword_t fetch_thumb(const ProgramMemory *mem, const uint32_t pc, FaultTrap *trap) {
+    assert(mem != NULL);
+    assert(trap != NULL);
+
+    if (__builtin_expect(pc & HALFWORD_ALIGN_MASK, 0)) {
+        trap_raise(trap, FAULT_ALIGNMENT, pc);
+    }
+    if (__builtin_expect(pc - trap->fetch_base == trap->fetch_size, 0)) {
+        trap_raise(trap, FAULT_NONE, pc);
+    }
+    if (__builtin_expect(!mem_read_is_direct(mem, pc, HALFWORD_SIZE_BYTES), 0) &&
+        !mem_in_bounds(mem, pc, HALFWORD_SIZE_BYTES)) {
+        trap_raise(trap, FAULT_OUT_OF_BOUNDS, pc);
+    }
+
+    return mem_read16(mem, pc);
+}
+
+/// ARM fetch at a virtual address, through `mmu` once the guest enabled it (see fetch)
+static inline uint32_t fetch_virtual(Mmu *mmu, const ProgramMemory *mem, const uint32_t pc, FaultTrap *trap) {
+    if (!mmu_enabled(mmu)) return fetch(mem, pc, trap);
+
+    // The end of the program window is virtual, alignment and aborts are the MMU's
+    if (__builtin_expect(pc - trap->fetch_base == trap->fetch_size, 0)) {
+        trap_raise(trap, FAULT_NONE, pc);
+    }
+    return mmu_fetch32(mmu, trap, pc);
+}
+
+/// Thumb counterpart of fetch_virtual
+static inline halfword_t fetch_thumb_virtual(Mmu *mmu, const ProgramMemory *mem, const uint32_t pc,
+                                             FaultTrap *trap) {
+    if (!mmu_enabled(mmu)) return fetch_thumb(mem, pc, trap);
+
+    if (__builtin_expect(pc - trap->fetch_base == trap->fetch_size, 0)) {
+        trap_raise(trap, FAULT_NONE, pc);
+    }
+    return mmu_fetch16(mmu, trap, pc);
+}
@@ -0,0 +1,175 @@
+//
+// Created by valentin on 02/05/26.
+//
+#pragma once
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+
+// Shared block code
+//
+// Guests running the same image translate the same blocks. A SharedCode table lets
+// their BlockCaches hold one copy: the code of a block is registered under the
+// guest instructions it was built from (entry address and raw words) and the tier
+// it belongs to, and a cache translating the same instructions takes a reference to
+// the registered code instead of decoding, optimising and storing it again.
+//
+// Registered code is immutable, and so are the raw words it was built and optimised
+// from. A guest overwriting its code hits the watch on the code pages of its memory
+// (mem_watch_code), which drops its own blocks there (block_cache_invalidate); it then
+// translates the new instructions, which have a key of their own: the other guests
+// keep the code they share, the writer gets a copy of what it wrote.
+//
+// Entries are reference counted by the blocks using them and by retired code,
+// the last release frees them. The table is locked, it is only touched when a
+// block is translated, optimised or freed.
+
+/// Hash buckets of a SharedCode table, a power of two
+#define SHARED_CODE_BUCKETS 4096u
+
+static const uint64_t SHARED_CODE_FNV_OFFSET_BASIS = 0xCBF29CE484222325u;
+static const uint64_t SHARED_CODE_FNV_PRIME = 0x100000001B3u;
+
+struct BlockCode;
+
+typedef struct SharedCodeEntry {
+    struct SharedCode *owner;
+    /// Registered code, freed with the entry
+    struct BlockCode *code;
+    uint64_t hash;
+    uint32_t refs;
+    /// ExecutionTier of the code
+    uint32_t tier;
+    word_t start;
+    uint32_t length;
+    struct SharedCodeEntry *next;
+    /// Guest instructions the code was built from
+    word_t raw[];
+} SharedCodeEntry;
+
+typedef struct SharedCodeStats {
+    /// Codes registered, and translations that found theirs registered already
+    uint64_t registered;
+    uint64_t reused;
+    /// Entries alive
+    uint64_t entries;
+} SharedCodeStats;
+
+typedef struct SharedCode {
+    pthread_mutex_t lock;
+    SharedCodeEntry *buckets[SHARED_CODE_BUCKETS];
+    SharedCodeStats stats;
+} SharedCode;
+
+static inline SharedCode *construct_shared_code(void) {
+    SharedCode *shared = calloc(1, sizeof(SharedCode));
+    if (shared == NULL) return NULL;
+    pthread_mutex_init(&shared->lock, NULL);
+    return shared;
+}
+
+/// Every entry must have been released, the caches using the table go first
+static inline void destroy_shared_code(SharedCode *shared) {
+    if (shared == NULL) return;
+    assert(shared->stats.entries == 0u);
+    pthread_mutex_destroy(&shared->lock);
+    free(shared);
+}
+
+static inline uint64_t shared_code_hash(const word_t start, const word_t *raw, const uint32_t length,
+                                        const uint32_t tier) {
+    uint64_t hash = SHARED_CODE_FNV_OFFSET_BASIS;
+    const word_t identity[] = {start, length, tier};
+    const byte_t *bytes = (const byte_t *)identity;
+    for (size_t i = 0; i < sizeof(identity); ++i) hash = (hash ^ bytes[i]) * SHARED_CODE_FNV_PRIME;
+    bytes = (const byte_t *)raw;
+    for (size_t i = 0; i < length * sizeof(word_t); ++i) hash = (hash ^ bytes[i]) * SHARED_CODE_FNV_PRIME;
+    return hash;
+}
+
+/// Entry of the code built from `raw` for `tier`, with the lock held
+static inline SharedCodeEntry *shared_code_find(const SharedCode *shared, const uint64_t hash, const word_t start,
+                                                const word_t *raw, const uint32_t length, const uint32_t tier) {
+    for (SharedCodeEntry *entry = shared->buckets[hash & (SHARED_CODE_BUCKETS - 1u)]; entry != NULL;
+         entry = entry->next) {
+        if (entry->hash == hash && entry->start == start && entry->length == length && entry->tier == tier &&
+            memcmp(entry->raw, raw, length * sizeof(word_t)) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/// Registered code built from the `length` instructions `raw` at `start` for `tier`,
+/// with a reference taken. NULL when no cache registered it.
+static inline SharedCodeEntry *shared_code_acquire(SharedCode *shared, const word_t start, const word_t *raw,
+                                                   const uint32_t length, const uint32_t tier) {
+    assert(shared != NULL);
+    const uint64_t hash = shared_code_hash(start, raw, length, tier);
+    pthread_mutex_lock(&shared->lock);
+    SharedCodeEntry *entry = shared_code_find(shared, hash, start, raw, length, tier);
+    if (entry != NULL) {
+        ++entry->refs;
+        ++shared->stats.reused;
+    }
+    pthread_mutex_unlock(&shared->lock);
+    return entry;
+}
+
+/// Registers `code`, built from `raw`, and takes a reference to it
+/// When another cache registered the same code meanwhile that entry is returned instead,
+/// its code differs from `code` and the caller frees its own. NULL when out of memory.
+static inline SharedCodeEntry *shared_code_register(SharedCode *shared, const word_t start, const word_t *raw,
+                                                    const uint32_t length, const uint32_t tier,
+                                                    struct BlockCode *code) {
+    assert(shared != NULL);
+    assert(code != NULL);
+    const uint64_t hash = shared_code_hash(start, raw, length, tier);
+    pthread_mutex_lock(&shared->lock);
+    SharedCodeEntry *entry = shared_code_find(shared, hash, start, raw, length, tier);
+    if (entry != NULL) {
+        ++entry->refs;
+        ++shared->stats.reused;
+        pthread_mutex_unlock(&shared->lock);
+        return entry;
+    }
+
+    entry = malloc(sizeof(SharedCodeEntry) + length * sizeof(word_t));
+    if (entry != NULL) {
+        SharedCodeEntry **bucket = &shared->buckets[hash & (SHARED_CODE_BUCKETS - 1u)];
+        *entry = (SharedCodeEntry){
+            .owner = shared, .code = code, .hash = hash, .refs = 1, .tier = tier, .start = start, .length = length,
+            .next = *bucket,
+        };
+        memcpy(entry->raw, raw, length * sizeof(word_t));
+        *bucket = entry;
+        ++shared->stats.registered;
+        ++shared->stats.entries;
+    }
+    pthread_mutex_unlock(&shared->lock);
+    return entry;
+}
+
+/// Drops a reference, the last one unregisters the entry and frees it with its code
+static inline void shared_code_release(SharedCodeEntry *entry) {
+    SharedCode *shared = entry->owner;
+    pthread_mutex_lock(&shared->lock);
+    if (--entry->refs > 0u) {
+        pthread_mutex_unlock(&shared->lock);
+        return;
+    }
+    SharedCodeEntry **link = &shared->buckets[entry->hash & (SHARED_CODE_BUCKETS - 1u)];
+    while (*link != entry) link = &(*link)->next;
+    *link = entry->next;
+    --shared->stats.entries;
+    pthread_mutex_unlock(&shared->lock);
+
+    free(entry->code);
+    free(entry);
+}
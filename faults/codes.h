@@ -3,22 +3,28 @@
 //
 #pragma once
 
-typedef enum ReturnStatus {
-    OK = 0,
-    FAULT,
-    ERROR,
-    HALT,
-} ReturnStatus;
-
-typedef enum FaultCodeFetch {
+/// Every reason execution can leave the run loop early.
+///
+/// Faults are not returned through the stages (fetch/decode/execute), they are
+/// raised through the FaultTrap of the running CPU (see faults/fault.h) so the
+/// common path never tests for them.
+typedef enum Fault {
+    /// No fault, the guest stopped normally (end of code)
+    FAULT_NONE = 0,
+    /// PC or data address is not aligned to the access size
     FAULT_ALIGNMENT,
-} FaultCodeFetch;
-
-typedef enum FaultCodeDecode {
-    FAULT_INVALID_OPCODE,
-} FaultCodeDecode;
-
-typedef enum FaultCodeExecute {
+    /// PC or data address is outside of guest memory
     FAULT_OUT_OF_BOUNDS,
-} FaultCodeExecute;
-
+    /// Instruction is architecturally undefined or not supported by the executor
+    FAULT_UNDEFINED_INSTRUCTION,
+    /// Instruction fetch rejected by the MMU (translation, domain or permission fault)
+    FAULT_PREFETCH_ABORT,
+    /// Data access rejected by the MMU, the fault status and address are in CP15 c5/c6
+    FAULT_DATA_ABORT,
+    /// Not a fault: the CPU changed between ARM and Thumb state, the run loop of
+    /// the other instruction set continues at the PC
+    FAULT_STATE_SWITCH,
+    /// Not a fault: a semihosting call was handed to the host I/O pool, the guest
+    /// waits at the PC (the next instruction) until the call is finished
+    FAULT_IO_PENDING,
+} Fault;
@@ -0,0 +1,74 @@
+//
+// Created by valentin on 01/23/26.
+//
+#pragma once
+#include <assert.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "faults/codes.h"
+
+/// Cold exit path of a run loop.
+///
+/// The run loop arms the trap once with FAULT_TRAP_ENTER, and any stage that hits a
+/// fault unwinds straight back to it with trap_raise. Instructions therefore carry no
+/// fault out-pointers and the loop re-checks nothing after each instruction.
+typedef struct FaultTrap {
+    /// Unwind target, armed by FAULT_TRAP_ENTER
+    jmp_buf env;
+    /// Reason of the last exit
+    Fault fault;
+    /// Guest address that caused the exit
+    word_t address;
+
+    /// Valid window for control-flow targets: [fetch_base, fetch_base + fetch_size]
+    /// Reaching exactly the end stops execution normally
+    word_t fetch_base;
+    word_t fetch_size;
+} FaultTrap;
+
+static inline FaultTrap construct_fault_trap(const word_t fetch_base, const word_t fetch_size) {
+    FaultTrap trap = {0};
+    trap.fault = FAULT_NONE;
+    trap.fetch_base = fetch_base;
+    trap.fetch_size = fetch_size;
+    return trap;
+}
+
+/// Arms the trap. Evaluates to 0 when armed, and to non-zero when execution
+/// came back through trap_raise (the reason is then in trap->fault).
+/// Must be used in the frame of the run loop, as setjmp requires.
+#define FAULT_TRAP_ENTER(trap) setjmp((trap)->env)
+
+/// Leaves the run loop with the given reason, FAULT_NONE means a normal stop
+__attribute__((cold, noreturn))
+static inline void trap_raise(FaultTrap *trap, const Fault fault, const word_t address) {
+    assert(trap != NULL && "Fault raised without an armed trap");
+    trap->fault = fault;
+    trap->address = address;
+    longjmp(trap->env, 1);
+}
+
+/// Validates a control-flow target, only taken branches pay for this test
+static inline word_t trap_check_jump(FaultTrap *trap, const word_t target) {
+    if (__builtin_expect((target & WORD_ALIGN_MASK) != 0, 0)) {
+        trap_raise(trap, FAULT_ALIGNMENT, target);
+    }
+    if (__builtin_expect(target - trap->fetch_base > trap->fetch_size, 0)) {
+        trap_raise(trap, FAULT_OUT_OF_BOUNDS, target);
+    }
+    return target;
+}
+
+/// Thumb variant of trap_check_jump, targets only need halfword alignment
+static inline word_t trap_check_thumb_jump(FaultTrap *trap, const word_t target) {
+    if (__builtin_expect((target & HALFWORD_ALIGN_MASK) != 0, 0)) {
+        trap_raise(trap, FAULT_ALIGNMENT, target);
+    }
+    if (__builtin_expect(target - trap->fetch_base > trap->fetch_size, 0)) {
+        trap_raise(trap, FAULT_OUT_OF_BOUNDS, target);
+    }
+    return target;
+}
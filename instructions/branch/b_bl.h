@@ -10,20 +10,9 @@
 #include "memory.h"
 #include "cpu/cpu.h"
 #include "instructions/cond.h"
-#include "faults/codes.h"
+#include "decoder/decoded_inst.h"
 
-typedef struct DecodedB {
-    word_t raw;
-    /// The comparison operator (EQ, LT, etc)
-    CondCode cond;
-    /// Boolean flag to indicate if we store the pc to link register
-    bool link;
-    /// 32-bit signed offset to branch to
-    /// This value must be added to the PC to get the target address
-    int32_t offset;
-} DecodedB;
-
-static inline DecodedB decode_b(const word_t raw_inst, FaultCodeDecode* fault_out) {
+static inline DecodedInst decode_b(const word_t raw_inst) {
     static const word_t OFFSET_MASK = 0x00FFFFFF;
     static const word_t LINK_MASK = 0x1000000;
     static const word_t COND_MASK = 0xF0000000;
@@ -47,22 +36,29 @@ static inline DecodedB decode_b(const word_t raw_inst, FaultCodeDecode* fault_ou
 
     const bool link = (raw_inst & LINK_MASK) != 0;
 
-    const DecodedB inst = {.raw = raw_inst, .cond = cond, .link = link, .offset = offset};
+    // The link bit selects the handler, the byte offset is kept pre-resolved
+    const DecodedInst inst = {
+        .handler = link ? HANDLER_BRANCH_LINK : HANDLER_BRANCH,
+        .cond = cond,
+        .imm = (word_t)offset,
+    };
     return inst;
 }
 
-static inline void b_op(CpuState* cpu, const DecodedB* inst, FaultCodeExecute* fault_out) {
+/// Executes B/BL, R15 must hold the prefetch-biased PC (address + 8)
+/// Returns true when the branch was taken
+static inline bool b_op(CpuState* cpu, const DecodedInst* inst) {
     static const word_t LINK_ADDRESS_CLEARED_BITS_MASK = ~3u;
     assert(cpu != NULL);
     assert(inst != NULL);
 
 
     if (!cond_passed(inst->cond, &cpu->cpsr)) {
-        return;
+        return false;
     }
 
     const word_t pc = cpu_get_reg(cpu, PC_REGISTER_INDEX);
-    if (inst->link) {
+    if (inst->handler == HANDLER_BRANCH_LINK) {
         // Subtract one word to account for instruction prefetch
         // PC points two instructions ahead, and we need to store the next instruction
         // after this branch in case we want to continue where we left off
@@ -72,6 +68,8 @@ static inline void b_op(CpuState* cpu, const DecodedB* inst, FaultCodeExecute* f
         // Store the "left off" address to the link register
         cpu_set_reg(cpu, LINK_REGISTER_INDEX, stored_address);
     }
-    const word_t next_address = pc + inst->offset;
+    // imm holds the signed byte offset, unsigned wrap-around gives the same sum
+    const word_t next_address = pc + inst->imm;
     cpu_set_reg(cpu, PC_REGISTER_INDEX, next_address);
+    return true;
 }
@@ -10,24 +10,15 @@
 #include "memory.h"
 #include "cpu/cpu.h"
 #include "../cond.h"
-#include "faults/codes.h"
+#include "decoder/decoded_inst.h"
 
 
-typedef struct DecodedBx {
-    word_t raw;
-    /// The condition code to evaluate
-    CondCode cond;
-    /// Index of the register that contains the address
-    /// to branch to
-    RegisterIndex rn;
-} DecodedBx;
-
 /// Decodes BX instruction
 /// B/BL encoding:
 /// [31:28]: Condition field
 /// [27: 4]: '0001 0010 1111 1111 1111 0001' fill bits
 /// [ 4: 0]: Register index
-static inline DecodedBx decode_bx(const word_t raw_inst, FaultCodeExecute *fault_out) {
+static inline DecodedInst decode_bx(const word_t raw_inst) {
 
     static const word_t RN_MASK = 0x0000000F;
     static const uint8_t COND_RIGHT_SHIFT = 28;
@@ -36,32 +27,45 @@ static inline DecodedBx decode_bx(const word_t raw_inst, FaultCodeExecute *fault
     const CondCode cond = raw_inst >> COND_RIGHT_SHIFT;
     const RegisterIndex rn = raw_inst & RN_MASK;
 
-    const DecodedBx decoded = {.raw = raw_inst, .cond = cond, .rn = rn};
+    // The target register is kept in the rm field of the uniform shape
+    const DecodedInst decoded = {.handler = HANDLER_BRANCH_EXCHANGE, .cond = cond, .rm = rn};
     return decoded;
 }
 
 
-static inline void bx_op(CpuState* cpu, const DecodedBx* inst) {
+/// Executes BX, bit 0 of the target selects the Thumb (1) or ARM (0) state
+/// Returns true when the branch was taken
+static inline bool bx_op(CpuState* cpu, const DecodedInst* inst) {
     static const word_t ARM_PC_ALIGN_MASK      = ~3u; // word align (clear bits0..1)
+    static const word_t THUMB_PC_ALIGN_MASK    = ~1u; // halfword align (clear bit0)
     static const word_t THUMB_STATE_BIT = 1u; // target bit0 selects Thumb when using BX
 
     assert(cpu != NULL);
     assert(inst != NULL);
 
-    assert(inst->rn != PC_REGISTER_INDEX && "Using R15 (PC) as operand is undefined");
+    // BX PC is only meaningful in Thumb state (switch to the ARM code that follows)
+    assert((inst->rm != PC_REGISTER_INDEX || cpsr_get_thumb(&cpu->cpsr)) &&
+           "Using R15 (PC) as operand is undefined");
 
     const CondCode condition = inst->cond;
     if (!cond_passed(condition, &cpu->cpsr))
-        return;
+        return false;
 
-    const word_t target_address = cpu_get_reg(cpu, inst->rn);
+    const word_t target_address = cpu_get_reg(cpu, inst->rm);
 
     const bool is_thumb = (target_address & THUMB_STATE_BIT) != 0;
-    assert(is_thumb == false && "Thumb mode is not supported");
 
     // Align PC based on next state
     word_t aligned_target_address = target_address;
-    aligned_target_address &= ARM_PC_ALIGN_MASK;
+    if (is_thumb) {
+        cpsr_set_thumb(&cpu->cpsr);
+        aligned_target_address &= THUMB_PC_ALIGN_MASK;
+    }
+    else {
+        cpsr_clear_thumb(&cpu->cpsr);
+        aligned_target_address &= ARM_PC_ALIGN_MASK;
+    }
 
     cpu_set_reg(cpu, PC_REGISTER_INDEX, aligned_target_address);
+    return true;
 }
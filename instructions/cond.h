@@ -11,60 +11,60 @@ typedef enum CondCode {
     /// Set Flags: Z set
     ///
     /// Meaning: equal
-    EQ = 0x0000,
+    EQ = 0x0,
     /// Set Flags: Z clear not
     ///
     /// Meaning: equal
-    NE = 0x0001,
+    NE = 0x1,
     /// Set Flags: C set unsigned
     ///
     /// Meaning: higher or same
-    CS = 0x0010,
+    CS = 0x2,
     /// Set Flags: C clear unsigned
     ///
     /// Meaning: lower
-    CC = 0x0011,
+    CC = 0x3,
     /// Set Flags: N set
     ///
     /// Meaning: negative
-    MI = 0x0100,
+    MI = 0x4,
     /// Set Flags: N clear
     ///
     /// Meaning: positive or zero
-    PL = 0x0101,
+    PL = 0x5,
     /// Set Flags: V set
     /// Meaning: overflow
-    VS = 0x0110,
+    VS = 0x6,
     /// Set Flags: V clear
     ///
     /// Meaning: no overflow
-    VC = 0x0111,
+    VC = 0x7,
     /// Set Flags: C set and Z clear unsigned
     ///
     /// Meaning: higher
-    HI = 0x1000,
+    HI = 0x8,
     /// Set Flags: C clear or Z set unsigned
     ///
     /// Meaning: lower or same
-    LS = 0x1001,
+    LS = 0x9,
     /// Set Flags: N equals V
     ///
     /// Meaning: greater or equal
-    GE = 0x1010,
+    GE = 0xA,
     /// Set Flags: N not equal to V
     ///
     /// Meaning: less than
-    LT = 0x1011,
+    LT = 0xB,
     /// Set Flags: Z clear AND (N equals V)
     ///
     /// Meaning: greater than
-    GT = 0x1100,
+    GT = 0xC,
     /// Set Flags: Z set OR (N not equal to V)
     ///
     /// Meaning: less than or equal
-    LE = 0x1101,
+    LE = 0xD,
     /// Meaning: (ignored) always
-    AL = 0x1110,
+    AL = 0xE,
 } CondCode;
 
 
@@ -97,4 +97,35 @@ static inline bool cond_passed(const CondCode cond, const Cpsr* cpsr) {
         assert(false && "Unexpected/unsupported condition");
         return false; // unreachable
     }
-}
\ No newline at end of file
+}
+
+/// Evaluates a condition for the flags a subtraction (CMP/SUBS) of
+/// operand1 - operand2 would produce, without reading or writing the CPSR.
+static inline bool cond_passed_sub(const CondCode cond, const word_t operand1, const word_t operand2) {
+    const int32_t signed1 = (int32_t)operand1;
+    const int32_t signed2 = (int32_t)operand2;
+    const word_t result = operand1 - operand2;
+    // Signed overflow of the subtraction (V flag)
+    const bool overflow = ((operand1 ^ operand2) & (operand1 ^ result)) >> 31;
+
+    switch (cond) {
+    case EQ: return operand1 == operand2;    // Z==1
+    case NE: return operand1 != operand2;    // Z==0
+    case CS: return operand1 >= operand2;    // C==1 (no borrow)
+    case CC: return operand1 < operand2;     // C==0 (borrow)
+    case MI: return (result >> 31) != 0u;    // N==1
+    case PL: return (result >> 31) == 0u;    // N==0
+    case VS: return overflow;                // V==1
+    case VC: return !overflow;               // V==0
+    case HI: return operand1 > operand2;     // unsigned >
+    case LS: return operand1 <= operand2;    // unsigned <=
+    case GE: return signed1 >= signed2;      // N==V
+    case LT: return signed1 < signed2;       // N!=V
+    case GT: return signed1 > signed2;       // Z==0 && N==V
+    case LE: return signed1 <= signed2;      // Z==1 || N!=V
+    case AL: return true;
+    default:
+        assert(false && "Unexpected/unsupported condition");
+        return false; // unreachable
+    }
+}
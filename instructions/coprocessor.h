@@ -0,0 +1,168 @@
+//
+// Created by valentin on 01/30/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "cpu/cpu.h"
+#include "instructions/cond.h"
+#include "decoder/decoded_inst.h"
+#include "coprocessor/coprocessor.h"
+
+// Coprocessor instructions
+//
+// The slot keeps every operand so executing one is a table lookup and a call:
+//   op: Op1, rd: Rd (MRC/MCR) or CRd, rn: CRn or the base Rn (LDC/STC), rm: CRm
+//   imm [3:0]: CP#, [6:4]: Op2 (CDP, MRC/MCR)
+//   imm [3:0]: CP#, [4]: P, [5]: U, [6]: N, [7]: W, [15:8]: imm8 (LDC/STC)
+
+static const word_t COPROCESSOR_CP_MASK = 0xF;
+static const uint8_t COPROCESSOR_OPCODE2_SHIFT = 4u;
+static const word_t COPROCESSOR_PRE_INDEX = 1u << 4;
+static const word_t COPROCESSOR_UP = 1u << 5;
+static const word_t COPROCESSOR_LONG = 1u << 6;
+static const word_t COPROCESSOR_WRITE_BACK = 1u << 7;
+static const uint8_t COPROCESSOR_OFFSET_SHIFT = 8u;
+
+/// Decodes CDP
+/// [31:28]: Condition field, [27:24]: '1110', [23:20]: Op1, [19:16]: CRn, [15:12]: CRd,
+/// [11:8]: CP#, [7:5]: Op2, [4]: 0, [3:0]: CRm
+static inline DecodedInst decode_cdp(const word_t raw_inst) {
+    const DecodedInst inst = {
+        .handler = HANDLER_CDP,
+        .cond = raw_inst >> 28,
+        .op = (raw_inst >> 20) & 0xFu,
+        .rn = (raw_inst >> 16) & 0xFu,
+        .rd = (raw_inst >> 12) & 0xFu,
+        .rm = raw_inst & 0xFu,
+        .imm = ((raw_inst >> 8) & COPROCESSOR_CP_MASK) | (((raw_inst >> 5) & 0x7u) << COPROCESSOR_OPCODE2_SHIFT),
+    };
+    return inst;
+}
+
+/// Decodes MRC/MCR
+/// [31:28]: Condition field, [27:24]: '1110', [23:21]: Op1, [20]: L (MRC), [19:16]: CRn,
+/// [15:12]: Rd, [11:8]: CP#, [7:5]: Op2, [4]: 1, [3:0]: CRm
+static inline DecodedInst decode_mrc_mcr(const word_t raw_inst) {
+    static const word_t LOAD_MASK = 0x00100000;
+
+    const DecodedInst inst = {
+        .handler = (raw_inst & LOAD_MASK) ? HANDLER_MRC : HANDLER_MCR,
+        .cond = raw_inst >> 28,
+        .op = (raw_inst >> 21) & 0x7u,
+        .rn = (raw_inst >> 16) & 0xFu,
+        .rd = (raw_inst >> 12) & 0xFu,
+        .rm = raw_inst & 0xFu,
+        .imm = ((raw_inst >> 8) & COPROCESSOR_CP_MASK) | (((raw_inst >> 5) & 0x7u) << COPROCESSOR_OPCODE2_SHIFT),
+    };
+    return inst;
+}
+
+/// Decodes LDC/STC, see COPROCESSOR_DATA_TRANSFER for the addressing
+/// [31:28]: Condition field, [27:25]: '110', [24]: P, [23]: U, [22]: N, [21]: W, [20]: L,
+/// [19:16]: Rn, [15:12]: CRd, [11:8]: CP#, [7:0]: imm8 (words)
+static inline DecodedInst decode_ldc_stc(const word_t raw_inst) {
+    static const word_t LOAD_MASK = 0x00100000;
+    static const uint8_t FLAGS_SHIFT = 21u;
+
+    // P, U, N and W are bits 24:21, they land on imm [7:4] reversed
+    const word_t flags = raw_inst >> FLAGS_SHIFT;
+    const word_t packed = (((flags >> 3) & 1u) ? COPROCESSOR_PRE_INDEX : 0u) |
+                          (((flags >> 2) & 1u) ? COPROCESSOR_UP : 0u) |
+                          (((flags >> 1) & 1u) ? COPROCESSOR_LONG : 0u) |
+                          ((flags & 1u) ? COPROCESSOR_WRITE_BACK : 0u);
+    const DecodedInst inst = {
+        .handler = (raw_inst & LOAD_MASK) ? HANDLER_LDC : HANDLER_STC,
+        .cond = raw_inst >> 28,
+        .rn = (raw_inst >> 16) & 0xFu,
+        .rd = (raw_inst >> 12) & 0xFu,
+        .imm = ((raw_inst >> 8) & COPROCESSOR_CP_MASK) | packed | ((raw_inst & 0xFFu) << COPROCESSOR_OFFSET_SHIFT),
+    };
+    return inst;
+}
+
+/// Operands of a decoded CDP/MRC/MCR for the coprocessor
+static inline CoprocessorCall coprocessor_call_of(const DecodedInst *inst) {
+    const CoprocessorCall call = {
+        .cp = inst->imm & COPROCESSOR_CP_MASK,
+        .opcode1 = inst->op,
+        .opcode2 = (inst->imm >> COPROCESSOR_OPCODE2_SHIFT) & 0x7u,
+        .crn = inst->rn,
+        .crm = inst->rm,
+        .crd = inst->rd,
+    };
+    return call;
+}
+
+// The ops below return false when no coprocessor accepts the instruction, the
+// caller then raises the undefined instruction. Conditions are checked by the caller.
+
+/// Executes CDP
+static inline bool cdp_op(CpuState *cpu, const DecodedInst *inst) {
+    assert(cpu != NULL);
+    assert(inst != NULL);
+
+    const CoprocessorCall call = coprocessor_call_of(inst);
+    const Coprocessor *coprocessor = coprocessor_lookup(cpu, call.cp);
+    if (coprocessor == NULL || coprocessor->data_operation == NULL) return false;
+    return coprocessor->data_operation(coprocessor->context, cpu, &call);
+}
+
+/// Executes MRC, with Rd = PC bits 31:28 of the value become the N, Z, C, V flags
+static inline bool mrc_op(CpuState *cpu, const DecodedInst *inst) {
+    assert(cpu != NULL);
+    assert(inst != NULL);
+
+    const CoprocessorCall call = coprocessor_call_of(inst);
+    const Coprocessor *coprocessor = coprocessor_lookup(cpu, call.cp);
+    word_t value;
+    if (coprocessor == NULL || coprocessor->read == NULL ||
+        !coprocessor->read(coprocessor->context, cpu, &call, &value)) {
+        return false;
+    }
+    if (inst->rd == PC_REGISTER_INDEX) cpsr_write_flags(&cpu->cpsr, value & CPSR_FLAGS_NZCV_MASK);
+    else cpu_set_reg(cpu, inst->rd, value);
+    return true;
+}
+
+/// Executes MCR
+static inline bool mcr_op(CpuState *cpu, const DecodedInst *inst) {
+    assert(cpu != NULL);
+    assert(inst != NULL);
+
+    const CoprocessorCall call = coprocessor_call_of(inst);
+    const Coprocessor *coprocessor = coprocessor_lookup(cpu, call.cp);
+    if (coprocessor == NULL || coprocessor->write == NULL) return false;
+    return coprocessor->write(coprocessor->context, cpu, &call, cpu_get_reg(cpu, inst->rd));
+}
+
+/// Executes LDC (load) or STC, the base is written back only once the coprocessor accepted
+static inline bool ldc_stc_op(CpuState *cpu, const DecodedInst *inst, const bool load) {
+    assert(cpu != NULL);
+    assert(inst != NULL);
+
+    const word_t flags = inst->imm;
+    // Write-back to the PC is unpredictable, it is refused
+    if ((flags & COPROCESSOR_WRITE_BACK) && inst->rn == PC_REGISTER_INDEX) return false;
+
+    const CoprocessorCall call = {
+        .cp = flags & COPROCESSOR_CP_MASK,
+        .crd = inst->rd,
+        .long_transfer = (flags & COPROCESSOR_LONG) != 0u,
+    };
+    const Coprocessor *coprocessor = coprocessor_lookup(cpu, call.cp);
+    if (coprocessor == NULL || (load ? coprocessor->load : coprocessor->store) == NULL) return false;
+
+    const word_t offset = (flags >> COPROCESSOR_OFFSET_SHIFT) << 2;
+    const word_t base = cpu_get_reg(cpu, inst->rn);
+    const word_t moved = (flags & COPROCESSOR_UP) ? base + offset : base - offset;
+    const word_t address = (flags & COPROCESSOR_PRE_INDEX) ? moved : base;
+
+    const bool accepted = load ? coprocessor->load(coprocessor->context, cpu, &call, address)
+                               : coprocessor->store(coprocessor->context, cpu, &call, address);
+    if (accepted && (flags & COPROCESSOR_WRITE_BACK)) cpu_set_reg(cpu, inst->rn, moved);
+    return accepted;
+}
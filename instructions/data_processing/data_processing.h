@@ -2,73 +2,109 @@
 // Created by valentin on 12/24/25.
 //
 #pragma once
+#include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
-#include "instructions/opcodes.h"
-#include "faults/codes.h"
+
+#include "memory.h"
+#include "cpu/cpu.h"
+#include "faults/fault.h"
+#include "decoder/decoded_inst.h"
 #include "instructions/cond.h"
+#include "instructions/opcodes.h"
 #include "instructions/data_processing/data_processing_decoder.h"
-#include "instructions/data_processing/operations.h"
+#include "instructions/data_processing/dp_table.h"
 
+// -------------------------
+// Operation classes
+// -------------------------
 
+/// AddWithCarry(a, b, carry_in), as the ARM ARM defines every arithmetic operation
+static inline word_t dp_result_arith(const Cpsr* cpsr, const word_t a, const word_t b, const word_t carry_in,
+                                     const word_t shifter_carry, word_t* flags) {
+    const uint64_t wide_result = (uint64_t)a + (uint64_t)b + carry_in;
+    const word_t result = (word_t)wide_result;
 
+    word_t nzcv = result & CPSR_FLAG_N;
+    nzcv |= result == 0u ? CPSR_FLAG_Z : 0u;
+    // Carry out of bit 31 (for subtractions this is "no borrow")
+    nzcv |= (wide_result >> 32) != 0u ? CPSR_FLAG_C : 0u;
+    // Signed overflow: the result sign differs from the sign of both inputs
+    nzcv |= (((a ^ result) & (b ^ result)) >> 31) != 0u ? CPSR_FLAG_V : 0u;
+    *flags = nzcv;
+    return result;
+}
 
-static inline ReturnStatus data_proc_op(CpuState* cpu, const DecodedDataProcessing* inst, FaultCodeExecute* fault_out) {
-    assert(cpu != NULL);
-    assert(inst != NULL);
+/// Logical operations: the result is already computed, C comes from the barrel shifter
+static inline word_t dp_result_logic(const Cpsr* cpsr, const word_t result, const word_t unused_b,
+                                     const word_t unused_carry_in, const word_t shifter_carry, word_t* flags) {
+    word_t nzcv = cpsr->value & CPSR_FLAG_V;
+    nzcv |= result & CPSR_FLAG_N;
+    nzcv |= result == 0u ? CPSR_FLAG_Z : 0u;
+    nzcv |= shifter_carry ? CPSR_FLAG_C : 0u;
+    *flags = nzcv;
+    return result;
+}
 
-    // Ensure registers are valid
-    if (inst->rd >= REGISTER_COUNT || inst->rd >= REGISTER_COUNT ) {
-        *fault_out = ERROR_INVALID_REGISTER_INDEX;
-        return ERROR;
-    }
-    // If PC is used as operand, warn
-    if (inst->rd == PC_REGISTER_INDEX || inst->rn == PC_REGISTER_INDEX) {
-        *fault_out = WARNING_PC_USED_AS_OPERAND;
-    }
+// -------------------------
+// Specialised handlers
+// -------------------------
+// One handler per (operation x S x Operand2 form x Rd is PC). S, the form and
+// Rd-is-PC are compile-time constants in each body, so none of them is tested at
+// run time and the unused flag/carry work is folded away.
+//
+// Handler names: dp_<op>_s<S>_<imm|reg>_pc<Rd is PC>
 
-    // The same thing as before, but for the second operand
-    // if not in immediate mode
-    if (!inst->immediate_mode) {
-        if (inst->reg_operand.rm >= REGISTER_COUNT) {
-            *fault_out = ERROR_INVALID_REGISTER_INDEX;
-            return ERROR;
-        }
-        if (inst->reg_operand.rm == PC_REGISTER_INDEX) {
-            *fault_out = WARNING_PC_USED_AS_OPERAND;
-        }
+#define DP_DEFINE_HANDLER(name, klass, a, b, cin, writes_rd, S, FORM, RD_PC)                           \
+    static inline word_t dp_##name##_s##S##_##FORM##_pc##RD_PC(CpuState* cpu, const DecodedInst* inst, \
+                                                               const word_t pc) {                      \
+        if (inst->cond != AL && !cond_passed(inst->cond, &cpu->cpsr)) return pc + WORD_SIZE_BYTES;     \
+                                                                                                       \
+        word_t shifter_carry;                                                                          \
+        const word_t op1 = cpu_get_reg(cpu, inst->rn);                                                 \
+        const word_t op2 = operand2_##FORM##_shift(cpu, inst, &shifter_carry);                         \
+        const word_t carry = cpsr_get_carry(&cpu->cpsr) ? 1u : 0u;                                     \
+        (void)op1;                                                                                     \
+        (void)carry;                                                                                   \
+                                                                                                       \
+        word_t flags;                                                                                  \
+        const word_t result = dp_result_##klass(&cpu->cpsr, (a), (b), (cin), shifter_carry, &flags);   \
+        /* With Rd = PC, S is the exception return: CPSR comes back from the SPSR */                   \
+        if (S && !(RD_PC && writes_rd)) cpsr_write_flags(&cpu->cpsr, flags);                           \
+                                                                                                       \
+        if (writes_rd) {                                                                               \
+            cpu_set_reg(cpu, inst->rd, result);                                                        \
+            if (RD_PC) {                                                                               \
+                if (S) {                                                                               \
+                    cpu_restore_spsr(cpu);                                                             \
+                    if (cpsr_get_thumb(&cpu->cpsr)) cpu_raise_state_switch(cpu, result & ~1u);         \
+                }                                                                                      \
+                return trap_check_jump(cpu->trap, result);                                             \
+            }                                                                                          \
+        }                                                                                              \
+        return pc + WORD_SIZE_BYTES;                                                                   \
     }
 
-    const word_t operand1 = cpu_get_reg(cpu, inst->rn);
-    const word_t operand2 = inst->immediate_mode ? inst->imm_operand.imm8 : cpu_get_reg(cpu, inst->reg_operand.rm);
-    const register_index_t result_reg = inst->reg_operand.rm;
+#define DP_DEFINE_VARIANTS(name, opcode, klass, a, b, cin, writes_rd)  \
+    DP_DEFINE_HANDLER(name, klass, a, b, cin, writes_rd, 0, imm, 0)    \
+    DP_DEFINE_HANDLER(name, klass, a, b, cin, writes_rd, 0, imm, 1)    \
+    DP_DEFINE_HANDLER(name, klass, a, b, cin, writes_rd, 0, reg, 0)    \
+    DP_DEFINE_HANDLER(name, klass, a, b, cin, writes_rd, 0, reg, 1)    \
+    DP_DEFINE_HANDLER(name, klass, a, b, cin, writes_rd, 1, imm, 0)    \
+    DP_DEFINE_HANDLER(name, klass, a, b, cin, writes_rd, 1, imm, 1)    \
+    DP_DEFINE_HANDLER(name, klass, a, b, cin, writes_rd, 1, reg, 0)    \
+    DP_DEFINE_HANDLER(name, klass, a, b, cin, writes_rd, 1, reg, 1)
 
-    switch (inst->op) {
-    case OP_ADD:
-        add_op(cpu, result_reg, operand1, operand2);
-        break;
+DATA_PROCESSING_OPS(DP_DEFINE_VARIANTS)
 
-    case OP_SUB:
-        sub_op(cpu, result_reg, operand1, operand2);
-        break;
-
-    case OP_AND:
-        and_op(cpu, result_reg, operand1, operand2);
-        break;
-
-    case OP_ORR:
-        or_op(cpu, result_reg, operand1, operand2);
-        break;
-
-    case OP_CMP:
-        cmp_op(cpu, result_reg, operand1, operand2);
-        break;
-
-    case OP_MOV:
-        mov_op(cpu, result_reg, operand1, operand2);
-        break;
-
-    default:
-        assert(false && "Unknown data processing opcode");
-        break;
-    }
-}
\ No newline at end of file
+/// Designated initialisers placing every variant at its dp_handler_id slot,
+/// expanded inside the executor's handler table
+#define DP_HANDLER_ENTRIES(name, opcode, klass, a, b, cin, writes_rd)                  \
+    [HANDLER_DATA_PROCESSING_FIRST + ((opcode) << 3) + 0] = dp_##name##_s0_imm_pc0,    \
+    [HANDLER_DATA_PROCESSING_FIRST + ((opcode) << 3) + 1] = dp_##name##_s0_imm_pc1,    \
+    [HANDLER_DATA_PROCESSING_FIRST + ((opcode) << 3) + 2] = dp_##name##_s0_reg_pc0,    \
+    [HANDLER_DATA_PROCESSING_FIRST + ((opcode) << 3) + 3] = dp_##name##_s0_reg_pc1,    \
+    [HANDLER_DATA_PROCESSING_FIRST + ((opcode) << 3) + 4] = dp_##name##_s1_imm_pc0,    \
+    [HANDLER_DATA_PROCESSING_FIRST + ((opcode) << 3) + 5] = dp_##name##_s1_imm_pc1,    \
+    [HANDLER_DATA_PROCESSING_FIRST + ((opcode) << 3) + 6] = dp_##name##_s1_reg_pc0,    \
+    [HANDLER_DATA_PROCESSING_FIRST + ((opcode) << 3) + 7] = dp_##name##_s1_reg_pc1,
@@ -1,93 +1,39 @@
 
 #pragma once
-#include "data_processing.h"
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "memory.h"
+#include "cpu/cpu.h"
+#include "decoder/decoded_inst.h"
+#include "instructions/cond.h"
+#include "instructions/opcodes.h"
 
-typedef enum ShiftType : byte_t {
+typedef enum ShiftType {
     SHIFT_LSL = 0,
     SHIFT_LSR = 1,
     SHIFT_ASR = 2,
     SHIFT_ROR = 3,
 } ShiftType;
 
-typedef struct Operand2RegShiftImm {
-    /// Type of the shift
-    ShiftType type;
-    /// Immediate value specifying the shift amount
-    uint8_t imm5;
-} Operand2RegShiftImm;
-
-typedef struct Operand2RegShiftReg {
-    /// Type of the shift
-    ShiftType type;
-    /// Register that specifies the shift amount
-    register_index_t rs;
-} Operand2RegShiftReg;
-
-typedef struct RegShift {
-    /// If true, shift is specified by register
-    /// If false, shift is specified by immediate
-    bool shift_by_reg;
-
-    union {
-        /// Shift specification when shift is by immediate
-        Operand2RegShiftImm by_imm;
-        /// Shift specification when shift is by register
-        Operand2RegShiftReg by_reg;
-    };
-} RegShift;
-
-typedef struct Operand2Reg {
-    /// Second operand register index
-    register_index_t rm;
-    /// Shift specification
-    RegShift shift;
-} Operand2Reg;
-
-typedef struct Operand2Imm {
-    /// 8-bit immediate value
-    /// [0:7]
-    byte_t imm8;
-    /// 4-bit rotate value
-    /// [8:11]
-    RegShift rotate;
-} Operand2Imm;
-
-;
-
-typedef struct DecodedDataProcessing {
-    word_t raw;
-    CondCode cond;
-    bool immediate_mode;
-    OpCode op;
-    bool set_condition_codes;
-    /// Index of the first register (first operator)
-    register_index_t rn;
-    /// Index of the destination register
-    register_index_t rd;
-
-    /// Second operand, either register or immediate
-    /// It is a union because it occupies the same space in the instruction
-    union {
-        Operand2Reg reg_operand;
-        Operand2Imm imm_operand;
-    };
-} DecodedDataProcessing;
-
-
-static inline DecodedDataProcessing decode(const word_t raw_inst, FaultCodeExecute* fault_out) {
+/// Resolves the rotated immediate of an immediate-form Operand2
+/// imm8 is rotated right by twice the 4-bit rotate field
+static inline word_t operand2_imm_value(const byte_t imm8, const byte_t rotate) {
+    const uint8_t rotation = (uint8_t)(rotate * 2u);
+    const word_t value = imm8;
+    if (rotation == 0u) return value;
+    return (value >> rotation) | (value << (WORD_SIZE_BITS - rotation));
+}
+
+static inline DecodedInst decode_data_processing(const word_t raw_inst) {
     static const uint8_t COND_SHIFT = 28u;
-    static const uint8_t I_SHIFT = 24u;
     static const uint8_t OP_SHIFT = 21u;
-    static const uint8_t S_SHIFT = 20u;
     static const uint8_t RN_SHIFT = 16u;
     static const uint8_t RD_SHIFT = 12u;
 
-    static const uint8_t SHIFT_SHIFT = 4u;
-    static const uint8_t SHIFT_BY_REG_TYPE_SHIFT = 5u;
-    static const uint8_t SHIFT_BY_REG_RS_SHIFT = 8u;
-    static const uint8_t SHIFT_BY_IMM_TYPE_SHIFT = 5u;
-    static const uint8_t SHIFT_BY_IMM_IMM5_SHIFT = 7u;
+    static const uint8_t SHIFT_TYPE_SHIFT = 5u;
+    static const uint8_t SHIFT_RS_SHIFT = 8u;
+    static const uint8_t SHIFT_IMM5_SHIFT = 7u;
     static const uint8_t RM_SHIFT = 0u;
 
     static const uint8_t ROT_SHIFT = 8u;
@@ -100,58 +46,123 @@ static inline DecodedDataProcessing decode(const word_t raw_inst, FaultCodeExecu
     static const word_t RN_MASK = 0x000F0000;
     static const word_t RD_MASK = 0x0000F000;
 
-    static const word_t SHIFT_MASK = 0x00000FF0;
     static const word_t SHIFT_BY_REG_MASK = 0x00000010;
-    static const word_t SHIFT_BY_REG_TYPE_MASK = 0x00000060;
-    static const word_t SHIFT_BY_REG_RS_MASK = 0x00000F00;
-    static const word_t SHIFT_BY_IMM_TYPE_MASK = 0x00000060;
-    static const word_t SHIFT_BY_IMM_IMM5_MASK = 0x000000F80;
+    static const word_t SHIFT_TYPE_MASK = 0x00000060;
+    static const word_t SHIFT_RS_MASK = 0x00000F00;
+    static const word_t SHIFT_IMM5_MASK = 0x00000F80;
     static const word_t RM_MASK = 0x0000000F;
 
     static const word_t ROT_MASK = 0x00000F00;
     static const word_t IMM_MASK = 0x000000FF;
-    DecodedDataProcessing d;
-    d.raw = raw_inst;
 
+    DecodedInst d = {0};
     d.cond = (raw_inst & COND_MASK) >> COND_SHIFT;
-    d.immediate_mode = (raw_inst & I_MASK) != 0;
+    d.i = (raw_inst & I_MASK) != 0;
     d.op = (raw_inst & OP_MASK) >> OP_SHIFT;
-    d.set_condition_codes = (raw_inst & S_MASK) != 0;
+    d.s = (raw_inst & S_MASK) != 0;
     d.rn = (raw_inst & RN_MASK) >> RN_SHIFT;
     d.rd = (raw_inst & RD_MASK) >> RD_SHIFT;
 
-    if (d.immediate_mode) {
+    if (d.i) {
         const byte_t rotate = (raw_inst & ROT_MASK) >> ROT_SHIFT;
         const byte_t imm8 = (raw_inst & IMM_MASK) >> IMM_SHIFT;
-
-        d.imm_operand = (Operand2Imm){
-            .rotate = rotate,
-            .imm8 = imm8
-        };
+        d.imm = operand2_imm_value(imm8, rotate);
+        // Remembered so the shifter carry-out can be derived from imm
+        d.shift_type = rotate != 0u;
     }
     else {
-        const byte_t shift = (raw_inst & SHIFT_MASK) >> SHIFT_SHIFT;
-        const register_index_t rm = (raw_inst & RM_MASK) >> RM_SHIFT;
-        RegShift shift_reg;
-
-        shift_reg.shift_by_reg = (shift >> SHIFT_BY_IMM_IMM5_SHIFT) & SHIFT_BY_REG_MASK;
-        if (shift_reg.shift_by_reg) {
-            shift_reg.by_reg.type = (shift >> SHIFT_BY_REG_TYPE_SHIFT) & SHIFT_BY_REG_TYPE_MASK;
-            shift_reg.by_reg.rs = (shift >> SHIFT_BY_REG_RS_SHIFT) & SHIFT_BY_REG_RS_MASK;
+        d.rm = (raw_inst & RM_MASK) >> RM_SHIFT;
+        d.shift_type = (raw_inst & SHIFT_TYPE_MASK) >> SHIFT_TYPE_SHIFT;
+
+        if (raw_inst & SHIFT_BY_REG_MASK) {
+            d.imm = DECODED_SHIFT_BY_REG | ((raw_inst & SHIFT_RS_MASK) >> SHIFT_RS_SHIFT);
         } else {
-            shift_reg.by_imm.type = (shift >> SHIFT_BY_IMM_TYPE_SHIFT) & SHIFT_BY_IMM_TYPE_MASK;
-            shift_reg.by_imm.imm5 = (shift >> SHIFT_BY_IMM_IMM5_SHIFT) & SHIFT_BY_IMM_IMM5_MASK;
+            d.imm = (raw_inst & SHIFT_IMM5_MASK) >> SHIFT_IMM5_SHIFT;
         }
+    }
 
+    d.handler = dp_handler_id(d.op, d.s, !d.i, d.rd == PC_REGISTER_INDEX);
+    return d;
+}
 
-        d.reg_operand = (Operand2Reg){
-            .shift = shift,
-            .rm = rm
-        };
+/// True when a register-form Operand2 is the plain register (LSL #0)
+static inline bool operand2_reg_is_plain(const DecodedInst* inst) {
+    return !inst->i && inst->shift_type == SHIFT_LSL && inst->imm == 0u;
+}
+
+/// Barrel shifter for a register-form Operand2
+/// Returns the shifted value and stores the shifter carry-out in `carry_out`
+static inline word_t operand2_reg_shift(const CpuState* cpu, const DecodedInst* inst, word_t* carry_out) {
+    const word_t value = cpu_get_reg(cpu, inst->rm);
+    const word_t carry_in = cpsr_get_carry(&cpu->cpsr) ? 1u : 0u;
+    const bool by_reg = (inst->imm & DECODED_SHIFT_BY_REG) != 0;
+    // Register shifts use the bottom byte of Rs, immediate shifts use imm5
+    const word_t amount = by_reg ? (cpu_get_reg(cpu, inst->imm & 0xFu) & 0xFFu) : inst->imm;
+
+    // A register shift by zero leaves both value and carry untouched
+    if (by_reg && amount == 0u) {
+        *carry_out = carry_in;
+        return value;
     }
 
+    switch ((ShiftType)inst->shift_type) {
+    case SHIFT_LSL:
+        if (amount == 0u) {
+            *carry_out = carry_in;
+            return value;
+        }
+        if (amount >= WORD_SIZE_BITS) {
+            *carry_out = amount == WORD_SIZE_BITS ? (value & 1u) : 0u;
+            return 0u;
+        }
+        *carry_out = (value >> (WORD_SIZE_BITS - amount)) & 1u;
+        return value << amount;
+
+    case SHIFT_LSR: {
+        // LSR #0 encodes LSR #32
+        const word_t effective = amount == 0u ? WORD_SIZE_BITS : amount;
+        if (effective >= WORD_SIZE_BITS) {
+            *carry_out = effective == WORD_SIZE_BITS ? (value >> 31) : 0u;
+            return 0u;
+        }
+        *carry_out = (value >> (effective - 1u)) & 1u;
+        return value >> effective;
+    }
 
+    case SHIFT_ASR: {
+        // ASR #0 encodes ASR #32
+        const word_t effective = amount == 0u ? WORD_SIZE_BITS : amount;
+        if (effective >= WORD_SIZE_BITS) {
+            *carry_out = value >> 31;
+            return (word_t)((int32_t)value >> 31);
+        }
+        *carry_out = (value >> (effective - 1u)) & 1u;
+        return (word_t)((int32_t)value >> effective);
+    }
 
-    return d;
+    case SHIFT_ROR: {
+        // ROR #0 encodes RRX (rotate right by one through carry)
+        if (amount == 0u) {
+            *carry_out = value & 1u;
+            return (carry_in << 31) | (value >> 1);
+        }
+        const word_t rotation = amount & 31u;
+        if (rotation == 0u) {
+            *carry_out = value >> 31;
+            return value;
+        }
+        *carry_out = (value >> (rotation - 1u)) & 1u;
+        return (value >> rotation) | (value << (WORD_SIZE_BITS - rotation));
+    }
+    default:
+        *carry_out = carry_in;
+        return value;
+    }
 }
 
+/// Immediate Operand2 with its shifter carry-out
+static inline word_t operand2_imm_shift(const CpuState* cpu, const DecodedInst* inst, word_t* carry_out) {
+    // shift_type marks a rotated immediate, see DecodedInst
+    *carry_out = inst->shift_type ? (inst->imm >> 31) : (cpsr_get_carry(&cpu->cpsr) ? 1u : 0u);
+    return inst->imm;
+}
@@ -0,0 +1,35 @@
+//
+// Created by valentin on 01/24/26.
+//
+#pragma once
+
+/// The 16 data processing operations, in OpCode order.
+///
+/// This is the only place the semantics of an operation are written down, every
+/// specialised handler in data_processing.h is generated from it.
+///
+/// Columns:
+/// - name:      suffix of the generated handlers
+/// - opcode:    OpCode value (bits 24:21)
+/// - class:     arith -> result and flags come from AddWithCarry(a, b, cin)
+///              logic -> result is `a`, N/Z from the result, C from the shifter, V kept
+/// - a, b, cin: expressions over op1 (Rn), op2 (Operand2) and carry (current C, 0/1)
+/// - writes_rd: 0 for the flag-only operations (TST/TEQ/CMP/CMN)
+#define DATA_PROCESSING_OPS(X)                                       \
+    /* name  opcode  class  a            b      cin    writes_rd */  \
+    X(and,   OP_AND, logic, op1 & op2,   0u,    0u,    1)            \
+    X(eor,   OP_EOR, logic, op1 ^ op2,   0u,    0u,    1)            \
+    X(sub,   OP_SUB, arith, op1,         ~op2,  1u,    1)            \
+    X(rsb,   OP_RSB, arith, op2,         ~op1,  1u,    1)            \
+    X(add,   OP_ADD, arith, op1,         op2,   0u,    1)            \
+    X(adc,   OP_ADC, arith, op1,         op2,   carry, 1)            \
+    X(sbc,   OP_SBC, arith, op1,         ~op2,  carry, 1)            \
+    X(rsc,   OP_RSC, arith, op2,         ~op1,  carry, 1)            \
+    X(tst,   OP_TST, logic, op1 & op2,   0u,    0u,    0)            \
+    X(teq,   OP_TEQ, logic, op1 ^ op2,   0u,    0u,    0)            \
+    X(cmp,   OP_CMP, arith, op1,         ~op2,  1u,    0)            \
+    X(cmn,   OP_CMN, arith, op1,         op2,   0u,    0)            \
+    X(orr,   OP_ORR, logic, op1 | op2,   0u,    0u,    1)            \
+    X(mov,   OP_MOV, logic, op2,         0u,    0u,    1)            \
+    X(bic,   OP_BIC, logic, op1 & ~op2,  0u,    0u,    1)            \
+    X(mvn,   OP_MVN, logic, ~op2,        0u,    0u,    1)
@@ -0,0 +1,99 @@
+//
+// Created by valentin on 01/21/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "cpu/cpu.h"
+#include "instructions/cond.h"
+#include "decoder/predecoder.h"
+
+// Superinstruction handlers
+//
+// Every handler receives the first slot of the fused group and the guest
+// address of that first instruction, and returns the address to continue at.
+// The condition of the trailing branch is computed straight from the operands,
+// and the architectural NZCV is still committed (in one store) because code after
+// the group may observe it.
+
+/// Operand2 of an instruction accepted by fusion_is_simple
+static inline word_t fused_operand2(const CpuState *cpu, const DecodedInst *inst) {
+    return inst->i ? inst->imm : cpu_get_reg(cpu, inst->rm);
+}
+
+/// Target of the branch in the second slot of a group starting at `pc`
+static inline word_t fused_branch_target(const DecodedInst *branch, const word_t pc) {
+    // The branch sits one word after the group start and reads PC + 8
+    return pc + WORD_SIZE_BYTES + 2 * WORD_SIZE_BYTES + branch->imm;
+}
+
+/// CMP/SUBS Rn, Op2 ; B<cond> label
+static inline word_t fused_sub_b_op(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    assert(cpu != NULL);
+    assert(inst != NULL);
+
+    const DecodedInst *dp = &inst[0];
+    const DecodedInst *branch = &inst[1];
+
+    const word_t operand1 = cpu_get_reg(cpu, dp->rn);
+    const word_t operand2 = fused_operand2(cpu, dp);
+
+    if (dp->op == OP_SUB) {
+        cpu_set_reg(cpu, dp->rd, operand1 - operand2);
+    }
+    cpsr_write_flags(&cpu->cpsr, cpsr_flags_sub(operand1, operand2));
+
+    if (cond_passed_sub(branch->cond, operand1, operand2)) {
+        return fused_branch_target(branch, pc);
+    }
+    return pc + 2 * WORD_SIZE_BYTES;
+}
+
+/// TST Rn, Op2 ; B<cond> label
+static inline word_t fused_tst_b_op(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    assert(cpu != NULL);
+    assert(inst != NULL);
+
+    const DecodedInst *dp = &inst[0];
+    const DecodedInst *branch = &inst[1];
+
+    const word_t result = cpu_get_reg(cpu, dp->rn) & fused_operand2(cpu, dp);
+    word_t flags = cpsr_flags_logic(&cpu->cpsr, result);
+    // A rotated immediate is the shifter carry-out, as in dp_tst (see DecodedInst)
+    if (dp->i && dp->shift_type) {
+        flags = (flags & ~CPSR_FLAG_C) | ((dp->imm >> 31) ? CPSR_FLAG_C : 0u);
+    }
+    cpsr_write_flags(&cpu->cpsr, flags);
+
+    bool taken;
+    switch (branch->cond) {
+    // The common TST conditions only depend on the result
+    case EQ: taken = result == 0u; break;
+    case NE: taken = result != 0u; break;
+    case MI: taken = (result >> 31) != 0u; break;
+    case PL: taken = (result >> 31) == 0u; break;
+    // The rest also read C and V, already committed above
+    default: taken = cond_passed(branch->cond, &cpu->cpsr); break;
+    }
+
+    if (taken) {
+        return fused_branch_target(branch, pc);
+    }
+    return pc + 2 * WORD_SIZE_BYTES;
+}
+
+/// MOV Rd, Op2 ; MOV Rd, Op2 [; MOV Rd, Op2]
+static inline word_t fused_mov_chain_op(CpuState *cpu, const DecodedInst *inst, const word_t pc, const uint8_t length) {
+    assert(cpu != NULL);
+    assert(inst != NULL);
+
+    // Executed in order, a later MOV may read the register an earlier one wrote
+    for (uint8_t i = 0; i < length; ++i) {
+        const DecodedInst *dp = &inst[i];
+        cpu_set_reg(cpu, dp->rd, fused_operand2(cpu, dp));
+    }
+    return pc + length * WORD_SIZE_BYTES;
+}
@@ -0,0 +1,188 @@
+//
+// Created by valentin on 01/31/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "memory.h"
+#include "cpu/cpu.h"
+#include "faults/fault.h"
+#include "decoder/decoded_inst.h"
+
+// Idiom handlers
+//
+// A recognised copy/fill/scan loop (see predecoder_recognise_idioms) runs as one host
+// memmove/memset/memchr. They leave exactly the registers and flags the loop would:
+// pointers past the last element, the counter at 0, the temporary holding the last
+// element, and the NZCV of the final SUBS/CMP.
+//
+// Only the common case takes the host route: element-aligned pointers, a counter that
+// reaches 0, host-backed ranges (within one page under the guest's MMU) and, for copies,
+// no forward overlap. Everything else runs the loop iteration by iteration through the
+// MMU and the memory map, so MMIO, ROM, aborts and faults behave as the guest wrote
+// them (registers reflect the iterations done).
+//
+// Slot layout:
+//   COPY: rd dst, rn src, rm counter, op temporary, s byte elements, imm counter step
+//   FILL: rd dst, rn value, rm counter, s byte elements, imm counter step
+//   SCAN: rn pointer, rd temporary, imm byte searched for
+
+/// Guest instructions of each recognised loop
+#define IDIOM_COPY_LENGTH 4u
+#define IDIOM_FILL_LENGTH 3u
+#define IDIOM_SCAN_LENGTH 3u
+
+/// Element access of the per-iteration path, faults like the load/store would
+/// With the MMU on, alignment, aborts and unmapped memory are the MMU's to raise
+static inline word_t idiom_load(CpuState *cpu, const word_t addr, const word_t size) {
+    if (!mmu_enabled(cpu->mmu)) {
+        if (size == WORD_SIZE_BYTES && (addr & WORD_ALIGN_MASK) != 0u) trap_raise(cpu->trap, FAULT_ALIGNMENT, addr);
+        if (mem_find_region(cpu->memory, addr, size) == NULL) trap_raise(cpu->trap, FAULT_OUT_OF_BOUNDS, addr);
+    }
+    return mmu_load(cpu->mmu, cpu->memory, cpu->trap, addr, size);
+}
+
+static inline void idiom_store(CpuState *cpu, const word_t addr, const word_t size, const word_t value) {
+    if (!mmu_enabled(cpu->mmu)) {
+        if (size == WORD_SIZE_BYTES && (addr & WORD_ALIGN_MASK) != 0u) trap_raise(cpu->trap, FAULT_ALIGNMENT, addr);
+        if (mem_find_region(cpu->memory, addr, size) == NULL) trap_raise(cpu->trap, FAULT_OUT_OF_BOUNDS, addr);
+    }
+    mmu_store(cpu->mmu, cpu->memory, cpu->trap, addr, value, size);
+}
+
+/// Iterations of a `SUBS counter, counter, #step ; BNE` loop, 0 when it would not stop at 0
+static inline uint64_t idiom_iterations(const word_t counter, const word_t step) {
+    if (counter == 0u || counter % step != 0u) return 0;
+    return counter / step;
+}
+
+/// Host address of [addr, addr + bytes), NULL unless it is one host-backed run
+static inline byte_t *idiom_host_range(const CpuState *cpu, const word_t addr, const uint64_t bytes,
+                                       const bool writable) {
+    byte_t *host;
+    if ((uint64_t)addr + bytes > ((uint64_t)1 << 32)) return NULL;
+    return mmu_host_span(cpu->mmu, cpu->memory, addr, bytes, writable, &host) == bytes ? host : NULL;
+}
+
+/// LDR{B} t, [src], #k ; STR{B} t, [dst], #k ; SUBS n, n, #step ; BNE loop
+static inline word_t idiom_copy_op(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    assert(cpu != NULL && cpu->memory != NULL);
+    assert(inst != NULL);
+
+    const word_t size = inst->s ? BYTE_SIZE_BYTES : WORD_SIZE_BYTES;
+    const word_t step = inst->imm;
+    word_t dst = cpu_get_reg(cpu, inst->rd);
+    word_t src = cpu_get_reg(cpu, inst->rn);
+    word_t counter = cpu_get_reg(cpu, inst->rm);
+
+    const uint64_t iterations = idiom_iterations(counter, step);
+    const uint64_t bytes = iterations * size;
+    const bool aligned = size == BYTE_SIZE_BYTES || ((dst | src) & WORD_ALIGN_MASK) == 0u;
+    // An element-wise forward copy onto a later, overlapping destination repeats a pattern
+    const bool forward_overlap = dst > src && dst - src < bytes;
+
+    byte_t *to = iterations != 0u && aligned && !forward_overlap ? idiom_host_range(cpu, dst, bytes, true) : NULL;
+    const byte_t *from = to != NULL ? idiom_host_range(cpu, src, bytes, false) : NULL;
+    if (from != NULL) {
+        memmove(to, from, bytes);
+        // The last element loaded is still the last one stored
+        cpu_set_reg(cpu, inst->op, (word_t)mem_host_load(to + bytes - size, size));
+        cpu_set_reg(cpu, inst->rd, dst + (word_t)bytes);
+        cpu_set_reg(cpu, inst->rn, src + (word_t)bytes);
+        cpu_set_reg(cpu, inst->rm, 0);
+        cpsr_write_flags(&cpu->cpsr, cpsr_flags_sub(step, step));
+        return pc + IDIOM_COPY_LENGTH * WORD_SIZE_BYTES;
+    }
+
+    do {
+        const word_t element = idiom_load(cpu, src, size);
+        cpu_set_reg(cpu, inst->op, element);
+        cpu_set_reg(cpu, inst->rn, src += size);
+        idiom_store(cpu, dst, size, element);
+        cpu_set_reg(cpu, inst->rd, dst += size);
+        cpsr_write_flags(&cpu->cpsr, cpsr_flags_sub(counter, step));
+        cpu_set_reg(cpu, inst->rm, counter -= step);
+    } while (counter != 0u);
+    return pc + IDIOM_COPY_LENGTH * WORD_SIZE_BYTES;
+}
+
+/// STR{B} v, [dst], #k ; SUBS n, n, #step ; BNE loop
+static inline word_t idiom_fill_op(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    assert(cpu != NULL && cpu->memory != NULL);
+    assert(inst != NULL);
+
+    const word_t size = inst->s ? BYTE_SIZE_BYTES : WORD_SIZE_BYTES;
+    const word_t step = inst->imm;
+    const word_t value = cpu_get_reg(cpu, inst->rn);
+    word_t dst = cpu_get_reg(cpu, inst->rd);
+    word_t counter = cpu_get_reg(cpu, inst->rm);
+
+    const uint64_t iterations = idiom_iterations(counter, step);
+    const uint64_t bytes = iterations * size;
+    const bool aligned = size == BYTE_SIZE_BYTES || (dst & WORD_ALIGN_MASK) == 0u;
+
+    byte_t *to = iterations != 0u && aligned ? idiom_host_range(cpu, dst, bytes, true) : NULL;
+    if (to != NULL) {
+        const byte_t low = (byte_t)value;
+        if (size == BYTE_SIZE_BYTES || value == low * 0x01010101u) {
+            memset(to, low, bytes);
+        }
+        else {
+            for (uint64_t i = 0; i < bytes; i += WORD_SIZE_BYTES) mem_host_store(to + i, value, WORD_SIZE_BYTES);
+        }
+        cpu_set_reg(cpu, inst->rd, dst + (word_t)bytes);
+        cpu_set_reg(cpu, inst->rm, 0);
+        cpsr_write_flags(&cpu->cpsr, cpsr_flags_sub(step, step));
+        return pc + IDIOM_FILL_LENGTH * WORD_SIZE_BYTES;
+    }
+
+    do {
+        idiom_store(cpu, dst, size, value);
+        cpu_set_reg(cpu, inst->rd, dst += size);
+        cpsr_write_flags(&cpu->cpsr, cpsr_flags_sub(counter, step));
+        cpu_set_reg(cpu, inst->rm, counter -= step);
+    } while (counter != 0u);
+    return pc + IDIOM_FILL_LENGTH * WORD_SIZE_BYTES;
+}
+
+/// LDRB t, [p], #1 ; CMP t, #c ; BNE loop (strlen with c = 0, memchr otherwise)
+static inline word_t idiom_scan_op(CpuState *cpu, const DecodedInst *inst, const word_t pc) {
+    assert(cpu != NULL && cpu->memory != NULL);
+    assert(inst != NULL);
+
+    const word_t needle = inst->imm;
+    word_t p = cpu_get_reg(cpu, inst->rn);
+
+    for (;;) {
+        byte_t *host;
+        const uint64_t span = mmu_host_span(cpu->mmu, cpu->memory, p, ((uint64_t)1 << 32) - p, false, &host);
+        if (span == 0u) {
+            // Not host-backed, one iteration through the memory map
+            const word_t element = idiom_load(cpu, p, BYTE_SIZE_BYTES);
+            cpu_set_reg(cpu, inst->rd, element);
+            cpu_set_reg(cpu, inst->rn, ++p);
+            cpsr_write_flags(&cpu->cpsr, cpsr_flags_sub(element, needle));
+            if (element == needle) break;
+            continue;
+        }
+
+        const byte_t *found = memchr(host, (int)needle, span);
+        if (found != NULL) {
+            p += (word_t)(found - host) + 1u;
+            cpu_set_reg(cpu, inst->rd, needle);
+            cpu_set_reg(cpu, inst->rn, p);
+            cpsr_write_flags(&cpu->cpsr, cpsr_flags_sub(needle, needle));
+            break;
+        }
+        // The loop went through the whole run, its state is the one after the last byte
+        const word_t last = host[span - 1u];
+        p += (word_t)span;
+        cpu_set_reg(cpu, inst->rd, last);
+        cpu_set_reg(cpu, inst->rn, p);
+        cpsr_write_flags(&cpu->cpsr, cpsr_flags_sub(last, needle));
+    }
+    return pc + IDIOM_SCAN_LENGTH * WORD_SIZE_BYTES;
+}
@@ -802,6 +802,18 @@ typedef enum InstructionType {
     ///   - SWI always causes a mode change and pipeline flush.
     ///   - Return is normally performed with MOVS PC, LR_svc (restores CPSR).
     SOFTWARE_INTERRUPT,
+
+    /// ## Undefined Instruction ##
+    ///
+    /// Encoding (A32, 32 bits):
+    /// - [31:28]: Cond
+    /// - [27:25]: 011
+    /// - [4:4]: 1
+    ///
+    /// Semantics:
+    ///   If condition passes -> take Undefined Instruction exception (trap).
+    ///   See UNDEFINED in the Instruction enum for the full description.
+    UNDEFINED_INSTRUCTION,
 } InstructionType;
 
 typedef enum Instruction {
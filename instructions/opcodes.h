@@ -5,85 +5,71 @@
 
 
 typedef enum Opcode {
-    // Boolean
+    // Values match the A32 data-processing OpCode field (bits 24:21)
 
     /// AND - Bitwise AND.
     /// Semantics: Rd := Rn & Op2
     OP_AND = 0x0,
 
-    /// ORR - Bitwise OR.
-    /// Semantics: Rd := Rn | Op2
-    OP_ORR,
-
     /// EOR - Bitwise XOR.
     /// Semantics: Rd := Rn ^ Op2
-    OP_EOR,
+    OP_EOR = 0x1,
 
+    /// SUB - Subtract.
+    /// Semantics: Rd := Rn - Op2
+    OP_SUB = 0x2,
 
-    // Add
+    /// RSB - Reverse subtract.
+    /// Semantics: Rd := Op2 - Rn
+    OP_RSB = 0x3,
 
     /// ADD - Add.
     /// Semantics: Rd := Rn + Op2
-    OP_ADD,
+    OP_ADD = 0x4,
 
     /// ADC - Add with carry-in.
     /// Semantics: Rd := Rn + Op2 + C
-    OP_ADC,
-
-
-    // Subtract
-
-    /// SUB - Subtract.
-    /// Semantics: Rd := Rn - Op2
-    OP_SUB,
+    OP_ADC = 0x5,
 
     /// SBC - Subtract with carry/borrow.
     /// Semantics: Rd := Rn - Op2 - (1 - C)
-    OP_SBC,
-
-    /// RSB - Reverse subtract.
-    /// Semantics: Rd := Op2 - Rn
-    OP_RSB,
+    OP_SBC = 0x6,
 
     /// RSC - Reverse subtract with carry/borrow.
     /// Semantics: Rd := Op2 - Rn - (1 - C)
-    OP_RSC,
-
-
-    // Test
+    OP_RSC = 0x7,
 
     /// TST - Test (AND, flags only; no Rd write).
     /// Semantics: flags := Rn & Op2
-    OP_TST,
+    OP_TST = 0x8,
 
     /// TEQ - Test equivalence (XOR, flags only; no Rd write).
     /// Semantics: flags := Rn ^ Op2
-    OP_TEQ,
-
-    // Compare
+    OP_TEQ = 0x9,
 
     /// CMP - Compare (SUB, flags only; no Rd write).
     /// Semantics: flags := Rn - Op2
-    OP_CMP,
+    OP_CMP = 0xA,
 
     /// CMN - Compare negative (ADD, flags only; no Rd write).
     /// Semantics: flags := Rn + Op2
-    OP_CMN,
+    OP_CMN = 0xB,
 
-
-    /// BIC - Bit clear (AND with inverted operand).
-    /// Semantics: Rd := Rn & ~Op2
-    OP_BIC,
-
-    // Move
+    /// ORR - Bitwise OR.
+    /// Semantics: Rd := Rn | Op2
+    OP_ORR = 0xC,
 
     /// MOV — Move (copy operand).
     /// Semantics: Rd := Op2
-    OP_MOV,
+    OP_MOV = 0xD,
+
+    /// BIC - Bit clear (AND with inverted operand).
+    /// Semantics: Rd := Rn & ~Op2
+    OP_BIC = 0xE,
 
     /// MVN - Move NOT (bitwise invert).
     /// Semantics: Rd := ~Op2
-    OP_MVN,
+    OP_MVN = 0xF,
 
     /// No operation
     OP_NOP,
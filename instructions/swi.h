@@ -0,0 +1,34 @@
+//
+// Created by valentin on 01/27/26.
+//
+#pragma once
+#include <stdint.h>
+
+#include "memory.h"
+#include "instructions/cond.h"
+#include "decoder/decoded_inst.h"
+
+// SWI keeps its comment field in imm, the handler compares it against the
+// semihosting numbers (semihosting/semihost.h) before taking the exception
+
+/// Decodes SWI
+/// [31:28]: Condition field
+/// [27:24]: '1111'
+/// [23: 0]: Comment field, ignored by the processor
+static inline DecodedInst decode_swi(const word_t raw_inst) {
+    static const word_t COMMENT_MASK = 0x00FFFFFF;
+    static const uint8_t COND_SHIFT = 28u;
+
+    const DecodedInst inst = {.handler = HANDLER_SWI, .cond = raw_inst >> COND_SHIFT, .imm = raw_inst & COMMENT_MASK};
+    return inst;
+}
+
+/// Decodes Thumb SWI (format 17)
+/// [15:8]: '11011111'
+/// [ 7:0]: Comment field
+static inline DecodedInst decode_thumb_swi(const halfword_t raw_inst) {
+    static const halfword_t COMMENT_MASK = 0x00FF;
+
+    const DecodedInst inst = {.handler = HANDLER_SWI, .cond = AL, .imm = raw_inst & COMMENT_MASK};
+    return inst;
+}
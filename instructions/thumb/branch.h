@@ -0,0 +1,102 @@
+//
+// Created by valentin on 01/26/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "cpu/cpu.h"
+#include "instructions/cond.h"
+#include "decoder/decoded_inst.h"
+
+// Thumb branches read R15 as the address of the instruction + 4
+
+/// Decodes B<cond> (format 16)
+/// [15:12]: '1101'
+/// [11: 8]: Condition field (AL is undefined and 0xF is SWI, both are filtered by the caller)
+/// [ 7: 0]: Signed offset in halfwords
+static inline DecodedInst decode_thumb_b_cond(const halfword_t raw_inst) {
+    static const uint8_t COND_SHIFT = 8u;
+    static const halfword_t COND_MASK = 0x0F00;
+    static const halfword_t OFFSET_MASK = 0x00FF;
+
+    const CondCode cond = (raw_inst & COND_MASK) >> COND_SHIFT;
+    // Sign-extend 8 -> 32, then scale halfwords to bytes
+    const int32_t offset = (int32_t)(int8_t)(raw_inst & OFFSET_MASK) * 2;
+
+    const DecodedInst inst = {.handler = HANDLER_THUMB_BRANCH, .cond = cond, .imm = (word_t)offset};
+    return inst;
+}
+
+/// Decodes B (format 18)
+/// [15:11]: '11100'
+/// [10: 0]: Signed offset in halfwords
+static inline DecodedInst decode_thumb_b(const halfword_t raw_inst) {
+    static const halfword_t OFFSET_MASK = 0x07FF;
+    static const uint8_t OFFSET_SIGN_EXTEND_SHIFT = 21;
+
+    // Sign-extend 11 -> 32 and scale to bytes in one go
+    const int32_t offset = (int32_t)((word_t)(raw_inst & OFFSET_MASK) << OFFSET_SIGN_EXTEND_SHIFT) >> (OFFSET_SIGN_EXTEND_SHIFT - 1);
+
+    const DecodedInst inst = {.handler = HANDLER_THUMB_BRANCH, .cond = AL, .imm = (word_t)offset};
+    return inst;
+}
+
+/// Decodes one half of BL (format 19)
+/// [15:12]: '1111'
+/// [11]   : H, 0 for the first half (high offset), 1 for the second (low offset)
+/// [10: 0]: Offset part, bits 22:12 (signed) or 11:1 of the byte offset
+static inline DecodedInst decode_thumb_bl(const halfword_t raw_inst) {
+    static const halfword_t H_MASK = 0x0800;
+    static const halfword_t OFFSET_MASK = 0x07FF;
+    static const uint8_t HIGH_SIGN_EXTEND_SHIFT = 21;
+    static const uint8_t HIGH_SCALE_SHIFT = 12;
+
+    const word_t offset = raw_inst & OFFSET_MASK;
+    if (raw_inst & H_MASK) {
+        const DecodedInst suffix = {.handler = HANDLER_THUMB_BL_SUFFIX, .cond = AL, .imm = offset << 1};
+        return suffix;
+    }
+
+    const int32_t high = (int32_t)(offset << HIGH_SIGN_EXTEND_SHIFT) >> (HIGH_SIGN_EXTEND_SHIFT - HIGH_SCALE_SHIFT);
+    const DecodedInst prefix = {.handler = HANDLER_THUMB_BL_PREFIX, .cond = AL, .imm = (word_t)high};
+    return prefix;
+}
+
+/// Executes B<cond>/B
+/// Returns true when the branch was taken
+static inline bool thumb_b_op(CpuState* cpu, const DecodedInst* inst) {
+    assert(cpu != NULL);
+    assert(inst != NULL);
+
+    if (inst->cond != AL && !cond_passed(inst->cond, &cpu->cpsr)) {
+        return false;
+    }
+
+    // imm holds the signed byte offset, unsigned wrap-around gives the same sum
+    cpu_set_pc(cpu, cpu_get_pc(cpu) + inst->imm);
+    return true;
+}
+
+/// Executes the first half of BL, only LR changes
+static inline void thumb_bl_prefix_op(CpuState* cpu, const DecodedInst* inst) {
+    assert(cpu != NULL);
+    assert(inst != NULL);
+
+    cpu_set_reg(cpu, LINK_REGISTER_INDEX, cpu_get_pc(cpu) + inst->imm);
+}
+
+/// Executes the second half of BL, always taken
+static inline void thumb_bl_suffix_op(CpuState* cpu, const DecodedInst* inst) {
+    static const word_t THUMB_STATE_BIT = 1u;
+    assert(cpu != NULL);
+    assert(inst != NULL);
+
+    const word_t target = cpu_get_reg(cpu, LINK_REGISTER_INDEX) + inst->imm;
+    // Return to the next halfword, bit 0 keeps the caller in Thumb state on BX LR
+    const word_t return_address = cpu_get_pc(cpu) - HALFWORD_SIZE_BYTES;
+    cpu_set_reg(cpu, LINK_REGISTER_INDEX, return_address | THUMB_STATE_BIT);
+    cpu_set_pc(cpu, target);
+}
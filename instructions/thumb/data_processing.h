@@ -0,0 +1,191 @@
+//
+// Created by valentin on 01/26/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "cpu/cpu.h"
+#include "instructions/cond.h"
+#include "instructions/opcodes.h"
+#include "decoder/decoded_inst.h"
+#include "instructions/data_processing/data_processing_decoder.h"
+
+// Thumb data processing
+//
+// Every Thumb ALU form is an ARM data processing instruction with a restricted
+// operand choice, so these decoders produce the ARM DecodedInst and the ARM
+// handlers execute it. Only ADD Rd, PC and writes to the PC need Thumb handlers.
+
+/// Thumb register fields are 3 bits wide
+static const halfword_t THUMB_LOW_REG_MASK = 0x7;
+/// First register reached through the high register operations (format 5)
+static const uint8_t THUMB_HIGH_REG_OFFSET = 8u;
+
+/// Data processing with a register Operand2, Rm shifted by `shift_type` and `shift`
+/// (imm5, or DECODED_SHIFT_BY_REG | Rs)
+static inline DecodedInst thumb_dp_reg(const OpCode op, const bool s, const uint8_t rd, const uint8_t rn,
+                                       const uint8_t rm, const ShiftType shift_type, const word_t shift) {
+    DecodedInst d = {0};
+    d.cond = AL;
+    d.op = op;
+    d.s = s;
+    d.rd = rd;
+    d.rn = rn;
+    d.rm = rm;
+    d.shift_type = shift_type;
+    d.imm = shift;
+    d.handler = dp_handler_id(op, s, true, rd == PC_REGISTER_INDEX);
+    return d;
+}
+
+/// Data processing with an (unrotated) immediate Operand2, the carry is left as it is
+static inline DecodedInst thumb_dp_imm(const OpCode op, const bool s, const uint8_t rd, const uint8_t rn,
+                                       const word_t value) {
+    DecodedInst d = {0};
+    d.cond = AL;
+    d.op = op;
+    d.s = s;
+    d.i = true;
+    d.rd = rd;
+    d.rn = rn;
+    d.imm = value;
+    d.handler = dp_handler_id(op, s, false, rd == PC_REGISTER_INDEX);
+    return d;
+}
+
+/// Format 1: LSL/LSR/ASR Rd, Rs, #imm5 -> MOVS Rd, Rs, <shift> #imm5
+/// [15:13]: '000', [12:11]: shift type (not 11), [10:6]: imm5, [5:3]: Rs, [2:0]: Rd
+/// The ARM meaning of a 0 amount (LSR/ASR #32) is also the Thumb one
+static inline DecodedInst decode_thumb_shift_imm(const halfword_t raw_inst) {
+    const ShiftType type = (ShiftType)((raw_inst >> 11) & 0x3u);
+    const word_t imm5 = (raw_inst >> 6) & 0x1Fu;
+    const uint8_t rs = (raw_inst >> 3) & THUMB_LOW_REG_MASK;
+    const uint8_t rd = raw_inst & THUMB_LOW_REG_MASK;
+    return thumb_dp_reg(OP_MOV, true, rd, 0, rs, type, imm5);
+}
+
+/// Format 2: ADDS/SUBS Rd, Rs, Rn|#imm3
+/// [15:11]: '00011', [10]: immediate, [9]: SUB, [8:6]: Rn or imm3, [5:3]: Rs, [2:0]: Rd
+static inline DecodedInst decode_thumb_add_sub(const halfword_t raw_inst) {
+    static const halfword_t IMMEDIATE_MASK = 0x0400;
+    static const halfword_t SUB_MASK = 0x0200;
+
+    const OpCode op = (raw_inst & SUB_MASK) ? OP_SUB : OP_ADD;
+    const uint8_t operand = (raw_inst >> 6) & THUMB_LOW_REG_MASK;
+    const uint8_t rs = (raw_inst >> 3) & THUMB_LOW_REG_MASK;
+    const uint8_t rd = raw_inst & THUMB_LOW_REG_MASK;
+
+    if (raw_inst & IMMEDIATE_MASK) return thumb_dp_imm(op, true, rd, rs, operand);
+    return thumb_dp_reg(op, true, rd, rs, operand, SHIFT_LSL, 0);
+}
+
+/// Format 3: MOVS/CMP/ADDS/SUBS Rd, #imm8
+/// [15:13]: '001', [12:11]: operation, [10:8]: Rd, [7:0]: imm8
+static inline DecodedInst decode_thumb_imm8(const halfword_t raw_inst) {
+    static const OpCode OPS[4] = {OP_MOV, OP_CMP, OP_ADD, OP_SUB};
+
+    const OpCode op = OPS[(raw_inst >> 11) & 0x3u];
+    const uint8_t rd = (raw_inst >> 8) & THUMB_LOW_REG_MASK;
+    const word_t imm8 = raw_inst & 0xFFu;
+    // CMP has no destination, Rd is its first operand
+    return thumb_dp_imm(op, true, op == OP_CMP ? 0 : rd, rd, imm8);
+}
+
+/// Format 4: ALU operations Rd := Rd <op> Rs, all of them set the flags
+/// [15:10]: '010000', [9:6]: operation, [5:3]: Rs, [2:0]: Rd
+/// Returns false for MUL, which has no executor yet
+static inline bool decode_thumb_alu(const halfword_t raw_inst, DecodedInst* out) {
+    const word_t operation = (raw_inst >> 6) & 0xFu;
+    const uint8_t rs = (raw_inst >> 3) & THUMB_LOW_REG_MASK;
+    const uint8_t rd = raw_inst & THUMB_LOW_REG_MASK;
+
+    switch (operation) {
+    case 0x0: *out = thumb_dp_reg(OP_AND, true, rd, rd, rs, SHIFT_LSL, 0); return true;
+    case 0x1: *out = thumb_dp_reg(OP_EOR, true, rd, rd, rs, SHIFT_LSL, 0); return true;
+    // Shifts by register: MOVS Rd, Rd, <shift> Rs
+    case 0x2: *out = thumb_dp_reg(OP_MOV, true, rd, 0, rd, SHIFT_LSL, DECODED_SHIFT_BY_REG | rs); return true;
+    case 0x3: *out = thumb_dp_reg(OP_MOV, true, rd, 0, rd, SHIFT_LSR, DECODED_SHIFT_BY_REG | rs); return true;
+    case 0x4: *out = thumb_dp_reg(OP_MOV, true, rd, 0, rd, SHIFT_ASR, DECODED_SHIFT_BY_REG | rs); return true;
+    case 0x5: *out = thumb_dp_reg(OP_ADC, true, rd, rd, rs, SHIFT_LSL, 0); return true;
+    case 0x6: *out = thumb_dp_reg(OP_SBC, true, rd, rd, rs, SHIFT_LSL, 0); return true;
+    case 0x7: *out = thumb_dp_reg(OP_MOV, true, rd, 0, rd, SHIFT_ROR, DECODED_SHIFT_BY_REG | rs); return true;
+    case 0x8: *out = thumb_dp_reg(OP_TST, true, 0, rd, rs, SHIFT_LSL, 0); return true;
+    // NEG Rd, Rs -> RSBS Rd, Rs, #0
+    case 0x9: *out = thumb_dp_imm(OP_RSB, true, rd, rs, 0u); return true;
+    case 0xA: *out = thumb_dp_reg(OP_CMP, true, 0, rd, rs, SHIFT_LSL, 0); return true;
+    case 0xB: *out = thumb_dp_reg(OP_CMN, true, 0, rd, rs, SHIFT_LSL, 0); return true;
+    case 0xC: *out = thumb_dp_reg(OP_ORR, true, rd, rd, rs, SHIFT_LSL, 0); return true;
+    case 0xE: *out = thumb_dp_reg(OP_BIC, true, rd, rd, rs, SHIFT_LSL, 0); return true;
+    case 0xF: *out = thumb_dp_reg(OP_MVN, true, rd, 0, rs, SHIFT_LSL, 0); return true;
+    default:
+        return false;
+    }
+}
+
+/// Format 5: ADD/CMP/MOV on the full register file (BX is decoded by the caller)
+/// [15:10]: '010001', [9:8]: operation, [7]: H1, [6]: H2, [5:3]: Rs, [2:0]: Rd
+/// ADD and MOV leave the flags alone, CMP sets them
+static inline DecodedInst decode_thumb_high_register(const halfword_t raw_inst) {
+    static const halfword_t H1_MASK = 0x0080;
+    static const halfword_t H2_MASK = 0x0040;
+
+    const word_t operation = (raw_inst >> 8) & 0x3u;
+    const uint8_t rd = (raw_inst & THUMB_LOW_REG_MASK) + ((raw_inst & H1_MASK) ? THUMB_HIGH_REG_OFFSET : 0u);
+    const uint8_t rm = ((raw_inst >> 3) & THUMB_LOW_REG_MASK) + ((raw_inst & H2_MASK) ? THUMB_HIGH_REG_OFFSET : 0u);
+
+    if (operation == 0x1u) return thumb_dp_reg(OP_CMP, true, 0, rd, rm, SHIFT_LSL, 0);
+
+    const OpCode op = operation == 0x0u ? OP_ADD : OP_MOV;
+    if (rd == PC_REGISTER_INDEX) {
+        const DecodedInst to_pc = {.handler = HANDLER_THUMB_HI_TO_PC, .cond = AL, .op = op, .rn = rd, .rm = rm};
+        return to_pc;
+    }
+    return thumb_dp_reg(op, false, rd, op == OP_ADD ? rd : 0, rm, SHIFT_LSL, 0);
+}
+
+/// Format 12: ADD Rd, PC|SP, #imm8 * 4
+/// [15:12]: '1010', [11]: SP, [10:8]: Rd, [7:0]: imm8
+static inline DecodedInst decode_thumb_load_address(const halfword_t raw_inst) {
+    static const halfword_t SP_MASK = 0x0800;
+
+    const uint8_t rd = (raw_inst >> 8) & THUMB_LOW_REG_MASK;
+    const word_t offset = (raw_inst & 0xFFu) << 2;
+    if (raw_inst & SP_MASK) return thumb_dp_imm(OP_ADD, false, rd, SP_REGISTER_INDEX, offset);
+
+    const DecodedInst adr = {.handler = HANDLER_THUMB_ADD_PC, .cond = AL, .rd = rd, .imm = offset};
+    return adr;
+}
+
+/// Format 13: ADD SP, #+/-imm7 * 4
+/// [15:8]: '10110000', [7]: negative, [6:0]: imm7
+static inline DecodedInst decode_thumb_adjust_sp(const halfword_t raw_inst) {
+    static const halfword_t NEGATIVE_MASK = 0x0080;
+
+    const word_t offset = (raw_inst & 0x7Fu) << 2;
+    const OpCode op = (raw_inst & NEGATIVE_MASK) ? OP_SUB : OP_ADD;
+    return thumb_dp_imm(op, false, SP_REGISTER_INDEX, SP_REGISTER_INDEX, offset);
+}
+
+/// Executes ADD Rd, PC, #imm, the PC is word aligned before the addition
+static inline void thumb_add_pc_op(CpuState* cpu, const DecodedInst* inst) {
+    static const word_t WORD_ALIGN_CLEAR_MASK = ~3u;
+    assert(cpu != NULL);
+    assert(inst != NULL);
+
+    cpu_set_reg(cpu, inst->rd, (cpu_get_pc(cpu) & WORD_ALIGN_CLEAR_MASK) + inst->imm);
+}
+
+/// Executes ADD PC, Rm / MOV PC, Rm, the state stays Thumb so bit 0 of the result is dropped
+/// Always taken
+static inline void thumb_hi_to_pc_op(CpuState* cpu, const DecodedInst* inst) {
+    static const word_t THUMB_PC_ALIGN_MASK = ~1u;
+    assert(cpu != NULL);
+    assert(inst != NULL);
+
+    const word_t operand = cpu_get_reg(cpu, inst->rm);
+    const word_t result = inst->op == OP_ADD ? cpu_get_reg(cpu, inst->rn) + operand : operand;
+    cpu_set_pc(cpu, result & THUMB_PC_ALIGN_MASK);
+}
@@ -0,0 +1,336 @@
+//
+// Created by valentin on 01/25/26.
+//
+#pragma once
+#include <assert.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "cpu/cpu.h"
+
+// ELF32 loader
+//
+// The guest address space is one anonymous reservation starting at guest address 0,
+// so guest address A is host address host + A. It is mapped as one RAM region rounded
+// up to whole memory slices, every access to it takes the direct path of memory.h.
+// The kernel only backs its pages when they are first touched, which also gives BSS
+// its zero fill lazily.
+// PT_LOAD segments are mapped over it straight from the file instead of being copied:
+// - read-only segments are shared file mappings, every instance uses the same page cache pages,
+//   they are also ROM regions so a guest store is dropped instead of hitting a read-only host page
+// - writable segments are private (copy-on-write) mappings, only the pages a guest writes get copied
+// Startup therefore costs a few mmap calls however large the image is.
+
+/// Maximum number of PT_LOAD segments kept in an ElfImage
+#define ELF_MAX_SEGMENTS 16
+
+typedef enum ElfError {
+    ELF_OK = 0,
+    /// The file could not be opened or read
+    ELF_ERROR_OPEN,
+    /// Not a well-formed ELF32 little-endian executable
+    ELF_ERROR_FORMAT,
+    /// Not an ARM executable
+    ELF_ERROR_MACHINE,
+    /// Mapping the address space or a segment failed
+    ELF_ERROR_MAP,
+} ElfError;
+
+typedef struct ElfSegment {
+    /// Guest address and size in memory (p_vaddr, p_memsz)
+    word_t address;
+    word_t size;
+    /// Bytes coming from the file (p_filesz), the rest is zero-filled
+    word_t file_size;
+    bool writable;
+    bool executable;
+} ElfSegment;
+
+typedef struct ElfSymbol {
+    /// Points into the read-only view of the file
+    const char *name;
+    word_t value;
+    word_t size;
+    /// STT_FUNC, STT_OBJECT, ...
+    byte_t type;
+} ElfSymbol;
+
+typedef struct ElfImage {
+    /// Guest address space, covers [0, end of the highest segment)
+    ProgramMemory memory;
+    /// Host address of guest address 0
+    byte_t *host;
+    /// Bytes reserved at host (rounded up to whole memory slices)
+    size_t mapping_size;
+    /// Entry point (e_entry)
+    word_t entry;
+
+    ElfSegment segments[ELF_MAX_SEGMENTS];
+    size_t segment_count;
+
+    ElfSymbol *symbols;
+    size_t symbol_count;
+
+    /// Read-only view of the whole file, the symbol names live in it
+    const byte_t *file;
+    size_t file_size;
+
+    ElfError error;
+} ElfImage;
+
+static inline size_t elf_page_size(void) {
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static inline size_t elf_round_up(const size_t value, const size_t page) {
+    return (value + page - 1u) & ~(page - 1u);
+}
+
+static inline bool elf_range_in_file(const ElfImage *image, const uint64_t offset, const uint64_t size) {
+    return offset <= image->file_size && size <= image->file_size - offset;
+}
+
+/// Validates the ELF header and returns it, NULL (with image->error set) when the file is unusable
+static inline const Elf32_Ehdr *elf_header(ElfImage *image) {
+    const Elf32_Ehdr *header = (const Elf32_Ehdr *)image->file;
+    if (image->file_size < sizeof(Elf32_Ehdr) || memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 ||
+        header->e_ident[EI_CLASS] != ELFCLASS32 || header->e_ident[EI_DATA] != ELFDATA2LSB ||
+        header->e_type != ET_EXEC) {
+        image->error = ELF_ERROR_FORMAT;
+        return NULL;
+    }
+    if (header->e_machine != EM_ARM) {
+        image->error = ELF_ERROR_MACHINE;
+        return NULL;
+    }
+    if (header->e_phentsize != sizeof(Elf32_Phdr) ||
+        !elf_range_in_file(image, header->e_phoff, (uint64_t)header->e_phnum * sizeof(Elf32_Phdr))) {
+        image->error = ELF_ERROR_FORMAT;
+        return NULL;
+    }
+    return header;
+}
+
+/// Maps one PT_LOAD segment over the reservation
+static inline bool elf_map_segment(ElfImage *image, const int fd, const Elf32_Phdr *segment) {
+    const size_t page = elf_page_size();
+    byte_t *const base = image->host;
+
+    const int prot = PROT_READ | (segment->p_flags & PF_W ? PROT_WRITE : 0);
+    if (segment->p_filesz == 0u) {
+        // Pure BSS, the reservation is already zero-filled on demand
+        return true;
+    }
+
+    const size_t page_start = segment->p_vaddr & ~(page - 1u);
+    const size_t head = segment->p_vaddr - page_start;
+    if ((segment->p_offset - head) % page != 0u) {
+        // File offset and address disagree within a page, mmap cannot place it, copy instead
+        // (the pages stay writable, they may be shared with a neighbouring segment)
+        memcpy(base + segment->p_vaddr, image->file + segment->p_offset, segment->p_filesz);
+        return true;
+    }
+
+    const size_t file_end = segment->p_vaddr + segment->p_filesz;
+    const size_t mapped_size = elf_round_up(head + segment->p_filesz, page);
+    const size_t tail = page_start + mapped_size - file_end;
+
+    // The last file page carries whatever follows the segment in the file, it must read as
+    // zero when the segment extends into it. That page is then written, so it needs a private mapping.
+    const bool zero_tail = tail != 0u && segment->p_memsz > segment->p_filesz;
+    const bool private_mapping = (segment->p_flags & PF_W) || zero_tail;
+
+    void *mapped = mmap(base + page_start, mapped_size, zero_tail ? PROT_READ | PROT_WRITE : prot,
+                        MAP_FIXED | (private_mapping ? MAP_PRIVATE : MAP_SHARED), fd,
+                        (off_t)(segment->p_offset - head));
+    if (mapped == MAP_FAILED) return false;
+
+    if (zero_tail) {
+        memset(base + file_end, 0, tail);
+        if (mprotect(mapped, mapped_size, prot) != 0) return false;
+    }
+    return true;
+}
+
+static inline bool elf_map_segments(ElfImage *image, const int fd, const Elf32_Ehdr *header) {
+    const Elf32_Phdr *segments = (const Elf32_Phdr *)(image->file + header->e_phoff);
+
+    // Size of the address space: the end of the highest segment
+    uint64_t end = 0;
+    for (size_t i = 0; i < header->e_phnum; ++i) {
+        const Elf32_Phdr *segment = &segments[i];
+        if (segment->p_type != PT_LOAD || segment->p_memsz == 0u) continue;
+        if (segment->p_filesz > segment->p_memsz || !elf_range_in_file(image, segment->p_offset, segment->p_filesz) ||
+            image->segment_count == ELF_MAX_SEGMENTS) {
+            image->error = ELF_ERROR_FORMAT;
+            return false;
+        }
+        const uint64_t segment_end = (uint64_t)segment->p_vaddr + segment->p_memsz;
+        if (segment_end > end) end = segment_end;
+
+        image->segments[image->segment_count++] = (ElfSegment){
+            .address = segment->p_vaddr,
+            .size = segment->p_memsz,
+            .file_size = segment->p_filesz,
+            .writable = (segment->p_flags & PF_W) != 0,
+            .executable = (segment->p_flags & PF_X) != 0,
+        };
+    }
+    if (end == 0u || end > UINT32_MAX) {
+        image->error = ELF_ERROR_FORMAT;
+        return false;
+    }
+
+    // Reserve the whole guest address space, nothing is backed until touched
+    image->mapping_size = elf_round_up((size_t)end, (size_t)MEM_SLICE_SIZE);
+    void *reservation = mmap(NULL, image->mapping_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reservation == MAP_FAILED) {
+        image->mapping_size = 0;
+        image->error = ELF_ERROR_MAP;
+        return false;
+    }
+    image->host = reservation;
+    image->memory = construct_empty_memory();
+    mem_map_ram(&image->memory, 0, image->mapping_size, image->host);
+
+    for (size_t i = 0; i < header->e_phnum; ++i) {
+        if (segments[i].p_type != PT_LOAD || segments[i].p_memsz == 0u) continue;
+        if (!elf_map_segment(image, fd, &segments[i])) {
+            image->error = ELF_ERROR_MAP;
+            return false;
+        }
+    }
+
+    // Read-only segments go on top of the RAM, they keep its bias so reads stay on the direct path
+    for (size_t i = 0; i < image->segment_count; ++i) {
+        const ElfSegment *segment = &image->segments[i];
+        if (segment->writable) continue;
+        if (image->memory.map->region_count == MEM_MAX_REGIONS) break;
+        mem_map_rom(&image->memory, segment->address, segment->size, image->host + segment->address);
+    }
+    return true;
+}
+
+/// Collects the symbols of the first SHT_SYMTAB section, a stripped file simply has none
+static inline bool elf_read_symbols(ElfImage *image, const Elf32_Ehdr *header) {
+    if (header->e_shoff == 0u || header->e_shnum == 0u) return true;
+    if (header->e_shentsize != sizeof(Elf32_Shdr) ||
+        !elf_range_in_file(image, header->e_shoff, (uint64_t)header->e_shnum * sizeof(Elf32_Shdr))) {
+        image->error = ELF_ERROR_FORMAT;
+        return false;
+    }
+    const Elf32_Shdr *sections = (const Elf32_Shdr *)(image->file + header->e_shoff);
+
+    for (size_t i = 0; i < header->e_shnum; ++i) {
+        const Elf32_Shdr *symtab = &sections[i];
+        if (symtab->sh_type != SHT_SYMTAB) continue;
+
+        const Elf32_Shdr *strtab = symtab->sh_link < header->e_shnum ? &sections[symtab->sh_link] : NULL;
+        if (strtab == NULL || symtab->sh_entsize != sizeof(Elf32_Sym) ||
+            !elf_range_in_file(image, symtab->sh_offset, symtab->sh_size) ||
+            !elf_range_in_file(image, strtab->sh_offset, strtab->sh_size) || strtab->sh_size == 0u ||
+            image->file[strtab->sh_offset + strtab->sh_size - 1u] != '\0') {
+            image->error = ELF_ERROR_FORMAT;
+            return false;
+        }
+
+        const Elf32_Sym *entries = (const Elf32_Sym *)(image->file + symtab->sh_offset);
+        const size_t count = symtab->sh_size / sizeof(Elf32_Sym);
+        image->symbols = malloc(count * sizeof(ElfSymbol));
+        assert(count == 0u || image->symbols != NULL);
+
+        const char *names = (const char *)(image->file + strtab->sh_offset);
+        for (size_t s = 0; s < count; ++s) {
+            // Entry 0 is the reserved null symbol, unnamed ones (sections, files) are of no use here
+            if (entries[s].st_name == 0u || entries[s].st_name >= strtab->sh_size) continue;
+            image->symbols[image->symbol_count++] = (ElfSymbol){
+                .name = names + entries[s].st_name,
+                .value = entries[s].st_value,
+                .size = entries[s].st_size,
+                .type = (byte_t)ELF32_ST_TYPE(entries[s].st_info),
+            };
+        }
+        return true;
+    }
+    return true;
+}
+
+static inline void destroy_elf_image(ElfImage *image) {
+    assert(image != NULL);
+    if (image->memory.map != NULL) destroy_memory(&image->memory);
+    if (image->mapping_size != 0u) munmap(image->host, image->mapping_size);
+    if (image->file != NULL) munmap((void *)image->file, image->file_size);
+    free(image->symbols);
+
+    const ElfError error = image->error;
+    *image = (ElfImage){0};
+    image->error = error;
+}
+
+/// Maps the ELF32 ARM executable at `path` into a fresh guest address space
+/// On failure image.error tells why and the image holds no mappings.
+static inline ElfImage construct_elf_image(const char *path) {
+    assert(path != NULL);
+    ElfImage image = {0};
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0 || status.st_size <= 0) {
+        if (fd >= 0) close(fd);
+        image.error = ELF_ERROR_OPEN;
+        return image;
+    }
+
+    // Headers, section table and symbol names are read in place, nothing is copied
+    image.file_size = (size_t)status.st_size;
+    void *file = mmap(NULL, image.file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file == MAP_FAILED) {
+        close(fd);
+        image.file_size = 0;
+        image.error = ELF_ERROR_OPEN;
+        return image;
+    }
+    image.file = file;
+
+    const Elf32_Ehdr *header = elf_header(&image);
+    const bool loaded = header != NULL && elf_map_segments(&image, fd, header) && elf_read_symbols(&image, header);
+    // The mappings keep the file referenced
+    close(fd);
+
+    if (!loaded) {
+        destroy_elf_image(&image);
+        return image;
+    }
+    image.entry = header->e_entry;
+    return image;
+}
+
+/// Points the CPU at the entry of the image
+static inline void elf_set_entry(CpuState *cpu, const ElfImage *image) {
+    assert(cpu != NULL);
+    assert(image != NULL && image->error == ELF_OK);
+    cpu_set_pc(cpu, image->entry);
+}
+
+/// Value of the symbol called `name`, false when the image has none
+static inline bool elf_lookup_symbol(const ElfImage *image, const char *name, word_t *value) {
+    assert(image != NULL);
+    assert(name != NULL);
+    for (size_t i = 0; i < image->symbol_count; ++i) {
+        if (strcmp(image->symbols[i].name, name) == 0) {
+            *value = image->symbols[i].value;
+            return true;
+        }
+    }
+    return false;
+}
@@ -18,70 +18,178 @@
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include "memory.h"
 #include "cpu/cpu.h"
-#include "instructions/data_processing/data_processing.h"
+#include "decoder/decoder.h"
+#include "decoder/thumb_decoder.h"
+#include "executor/dispatch.h"
 #include "instructions/instructions_enums.h"
-#include "faults/codes.h"
+#include "faults/fault.h"
+#include "parser.h"
+#include "loader/elf.h"
+#include "scheduler/scheduler.h"
+#include "scheduler/fork_server.h"
 
 
 
-static uint32_t fetch(const ProgramMemory *mem, const uint32_t pc, FaultCodeExecute *fault_out) {
-    // Validate inputs
-    assert(mem != NULL);
-    assert(mem->words != NULL);
-    assert(fault_out != NULL);
-    assert(*fault_out == FAULT_NONE);
+/// Sums 10 + 9 + ... + 1 into r0, then fills 16 words at 0x200 with it, copies them to
+/// 0x300 and scans up to its first byte there. The loops run once, cold: the interpreter
+/// must hand them to their idioms or the program faults.
+static const char PROGRAM[] =
+    "_start:\n"
+    "    mov   r0, #0\n"
+    "    mov   r1, #10\n"
+    "loop:\n"
+    "    add   r0, r0, r1\n"
+    "    subs  r1, r1, #1\n"
+    "    bne   loop\n"
+    "    orr   r2, r0, #0xFF000000\n"
+    "    and   r3, r2, r0\n"
+    "    mov   r4, #0x200\n"
+    "    mov   r5, #16\n"
+    "fill:\n"
+    "    str   r0, [r4], #4\n"
+    "    subs  r5, r5, #1\n"
+    "    bne   fill\n"
+    "    mov   r4, #0x200\n"
+    "    mov   r6, #0x300\n"
+    "    mov   r5, #16\n"
+    "copy:\n"
+    "    ldr   r7, [r4], #4\n"
+    "    str   r7, [r6], #4\n"
+    "    subs  r5, r5, #1\n"
+    "    bne   copy\n"
+    "    mov   r6, #0x2F0\n"
+    "scan:\n"
+    "    ldrb  r7, [r6], #1\n"
+    "    cmp   r7, #55\n"
+    "    bne   scan\n";
 
-    // Check for alignment (PC must be multiple of 4)
-    if (pc & 3u) {
-        *fault_out = FAULT_ALIGNMENT;
-        return 0;
+/// Assembles the built-in sample program into `memory`, returns false on an assembly error
+static bool load_sample_program(const ProgramMemory *memory, CpuState *cpu, FaultTrap *trap) {
+    AsmProgram program = construct_asm_program(PROGRAM, sizeof(PROGRAM) - 1, INITIAL_PC);
+    if (!program.ok) {
+        fprintf(stderr, "line %zu: %s\n", program.error_line, program.error);
+        destroy_asm_program(&program);
+        return false;
     }
+    asm_load_program(&program, memory);
+    cpu_set_pc(cpu, program.entry);
+    *trap = construct_fault_trap(program.base_address, (word_t)program.size);
+    destroy_asm_program(&program);
+    return true;
+}
 
-    // Shift PC right by 2 (divide by 4) to get word index
-    // We do it like this because PC is byte-addressed and
-    // memory is word-addressed (4 bytes per word)
-    const uint32_t index = pc >> 2;
+static const char USAGE[] =
+    "usage: %s [-c block-store-dir] [-p pause-address] [-S socket | -P in-fd,out-fd] [program.elf...]\n";
 
-    // If index is out of bounds, return fault
-    if (index >= mem->word_count) {
-        *fault_out = FAULT_OUT_OF_BOUNDS;
-        return 0;
+/// Runs the only guest up to `pause_at` (GUEST_NO_PAUSE: not at all), then serves
+/// fork server jobs on the Unix socket `socket_path`, or on the pipes `pipes`
+static int run_fork_server(Scheduler *scheduler, const word_t pause_at, const char *socket_path, const int pipes[2]) {
+    Guest *guest = &scheduler->guests[0];
+    if (pause_at != GUEST_NO_PAUSE) {
+        guest->pause_at = pause_at;
+        scheduler_run(scheduler, 1u);
+        if (guest->status != GUEST_PAUSED) {
+            fprintf(stderr, "the guest finished before reaching 0x%08x\n", pause_at);
+            return 1;
+        }
     }
 
-    return mem->words[index];
+    ForkServer server = construct_fork_server(scheduler, guest);
+    const bool served = socket_path != NULL ? fork_server_listen(&server, socket_path)
+                                            : fork_server_serve(&server, pipes[0], pipes[1]);
+    if (!served) perror("fork server");
+    return served ? 0 : 1;
 }
 
+/// Usage: SimpleARM [-c block-store-dir] [-p pause-address] [-S socket | -P in-fd,out-fd] [program.elf...]
+/// Every ELF file runs as its own guest, without one the built-in sample program runs.
+/// With -c the translated blocks are read from and written back to that directory.
+/// With -S or -P the only guest runs up to the pause address and every request on the
+/// socket or pipes then runs it to the end in a forked child (see fork_server.h).
+/// When __AFL_SHM_ID names a shared memory segment the guests' edge coverage goes there.
+/// Returns the first non-zero guest status (SYS_EXIT status or fault), 0 when all succeed
+int main(const int argc, char **argv) {
+    const char *block_store = NULL;
+    const char *socket_path = NULL;
+    int pipes[2] = {-1, -1};
+    word_t pause_at = GUEST_NO_PAUSE;
+    for (int option; (option = getopt(argc, argv, "c:p:S:P:")) != -1;) {
+        switch (option) {
+        case 'c': block_store = optarg; break;
+        case 'p': pause_at = (word_t)strtoul(optarg, NULL, 0); break;
+        case 'S': socket_path = optarg; break;
+        case 'P':
+            if (sscanf(optarg, "%d,%d", &pipes[0], &pipes[1]) == 2) break;
+            // fallthrough
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            return 1;
+        }
+    }
+    const int program_count = argc - optind;
+    char **programs = argv + optind;
+    const bool fork_server = socket_path != NULL || pipes[0] >= 0;
+    if (fork_server && program_count > 1) {
+        fprintf(stderr, "the fork server runs one guest\n");
+        return 1;
+    }
 
+    const size_t guest_count = program_count > 0 ? (size_t)program_count : 1u;
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    // Parked guests only pay off when another guest can run meanwhile, and a compiler
+    // thread when it has a core of its own
+    Scheduler *scheduler = construct_scheduler(guest_count, SCHEDULER_DEFAULT_QUANTUM,
+                                               guest_count > 1u ? IO_POOL_DEFAULT_WORKERS : 0u, cores > 1);
+    if (scheduler == NULL) {
+        fprintf(stderr, "cannot allocate %zu guests\n", guest_count);
+        return 1;
+    }
+    thumb_decode_table_init();
+    CoverageMap *coverage = coverage_map_from_env();
+    scheduler->coverage = coverage;
 
-int main(void) {
-    // Initialize memory and registers
-    const ProgramMemory memory = construct_memory();
-
-    CpuState cpu = construct_cpu_state();
-
-    cpu_set_pc(&cpu, INITIAL_PC);
+    ElfImage *images = calloc(guest_count, sizeof(ElfImage));
+    for (int i = 0; i < program_count; ++i) {
+        ElfImage *image = &images[i];
+        *image = construct_elf_image(programs[i]);
+        if (image->error != ELF_OK) {
+            fprintf(stderr, "%s: cannot load (error %d)\n", programs[i], image->error);
+            return 1;
+        }
+        CpuState cpu = construct_cpu_state();
+        elf_set_entry(&cpu, image);
+        // The reservation may span the whole 4 GiB, clamp the window to what a word can hold
+        scheduler_add_guest(scheduler, &cpu, image->memory, 0,
+                            image->mapping_size > UINT32_MAX ? UINT32_MAX : (word_t)image->mapping_size);
+    }
+    if (program_count <= 0) {
+        CpuState cpu = construct_cpu_state();
+        ProgramMemory memory = construct_memory();
+        FaultTrap trap;
+        if (!load_sample_program(&memory, &cpu, &trap)) return 1;
+        scheduler_add_guest(scheduler, &cpu, memory, trap.fetch_base, trap.fetch_size);
+    }
 
-    memory.words[0] = ENCODE(OP_MOV, 1, 1, 1);
-    memory.words[1] = ENCODE(OP_AND, 1, 1, 1);
-    memory.words[2] = ENCODE(OP_MUL, 1, 1, 1);
-    memory.words[3] = ENCODE(OP_MOVI, 1, 1, 1);
-    memory.words[4] = ENCODE(OP_ADD, 1, 1, 1);
-    memory.words[5] = ENCODE(OP_BEQ, 1, 1, 1);
-    memory.words[6] = ENCODE(OP_LDR, 1, 1, 1);
-    memory.words[7] = ENCODE(OP_ORR, 1, 1, 1);
+    if (block_store != NULL) scheduler_load_blocks(scheduler, block_store);
+    // Only returns when the server stops, the children never get here
+    if (fork_server) return run_fork_server(scheduler, pause_at, socket_path, pipes);
+    scheduler_run(scheduler, cores > 0 ? (size_t)cores : 1u);
+    if (block_store != NULL && !scheduler_save_blocks(scheduler, block_store)) {
+        fprintf(stderr, "%s: cannot write the block store\n", block_store);
+    }
 
-    FaultCodeExecute fault_out = FAULT_NONE;
-    do {
-        const uint32_t pc = cpu_get_pc(&cpu);
-        const uint32_t raw_inst = fetch(&memory, pc, &fault_out);
-        const DecodedInst inst = decode(raw_inst, &fault_out);
-        const ExecResult result = execute_instruction(&cpu, &inst);
-        if (result.error_code) return result.error_code;
-        if (result.should_halt) break;
-        cpu_set_pc(&cpu, result.next_pc);
+    int status = 0;
+    for (size_t i = 0; i < scheduler->guest_count && status == 0; ++i) {
+        status = guest_exit_status(&scheduler->guests[i]);
     }
-    while (fault_out == FAULT_NONE);
-    return 0;
+    destroy_scheduler(scheduler);
+    destroy_coverage_map(coverage);
+    for (int i = 0; i < program_count; ++i) destroy_elf_image(&images[i]);
+    free(images);
+    return status;
 }
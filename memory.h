@@ -4,6 +4,9 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include <assert.h>
 #include <stdbool.h>
@@ -27,21 +30,695 @@ static const size_t WORD_SIZE_BITS = BYTE_SIZE_BITS * WORD_SIZE_BYTES;
 
 #define MEMORY_SIZE 1024u
 
+// -------------------------
+// Region map
+// -------------------------
+// The 32-bit address space is cut into slices of 2^MEM_SLICE_SHIFT bytes, each with
+// one entry in a two-level table: a directory of MEM_DIR_COUNT slice tables, each
+// allocated once something is mapped in its range (all others point at one empty
+// table), so a guest only carries the tables of the ranges it maps. A slice stores
+// the bias (host address - guest address) of the host memory backing it, and the
+// span of the slice that bias holds for: the whole slice, or the longest run one
+// region backs when the slice is only partly mapped (a small RAM at 0, the tail of
+// a segment). An access within the span is one table lookup, a bounds compare and a
+// pointer add. Everything else (devices, ROM writes, slices shared by regions with
+// different backing, unmapped addresses) goes through the region list, and an access
+// no region holds is handed to MemFaultOps.
+//
+// RAM can be cloned copy-on-write (mem_clone). The RAM of the parent then becomes a
+// frozen source both sides read from, and each side gets a private buffer that only
+// takes host pages once written. The page (MEM_PAGE_SIZE) is the unit of sharing: a
+// page still shared reads straight from the source and sends writes to the slow path,
+// whose first write copies that page into the private buffer (mem_cow_privatise);
+// from then on the page is plain RAM again. Memory therefore grows with the pages
+// written. A slice whose pages read from both buffers keeps its spans on the longest
+// run of pages read from (or written to) one of them, as for a partly mapped slice.
+//
+// Pages holding translated guest code are watched (mem_watch_code). Every path that
+// lets the guest write memory, the slice fast path, the slow path and the writable
+// host pointers, checks the page and reports a write to a watched one through
+// MemWriteOps, so the translations of the code written over are dropped.
+
+/// Build with -DMEM_SLICE_SHIFT=<n> for a finer (and larger) slice table
+#ifndef MEM_SLICE_SHIFT
+#define MEM_SLICE_SHIFT 20u
+#endif
+#define MEM_SLICE_SIZE (1ull << MEM_SLICE_SHIFT)
+#define MEM_SLICE_COUNT (1u << (32u - MEM_SLICE_SHIFT))
+#define MEM_SLICE_MASK ((word_t)(MEM_SLICE_SIZE - 1u))
+_Static_assert(MEM_SLICE_SHIFT < 32u, "slice offsets and spans are 32-bit");
+#define MEM_MAX_REGIONS 32u
+
+/// Slices per slice table, the directory has one table per 2^MEM_DIR_SHIFT bytes
+#define MEM_DIR_SLICES 64u
+#define MEM_DIR_SHIFT (MEM_SLICE_SHIFT + 6u)
+#define MEM_DIR_COUNT (MEM_SLICE_COUNT / MEM_DIR_SLICES)
+_Static_assert(MEM_DIR_SHIFT < 32u, "the directory has more than one table");
+
+/// Granule of copy-on-write and of the code watch, the small page of the MMU
+#define MEM_PAGE_SHIFT 12u
+#define MEM_PAGE_SIZE (1u << MEM_PAGE_SHIFT)
+#define MEM_SLICE_PAGES (1u << (MEM_SLICE_SHIFT - MEM_PAGE_SHIFT))
+#define MEM_SLICE_PAGE_WORDS ((MEM_SLICE_PAGES + 63u) / 64u)
+_Static_assert(MEM_SLICE_SHIFT >= MEM_PAGE_SHIFT, "a slice holds whole pages");
+
+typedef enum MemRegionKind {
+    /// Host memory, read and written directly
+    MEM_REGION_RAM,
+    /// Host memory, read directly, guest writes are ignored (loaders still fill it through mem_host_ptr)
+    MEM_REGION_ROM,
+    /// Device, every access goes to its callbacks
+    MEM_REGION_MMIO,
+} MemRegionKind;
+
+/// Callbacks of an MMIO region, offsets are relative to the region base
+typedef struct MmioOps {
+    word_t (*read)(void *device, word_t offset, word_t size_bytes);
+    void (*write)(void *device, word_t offset, word_t value, word_t size_bytes);
+    void *device;
+} MmioOps;
+
+typedef struct MemRegion {
+    MemRegionKind kind;
+    word_t base;
+    /// Bytes covered, base + size must not exceed 2^32
+    uint64_t size;
+    /// Backing memory of RAM/ROM, host[0] is guest address base
+    /// Of a copy-on-write region: the private buffer, mapped by mem_clone and only valid in privatised pages
+    byte_t *host;
+    /// Frozen source of the slices a copy-on-write RAM region still shares, NULL for any other region
+    byte_t *shared;
+    MmioOps mmio;
+} MemRegion;
+
+/// Leaves an access that no region holds, see mem_set_fault_ops
+typedef struct MemFaultOps {
+    /// Must not return, it unwinds the guest access (through the trap of its run loop)
+    void (*unmapped)(void *context, word_t addr);
+    void *context;
+} MemFaultOps;
+
+/// Told about guest writes to the pages mem_watch_code marked, see mem_set_code_write_ops
+typedef struct MemWriteOps {
+    /// The page [page, page + size) was written, it is no longer watched
+    void (*written)(void *context, word_t page, word_t size);
+    void *context;
+} MemWriteOps;
+
+typedef struct MemSlice {
+    /// host - guest address bias valid for the slice offsets [low, low + span) of reads / writes
+    uintptr_t read_bias;
+    uintptr_t write_bias;
+    /// A span of 0 sends every access of that kind to the slow path
+    word_t read_low;
+    word_t read_span;
+    word_t write_low;
+    word_t write_span;
+    /// One bit per page copied out of the copy-on-write sources, see mem_cow_privatise
+    uint64_t privatised[MEM_SLICE_PAGE_WORDS];
+    /// One bit per page holding translated code, see mem_watch_code
+    uint64_t code[MEM_SLICE_PAGE_WORDS];
+} MemSlice;
+
+typedef struct MemSliceTable {
+    MemSlice slices[MEM_DIR_SLICES];
+} MemSliceTable;
+
+/// Table of every range with nothing mapped, all spans 0: never written
+static MemSliceTable mem_no_slices;
+
+typedef struct MemoryMap {
+    /// Slice tables, &mem_no_slices for a range nothing was mapped in
+    MemSliceTable *tables[MEM_DIR_COUNT];
+    /// In mapping order, a later region hides the earlier ones it overlaps
+    MemRegion regions[MEM_MAX_REGIONS];
+    size_t region_count;
+    /// Unmapped accesses, without a handler they abort the host
+    MemFaultOps fault;
+    /// Writes to the watched pages, without a handler they are only unwatched
+    MemWriteOps code_writes;
+} MemoryMap;
+
 typedef struct ProgramMemory {
     /// Byte-addressed memory (ARM memory model is byte-addressable)
-    byte_t *bytes;
-    /// Number of bytes in memory
-    size_t byte_count;
+    MemoryMap *map;
 } ProgramMemory;
 
 static byte_t g_mem[MEMORY_SIZE];
 
+/// Address space with nothing mapped
+static inline ProgramMemory construct_empty_memory(void) {
+    const ProgramMemory m = {.map = calloc(1, sizeof(MemoryMap))};
+    assert(m.map != NULL);
+    for (size_t i = 0; i < MEM_DIR_COUNT; ++i) m.map->tables[i] = &mem_no_slices;
+    return m;
+}
+
+/// Unmaps the private buffers of copy-on-write regions, the sources belong to whoever mapped them
+static inline void destroy_memory(ProgramMemory *m) {
+    assert(m != NULL);
+    for (size_t i = 0; i < m->map->region_count; ++i) {
+        const MemRegion *region = &m->map->regions[i];
+        if (region->shared != NULL) munmap(region->host, region->size);
+    }
+    for (size_t i = 0; i < MEM_DIR_COUNT; ++i) {
+        if (m->map->tables[i] != &mem_no_slices) free(m->map->tables[i]);
+    }
+    free(m->map);
+    m->map = NULL;
+}
+
+static inline size_t mem_slice_of(const word_t addr) {
+    return addr >> MEM_SLICE_SHIFT;
+}
+
+/// Entry of the slice holding `addr`, read-only for a range nothing is mapped in
+static inline MemSlice *mem_slice_entry(const MemoryMap *map, const word_t addr) {
+    return &map->tables[addr >> MEM_DIR_SHIFT]->slices[(addr >> MEM_SLICE_SHIFT) & (MEM_DIR_SLICES - 1u)];
+}
+
+/// Entry of `slice` to write to, its table is allocated on first use
+static inline MemSlice *mem_slice_writable(MemoryMap *map, const size_t slice) {
+    MemSliceTable **table = &map->tables[slice / MEM_DIR_SLICES];
+    if (*table == &mem_no_slices) {
+        *table = calloc(1, sizeof(MemSliceTable));
+        assert(*table != NULL);
+    }
+    return &(*table)->slices[slice % MEM_DIR_SLICES];
+}
+
+static inline size_t mem_page_in_slice(const word_t addr) {
+    return (addr >> MEM_PAGE_SHIFT) & (MEM_SLICE_PAGES - 1u);
+}
+
+static inline uint64_t mem_page_start(const uint64_t addr) {
+    return addr & ~(uint64_t)(MEM_PAGE_SIZE - 1u);
+}
+
+/// True when the page holding `addr` was copied out of the copy-on-write sources
+static inline bool mem_page_privatised(const MemoryMap *map, const word_t addr) {
+    const size_t page = mem_page_in_slice(addr);
+    return (mem_slice_entry(map, addr)->privatised[page / 64u] & (1ull << (page % 64u))) != 0u;
+}
+
+/// True when the page holding `addr` of a copy-on-write region still reads from the source
+static inline bool mem_cow_shared(const MemoryMap *map, const MemRegion *region, const word_t addr) {
+    return region->shared != NULL && !mem_page_privatised(map, addr);
+}
+
+/// Host memory holding the guest bytes of `region` in the page of `addr`, host[0] is guest address base
+static inline byte_t *mem_region_host(const MemoryMap *map, const MemRegion *region, const word_t addr) {
+    return mem_cow_shared(map, region, addr) ? region->shared : region->host;
+}
+
+/// True when the accesses of one kind to the part of [start, end) `region` holds may use one bias, stored in `bias`
+/// Not for a device or a ROM written to, nor for copy-on-write pages that are still
+/// shared for a write, or that do not all read from the same buffer.
+static inline bool mem_region_direct(const MemoryMap *map, const MemRegion *region, const uint64_t start,
+                                     const uint64_t end, const bool writes, uintptr_t *bias) {
+    if (!(region->kind == MEM_REGION_RAM || (!writes && region->kind == MEM_REGION_ROM))) return false;
+    const uint64_t low = region->base > start ? region->base : start;
+    const uint64_t high = region->base + region->size < end ? region->base + region->size : end;
+    const bool shared = mem_cow_shared(map, region, (word_t)low);
+    if (region->shared != NULL) {
+        // A write to a shared page privatises it first, through the slow path
+        if (writes && shared) return false;
+        for (uint64_t page = mem_page_start(low) + MEM_PAGE_SIZE; page < high; page += MEM_PAGE_SIZE) {
+            if (mem_cow_shared(map, region, (word_t)page) != shared) return false;
+        }
+    }
+    *bias = (uintptr_t)(shared ? region->shared : region->host) - region->base;
+    return true;
+}
+
+
+/// Bias shared by every region overlapping [start, end) when, together, they cover it
+/// completely with host memory of the allowed kinds. 0 when there is no such bias.
+/// The range lies within one slice.
+static inline uintptr_t mem_range_bias(const MemoryMap *map, const uint64_t start, const uint64_t end,
+                                       const bool writes) {
+    uintptr_t bias = 0;
+    for (size_t i = 0; i < map->region_count; ++i) {
+        const MemRegion *region = &map->regions[i];
+        if (region->base >= end || region->base + region->size <= start) continue;
+
+        uintptr_t region_bias;
+        if (!mem_region_direct(map, region, start, end, writes, &region_bias)) return 0;
+        if (bias != 0u && region_bias != bias) return 0;
+        bias = region_bias;
+    }
+
+    // Coverage: walk forward through the regions reaching furthest from the current point
+    uint64_t covered = start;
+    while (covered < end) {
+        uint64_t reach = covered;
+        for (size_t i = 0; i < map->region_count; ++i) {
+            const MemRegion *region = &map->regions[i];
+            if (region->base <= covered && region->base + region->size > reach) reach = region->base + region->size;
+        }
+        if (reach == covered) return 0;
+        covered = reach;
+    }
+    return bias;
+}
+
+/// Longest run of `slice` with one bias for reads or writes, its offsets go to `low` and `span`
+/// The whole slice when it has one, otherwise the largest visible part of a single region
+/// (of a copy-on-write region, whose pages all read from, or write to, one buffer).
+static inline uintptr_t mem_slice_direct_span(const MemoryMap *map, const size_t slice, const bool writes,
+                                              word_t *low, word_t *span) {
+    const uint64_t start = (uint64_t)slice << MEM_SLICE_SHIFT;
+    const uint64_t end = start + MEM_SLICE_SIZE;
+    uintptr_t best = mem_range_bias(map, start, end, writes);
+    *low = 0;
+    *span = best != 0u ? (word_t)MEM_SLICE_SIZE : 0u;
+    if (best != 0u) return best;
+
+    for (size_t i = 0; i < map->region_count; ++i) {
+        const MemRegion *region = &map->regions[i];
+        uint64_t from = region->base > start ? region->base : start;
+        uint64_t to = region->base + region->size < end ? region->base + region->size : end;
+        // Newer regions hide what they overlap, the run stops at the first one
+        for (size_t j = i + 1; j < map->region_count && from < to; ++j) {
+            const MemRegion *above = &map->regions[j];
+            if (above->base >= to || above->base + above->size <= from) continue;
+            if (above->base <= from) from = to;
+            else to = above->base;
+        }
+        // Copy-on-write pages cut the run where they change buffer
+        while (from < to) {
+            uint64_t run_end = to;
+            if (region->shared != NULL) {
+                const bool shared = mem_cow_shared(map, region, (word_t)from);
+                run_end = mem_page_start(from) + MEM_PAGE_SIZE;
+                while (run_end < to && mem_cow_shared(map, region, (word_t)run_end) == shared) {
+                    run_end += MEM_PAGE_SIZE;
+                }
+                if (run_end > to) run_end = to;
+            }
+            uintptr_t bias;
+            if (run_end - from > *span && mem_region_direct(map, region, from, run_end, writes, &bias)) {
+                best = bias;
+                *low = (word_t)(from - start);
+                *span = (word_t)(run_end - from);
+            }
+            from = run_end;
+        }
+    }
+    return best;
+}
+
+static inline void mem_update_slices(MemoryMap *map, const word_t base, const uint64_t size) {
+    const size_t first = base >> MEM_SLICE_SHIFT;
+    const size_t last = (size_t)((base + size - 1u) >> MEM_SLICE_SHIFT);
+    for (size_t slice = first; slice <= last; ++slice) {
+        MemSlice *entry = mem_slice_writable(map, slice);
+        entry->read_bias = mem_slice_direct_span(map, slice, false, &entry->read_low, &entry->read_span);
+        entry->write_bias = mem_slice_direct_span(map, slice, true, &entry->write_low, &entry->write_span);
+    }
+}
+
+/// True when the access [addr, addr + size_bytes) lies within the span [low, low + span) of its slice
+static inline bool mem_span_holds(const word_t low, const word_t span, const word_t addr, const word_t size_bytes) {
+    // Below low the offset wraps around and fails the compare too
+    return (uint64_t)((addr & MEM_SLICE_MASK) - low) + size_bytes <= span;
+}
+
+/// Adds a region on top of the map
+static inline const MemRegion *mem_map_region(const ProgramMemory *m, const MemRegion region) {
+    assert(m != NULL && m->map != NULL);
+    assert(m->map->region_count < MEM_MAX_REGIONS);
+    assert(region.size != 0u && region.base + region.size <= (1ull << 32));
+    assert(region.kind == MEM_REGION_MMIO || region.host != NULL);
+
+    MemRegion *mapped = &m->map->regions[m->map->region_count++];
+    *mapped = region;
+    mem_update_slices(m->map, region.base, region.size);
+    return mapped;
+}
+
+static inline const MemRegion *mem_map_ram(const ProgramMemory *m, const word_t base, const uint64_t size,
+                                           byte_t *host) {
+    const MemRegion region = {.kind = MEM_REGION_RAM, .base = base, .size = size, .host = host};
+    return mem_map_region(m, region);
+}
+
+static inline const MemRegion *mem_map_rom(const ProgramMemory *m, const word_t base, const uint64_t size,
+                                           byte_t *host) {
+    const MemRegion region = {.kind = MEM_REGION_ROM, .base = base, .size = size, .host = host};
+    return mem_map_region(m, region);
+}
+
+static inline const MemRegion *mem_map_mmio(const ProgramMemory *m, const word_t base, const uint64_t size,
+                                            const MmioOps ops) {
+    assert(ops.read != NULL && ops.write != NULL);
+    const MemRegion region = {.kind = MEM_REGION_MMIO, .base = base, .size = size, .mmio = ops};
+    return mem_map_region(m, region);
+}
+
+/// Sends the accesses no region holds to `ops`, instead of aborting the host
+static inline void mem_set_fault_ops(const ProgramMemory *m, const MemFaultOps ops) {
+    assert(m != NULL && m->map != NULL);
+    m->map->fault = ops;
+}
+
+/// Sends guest writes to the pages holding translated code to `ops`
+static inline void mem_set_code_write_ops(const ProgramMemory *m, const MemWriteOps ops) {
+    assert(m != NULL && m->map != NULL);
+    m->map->code_writes = ops;
+}
+
+/// The default memory: MEMORY_SIZE bytes of RAM at address 0
 static inline ProgramMemory construct_memory(void) {
-    const ProgramMemory m = { .bytes = g_mem, .byte_count = MEMORY_SIZE };
+    const ProgramMemory m = construct_empty_memory();
+    mem_map_ram(&m, 0, MEMORY_SIZE, g_mem);
     return m;
 }
+
+// -------------------------
+// Code watch
+// -------------------------
+
+static inline bool mem_code_watched(const MemoryMap *map, const word_t addr) {
+    const size_t page = mem_page_in_slice(addr);
+    return (mem_slice_entry(map, addr)->code[page / 64u] & (1ull << (page % 64u))) != 0u;
+}
+
+/// True when a page of [addr, addr + size_bytes) is watched
+static inline bool mem_code_watched_range(const MemoryMap *map, const word_t addr, const uint64_t size_bytes) {
+    const uint64_t end = (uint64_t)addr + size_bytes;
+    for (uint64_t page = addr & ~(uint64_t)(MEM_PAGE_SIZE - 1u); page < end; page += MEM_PAGE_SIZE) {
+        if (mem_code_watched(map, (word_t)page)) return true;
+    }
+    return false;
+}
+
+/// Watches the pages of [addr, addr + size_bytes), code was translated from them
+/// Returns true when one was not watched yet: host pointers handed out for writing
+/// before (TLB entries, see mem_direct_host) bypass the watch and must be dropped.
+static inline bool mem_watch_code(const ProgramMemory *m, const word_t addr, const uint64_t size_bytes) {
+    assert(m != NULL && m->map != NULL);
+    bool added = false;
+    const uint64_t end = (uint64_t)addr + size_bytes;
+    for (uint64_t page = addr & ~(uint64_t)(MEM_PAGE_SIZE - 1u); page < end; page += MEM_PAGE_SIZE) {
+        uint64_t *code = mem_slice_writable(m->map, (size_t)(page >> MEM_SLICE_SHIFT))->code;
+        const size_t index = mem_page_in_slice((word_t)page);
+        added |= (code[index / 64u] & (1ull << (index % 64u))) == 0u;
+        code[index / 64u] |= 1ull << (index % 64u);
+    }
+    return added;
+}
+
+/// Unwatches the watched pages of [addr, addr + size_bytes) and reports each as written
+__attribute__((noinline))
+static void mem_code_written(const ProgramMemory *m, const word_t addr, const uint64_t size_bytes) {
+    MemoryMap *map = m->map;
+    const uint64_t end = (uint64_t)addr + size_bytes;
+    for (uint64_t page = addr & ~(uint64_t)(MEM_PAGE_SIZE - 1u); page < end; page += MEM_PAGE_SIZE) {
+        if (!mem_code_watched(map, (word_t)page)) continue;
+        const size_t index = mem_page_in_slice((word_t)page);
+        mem_slice_entry(map, (word_t)page)->code[index / 64u] &= ~(1ull << (index % 64u));
+        if (map->code_writes.written != NULL) {
+            map->code_writes.written(map->code_writes.context, (word_t)page, MEM_PAGE_SIZE);
+        }
+    }
+}
+
+/// Guest write of [addr, addr + size_bytes), done or about to be done through a host pointer
+static inline void mem_note_write(const ProgramMemory *m, const word_t addr, const uint64_t size_bytes) {
+    // Single accesses are aligned, they stay within one page
+    if (size_bytes <= WORD_SIZE_BYTES) {
+        if (__builtin_expect(mem_code_watched(m->map, addr), 0)) mem_code_written(m, addr, size_bytes);
+        return;
+    }
+    mem_code_written(m, addr, size_bytes);
+}
+
+// -------------------------
+// Copy-on-write
+// -------------------------
+
+/// Copies the bytes `region` holds within [start, end) between two buffers laid out like its host
+static inline void mem_region_copy(const MemRegion *region, const uint64_t start, const uint64_t end, byte_t *to,
+                                   const byte_t *from) {
+    const uint64_t region_end = region->base + region->size;
+    if (region->base >= end || region_end <= start) return;
+    const uint64_t low = region->base > start ? region->base : start;
+    const uint64_t high = region_end < end ? region_end : end;
+    memcpy(to + (low - region->base), from + (low - region->base), high - low);
+}
+
+/// Copies the privatised pages of `region` between two buffers laid out like its host
+static inline void mem_region_copy_privatised(const MemoryMap *map, const MemRegion *region, byte_t *to,
+                                              const byte_t *from) {
+    const uint64_t end = region->base + region->size;
+    for (uint64_t page = mem_page_start(region->base); page < end; page += MEM_PAGE_SIZE) {
+        if (mem_page_privatised(map, (word_t)page)) mem_region_copy(region, page, page + MEM_PAGE_SIZE, to, from);
+    }
+}
+
+/// Copies the page holding `addr` of every copy-on-write region out of its source, the page then behaves as plain RAM
+static inline void mem_cow_privatise(MemoryMap *map, const word_t addr) {
+    const uint64_t start = mem_page_start(addr);
+    for (size_t i = 0; i < map->region_count; ++i) {
+        const MemRegion *region = &map->regions[i];
+        if (!mem_cow_shared(map, region, addr)) continue;
+        mem_region_copy(region, start, start + MEM_PAGE_SIZE, region->host, region->shared);
+    }
+    const size_t page = mem_page_in_slice(addr);
+    mem_slice_writable(map, mem_slice_of(addr))->privatised[page / 64u] |= 1ull << (page % 64u);
+    mem_update_slices(map, addr, 1u);
+}
+
+/// Privatises the shared pages of [addr, addr + size_bytes), before the host writes to it directly
+static inline void mem_cow_privatise_range(MemoryMap *map, const word_t addr, const uint64_t size_bytes) {
+    const uint64_t end = (uint64_t)addr + size_bytes;
+    for (uint64_t page = mem_page_start(addr); page < end; page += MEM_PAGE_SIZE) {
+        for (size_t i = 0; i < map->region_count; ++i) {
+            if (mem_cow_shared(map, &map->regions[i], (word_t)page)) {
+                mem_cow_privatise(map, (word_t)page);
+                break;
+            }
+        }
+    }
+}
+
+/// Lazily committed buffer of `size` bytes, NULL when the address space is exhausted
+static inline byte_t *mem_cow_buffer(const uint64_t size) {
+    void *buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return buffer == MAP_FAILED ? NULL : buffer;
+}
+
+/// Address space holding the same contents as `parent`, its RAM shared copy-on-write
+/// Writes on either side stay on that side from then on. The RAM the parent had
+/// before its first clone becomes the frozen source: its owner must keep it mapped
+/// until the parent and every clone are destroyed. ROM and MMIO regions are shared
+/// as they are, devices included. TLBs filled from the parent (see mmu.h) must be
+/// flushed, they may point into the source. map is NULL when the buffers cannot be mapped.
+static inline ProgramMemory mem_clone(const ProgramMemory *parent) {
+    assert(parent != NULL && parent->map != NULL);
+    MemoryMap *map = parent->map;
+    ProgramMemory clone = {.map = malloc(sizeof(MemoryMap))};
+    if (clone.map == NULL) return clone;
+
+    // The parent stops writing into what becomes the source
+    for (size_t i = 0; i < map->region_count; ++i) {
+        MemRegion *region = &map->regions[i];
+        if (region->kind != MEM_REGION_RAM || region->shared != NULL) continue;
+        byte_t *buffer = mem_cow_buffer(region->size);
+        if (buffer == NULL) {
+            free(clone.map);
+            clone.map = NULL;
+            return clone;
+        }
+        region->shared = region->host;
+        region->host = buffer;
+        // Pages already privatised for another region are private for this one too
+        mem_region_copy_privatised(map, region, region->host, region->shared);
+        mem_update_slices(map, region->base, region->size);
+    }
+
+    *clone.map = *map;
+    // The parent's translations and who drops them stay with the parent
+    clone.map->code_writes = (MemWriteOps){0};
+    for (size_t i = 0; i < MEM_DIR_COUNT; ++i) {
+        if (map->tables[i] == &mem_no_slices) continue;
+        clone.map->tables[i] = malloc(sizeof(MemSliceTable));
+        assert(clone.map->tables[i] != NULL);
+        *clone.map->tables[i] = *map->tables[i];
+        for (size_t slice = 0; slice < MEM_DIR_SLICES; ++slice) {
+            memset(clone.map->tables[i]->slices[slice].code, 0, sizeof(clone.map->tables[i]->slices[slice].code));
+        }
+    }
+    for (size_t i = 0; i < clone.map->region_count; ++i) {
+        MemRegion *region = &clone.map->regions[i];
+        if (region->shared == NULL) continue;
+        region->host = mem_cow_buffer(region->size);
+        if (region->host == NULL) {
+            // The regions after this one still point at the parent's buffers
+            clone.map->region_count = i;
+            destroy_memory(&clone);
+            return clone;
+        }
+    }
+    // What the parent already wrote is copied, the rest stays shared
+    for (size_t i = 0; i < map->region_count; ++i) {
+        const MemRegion *from = &map->regions[i];
+        if (from->shared != NULL) mem_region_copy_privatised(map, from, clone.map->regions[i].host, from->host);
+    }
+    for (size_t i = 0; i < clone.map->region_count; ++i) {
+        const MemRegion *region = &clone.map->regions[i];
+        if (region->shared != NULL) mem_update_slices(clone.map, region->base, region->size);
+    }
+    return clone;
+}
+
+/// Topmost region holding [addr, addr + size_bytes), NULL when unmapped or split across regions
+static inline const MemRegion *mem_find_region(const ProgramMemory *m, const word_t addr, const word_t size_bytes) {
+    for (size_t i = m->map->region_count; i-- > 0;) {
+        const MemRegion *region = &m->map->regions[i];
+        if (addr < region->base || addr - region->base >= region->size) continue;
+        return (uint64_t)(addr - region->base) + size_bytes <= region->size ? region : NULL;
+    }
+    return NULL;
+}
+
+/// True when [addr, addr + size_bytes) is readable memory (RAM or ROM)
 static inline bool mem_in_bounds(const ProgramMemory *m, const word_t addr, const word_t size_bytes) {
-    return m && size_bytes <= m->byte_count && addr <= (word_t)m->byte_count - size_bytes;
+    if (m == NULL) return false;
+    const MemRegion *region = mem_find_region(m, addr, size_bytes);
+    return region != NULL && region->kind != MEM_REGION_MMIO;
+}
+
+/// True when the aligned access [addr, addr + size_bytes) reads host memory through the slice table
+/// It is then in bounds, only the other accesses need mem_in_bounds
+static inline bool mem_read_is_direct(const ProgramMemory *m, const word_t addr, const word_t size_bytes) {
+    const MemSlice *slice = mem_slice_entry(m->map, addr);
+    return mem_span_holds(slice->read_low, slice->read_span, addr, size_bytes);
+}
+
+/// Host address of [addr, addr + size_bytes) for bulk loads and copies, NULL unless it is RAM or ROM
+/// Writing through it bypasses ROM protection, which is what loaders need. Shared
+/// copy-on-write pages of the range are privatised and its watched pages reported as
+/// written, the caller may write.
+static inline byte_t *mem_host_ptr(const ProgramMemory *m, const word_t addr, const word_t size_bytes) {
+    const MemRegion *region = mem_find_region(m, addr, size_bytes);
+    if (region == NULL || region->kind == MEM_REGION_MMIO) return NULL;
+    if (region->shared != NULL) mem_cow_privatise_range(m->map, addr, size_bytes);
+    mem_note_write(m, addr, size_bytes);
+    return region->host + (addr - region->base);
+}
+
+/// Host address of [addr, addr + size_bytes) the guest reads and writes directly, for TLB fills
+/// NULL unless it is RAM, or ROM for reads, and is in one slice (one page of a copy-on-write
+/// region). A write privatises a shared page, a read of one gets NULL: the page is about to
+/// move once written. Writes to a watched page get NULL too, they must go through mem_write* to be seen.
+static inline byte_t *mem_direct_host(const ProgramMemory *m, const word_t addr, const word_t size_bytes,
+                                      const bool writes) {
+    const MemRegion *region = mem_find_region(m, addr, size_bytes);
+    if (region == NULL || !(region->kind == MEM_REGION_RAM || (!writes && region->kind == MEM_REGION_ROM))) {
+        return NULL;
+    }
+    if (mem_slice_of(addr) != mem_slice_of(addr + size_bytes - 1u)) return NULL;
+    if (writes && mem_code_watched_range(m->map, addr, size_bytes)) return NULL;
+    if (region->shared != NULL) {
+        if (mem_page_start(addr) != mem_page_start(addr + size_bytes - 1u)) return NULL;
+        if (mem_cow_shared(m->map, region, addr)) {
+            if (!writes) return NULL;
+            mem_cow_privatise(m->map, addr);
+        }
+    }
+    return region->host + (addr - region->base);
+}
+
+/// Length of the host-backed run starting at `addr`, at most `size_bytes`, its host address goes to `host`.
+/// With `writable` only RAM qualifies (the guest sees the host writing into it), otherwise ROM too.
+/// Returns 0 when `addr` itself is not backed that way. Callers walk a guest buffer run by run.
+/// A writable run privatises its shared copy-on-write pages and reports its watched pages
+/// as written, a read-only run ends where the pages stop reading from the same buffer.
+static inline uint64_t mem_host_span(const ProgramMemory *m, const word_t addr, const uint64_t size_bytes,
+                                     const bool writable, byte_t **host) {
+    assert(m != NULL && host != NULL);
+
+    for (size_t i = m->map->region_count; i-- > 0;) {
+        const MemRegion *region = &m->map->regions[i];
+        if (addr < region->base || addr - region->base >= region->size) continue;
+        if (region->kind == MEM_REGION_MMIO || (writable && region->kind != MEM_REGION_RAM)) return 0;
+
+        uint64_t end = region->base + region->size;
+        if ((uint64_t)addr + size_bytes < end) end = (uint64_t)addr + size_bytes;
+        // Newer regions starting inside the run hide the rest of it
+        for (size_t j = i + 1; j < m->map->region_count; ++j) {
+            const word_t base = m->map->regions[j].base;
+            if (base > addr && base < end) end = base;
+        }
+        if (region->shared != NULL) {
+            if (writable) {
+                mem_cow_privatise_range(m->map, addr, end - addr);
+            }
+            else {
+                const bool shared = mem_cow_shared(m->map, region, addr);
+                uint64_t next = mem_page_start(addr) + MEM_PAGE_SIZE;
+                while (next < end && mem_cow_shared(m->map, region, (word_t)next) == shared) next += MEM_PAGE_SIZE;
+                if (next < end) end = next;
+            }
+        }
+        if (writable) mem_note_write(m, addr, end - addr);
+        *host = mem_region_host(m->map, region, addr) + (addr - region->base);
+        return end - addr;
+    }
+    return 0;
+}
+
+// -------------------------
+// Slow path
+// -------------------------
+
+static inline word_t mem_host_load(const byte_t *p, const word_t size_bytes) {
+    word_t value = 0;
+    for (word_t i = 0; i < size_bytes; ++i) value |= (word_t)p[i] << (BYTE_SIZE_BITS * i);
+    return value;
+}
+
+static inline void mem_host_store(byte_t *p, const word_t value, const word_t size_bytes) {
+    for (word_t i = 0; i < size_bytes; ++i) p[i] = (byte_t)((value >> (BYTE_SIZE_BITS * i)) & 0xFFu);
+}
+
+/// Hands an access no region holds to the fault handler of the map
+__attribute__((cold, noreturn))
+static inline void mem_unmapped(const ProgramMemory *m, const word_t addr) {
+    const MemFaultOps *fault = &m->map->fault;
+    assert(fault->unmapped != NULL && "Access to unmapped memory");
+    if (fault->unmapped != NULL) fault->unmapped(fault->context, addr);
+    abort();
+}
+
+__attribute__((cold, noinline))
+static word_t mem_slow_read(const ProgramMemory *m, const word_t addr, const word_t size_bytes) {
+    const MemRegion *region = mem_find_region(m, addr, size_bytes);
+    if (region == NULL) mem_unmapped(m, addr);
+    if (region->kind == MEM_REGION_MMIO) return region->mmio.read(region->mmio.device, addr - region->base, size_bytes);
+    return mem_host_load(mem_region_host(m->map, region, addr) + (addr - region->base), size_bytes);
+}
+
+__attribute__((cold, noinline))
+static void mem_slow_write(const ProgramMemory *m, const word_t addr, const word_t value, const word_t size_bytes) {
+    const MemRegion *region = mem_find_region(m, addr, size_bytes);
+    if (region == NULL) mem_unmapped(m, addr);
+    switch (region->kind) {
+    case MEM_REGION_RAM:
+        // First write to a page still shared with a clone, aligned accesses never straddle two
+        if (mem_cow_shared(m->map, region, addr)) mem_cow_privatise(m->map, addr);
+        mem_host_store(region->host + (addr - region->base), value, size_bytes);
+        mem_note_write(m, addr, size_bytes);
+        break;
+    case MEM_REGION_ROM:
+        // Like a flash part outside its programming sequence, the bus ignores the write
+        break;
+    case MEM_REGION_MMIO:
+        region->mmio.write(region->mmio.device, addr - region->base, value, size_bytes);
+        break;
+    }
 }
 
 // -------------------------
@@ -49,29 +726,42 @@ static inline bool mem_in_bounds(const ProgramMemory *m, const word_t addr, cons
 // -------------------------
 
 static inline uint8_t mem_read8(const ProgramMemory *m, const word_t addr) {
-    assert(mem_in_bounds(m, addr, BYTE_SIZE_BYTES));
-    return m->bytes[addr];
+    const MemSlice *slice = mem_slice_entry(m->map, addr);
+    if (__builtin_expect(!mem_span_holds(slice->read_low, slice->read_span, addr, BYTE_SIZE_BYTES), 0)) {
+        return (uint8_t)mem_slow_read(m, addr, BYTE_SIZE_BYTES);
+    }
+    return *(const byte_t *)(slice->read_bias + addr);
 }
 
 static inline uint16_t mem_read16(const ProgramMemory *m, const word_t addr) {
-    assert(mem_in_bounds(m, addr, HALFWORD_SIZE_BYTES));
     // Strict alignment check (halfword requires halfword alignment)
     assert((addr & HALFWORD_ALIGN_MASK) == 0);
 
-    const halfword_t b0 = m->bytes[addr + 0];
-    const halfword_t b1 = m->bytes[addr + 1];
+    const MemSlice *slice = mem_slice_entry(m->map, addr);
+    if (__builtin_expect(!mem_span_holds(slice->read_low, slice->read_span, addr, HALFWORD_SIZE_BYTES), 0)) {
+        return (uint16_t)mem_slow_read(m, addr, HALFWORD_SIZE_BYTES);
+    }
+
+    const byte_t *p = (const byte_t *)(slice->read_bias + addr);
+    const halfword_t b0 = p[0];
+    const halfword_t b1 = p[1];
     return (halfword_t)(b0 | (halfword_t)(b1 << 8));
 }
 
 static inline uint32_t mem_read32(const ProgramMemory *m, const word_t addr) {
-    assert(mem_in_bounds(m, addr, WORD_SIZE_BYTES));
     // Strict alignment check (word requires word alignment)
     assert((addr & WORD_ALIGN_MASK) == 0);
 
-    const uint32_t b0 = m->bytes[addr + 0];
-    const uint32_t b1 = m->bytes[addr + 1];
-    const uint32_t b2 = m->bytes[addr + 2];
-    const uint32_t b3 = m->bytes[addr + 3];
+    const MemSlice *slice = mem_slice_entry(m->map, addr);
+    if (__builtin_expect(!mem_span_holds(slice->read_low, slice->read_span, addr, WORD_SIZE_BYTES), 0)) {
+        return mem_slow_read(m, addr, WORD_SIZE_BYTES);
+    }
+
+    const byte_t *p = (const byte_t *)(slice->read_bias + addr);
+    const uint32_t b0 = p[0];
+    const uint32_t b1 = p[1];
+    const uint32_t b2 = p[2];
+    const uint32_t b3 = p[3];
     return b0 | (b1 << BYTE_SIZE_BITS) | (b2 << BYTE_SIZE_BITS * 2) | (b3 << BYTE_SIZE_BITS * 3);
 }
 
@@ -80,28 +770,44 @@ static inline uint32_t mem_read32(const ProgramMemory *m, const word_t addr) {
 // -------------------------
 
 static inline void mem_write8(const ProgramMemory *m, const word_t addr, const word_t value) {
-    assert(mem_in_bounds(m, addr, BYTE_SIZE_BYTES));
     // No alignment check needed for byte writes
-    m->bytes[addr + 0] = (byte_t)((value >> BYTE_SIZE_BITS * 0) & 0xFFu);
+    const MemSlice *slice = mem_slice_entry(m->map, addr);
+    if (__builtin_expect(!mem_span_holds(slice->write_low, slice->write_span, addr, BYTE_SIZE_BYTES), 0)) {
+        mem_slow_write(m, addr, value & 0xFFu, BYTE_SIZE_BYTES);
+        return;
+    }
+    *(byte_t *)(slice->write_bias + addr) = (byte_t)((value >> BYTE_SIZE_BITS * 0) & 0xFFu);
+    mem_note_write(m, addr, BYTE_SIZE_BYTES);
 }
 
 static inline void mem_write16(const ProgramMemory *m, const word_t addr, const halfword_t value) {
-    assert(mem_in_bounds(m, addr, HALFWORD_SIZE_BYTES));
     // Strict alignment check (halfword requires halfword alignment)
     assert((addr & HALFWORD_ALIGN_MASK) == 0);
 
-    m->bytes[addr + 0] = (byte_t)((value >> BYTE_SIZE_BITS * 0) & 0xFFu);
-    m->bytes[addr + 1] = (byte_t)((value >> BYTE_SIZE_BITS * 1) & 0xFFu);
+    const MemSlice *slice = mem_slice_entry(m->map, addr);
+    if (__builtin_expect(!mem_span_holds(slice->write_low, slice->write_span, addr, HALFWORD_SIZE_BYTES), 0)) {
+        mem_slow_write(m, addr, value, HALFWORD_SIZE_BYTES);
+        return;
+    }
+    byte_t *p = (byte_t *)(slice->write_bias + addr);
+    p[0] = (byte_t)((value >> BYTE_SIZE_BITS * 0) & 0xFFu);
+    p[1] = (byte_t)((value >> BYTE_SIZE_BITS * 1) & 0xFFu);
+    mem_note_write(m, addr, HALFWORD_SIZE_BYTES);
 }
 
 static inline void mem_write32(const ProgramMemory *m, const uint32_t addr, const uint32_t value) {
-    assert(mem_in_bounds(m, addr, WORD_SIZE_BYTES));
     // Strict alignment check (word requires word alignment)
     assert((addr & WORD_ALIGN_MASK) == 0);
 
-    m->bytes[addr + 0] = (byte_t)((value >> BYTE_SIZE_BITS * 0) & 0xFFu);
-    m->bytes[addr + 1] = (byte_t)((value >> BYTE_SIZE_BITS * 1) & 0xFFu);
-    m->bytes[addr + 2] = (byte_t)((value >> BYTE_SIZE_BITS * 2) & 0xFFu);
-    m->bytes[addr + 3] = (byte_t)((value >> BYTE_SIZE_BITS * 3) & 0xFFu);
-
-}
\ No newline at end of file
+    const MemSlice *slice = mem_slice_entry(m->map, addr);
+    if (__builtin_expect(!mem_span_holds(slice->write_low, slice->write_span, addr, WORD_SIZE_BYTES), 0)) {
+        mem_slow_write(m, addr, value, WORD_SIZE_BYTES);
+        return;
+    }
+    byte_t *p = (byte_t *)(slice->write_bias + addr);
+    p[0] = (byte_t)((value >> BYTE_SIZE_BITS * 0) & 0xFFu);
+    p[1] = (byte_t)((value >> BYTE_SIZE_BITS * 1) & 0xFFu);
+    p[2] = (byte_t)((value >> BYTE_SIZE_BITS * 2) & 0xFFu);
+    p[3] = (byte_t)((value >> BYTE_SIZE_BITS * 3) & 0xFFu);
+    mem_note_write(m, addr, WORD_SIZE_BYTES);
+}
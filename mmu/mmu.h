@@ -0,0 +1,490 @@
+//
+// Created by valentin on 01/26/26.
+//
+#pragma once
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "faults/fault.h"
+#include "mmu/tlb.h"
+
+// ARMv4 MMU (ARM920T style)
+//
+// Guest accesses go through mmu_fetch32/mmu_read*/mmu_write*, which first look the
+// virtual page up in a direct-mapped TLB of their access kind. A hit is a tag compare
+// and a pointer add on the host address cached there. A miss walks the translation
+// tables, checks the domain and access permissions, and caches the translation when
+// it covers a whole 4 KiB page of host-backed memory (RAM, or ROM for fetches and
+// reads). Everything else (tiny pages, sub-page permissions, MMIO) is translated
+// again on every access and completed through the physical accessors of memory.h.
+//
+// Cached translations depend on the tables, the control, domain and privilege state,
+// so anything changing those flushes the TLBs, as the TLB maintenance operations of
+// CP15 register c8 do for guests that edit their tables.
+
+/// CP15 c1 control register bits
+/// MMU enable
+#define MMU_CONTROL_M (1u << 0)
+/// Alignment fault checking, misaligned accesses always fault here
+#define MMU_CONTROL_A (1u << 1)
+/// System and ROM protection, change the meaning of AP = 0b00
+#define MMU_CONTROL_S (1u << 8)
+#define MMU_CONTROL_R (1u << 9)
+
+/// Main ID register of an ARM920T (CP15 c0)
+#define MMU_MAIN_ID 0x41129200u
+
+/// Fault status codes (CP15 c5 bits [3:0]), the domain goes to bits [7:4]
+#define MMU_FSR_NONE 0x0u
+#define MMU_FSR_ALIGNMENT 0x1u
+#define MMU_FSR_EXTERNAL_TRANSLATION_FIRST 0xCu
+#define MMU_FSR_EXTERNAL_TRANSLATION_SECOND 0xEu
+#define MMU_FSR_TRANSLATION_SECTION 0x5u
+#define MMU_FSR_TRANSLATION_PAGE 0x7u
+#define MMU_FSR_DOMAIN_SECTION 0x9u
+#define MMU_FSR_DOMAIN_PAGE 0xBu
+#define MMU_FSR_PERMISSION_SECTION 0xDu
+#define MMU_FSR_PERMISSION_PAGE 0xFu
+
+/// Domain access control values (CP15 c3, two bits per domain)
+#define MMU_DOMAIN_CLIENT 0x1u
+#define MMU_DOMAIN_MANAGER 0x3u
+
+typedef enum MmuAccess {
+    MMU_ACCESS_FETCH = 0,
+    MMU_ACCESS_READ,
+    MMU_ACCESS_WRITE,
+    MMU_ACCESS_COUNT,
+} MmuAccess;
+
+typedef struct Mmu {
+    /// Physical address space, translation tables are read from it too
+    const ProgramMemory *memory;
+    /// One TLB per MmuAccess, fetches do not evict data translations and the other way round
+    Tlb tlbs[MMU_ACCESS_COUNT];
+
+    /// CP15 c1
+    word_t control;
+    /// CP15 c2, 16 KiB aligned base of the first-level table
+    word_t translation_base;
+    /// CP15 c3
+    word_t domain_access;
+    /// CP15 c5 and c6, written by data aborts
+    word_t fault_status;
+    word_t fault_address;
+
+    /// Permissions are checked for a privileged mode (anything but USR)
+    bool privileged;
+} Mmu;
+
+/// Result of a table walk
+typedef struct MmuTranslation {
+    word_t physical;
+    /// The translation and its permissions hold for the whole 4 KiB page
+    bool page_uniform;
+} MmuTranslation;
+
+/// MMU after reset: disabled, virtual addresses are physical, privileged
+static inline Mmu construct_mmu(const ProgramMemory *memory) {
+    assert(memory != NULL);
+
+    Mmu mmu = {0};
+    mmu.memory = memory;
+    for (size_t i = 0; i < MMU_ACCESS_COUNT; ++i) tlb_flush(&mmu.tlbs[i]);
+    mmu.privileged = true;
+    return mmu;
+}
+
+static inline void mmu_flush_tlbs(Mmu *mmu) {
+    assert(mmu != NULL);
+    for (size_t i = 0; i < MMU_ACCESS_COUNT; ++i) tlb_flush(&mmu->tlbs[i]);
+}
+
+/// Switches between privileged and user permission checks
+static inline void mmu_set_privileged(Mmu *mmu, const bool privileged) {
+    assert(mmu != NULL);
+    if (mmu->privileged == privileged) return;
+    mmu->privileged = privileged;
+    mmu_flush_tlbs(mmu);
+}
+
+/// Guest addresses are translated: `mmu` exists and CP15 c1.M is set
+static inline bool mmu_enabled(const Mmu *mmu) {
+    return mmu != NULL && (mmu->control & MMU_CONTROL_M) != 0u;
+}
+
+// -------------------------
+// Table walk
+// -------------------------
+
+static inline bool mmu_ap_allows(const Mmu *mmu, const word_t ap, const MmuAccess access) {
+    const bool write = access == MMU_ACCESS_WRITE;
+    switch (ap) {
+    case 0u:
+        // Only readable, and only when S (privileged) or R (everyone) says so
+        if (write) return false;
+        return (mmu->control & MMU_CONTROL_R) || (mmu->privileged && (mmu->control & MMU_CONTROL_S));
+    case 1u:
+        return mmu->privileged;
+    case 2u:
+        return mmu->privileged || !write;
+    default:
+        return true;
+    }
+}
+
+/// Fault status of an access to `domain` with permission bits `ap`, MMU_FSR_NONE when allowed
+static inline word_t mmu_check_permission(const Mmu *mmu, const word_t domain, const word_t ap,
+                                          const MmuAccess access, const bool section) {
+    const word_t domain_mode = (mmu->domain_access >> (domain * 2u)) & 0x3u;
+    if (domain_mode == MMU_DOMAIN_MANAGER) return MMU_FSR_NONE;
+    if (domain_mode != MMU_DOMAIN_CLIENT) {
+        return (domain << 4) | (section ? MMU_FSR_DOMAIN_SECTION : MMU_FSR_DOMAIN_PAGE);
+    }
+    if (mmu_ap_allows(mmu, ap, access)) return MMU_FSR_NONE;
+    return (domain << 4) | (section ? MMU_FSR_PERMISSION_SECTION : MMU_FSR_PERMISSION_PAGE);
+}
+
+/// Translates `va`, returns the fault status (domain included), MMU_FSR_NONE on success
+static inline word_t mmu_walk(const Mmu *mmu, const word_t va, const MmuAccess access, MmuTranslation *out) {
+    static const word_t SECTION_BASE_MASK = 0xFFF00000u;
+    static const word_t COARSE_BASE_MASK = 0xFFFFFC00u;
+    static const word_t FINE_BASE_MASK = 0xFFFFF000u;
+    static const word_t LARGE_BASE_MASK = 0xFFFF0000u;
+    static const word_t SMALL_BASE_MASK = 0xFFFFF000u;
+    static const word_t TINY_BASE_MASK = 0xFFFFFC00u;
+    static const word_t TABLE_BASE_MASK = 0xFFFFC000u;
+
+    if (!(mmu->control & MMU_CONTROL_M)) {
+        out->physical = va;
+        out->page_uniform = true;
+        return MMU_FSR_NONE;
+    }
+
+    // First level: one descriptor per 1 MiB
+    const word_t first_address = (mmu->translation_base & TABLE_BASE_MASK) | ((va >> 20) << 2);
+    if (!mem_in_bounds(mmu->memory, first_address, WORD_SIZE_BYTES)) return MMU_FSR_EXTERNAL_TRANSLATION_FIRST;
+    const word_t first = mem_read32(mmu->memory, first_address);
+    const word_t domain = (first >> 5) & 0xFu;
+
+    word_t second_address;
+    switch (first & 0x3u) {
+    case 0x2u: {
+        // Section
+        const word_t status = mmu_check_permission(mmu, domain, (first >> 10) & 0x3u, access, true);
+        if (status != MMU_FSR_NONE) return status;
+        out->physical = (first & SECTION_BASE_MASK) | (va & ~SECTION_BASE_MASK);
+        out->page_uniform = true;
+        return MMU_FSR_NONE;
+    }
+    case 0x1u:
+        // Coarse table: 256 entries of 4 KiB
+        second_address = (first & COARSE_BASE_MASK) | (((va >> 12) & 0xFFu) << 2);
+        break;
+    case 0x3u:
+        // Fine table: 1024 entries of 1 KiB
+        second_address = (first & FINE_BASE_MASK) | (((va >> 10) & 0x3FFu) << 2);
+        break;
+    default:
+        return MMU_FSR_TRANSLATION_SECTION;
+    }
+
+    // Second level
+    if (!mem_in_bounds(mmu->memory, second_address, WORD_SIZE_BYTES)) {
+        return (domain << 4) | MMU_FSR_EXTERNAL_TRANSLATION_SECOND;
+    }
+    const word_t second = mem_read32(mmu->memory, second_address);
+
+    word_t ap;
+    switch (second & 0x3u) {
+    case 0x1u:
+        // Large page (64 KiB), four 16 KiB permission subpages: a 4 KiB page lies in one of them
+        ap = (second >> (4u + 2u * ((va >> 14) & 0x3u))) & 0x3u;
+        out->physical = (second & LARGE_BASE_MASK) | (va & ~LARGE_BASE_MASK);
+        out->page_uniform = true;
+        break;
+    case 0x2u:
+        // Small page (4 KiB), four 1 KiB permission subpages: uniform only when all four agree
+        ap = (second >> (4u + 2u * ((va >> 10) & 0x3u))) & 0x3u;
+        out->physical = (second & SMALL_BASE_MASK) | (va & ~SMALL_BASE_MASK);
+        out->page_uniform = ((second >> 4) & 0xFFu) == ap * 0x55u;
+        break;
+    case 0x3u:
+        // Tiny page (1 KiB), only valid in fine tables
+        if ((first & 0x3u) != 0x3u) return (domain << 4) | MMU_FSR_TRANSLATION_PAGE;
+        ap = (second >> 4) & 0x3u;
+        out->physical = (second & TINY_BASE_MASK) | (va & ~TINY_BASE_MASK);
+        out->page_uniform = false;
+        break;
+    default:
+        return (domain << 4) | MMU_FSR_TRANSLATION_PAGE;
+    }
+    return mmu_check_permission(mmu, domain, ap, access, false);
+}
+
+// -------------------------
+// Slow path
+// -------------------------
+
+__attribute__((cold, noreturn))
+static inline void mmu_abort(Mmu *mmu, FaultTrap *trap, const MmuAccess access, const word_t va,
+                             const word_t status) {
+    if (access == MMU_ACCESS_FETCH && status != MMU_FSR_ALIGNMENT) trap_raise(trap, FAULT_PREFETCH_ABORT, va);
+
+    // Data aborts (and alignment faults) report through FSR/FAR
+    mmu->fault_status = status;
+    mmu->fault_address = va;
+    trap_raise(trap, status == MMU_FSR_ALIGNMENT ? FAULT_ALIGNMENT : FAULT_DATA_ABORT, va);
+}
+
+/// Translates an access that missed its TLB and refills it when the page allows it
+static inline word_t mmu_resolve(Mmu *mmu, FaultTrap *trap, const word_t va, const word_t size_bytes,
+                                 const MmuAccess access) {
+    if ((va & (size_bytes - 1u)) != 0u) mmu_abort(mmu, trap, access, va, MMU_FSR_ALIGNMENT);
+
+    MmuTranslation translation;
+    const word_t status = mmu_walk(mmu, va, access, &translation);
+    if (status != MMU_FSR_NONE) mmu_abort(mmu, trap, access, va, status);
+
+    if (translation.page_uniform) {
+        const word_t physical_page = translation.physical & MMU_PAGE_MASK;
+        byte_t *host = mem_direct_host(mmu->memory, physical_page, MMU_PAGE_SIZE, access == MMU_ACCESS_WRITE);
+        if (host != NULL) tlb_fill(&mmu->tlbs[access], va, host);
+    }
+    return translation.physical;
+}
+
+__attribute__((cold, noinline))
+static word_t mmu_slow_read(Mmu *mmu, FaultTrap *trap, const word_t va, const word_t size_bytes,
+                            const MmuAccess access) {
+    const word_t physical = mmu_resolve(mmu, trap, va, size_bytes, access);
+    switch (size_bytes) {
+    case 1u:
+        return mem_read8(mmu->memory, physical);
+    case 2u:
+        return mem_read16(mmu->memory, physical);
+    default:
+        return mem_read32(mmu->memory, physical);
+    }
+}
+
+__attribute__((cold, noinline))
+static void mmu_slow_write(Mmu *mmu, FaultTrap *trap, const word_t va, const word_t value, const word_t size_bytes) {
+    const word_t physical = mmu_resolve(mmu, trap, va, size_bytes, MMU_ACCESS_WRITE);
+    switch (size_bytes) {
+    case 1u:
+        mem_write8(mmu->memory, physical, value);
+        break;
+    case 2u:
+        mem_write16(mmu->memory, physical, (halfword_t)value);
+        break;
+    default:
+        mem_write32(mmu->memory, physical, value);
+        break;
+    }
+}
+
+// -------------------------
+// Probes
+// -------------------------
+// For the host side (semihosting, block translation): nothing is raised, recorded in
+// FSR/FAR or cached, a failed translation is only reported.
+
+/// Physical address of `va` for `access`, false when the access would abort.
+/// `mmu` may be NULL or disabled, the address is then physical already.
+static inline bool mmu_translate(const Mmu *mmu, const word_t va, const MmuAccess access, word_t *physical) {
+    assert(physical != NULL);
+    if (!mmu_enabled(mmu)) {
+        *physical = va;
+        return true;
+    }
+    MmuTranslation translation;
+    if (mmu_walk(mmu, va, access, &translation) != MMU_FSR_NONE) return false;
+    *physical = translation.physical;
+    return true;
+}
+
+/// mem_host_span at a virtual address. With the MMU on the run also ends at the page,
+/// the next one may map anywhere, and it is 0 when the access would abort.
+static inline uint64_t mmu_host_span(const Mmu *mmu, const ProgramMemory *memory, const word_t va,
+                                     const uint64_t size, const bool writable, byte_t **host) {
+    if (!mmu_enabled(mmu)) return mem_host_span(memory, va, size, writable, host);
+
+    word_t physical;
+    if (!mmu_translate(mmu, va, writable ? MMU_ACCESS_WRITE : MMU_ACCESS_READ, &physical)) return 0;
+    const uint64_t page_left = MMU_PAGE_SIZE - (va & ~MMU_PAGE_MASK);
+    return mem_host_span(mmu->memory, physical, size < page_left ? size : page_left, writable, host);
+}
+
+// -------------------------
+// Guest accesses
+// -------------------------
+// Faults (aborts, misalignment) leave through `trap`.
+
+static inline word_t mmu_fetch32(Mmu *mmu, FaultTrap *trap, const word_t va) {
+    const byte_t *p = tlb_lookup(&mmu->tlbs[MMU_ACCESS_FETCH], va, WORD_ALIGN_MASK);
+    if (__builtin_expect(p == NULL, 0)) return mmu_slow_read(mmu, trap, va, WORD_SIZE_BYTES, MMU_ACCESS_FETCH);
+    return mem_host_load(p, WORD_SIZE_BYTES);
+}
+
+static inline uint16_t mmu_fetch16(Mmu *mmu, FaultTrap *trap, const word_t va) {
+    const byte_t *p = tlb_lookup(&mmu->tlbs[MMU_ACCESS_FETCH], va, HALFWORD_ALIGN_MASK);
+    if (__builtin_expect(p == NULL, 0)) {
+        return (uint16_t)mmu_slow_read(mmu, trap, va, HALFWORD_SIZE_BYTES, MMU_ACCESS_FETCH);
+    }
+    return (uint16_t)mem_host_load(p, HALFWORD_SIZE_BYTES);
+}
+
+static inline uint8_t mmu_read8(Mmu *mmu, FaultTrap *trap, const word_t va) {
+    const byte_t *p = tlb_lookup(&mmu->tlbs[MMU_ACCESS_READ], va, 0u);
+    if (__builtin_expect(p == NULL, 0)) return (uint8_t)mmu_slow_read(mmu, trap, va, BYTE_SIZE_BYTES, MMU_ACCESS_READ);
+    return *p;
+}
+
+static inline uint16_t mmu_read16(Mmu *mmu, FaultTrap *trap, const word_t va) {
+    const byte_t *p = tlb_lookup(&mmu->tlbs[MMU_ACCESS_READ], va, HALFWORD_ALIGN_MASK);
+    if (__builtin_expect(p == NULL, 0)) {
+        return (uint16_t)mmu_slow_read(mmu, trap, va, HALFWORD_SIZE_BYTES, MMU_ACCESS_READ);
+    }
+    return (uint16_t)mem_host_load(p, HALFWORD_SIZE_BYTES);
+}
+
+static inline uint32_t mmu_read32(Mmu *mmu, FaultTrap *trap, const word_t va) {
+    const byte_t *p = tlb_lookup(&mmu->tlbs[MMU_ACCESS_READ], va, WORD_ALIGN_MASK);
+    if (__builtin_expect(p == NULL, 0)) return mmu_slow_read(mmu, trap, va, WORD_SIZE_BYTES, MMU_ACCESS_READ);
+    return mem_host_load(p, WORD_SIZE_BYTES);
+}
+
+static inline void mmu_write8(Mmu *mmu, FaultTrap *trap, const word_t va, const word_t value) {
+    byte_t *p = tlb_lookup(&mmu->tlbs[MMU_ACCESS_WRITE], va, 0u);
+    if (__builtin_expect(p == NULL, 0)) {
+        mmu_slow_write(mmu, trap, va, value & 0xFFu, BYTE_SIZE_BYTES);
+        return;
+    }
+    *p = (byte_t)value;
+}
+
+static inline void mmu_write16(Mmu *mmu, FaultTrap *trap, const word_t va, const halfword_t value) {
+    byte_t *p = tlb_lookup(&mmu->tlbs[MMU_ACCESS_WRITE], va, HALFWORD_ALIGN_MASK);
+    if (__builtin_expect(p == NULL, 0)) {
+        mmu_slow_write(mmu, trap, va, value, HALFWORD_SIZE_BYTES);
+        return;
+    }
+    mem_host_store(p, value, HALFWORD_SIZE_BYTES);
+}
+
+static inline void mmu_write32(Mmu *mmu, FaultTrap *trap, const word_t va, const word_t value) {
+    byte_t *p = tlb_lookup(&mmu->tlbs[MMU_ACCESS_WRITE], va, WORD_ALIGN_MASK);
+    if (__builtin_expect(p == NULL, 0)) {
+        mmu_slow_write(mmu, trap, va, value, WORD_SIZE_BYTES);
+        return;
+    }
+    mem_host_store(p, value, WORD_SIZE_BYTES);
+}
+
+/// Byte or word load of a guest that may run without an MMU (`mmu` NULL or disabled),
+/// `memory` is then accessed at `va` directly
+static inline word_t mmu_load(Mmu *mmu, const ProgramMemory *memory, FaultTrap *trap, const word_t va,
+                              const word_t size_bytes) {
+    assert(size_bytes == BYTE_SIZE_BYTES || size_bytes == WORD_SIZE_BYTES);
+    if (!mmu_enabled(mmu)) return size_bytes == WORD_SIZE_BYTES ? mem_read32(memory, va) : mem_read8(memory, va);
+    return size_bytes == WORD_SIZE_BYTES ? mmu_read32(mmu, trap, va) : mmu_read8(mmu, trap, va);
+}
+
+/// Store counterpart of mmu_load
+static inline void mmu_store(Mmu *mmu, const ProgramMemory *memory, FaultTrap *trap, const word_t va,
+                             const word_t value, const word_t size_bytes) {
+    assert(size_bytes == BYTE_SIZE_BYTES || size_bytes == WORD_SIZE_BYTES);
+    if (!mmu_enabled(mmu)) {
+        if (size_bytes == WORD_SIZE_BYTES) mem_write32(memory, va, value);
+        else mem_write8(memory, va, value);
+        return;
+    }
+    if (size_bytes == WORD_SIZE_BYTES) mmu_write32(mmu, trap, va, value);
+    else mmu_write8(mmu, trap, va, value);
+}
+
+// -------------------------
+// CP15 system control registers
+// -------------------------
+// Registers are addressed as MRC/MCR p15, 0, Rd, CRn, CRm, opcode2.
+
+/// MRC p15, returns false for a register that does not exist
+static inline bool mmu_cp15_read(const Mmu *mmu, const word_t crn, const word_t crm, const word_t opcode2,
+                                 word_t *value) {
+    assert(mmu != NULL);
+    assert(value != NULL);
+    (void)crm;
+
+    switch (crn) {
+    case 0u:
+        // Main ID, cache type (no caches modelled)
+        *value = opcode2 == 0u ? MMU_MAIN_ID : 0u;
+        return true;
+    case 1u:
+        *value = mmu->control;
+        return true;
+    case 2u:
+        *value = mmu->translation_base;
+        return true;
+    case 3u:
+        *value = mmu->domain_access;
+        return true;
+    case 5u:
+        *value = mmu->fault_status;
+        return true;
+    case 6u:
+        *value = mmu->fault_address;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// MCR p15, returns false for a register that does not exist
+static inline bool mmu_cp15_write(Mmu *mmu, const word_t crn, const word_t crm, const word_t opcode2,
+                                  const word_t value) {
+    static const word_t TABLE_BASE_MASK = 0xFFFFC000u;
+    assert(mmu != NULL);
+
+    switch (crn) {
+    case 1u:
+        mmu->control = value;
+        mmu_flush_tlbs(mmu);
+        return true;
+    case 2u:
+        mmu->translation_base = value & TABLE_BASE_MASK;
+        mmu_flush_tlbs(mmu);
+        return true;
+    case 3u:
+        mmu->domain_access = value;
+        mmu_flush_tlbs(mmu);
+        return true;
+    case 5u:
+        mmu->fault_status = value;
+        return true;
+    case 6u:
+        mmu->fault_address = value;
+        return true;
+    case 7u:
+        // Cache maintenance, there are no caches
+        return true;
+    case 8u: {
+        // TLB maintenance: CRm selects I (5), D (6) or both (7), opcode2 all (0) or the entry of MVA `value` (1)
+        const bool instruction = crm == 5u || crm == 7u;
+        const bool data = crm == 6u || crm == 7u;
+        if ((!instruction && !data) || opcode2 > 1u) return false;
+        for (size_t access = 0; access < MMU_ACCESS_COUNT; ++access) {
+            if (access == MMU_ACCESS_FETCH ? !instruction : !data) continue;
+            if (opcode2 == 0u) tlb_flush(&mmu->tlbs[access]);
+            else tlb_invalidate(&mmu->tlbs[access], value);
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
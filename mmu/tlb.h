@@ -0,0 +1,74 @@
+//
+// Created by valentin on 01/26/26.
+//
+#pragma once
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory.h"
+
+/// Translation granule cached by a TLB entry (small page)
+#define MMU_PAGE_SHIFT 12u
+#define MMU_PAGE_SIZE (1u << MMU_PAGE_SHIFT)
+#define MMU_PAGE_MASK (~(MMU_PAGE_SIZE - 1u))
+
+/// Build with -DMMU_TLB_BITS=<n> for 2^n entries per TLB
+#ifndef MMU_TLB_BITS
+#define MMU_TLB_BITS 8u
+#endif
+#define MMU_TLB_ENTRIES (1u << MMU_TLB_BITS)
+
+/// Tag of an empty entry. Lookups compare against a page address with at most the
+/// alignment bits [1:0] kept, bits [11:2] are always clear there so this never matches.
+#define MMU_TLB_INVALID_TAG (MMU_PAGE_SIZE - 1u)
+
+/// One cached translation: guest virtual page -> host memory
+typedef struct TlbEntry {
+    /// Virtual page address, MMU_TLB_INVALID_TAG when empty
+    word_t tag;
+    /// host - virtual address bias of the page
+    uintptr_t bias;
+} TlbEntry;
+
+/// Direct-mapped software TLB, indexed by the low bits of the virtual page number
+typedef struct Tlb {
+    TlbEntry entries[MMU_TLB_ENTRIES];
+} Tlb;
+
+static inline void tlb_flush(Tlb *tlb) {
+    assert(tlb != NULL);
+    for (size_t i = 0; i < MMU_TLB_ENTRIES; ++i) tlb->entries[i].tag = MMU_TLB_INVALID_TAG;
+}
+
+static inline Tlb construct_tlb(void) {
+    Tlb tlb;
+    tlb_flush(&tlb);
+    return tlb;
+}
+
+static inline TlbEntry *tlb_entry(Tlb *tlb, const word_t va) {
+    return &tlb->entries[(va >> MMU_PAGE_SHIFT) & (MMU_TLB_ENTRIES - 1u)];
+}
+
+/// Host address of `va`, NULL on a miss.
+/// `align_mask` is the alignment mask of the access: a misaligned address keeps a
+/// low bit in the compared tag and misses, so the slow path also does the alignment check.
+static inline byte_t *tlb_lookup(const Tlb *tlb, const word_t va, const word_t align_mask) {
+    const TlbEntry *entry = &tlb->entries[(va >> MMU_PAGE_SHIFT) & (MMU_TLB_ENTRIES - 1u)];
+    if (__builtin_expect(entry->tag != (va & (MMU_PAGE_MASK | align_mask)), 0)) return NULL;
+    return (byte_t *)(entry->bias + va);
+}
+
+/// Caches the translation of the page holding `va` to the host page `host_page`
+static inline void tlb_fill(Tlb *tlb, const word_t va, byte_t *host_page) {
+    TlbEntry *entry = tlb_entry(tlb, va);
+    entry->tag = va & MMU_PAGE_MASK;
+    entry->bias = (uintptr_t)host_page - (va & MMU_PAGE_MASK);
+}
+
+/// Drops the translation of the page holding `va` (invalidate TLB single entry)
+static inline void tlb_invalidate(Tlb *tlb, const word_t va) {
+    TlbEntry *entry = tlb_entry(tlb, va);
+    if (entry->tag == (va & MMU_PAGE_MASK)) entry->tag = MMU_TLB_INVALID_TAG;
+}
@@ -5,4 +5,1625 @@
 #ifndef SIMPLEARM_PARSER_H
 #define SIMPLEARM_PARSER_H
 
-#endif //SIMPLEARM_PARSER_H
\ No newline at end of file
+#include <assert.h>
+#include <ctype.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "cpu/registers.h"
+#include "instructions/cond.h"
+#include "instructions/opcodes.h"
+#include "instructions/data_processing/data_processing_decoder.h"
+
+// ARM assembler
+//
+// Turns A32 assembly text into a memory image in one linear pass over the source.
+// Every statement is encoded as soon as it is read. References to symbols that are
+// not defined yet leave a zeroed field and a fixup, and the fixups are patched in a
+// single pass at the end, so the source is never re-read and nothing is allocated per line.
+//
+// Syntax:
+// - One statement per line, `@`, `;` and `//` start a comment
+// - `label:` may precede a statement on the same line, labels are case-sensitive
+// - Mnemonics, registers and directives are case-insensitive, the condition and the
+//   S/B/H/... suffixes may be written in UAL (ADDSEQ) or pre-UAL (ADDEQS) order
+// - Expressions: numbers (decimal, 0x, 0b, 'c'), symbols and `.` combined with + and -
+//   At most one symbol may still be undefined, and only where a fixup can take it
+//   (branch targets, PC-relative labels, ADR, LDR =, .word)
+//
+// Supported instruction classes (see InstructionType):
+// data processing (plus LSL/LSR/ASR/ROR/RRX, NOP and ADR), MUL/MLA, UMULL/UMLAL/SMULL/SMLAL,
+// B/BL, BX, LDR/STR{B,T,BT}, LDRH/STRH/LDRSB/LDRSH, SWP{B}, LDM/STM (plus PUSH/POP),
+// SWI/SVC, CDP, LDC/STC{L}, MRC/MCR and MRS/MSR.
+//
+// Directives: .word/.long, .hword/.short, .byte, .ascii, .asciz/.string, .space/.skip,
+// .align/.p2align, .balign, .org, .equ/.set, .ltorg/.pool and .end. Section, symbol
+// visibility and syntax directives are accepted and ignored.
+
+// -------------------------
+// Symbol table
+// -------------------------
+
+/// Symbol of an assembled program
+/// The name points into the assembled source text, which must outlive the program
+typedef struct AsmSymbol {
+    const char *name;
+    uint32_t length;
+    uint32_t hash;
+    word_t value;
+    bool defined;
+} AsmSymbol;
+
+/// Open-addressing hash table with linear probing
+typedef struct AsmSymbolTable {
+    /// Symbols in order of first appearance, fixups refer to them by index
+    AsmSymbol *items;
+    size_t count;
+    size_t item_capacity;
+    /// Hash index, each slot holds an item index + 1 (0 is empty)
+    /// The capacity is a power of two and the load stays under one half
+    uint32_t *slots;
+    size_t slot_capacity;
+} AsmSymbolTable;
+
+/// FNV-1a
+static inline uint32_t asm_hash(const char *name, const size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (byte_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline AsmSymbolTable construct_asm_symbol_table(void) {
+    static const size_t INITIAL_SLOTS = 256u;
+
+    AsmSymbolTable table = {
+        .items = malloc(INITIAL_SLOTS / 2u * sizeof(AsmSymbol)),
+        .count = 0,
+        .item_capacity = INITIAL_SLOTS / 2u,
+        .slots = calloc(INITIAL_SLOTS, sizeof(uint32_t)),
+        .slot_capacity = INITIAL_SLOTS,
+    };
+    assert(table.items != NULL);
+    assert(table.slots != NULL);
+    return table;
+}
+
+static inline void destroy_asm_symbol_table(AsmSymbolTable *table) {
+    assert(table != NULL);
+    free(table->items);
+    free(table->slots);
+    *table = (AsmSymbolTable){0};
+}
+
+/// Slot holding `name`, or the empty slot where it would be inserted
+static inline size_t asm_symbol_slot(const AsmSymbolTable *table, const char *name, const size_t length,
+                                     const uint32_t hash) {
+    const size_t mask = table->slot_capacity - 1u;
+    size_t slot = hash & mask;
+    for (;;) {
+        const uint32_t entry = table->slots[slot];
+        if (entry == 0u) return slot;
+
+        const AsmSymbol *symbol = &table->items[entry - 1u];
+        if (symbol->hash == hash && symbol->length == length && memcmp(symbol->name, name, length) == 0) {
+            return slot;
+        }
+        slot = (slot + 1u) & mask;
+    }
+}
+
+static inline void asm_symbol_table_grow(AsmSymbolTable *table) {
+    const size_t slot_capacity = table->slot_capacity * 2u;
+    const size_t mask = slot_capacity - 1u;
+    uint32_t *slots = calloc(slot_capacity, sizeof(uint32_t));
+    assert(slots != NULL);
+
+    for (size_t i = 0; i < table->count; ++i) {
+        size_t slot = table->items[i].hash & mask;
+        while (slots[slot] != 0u) slot = (slot + 1u) & mask;
+        slots[slot] = (uint32_t)(i + 1u);
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slot_capacity = slot_capacity;
+
+    table->item_capacity = slot_capacity / 2u;
+    table->items = realloc(table->items, table->item_capacity * sizeof(AsmSymbol));
+    assert(table->items != NULL);
+}
+
+/// Index of `name`, added as an undefined symbol on first use
+static inline uint32_t asm_symbol_intern(AsmSymbolTable *table, const char *name, const size_t length) {
+    const uint32_t hash = asm_hash(name, length);
+    size_t slot = asm_symbol_slot(table, name, length, hash);
+    if (table->slots[slot] != 0u) return table->slots[slot] - 1u;
+
+    if (table->count == table->item_capacity) {
+        asm_symbol_table_grow(table);
+        slot = asm_symbol_slot(table, name, length, hash);
+    }
+    table->items[table->count] = (AsmSymbol){.name = name, .length = (uint32_t)length, .hash = hash};
+    table->slots[slot] = (uint32_t)++table->count;
+    return (uint32_t)(table->count - 1u);
+}
+
+static inline const AsmSymbol *asm_symbol_find(const AsmSymbolTable *table, const char *name, const size_t length) {
+    const uint32_t entry = table->slots[asm_symbol_slot(table, name, length, asm_hash(name, length))];
+    return entry == 0u ? NULL : &table->items[entry - 1u];
+}
+
+// -------------------------
+// Program and assembler state
+// -------------------------
+
+typedef struct AsmProgram {
+    /// Assembled bytes, to be placed at base_address
+    byte_t *image;
+    size_t size;
+    size_t capacity;
+    word_t base_address;
+    /// Address of `_start` when the source defines it, base_address otherwise
+    word_t entry;
+    AsmSymbolTable symbols;
+
+    /// False when assembly stopped on an error, described by error and error_line
+    bool ok;
+    size_t error_line;
+    char error[128];
+} AsmProgram;
+
+/// PC reads 8 bytes ahead of the instruction using it
+#define ASM_PC_OFFSET 8u
+
+typedef enum AsmFixupKind {
+    /// B/BL: signed 24-bit word offset from PC
+    ASM_FIXUP_BRANCH24,
+    /// LDR/STR{B} PC-relative: 12-bit offset + U bit
+    ASM_FIXUP_OFFSET12,
+    /// LDRH/STRH/LDRSB/LDRSH PC-relative: split 8-bit offset + U bit
+    ASM_FIXUP_OFFSET8,
+    /// ADR: ADD/SUB Rd, PC, #rotated immediate
+    ASM_FIXUP_ADR,
+    /// .word and literal pool entries: absolute address
+    ASM_FIXUP_WORD,
+} AsmFixupKind;
+
+/// Value of an expression: value, plus the address of `symbol` once it is defined
+/// symbol is -1 when the expression is fully resolved
+typedef struct AsmExpr {
+    word_t value;
+    int32_t symbol;
+} AsmExpr;
+
+typedef struct AsmFixup {
+    AsmFixupKind kind;
+    uint32_t symbol;
+    word_t addend;
+    /// Address of the field to patch
+    word_t address;
+    size_t line;
+} AsmFixup;
+
+/// Pending `LDR Rd, =value`, placed in the next literal pool
+typedef struct AsmLiteral {
+    AsmExpr value;
+    /// Address of the LDR
+    word_t address;
+    /// Address of its pool entry, set when the pool is flushed
+    word_t slot;
+    size_t line;
+} AsmLiteral;
+
+typedef struct Assembler {
+    AsmProgram *program;
+
+    const char *cursor;
+    const char *line_end;
+    const char *end;
+    size_t line;
+    /// Set by .end
+    bool stopped;
+
+    AsmFixup *fixups;
+    size_t fixup_count;
+    size_t fixup_capacity;
+
+    AsmLiteral *literals;
+    size_t literal_count;
+    size_t literal_capacity;
+
+    /// Errors unwind straight to construct_asm_program
+    jmp_buf on_error;
+} Assembler;
+
+__attribute__((cold, noreturn, format(printf, 2, 3)))
+static inline void asm_fail(Assembler *as, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(as->program->error, sizeof(as->program->error), format, args);
+    va_end(args);
+    as->program->error_line = as->line;
+    longjmp(as->on_error, 1);
+}
+
+static inline void *asm_grow(void *items, size_t *capacity, const size_t item_size) {
+    *capacity = *capacity != 0u ? *capacity * 2u : 64u;
+    void *grown = realloc(items, *capacity * item_size);
+    assert(grown != NULL);
+    return grown;
+}
+
+// -------------------------
+// Image
+// -------------------------
+
+static inline word_t asm_location(const Assembler *as) {
+    return as->program->base_address + (word_t)as->program->size;
+}
+
+/// Appends `count` zeroed bytes and returns them
+static inline byte_t *asm_reserve(Assembler *as, const size_t count) {
+    AsmProgram *program = as->program;
+    if ((uint64_t)program->base_address + program->size + count > UINT32_MAX + 1ull) {
+        asm_fail(as, "program does not fit in the address space");
+    }
+    if (program->size + count > program->capacity) {
+        size_t capacity = program->capacity;
+        while (capacity < program->size + count) capacity *= 2u;
+        program->image = realloc(program->image, capacity);
+        assert(program->image != NULL);
+        program->capacity = capacity;
+    }
+    byte_t *bytes = program->image + program->size;
+    memset(bytes, 0, count);
+    program->size += count;
+    return bytes;
+}
+
+static inline void asm_store32(byte_t *bytes, const word_t value) {
+    bytes[0] = (byte_t)(value >> BYTE_SIZE_BITS * 0);
+    bytes[1] = (byte_t)(value >> BYTE_SIZE_BITS * 1);
+    bytes[2] = (byte_t)(value >> BYTE_SIZE_BITS * 2);
+    bytes[3] = (byte_t)(value >> BYTE_SIZE_BITS * 3);
+}
+
+static inline word_t asm_load32(const byte_t *bytes) {
+    return (word_t)bytes[0] | (word_t)bytes[1] << BYTE_SIZE_BITS * 1 | (word_t)bytes[2] << BYTE_SIZE_BITS * 2 |
+           (word_t)bytes[3] << BYTE_SIZE_BITS * 3;
+}
+
+static inline void asm_emit32(Assembler *as, const word_t value) {
+    asm_store32(asm_reserve(as, WORD_SIZE_BYTES), value);
+}
+
+static inline void asm_align(Assembler *as, const word_t alignment) {
+    const word_t misalignment = asm_location(as) % alignment;
+    if (misalignment != 0u) asm_reserve(as, alignment - misalignment);
+}
+
+/// Emits an instruction, which must be word aligned
+static inline void asm_emit_inst(Assembler *as, const word_t inst) {
+    if ((asm_location(as) & WORD_ALIGN_MASK) != 0u) asm_fail(as, "instruction is not word aligned");
+    asm_emit32(as, inst);
+}
+
+// -------------------------
+// Lexing
+// -------------------------
+
+typedef struct AsmToken {
+    const char *text;
+    size_t length;
+} AsmToken;
+
+static inline char asm_current(const Assembler *as) {
+    return as->cursor < as->line_end ? *as->cursor : '\0';
+}
+
+static inline void asm_skip_spaces(Assembler *as) {
+    while (as->cursor < as->line_end && (*as->cursor == ' ' || *as->cursor == '\t' || *as->cursor == '\r')) {
+        ++as->cursor;
+    }
+}
+
+/// True at the end of the statement (end of line or comment)
+static inline bool asm_at_end(Assembler *as) {
+    asm_skip_spaces(as);
+    const char c = asm_current(as);
+    if (c == '\0' || c == '@' || c == ';') return true;
+    return c == '/' && as->cursor + 1 < as->line_end && as->cursor[1] == '/';
+}
+
+static inline bool asm_peek(Assembler *as, const char c) {
+    asm_skip_spaces(as);
+    return asm_current(as) == c;
+}
+
+static inline bool asm_accept(Assembler *as, const char c) {
+    if (!asm_peek(as, c)) return false;
+    ++as->cursor;
+    return true;
+}
+
+static inline void asm_expect(Assembler *as, const char c) {
+    if (!asm_accept(as, c)) asm_fail(as, "expected '%c'", c);
+}
+
+static inline bool asm_is_identifier_start(const char c) {
+    return isalpha((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+static inline bool asm_is_identifier_char(const char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+/// Reads an identifier, length is 0 when there is none
+static inline AsmToken asm_identifier(Assembler *as) {
+    asm_skip_spaces(as);
+    AsmToken token = {.text = as->cursor, .length = 0};
+    if (!asm_is_identifier_start(asm_current(as))) return token;
+    while (as->cursor < as->line_end && asm_is_identifier_char(*as->cursor)) ++as->cursor;
+    token.length = (size_t)(as->cursor - token.text);
+    return token;
+}
+
+/// Case-insensitive comparison against a lowercase keyword
+static inline bool asm_keyword(const AsmToken token, const char *keyword) {
+    const size_t length = strlen(keyword);
+    if (token.length != length) return false;
+    for (size_t i = 0; i < length; ++i) {
+        if (tolower((unsigned char)token.text[i]) != keyword[i]) return false;
+    }
+    return true;
+}
+
+/// Number of `<prefix><0-15>` (r3, p15, c7), -1 when the token is not one
+static inline int asm_numbered_name(const AsmToken token, const char prefix) {
+    if (token.length < 2 || token.length > 3) return -1;
+    if (tolower((unsigned char)token.text[0]) != prefix) return -1;
+
+    int number = 0;
+    for (size_t i = 1; i < token.length; ++i) {
+        if (!isdigit((unsigned char)token.text[i])) return -1;
+        number = number * 10 + (token.text[i] - '0');
+    }
+    if (token.length == 3 && token.text[1] == '0') return -1;
+    return number < REGISTER_COUNT ? number : -1;
+}
+
+static inline int asm_register_number(const AsmToken token) {
+    static const struct {
+        const char *name;
+        uint8_t index;
+    } ALIASES[] = {
+        {"sp", 13}, {"lr", LINK_REGISTER_INDEX}, {"pc", PC_REGISTER_INDEX}, {"ip", 12}, {"fp", 11}, {"sl", 10},
+        {"sb", 9},
+    };
+
+    const int number = asm_numbered_name(token, 'r');
+    if (number >= 0) return number;
+    for (size_t i = 0; i < sizeof(ALIASES) / sizeof(ALIASES[0]); ++i) {
+        if (asm_keyword(token, ALIASES[i].name)) return ALIASES[i].index;
+    }
+    return -1;
+}
+
+static inline uint8_t asm_register(Assembler *as) {
+    const int number = asm_register_number(asm_identifier(as));
+    if (number < 0) asm_fail(as, "expected a register");
+    return (uint8_t)number;
+}
+
+static inline uint8_t asm_numbered(Assembler *as, const char prefix, const char *what) {
+    const int number = asm_numbered_name(asm_identifier(as), prefix);
+    if (number < 0) asm_fail(as, "expected %s", what);
+    return (uint8_t)number;
+}
+
+// -------------------------
+// Expressions
+// -------------------------
+
+static inline word_t asm_number(Assembler *as) {
+    const char *p = as->cursor;
+    uint32_t base = 10u;
+    if (p + 1 < as->line_end && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) base = 16u;
+    if (p + 1 < as->line_end && p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) base = 2u;
+    if (base != 10u) p += 2;
+
+    const char *digits = p;
+    uint64_t value = 0;
+    for (; p < as->line_end; ++p) {
+        const char c = (char)tolower((unsigned char)*p);
+        uint32_t digit;
+        if (c >= '0' && c <= '9') digit = (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') digit = (uint32_t)(c - 'a' + 10);
+        else break;
+        if (digit >= base) break;
+
+        value = value * base + digit;
+        if (value > UINT32_MAX) asm_fail(as, "number does not fit in 32 bits");
+    }
+    if (p == digits || (p < as->line_end && asm_is_identifier_char(*p))) asm_fail(as, "malformed number");
+    as->cursor = p;
+    return (word_t)value;
+}
+
+/// Adds one term (number, character, symbol or `.`) to `expr`
+static inline void asm_term(Assembler *as, AsmExpr *expr, const bool negate) {
+    asm_skip_spaces(as);
+    const bool invert = asm_accept(as, '~');
+    asm_skip_spaces(as);
+
+    const char c = asm_current(as);
+    word_t value;
+    if (isdigit((unsigned char)c)) {
+        value = asm_number(as);
+    }
+    else if (c == '\'') {
+        if (as->cursor + 2 >= as->line_end || as->cursor[2] != '\'') asm_fail(as, "malformed character literal");
+        value = (byte_t)as->cursor[1];
+        as->cursor += 3;
+    }
+    else {
+        const AsmToken token = asm_identifier(as);
+        if (token.length == 0) asm_fail(as, "expected an expression");
+
+        if (token.length == 1 && token.text[0] == '.') {
+            value = asm_location(as);
+        }
+        else {
+            const uint32_t id = asm_symbol_intern(&as->program->symbols, token.text, token.length);
+            const AsmSymbol *symbol = &as->program->symbols.items[id];
+            if (symbol->defined) {
+                value = symbol->value;
+            }
+            else {
+                // Only a single, added, forward reference can be left to a fixup
+                if (negate || invert || expr->symbol >= 0) {
+                    asm_fail(as, "'%.*s' must be defined before this expression", (int)token.length, token.text);
+                }
+                expr->symbol = (int32_t)id;
+                return;
+            }
+        }
+    }
+
+    if (invert) value = ~value;
+    expr->value += negate ? 0u - value : value;
+}
+
+static inline AsmExpr asm_expr(Assembler *as) {
+    AsmExpr expr = {.value = 0, .symbol = -1};
+    bool negate = asm_accept(as, '-');
+    if (!negate) asm_accept(as, '+');
+
+    for (;;) {
+        asm_term(as, &expr, negate);
+        if (asm_accept(as, '+')) negate = false;
+        else if (asm_accept(as, '-')) negate = true;
+        else return expr;
+    }
+}
+
+static inline word_t asm_const_expr(Assembler *as) {
+    const AsmExpr expr = asm_expr(as);
+    if (expr.symbol >= 0) {
+        const AsmSymbol *symbol = &as->program->symbols.items[expr.symbol];
+        asm_fail(as, "'%.*s' must be defined before this expression", (int)symbol->length, symbol->name);
+    }
+    return expr.value;
+}
+
+/// Constant with an optional '#'
+static inline word_t asm_small_const(Assembler *as, const word_t max, const char *what) {
+    asm_accept(as, '#');
+    const word_t value = asm_const_expr(as);
+    if (value > max) asm_fail(as, "%s %u out of range (max %u)", what, value, max);
+    return value;
+}
+
+// -------------------------
+// Fixups
+// -------------------------
+
+/// Encodes `value` as a rotated 8-bit immediate (bits [11:0]), false when impossible
+static inline bool asm_encode_imm(const word_t value, word_t *bits) {
+    for (word_t rotate = 0; rotate < 16u; ++rotate) {
+        const word_t amount = rotate * 2u;
+        // value == ROR(imm8, amount)  <=>  imm8 == ROL(value, amount)
+        const word_t imm8 = amount == 0u ? value : (value << amount) | (value >> (WORD_SIZE_BITS - amount));
+        if (imm8 <= 0xFFu) {
+            *bits = (rotate << 8) | imm8;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Patches the field of kind `kind` at `address` so it refers to `target`
+static inline void asm_apply(Assembler *as, const AsmFixupKind kind, const word_t address, const word_t target) {
+    static const word_t U_MASK = 0x00800000;
+    static const word_t I_MASK = 0x02000000;
+    static const uint8_t OP_SHIFT = 21u;
+
+    byte_t *field = as->program->image + (address - as->program->base_address);
+    word_t inst = asm_load32(field);
+
+    const int32_t delta = (int32_t)(target - (address + ASM_PC_OFFSET));
+    const word_t magnitude = delta < 0 ? 0u - (word_t)delta : (word_t)delta;
+    const word_t up = delta < 0 ? 0u : U_MASK;
+
+    switch (kind) {
+    case ASM_FIXUP_BRANCH24:
+        if ((delta & 3) != 0) asm_fail(as, "branch target 0x%08x is not word aligned", target);
+        if (delta < -(1 << 25) || delta >= (1 << 25)) asm_fail(as, "branch target 0x%08x out of range", target);
+        inst |= ((word_t)delta >> 2) & 0x00FFFFFFu;
+        break;
+    case ASM_FIXUP_OFFSET12:
+        if (magnitude > 0xFFFu) asm_fail(as, "PC-relative offset to 0x%08x out of range", target);
+        inst |= up | magnitude;
+        break;
+    case ASM_FIXUP_OFFSET8:
+        if (magnitude > 0xFFu) asm_fail(as, "PC-relative offset to 0x%08x out of range", target);
+        inst |= up | ((magnitude & 0xF0u) << 4) | (magnitude & 0x0Fu);
+        break;
+    case ASM_FIXUP_ADR: {
+        word_t bits;
+        if (!asm_encode_imm(magnitude, &bits)) asm_fail(as, "ADR offset to 0x%08x cannot be encoded", target);
+        inst |= I_MASK | (word_t)(delta < 0 ? OP_SUB : OP_ADD) << OP_SHIFT | bits;
+        break;
+    }
+    case ASM_FIXUP_WORD:
+        inst = target;
+        break;
+    }
+    asm_store32(field, inst);
+}
+
+/// Resolves the field at `address` now when `target` is known, otherwise records a fixup
+static inline void asm_reference(Assembler *as, const AsmFixupKind kind, const word_t address, const AsmExpr target) {
+    if (target.symbol < 0) {
+        asm_apply(as, kind, address, target.value);
+        return;
+    }
+    if (as->fixup_count == as->fixup_capacity) {
+        as->fixups = asm_grow(as->fixups, &as->fixup_capacity, sizeof(AsmFixup));
+    }
+    as->fixups[as->fixup_count++] = (AsmFixup){
+        .kind = kind,
+        .symbol = (uint32_t)target.symbol,
+        .addend = target.value,
+        .address = address,
+        .line = as->line,
+    };
+}
+
+static inline void asm_resolve_fixups(Assembler *as) {
+    for (size_t i = 0; i < as->fixup_count; ++i) {
+        const AsmFixup *fixup = &as->fixups[i];
+        const AsmSymbol *symbol = &as->program->symbols.items[fixup->symbol];
+        as->line = fixup->line;
+        if (!symbol->defined) asm_fail(as, "undefined symbol '%.*s'", (int)symbol->length, symbol->name);
+        asm_apply(as, fixup->kind, fixup->address, symbol->value + fixup->addend);
+    }
+}
+
+/// Places the pending literals (aligned, identical values shared) and points their LDRs at them
+static inline void asm_flush_literals(Assembler *as) {
+    const size_t line = as->line;
+    asm_align(as, WORD_SIZE_BYTES);
+
+    for (size_t i = 0; i < as->literal_count; ++i) {
+        AsmLiteral *literal = &as->literals[i];
+        as->line = literal->line;
+
+        literal->slot = 0;
+        for (size_t j = 0; j < i; ++j) {
+            const AsmLiteral *other = &as->literals[j];
+            if (other->value.value == literal->value.value && other->value.symbol == literal->value.symbol) {
+                literal->slot = other->slot;
+                break;
+            }
+        }
+        if (literal->slot == 0u) {
+            literal->slot = asm_location(as);
+            asm_emit32(as, 0);
+            asm_reference(as, ASM_FIXUP_WORD, literal->slot, literal->value);
+        }
+        asm_apply(as, ASM_FIXUP_OFFSET12, literal->address, literal->slot);
+    }
+    as->literal_count = 0;
+    as->line = line;
+}
+
+// -------------------------
+// Operands
+// -------------------------
+
+/// Parses the amount of a shift of the given ShiftType ("#n" or "Rs") and returns Operand2 bits [11:4]
+static inline word_t asm_shift_amount(Assembler *as, word_t type, const bool allow_register) {
+    static const char *const NAMES[] = {"LSL", "LSR", "ASR", "ROR"};
+    static const uint8_t TYPE_SHIFT = 5u;
+    static const uint8_t AMOUNT_SHIFT = 7u;
+    static const uint8_t RS_SHIFT = 8u;
+    static const word_t BY_REGISTER = 0x10;
+
+    if (!asm_accept(as, '#')) {
+        if (!allow_register) asm_fail(as, "register-specified shifts are not allowed here");
+        return (word_t)asm_register(as) << RS_SHIFT | type << TYPE_SHIFT | BY_REGISTER;
+    }
+
+    word_t amount = asm_const_expr(as);
+    const word_t max = type == SHIFT_LSR || type == SHIFT_ASR ? 32u : 31u;
+    const word_t min = type == SHIFT_ROR ? 1u : 0u;
+    if (amount < min || amount > max) asm_fail(as, "%s amount %u out of range", NAMES[type], amount);
+    // LSR/ASR #32 are encoded as #0, and LSR/ASR #0 mean LSL #0
+    if (amount == 0u) type = SHIFT_LSL;
+    if (amount == 32u) amount = 0u;
+    return amount << AMOUNT_SHIFT | type << TYPE_SHIFT;
+}
+
+/// Parses "LSL #n", "LSR Rs", "RRX", ... and returns Operand2 bits [11:4]
+static inline word_t asm_shift(Assembler *as, const bool allow_register) {
+    static const char *const NAMES[] = {"lsl", "lsr", "asr", "ror"};
+    static const uint8_t TYPE_SHIFT = 5u;
+
+    const AsmToken token = asm_identifier(as);
+    // RRX is ROR #0
+    if (asm_keyword(token, "rrx")) return (word_t)SHIFT_ROR << TYPE_SHIFT;
+    if (asm_keyword(token, "asl")) return asm_shift_amount(as, SHIFT_LSL, allow_register);
+
+    for (word_t type = 0; type < 4u; ++type) {
+        if (asm_keyword(token, NAMES[type])) return asm_shift_amount(as, type, allow_register);
+    }
+    asm_fail(as, "expected a shift");
+}
+
+/// True when the next token is a shift name (the cursor does not move)
+static inline bool asm_peek_shift(Assembler *as) {
+    const char *cursor = as->cursor;
+    const AsmToken token = asm_identifier(as);
+    as->cursor = cursor;
+    return asm_keyword(token, "lsl") || asm_keyword(token, "lsr") || asm_keyword(token, "asr") ||
+           asm_keyword(token, "ror") || asm_keyword(token, "rrx") || asm_keyword(token, "asl");
+}
+
+typedef struct AsmOperand2 {
+    bool immediate;
+    /// Immediate value, before encoding
+    word_t value;
+    /// Rm and shift bits of the register form
+    word_t bits;
+} AsmOperand2;
+
+static inline AsmOperand2 asm_operand2_register(Assembler *as, const uint8_t rm) {
+    AsmOperand2 op2 = {.immediate = false, .bits = rm};
+    if (asm_accept(as, ',')) op2.bits |= asm_shift(as, true);
+    return op2;
+}
+
+static inline AsmOperand2 asm_operand2(Assembler *as) {
+    if (asm_accept(as, '#')) {
+        const AsmOperand2 op2 = {.immediate = true, .value = asm_const_expr(as)};
+        return op2;
+    }
+    return asm_operand2_register(as, asm_register(as));
+}
+
+typedef struct AsmAddress {
+    uint8_t rn;
+    /// P bit
+    bool pre_indexed;
+    /// U bit
+    bool up;
+    /// W bit
+    bool writeback;
+    bool register_offset;
+    /// Immediate magnitude, or Rm and shift bits
+    word_t offset;
+} AsmAddress;
+
+static inline void asm_address_offset(Assembler *as, AsmAddress *address, const bool allow_register,
+                                      const bool allow_shift, const word_t imm_limit) {
+    if (asm_accept(as, '#')) {
+        const word_t value = asm_const_expr(as);
+        address->up = (int32_t)value >= 0;
+        address->offset = address->up ? value : 0u - value;
+        if (address->offset > imm_limit) asm_fail(as, "offset out of range (max %u)", imm_limit);
+        return;
+    }
+    if (!allow_register) asm_fail(as, "expected an immediate offset");
+
+    address->register_offset = true;
+    address->up = !asm_accept(as, '-');
+    if (address->up) asm_accept(as, '+');
+    address->offset = asm_register(as);
+    if (asm_accept(as, ',')) {
+        if (!allow_shift) asm_fail(as, "shifted offsets are not allowed here");
+        address->offset |= asm_shift(as, false);
+    }
+}
+
+/// Parses "[Rn]", "[Rn, offset]{!}" or "[Rn], offset"
+static inline AsmAddress asm_address(Assembler *as, const bool allow_register, const bool allow_shift,
+                                     const word_t imm_limit) {
+    AsmAddress address = {.pre_indexed = true, .up = true};
+    asm_expect(as, '[');
+    address.rn = asm_register(as);
+
+    if (asm_accept(as, ']')) {
+        if (asm_accept(as, ',')) {
+            address.pre_indexed = false;
+            asm_address_offset(as, &address, allow_register, allow_shift, imm_limit);
+        }
+        return address;
+    }
+    asm_expect(as, ',');
+    asm_address_offset(as, &address, allow_register, allow_shift, imm_limit);
+    asm_expect(as, ']');
+    address.writeback = asm_accept(as, '!');
+    return address;
+}
+
+/// Parses "{r0-r3, lr}" into a 16-bit register mask
+static inline word_t asm_register_list(Assembler *as) {
+    asm_expect(as, '{');
+    word_t list = 0;
+    do {
+        const uint8_t first = asm_register(as);
+        uint8_t last = first;
+        if (asm_accept(as, '-')) last = asm_register(as);
+        if (last < first) asm_fail(as, "register range r%u-r%u is reversed", first, last);
+        for (uint8_t r = first; r <= last; ++r) list |= 1u << r;
+    } while (asm_accept(as, ','));
+    asm_expect(as, '}');
+    return list;
+}
+
+/// Parses "cpsr", "spsr_fc", ... into the R bit (bit 22) and the field mask (bits 19:16)
+static inline word_t asm_psr(Assembler *as, const bool allow_fields) {
+    static const word_t R_MASK = 0x00400000;
+    static const uint8_t FIELDS_SHIFT = 16u;
+    // CPSR_fc, what a bare "cpsr" means to MSR
+    static const word_t DEFAULT_FIELDS = 0x9;
+
+    const AsmToken token = asm_identifier(as);
+    const AsmToken psr = {.text = token.text, .length = token.length < 4 ? token.length : 4};
+    const bool spsr = asm_keyword(psr, "spsr");
+    if (!spsr && !asm_keyword(psr, "cpsr")) asm_fail(as, "expected CPSR or SPSR");
+
+    const word_t r = spsr ? R_MASK : 0u;
+    if (token.length == 4) return r | (allow_fields ? DEFAULT_FIELDS << FIELDS_SHIFT : 0u);
+    if (!allow_fields || token.text[4] != '_') asm_fail(as, "unexpected PSR fields");
+
+    const AsmToken fields = {.text = token.text + 5, .length = token.length - 5};
+    if (asm_keyword(fields, "all")) return r | DEFAULT_FIELDS << FIELDS_SHIFT;
+    if (asm_keyword(fields, "flg")) return r | 0x8u << FIELDS_SHIFT;
+    if (asm_keyword(fields, "ctl")) return r | 0x1u << FIELDS_SHIFT;
+
+    word_t mask = 0;
+    for (size_t i = 0; i < fields.length; ++i) {
+        switch (tolower((unsigned char)fields.text[i])) {
+        case 'c': mask |= 0x1u; break;
+        case 'x': mask |= 0x2u; break;
+        case 's': mask |= 0x4u; break;
+        case 'f': mask |= 0x8u; break;
+        default: asm_fail(as, "unknown PSR field '%c'", fields.text[i]);
+        }
+    }
+    return r | mask << FIELDS_SHIFT;
+}
+
+// -------------------------
+// Mnemonics
+// -------------------------
+
+typedef enum AsmKind {
+    ASM_KIND_DATA_PROCESSING,
+    /// LSL/LSR/ASR/ROR/RRX, aliases of MOV with a shifted register
+    ASM_KIND_SHIFT,
+    ASM_KIND_NOP,
+    ASM_KIND_ADR,
+    ASM_KIND_MULTIPLY,
+    ASM_KIND_MULTIPLY_LONG,
+    ASM_KIND_BRANCH,
+    ASM_KIND_BRANCH_EXCHANGE,
+    /// LDR/STR and their B/T/BT/H/SB/SH forms
+    ASM_KIND_TRANSFER,
+    ASM_KIND_SWAP,
+    ASM_KIND_BLOCK,
+    ASM_KIND_PUSH_POP,
+    ASM_KIND_SOFTWARE_INTERRUPT,
+    ASM_KIND_COPROCESSOR_DATA,
+    ASM_KIND_COPROCESSOR_TRANSFER,
+    ASM_KIND_COPROCESSOR_REGISTER,
+    ASM_KIND_MRS,
+    ASM_KIND_MSR,
+} AsmKind;
+
+/// Suffixes a mnemonic accepts besides the condition
+typedef enum AsmSuffixSet {
+    ASM_SUFFIX_NONE,
+    ASM_SUFFIX_S,
+    ASM_SUFFIX_TRANSFER,
+    ASM_SUFFIX_BLOCK,
+    ASM_SUFFIX_BYTE,
+    ASM_SUFFIX_LONG,
+} AsmSuffixSet;
+
+/// Indices into ASM_SUFFIXES[ASM_SUFFIX_TRANSFER]
+typedef enum AsmTransferSuffix {
+    ASM_TRANSFER_WORD,
+    ASM_TRANSFER_BYTE,
+    ASM_TRANSFER_T,
+    ASM_TRANSFER_BT,
+    ASM_TRANSFER_H,
+    ASM_TRANSFER_SB,
+    ASM_TRANSFER_SH,
+} AsmTransferSuffix;
+
+/// NULL-terminated, "" (no suffix) is always tried first
+static const char *const ASM_SUFFIXES[][10] = {
+    [ASM_SUFFIX_NONE] = {"", NULL},
+    [ASM_SUFFIX_S] = {"", "s", NULL},
+    [ASM_SUFFIX_TRANSFER] = {"", "b", "t", "bt", "h", "sb", "sh", NULL},
+    [ASM_SUFFIX_BLOCK] = {"", "ia", "ib", "da", "db", "fd", "ed", "fa", "ea", NULL},
+    [ASM_SUFFIX_BYTE] = {"", "b", NULL},
+    [ASM_SUFFIX_LONG] = {"", "l", NULL},
+};
+
+typedef struct AsmMnemonic {
+    const char *name;
+    AsmKind kind;
+    /// Kind specific: OpCode, ShiftType, link/load flag, or the multiply variant
+    uint8_t code;
+    AsmSuffixSet suffixes;
+} AsmMnemonic;
+
+/// Shift code of RRX in ASM_KIND_SHIFT (past the ShiftType values)
+#define ASM_SHIFT_RRX 4u
+
+/// Longer names come first, so "bl" is tried before "b" and "bic" before both
+static const AsmMnemonic ASM_MNEMONICS[] = {
+    // MULTIPLY_LONG code: bit 1 signed, bit 0 accumulate
+    {"umull", ASM_KIND_MULTIPLY_LONG, 0, ASM_SUFFIX_S},
+    {"umlal", ASM_KIND_MULTIPLY_LONG, 1, ASM_SUFFIX_S},
+    {"smull", ASM_KIND_MULTIPLY_LONG, 2, ASM_SUFFIX_S},
+    {"smlal", ASM_KIND_MULTIPLY_LONG, 3, ASM_SUFFIX_S},
+    {"push", ASM_KIND_PUSH_POP, 0, ASM_SUFFIX_NONE},
+    {"and", ASM_KIND_DATA_PROCESSING, OP_AND, ASM_SUFFIX_S},
+    {"eor", ASM_KIND_DATA_PROCESSING, OP_EOR, ASM_SUFFIX_S},
+    {"sub", ASM_KIND_DATA_PROCESSING, OP_SUB, ASM_SUFFIX_S},
+    {"rsb", ASM_KIND_DATA_PROCESSING, OP_RSB, ASM_SUFFIX_S},
+    {"add", ASM_KIND_DATA_PROCESSING, OP_ADD, ASM_SUFFIX_S},
+    {"adc", ASM_KIND_DATA_PROCESSING, OP_ADC, ASM_SUFFIX_S},
+    {"sbc", ASM_KIND_DATA_PROCESSING, OP_SBC, ASM_SUFFIX_S},
+    {"rsc", ASM_KIND_DATA_PROCESSING, OP_RSC, ASM_SUFFIX_S},
+    {"tst", ASM_KIND_DATA_PROCESSING, OP_TST, ASM_SUFFIX_S},
+    {"teq", ASM_KIND_DATA_PROCESSING, OP_TEQ, ASM_SUFFIX_S},
+    {"cmp", ASM_KIND_DATA_PROCESSING, OP_CMP, ASM_SUFFIX_S},
+    {"cmn", ASM_KIND_DATA_PROCESSING, OP_CMN, ASM_SUFFIX_S},
+    {"orr", ASM_KIND_DATA_PROCESSING, OP_ORR, ASM_SUFFIX_S},
+    {"mov", ASM_KIND_DATA_PROCESSING, OP_MOV, ASM_SUFFIX_S},
+    {"bic", ASM_KIND_DATA_PROCESSING, OP_BIC, ASM_SUFFIX_S},
+    {"mvn", ASM_KIND_DATA_PROCESSING, OP_MVN, ASM_SUFFIX_S},
+    {"lsl", ASM_KIND_SHIFT, SHIFT_LSL, ASM_SUFFIX_S},
+    {"lsr", ASM_KIND_SHIFT, SHIFT_LSR, ASM_SUFFIX_S},
+    {"asr", ASM_KIND_SHIFT, SHIFT_ASR, ASM_SUFFIX_S},
+    {"ror", ASM_KIND_SHIFT, SHIFT_ROR, ASM_SUFFIX_S},
+    {"rrx", ASM_KIND_SHIFT, ASM_SHIFT_RRX, ASM_SUFFIX_S},
+    {"nop", ASM_KIND_NOP, 0, ASM_SUFFIX_NONE},
+    {"adr", ASM_KIND_ADR, 0, ASM_SUFFIX_NONE},
+    {"mul", ASM_KIND_MULTIPLY, 0, ASM_SUFFIX_S},
+    {"mla", ASM_KIND_MULTIPLY, 1, ASM_SUFFIX_S},
+    {"ldr", ASM_KIND_TRANSFER, 1, ASM_SUFFIX_TRANSFER},
+    {"str", ASM_KIND_TRANSFER, 0, ASM_SUFFIX_TRANSFER},
+    {"swp", ASM_KIND_SWAP, 0, ASM_SUFFIX_BYTE},
+    {"ldm", ASM_KIND_BLOCK, 1, ASM_SUFFIX_BLOCK},
+    {"stm", ASM_KIND_BLOCK, 0, ASM_SUFFIX_BLOCK},
+    {"pop", ASM_KIND_PUSH_POP, 1, ASM_SUFFIX_NONE},
+    {"swi", ASM_KIND_SOFTWARE_INTERRUPT, 0, ASM_SUFFIX_NONE},
+    {"svc", ASM_KIND_SOFTWARE_INTERRUPT, 0, ASM_SUFFIX_NONE},
+    {"cdp", ASM_KIND_COPROCESSOR_DATA, 0, ASM_SUFFIX_NONE},
+    {"ldc", ASM_KIND_COPROCESSOR_TRANSFER, 1, ASM_SUFFIX_LONG},
+    {"stc", ASM_KIND_COPROCESSOR_TRANSFER, 0, ASM_SUFFIX_LONG},
+    {"mrc", ASM_KIND_COPROCESSOR_REGISTER, 1, ASM_SUFFIX_NONE},
+    {"mcr", ASM_KIND_COPROCESSOR_REGISTER, 0, ASM_SUFFIX_NONE},
+    {"mrs", ASM_KIND_MRS, 0, ASM_SUFFIX_NONE},
+    {"msr", ASM_KIND_MSR, 0, ASM_SUFFIX_NONE},
+    {"bx", ASM_KIND_BRANCH_EXCHANGE, 0, ASM_SUFFIX_NONE},
+    {"bl", ASM_KIND_BRANCH, 1, ASM_SUFFIX_NONE},
+    {"b", ASM_KIND_BRANCH, 0, ASM_SUFFIX_NONE},
+};
+
+static inline bool asm_condition(const char *text, CondCode *cond) {
+    static const char NAMES[] = "eqnecsccmiplvsvchilsgeltgtleal";
+    if (text[0] == 'h' && text[1] == 's') {
+        *cond = CS;
+        return true;
+    }
+    if (text[0] == 'l' && text[1] == 'o') {
+        *cond = CC;
+        return true;
+    }
+    for (uint8_t i = 0; i <= AL; ++i) {
+        if (NAMES[2 * i] == text[0] && NAMES[2 * i + 1] == text[1]) {
+            *cond = (CondCode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Splits what follows the base mnemonic into a suffix and a condition, in either order
+static inline bool asm_split_suffix(const char *rest, const size_t length, const AsmSuffixSet set,
+                                    uint8_t *suffix, CondCode *cond) {
+    static const size_t COND_LENGTH = 2u;
+
+    for (uint8_t i = 0; ASM_SUFFIXES[set][i] != NULL; ++i) {
+        const char *candidate = ASM_SUFFIXES[set][i];
+        const size_t candidate_length = strlen(candidate);
+        *suffix = i;
+
+        if (length == candidate_length && memcmp(rest, candidate, candidate_length) == 0) {
+            *cond = AL;
+            return true;
+        }
+        if (length != candidate_length + COND_LENGTH) continue;
+        if (memcmp(rest, candidate, candidate_length) == 0 && asm_condition(rest + candidate_length, cond)) {
+            return true;
+        }
+        if (memcmp(rest + COND_LENGTH, candidate, candidate_length) == 0 && asm_condition(rest, cond)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// -------------------------
+// Instructions
+// -------------------------
+
+/// Rewrites an unencodable immediate into the complementary operation (MOV #-1 -> MVN #0)
+static inline bool asm_dp_alternate(uint8_t *op, word_t *value) {
+    switch (*op) {
+    case OP_MOV: *op = OP_MVN; *value = ~*value; return true;
+    case OP_MVN: *op = OP_MOV; *value = ~*value; return true;
+    case OP_AND: *op = OP_BIC; *value = ~*value; return true;
+    case OP_BIC: *op = OP_AND; *value = ~*value; return true;
+    case OP_ADC: *op = OP_SBC; *value = ~*value; return true;
+    case OP_SBC: *op = OP_ADC; *value = ~*value; return true;
+    case OP_ADD: *op = OP_SUB; *value = 0u - *value; return true;
+    case OP_SUB: *op = OP_ADD; *value = 0u - *value; return true;
+    case OP_CMP: *op = OP_CMN; *value = 0u - *value; return true;
+    case OP_CMN: *op = OP_CMP; *value = 0u - *value; return true;
+    default: return false;
+    }
+}
+
+static inline void asm_emit_data_processing(Assembler *as, const word_t cond, uint8_t op, const bool s,
+                                            const uint8_t rn, const uint8_t rd, AsmOperand2 op2) {
+    static const uint8_t COND_SHIFT = 28u;
+    static const uint8_t OP_SHIFT = 21u;
+    static const uint8_t S_SHIFT = 20u;
+    static const uint8_t RN_SHIFT = 16u;
+    static const uint8_t RD_SHIFT = 12u;
+    static const word_t I_MASK = 0x02000000;
+
+    if (op2.immediate) {
+        const word_t value = op2.value;
+        if (!asm_encode_imm(op2.value, &op2.bits) &&
+            (!asm_dp_alternate(&op, &op2.value) || !asm_encode_imm(op2.value, &op2.bits))) {
+            asm_fail(as, "immediate 0x%08x cannot be encoded", value);
+        }
+        op2.bits |= I_MASK;
+    }
+    asm_emit_inst(as, cond << COND_SHIFT | (word_t)op << OP_SHIFT | (word_t)s << S_SHIFT |
+                          (word_t)rn << RN_SHIFT | (word_t)rd << RD_SHIFT | op2.bits);
+}
+
+static inline void asm_data_processing(Assembler *as, const word_t cond, const uint8_t op, const bool s) {
+    if (op >= OP_TST && op <= OP_CMN) {
+        // Flag-only, S is implied
+        const uint8_t rn = asm_register(as);
+        asm_expect(as, ',');
+        asm_emit_data_processing(as, cond, op, true, rn, 0, asm_operand2(as));
+        return;
+    }
+
+    const uint8_t rd = asm_register(as);
+    asm_expect(as, ',');
+    if (op == OP_MOV || op == OP_MVN) {
+        asm_emit_data_processing(as, cond, op, s, 0, rd, asm_operand2(as));
+        return;
+    }
+
+    // "op Rd, Rn, Op2", or "op Rd, Op2" meaning "op Rd, Rd, Op2"
+    if (asm_peek(as, '#')) {
+        asm_emit_data_processing(as, cond, op, s, rd, rd, asm_operand2(as));
+        return;
+    }
+    const uint8_t second = asm_register(as);
+    if (!asm_accept(as, ',')) {
+        asm_emit_data_processing(as, cond, op, s, rd, rd, (AsmOperand2){.bits = second});
+        return;
+    }
+    if (asm_peek_shift(as)) {
+        const AsmOperand2 op2 = {.bits = second | asm_shift(as, true)};
+        asm_emit_data_processing(as, cond, op, s, rd, rd, op2);
+        return;
+    }
+    asm_emit_data_processing(as, cond, op, s, second, rd, asm_operand2(as));
+}
+
+/// LSL/LSR/ASR/ROR Rd, Rm, #n|Rs and RRX Rd, Rm
+static inline void asm_shift_alias(Assembler *as, const word_t cond, const uint8_t type, const bool s) {
+    static const uint8_t TYPE_SHIFT = 5u;
+
+    const uint8_t rd = asm_register(as);
+    asm_expect(as, ',');
+    const uint8_t rm = asm_register(as);
+
+    AsmOperand2 op2 = {.bits = rm};
+    if (type == ASM_SHIFT_RRX) {
+        op2.bits |= (word_t)SHIFT_ROR << TYPE_SHIFT;
+    }
+    else {
+        asm_expect(as, ',');
+        op2.bits |= asm_shift_amount(as, type, true);
+    }
+    asm_emit_data_processing(as, cond, OP_MOV, s, 0, rd, op2);
+}
+
+/// ADR Rd, label, assembled as ADD/SUB Rd, PC, #offset
+static inline void asm_adr(Assembler *as, const word_t cond) {
+    const uint8_t rd = asm_register(as);
+    asm_expect(as, ',');
+    const AsmExpr target = asm_expr(as);
+
+    const word_t address = asm_location(as);
+    asm_emit_inst(as, cond << 28 | (word_t)PC_REGISTER_INDEX << 16 | (word_t)rd << 12);
+    asm_reference(as, ASM_FIXUP_ADR, address, target);
+}
+
+/// MUL Rd, Rm, Rs and MLA Rd, Rm, Rs, Rn
+static inline void asm_multiply(Assembler *as, const word_t cond, const bool accumulate, const bool s) {
+    const uint8_t rd = asm_register(as);
+    asm_expect(as, ',');
+    const uint8_t rm = asm_register(as);
+    asm_expect(as, ',');
+    const uint8_t rs = asm_register(as);
+    uint8_t rn = 0;
+    if (accumulate) {
+        asm_expect(as, ',');
+        rn = asm_register(as);
+    }
+    asm_emit_inst(as, cond << 28 | (word_t)accumulate << 21 | (word_t)s << 20 | (word_t)rd << 16 |
+                          (word_t)rn << 12 | (word_t)rs << 8 | 0x90u | rm);
+}
+
+/// {U,S}MULL/{U,S}MLAL RdLo, RdHi, Rm, Rs
+static inline void asm_multiply_long(Assembler *as, const word_t cond, const uint8_t variant, const bool s) {
+    static const word_t LONG_PATTERN = 0x00800090;
+
+    const uint8_t rd_lo = asm_register(as);
+    asm_expect(as, ',');
+    const uint8_t rd_hi = asm_register(as);
+    asm_expect(as, ',');
+    const uint8_t rm = asm_register(as);
+    asm_expect(as, ',');
+    const uint8_t rs = asm_register(as);
+
+    const word_t is_signed = (variant >> 1) & 1u;
+    const word_t accumulate = variant & 1u;
+    asm_emit_inst(as, cond << 28 | LONG_PATTERN | is_signed << 22 | accumulate << 21 | (word_t)s << 20 |
+                          (word_t)rd_hi << 16 | (word_t)rd_lo << 12 | (word_t)rs << 8 | rm);
+}
+
+static inline void asm_branch(Assembler *as, const word_t cond, const bool link) {
+    static const word_t BRANCH_PATTERN = 0x0A000000;
+
+    const AsmExpr target = asm_expr(as);
+    const word_t address = asm_location(as);
+    asm_emit_inst(as, cond << 28 | BRANCH_PATTERN | (word_t)link << 24);
+    asm_reference(as, ASM_FIXUP_BRANCH24, address, target);
+}
+
+static inline void asm_branch_exchange(Assembler *as, const word_t cond) {
+    static const word_t BX_PATTERN = 0x012FFF10;
+    asm_emit_inst(as, cond << 28 | BX_PATTERN | asm_register(as));
+}
+
+/// LDR Rd, =value: a MOV/MVN when the value allows it, otherwise a literal pool load
+static inline void asm_literal_load(Assembler *as, const word_t cond, const uint8_t rd) {
+    static const word_t LDR_PC_PATTERN = 0x05100000 | (word_t)PC_REGISTER_INDEX << 16;
+
+    const AsmExpr value = asm_expr(as);
+    if (value.symbol < 0) {
+        word_t bits;
+        if (asm_encode_imm(value.value, &bits) || asm_encode_imm(~value.value, &bits)) {
+            const AsmOperand2 op2 = {.immediate = true, .value = value.value};
+            asm_emit_data_processing(as, cond, OP_MOV, false, 0, rd, op2);
+            return;
+        }
+    }
+
+    if (as->literal_count == as->literal_capacity) {
+        as->literals = asm_grow(as->literals, &as->literal_capacity, sizeof(AsmLiteral));
+    }
+    as->literals[as->literal_count++] = (AsmLiteral){.value = value, .address = asm_location(as), .line = as->line};
+    asm_emit_inst(as, cond << 28 | LDR_PC_PATTERN | (word_t)rd << 12);
+}
+
+/// LDR/STR{B}{T}, LDRH/STRH and LDRSB/LDRSH
+static inline void asm_transfer(Assembler *as, const word_t cond, const bool load, const uint8_t suffix) {
+    static const word_t SINGLE_PATTERN = 0x04000000;
+    static const word_t HALFWORD_PATTERN = 0x00000090;
+    static const word_t P_MASK = 0x01000000;
+    static const word_t U_MASK = 0x00800000;
+    static const word_t W_MASK = 0x00200000;
+    static const word_t L_MASK = 0x00100000;
+    // Single transfer: register offset. Halfword transfer: immediate offset
+    static const word_t SINGLE_REGISTER_MASK = 0x02000000;
+    static const word_t HALFWORD_IMMEDIATE_MASK = 0x00400000;
+
+    const bool halfword = suffix >= ASM_TRANSFER_H;
+    const bool byte = suffix == ASM_TRANSFER_BYTE || suffix == ASM_TRANSFER_BT;
+    const bool translated = suffix == ASM_TRANSFER_T || suffix == ASM_TRANSFER_BT;
+    if (!load && (suffix == ASM_TRANSFER_SB || suffix == ASM_TRANSFER_SH)) {
+        asm_fail(as, "signed stores do not exist, use STRB/STRH");
+    }
+
+    const uint8_t rd = asm_register(as);
+    asm_expect(as, ',');
+
+    word_t inst = cond << 28 | (load ? L_MASK : 0u) | (word_t)rd << 12;
+    if (halfword) {
+        // SH field: 01 unsigned halfword, 10 signed byte, 11 signed halfword
+        inst |= HALFWORD_PATTERN | (word_t)(suffix - ASM_TRANSFER_H + 1u) << 5;
+    }
+    else {
+        inst |= SINGLE_PATTERN | (byte ? 0x00400000u : 0u);
+    }
+
+    if (asm_accept(as, '=')) {
+        if (!load || suffix != ASM_TRANSFER_WORD) asm_fail(as, "literal loads are only available to LDR");
+        asm_literal_load(as, cond, rd);
+        return;
+    }
+
+    if (!asm_peek(as, '[')) {
+        // PC-relative label
+        if (translated) asm_fail(as, "T variants need post-indexed addressing");
+        const AsmExpr target = asm_expr(as);
+        const word_t address = asm_location(as);
+        inst |= P_MASK | (word_t)PC_REGISTER_INDEX << 16 | (halfword ? HALFWORD_IMMEDIATE_MASK : 0u);
+        asm_emit_inst(as, inst);
+        asm_reference(as, halfword ? ASM_FIXUP_OFFSET8 : ASM_FIXUP_OFFSET12, address, target);
+        return;
+    }
+
+    AsmAddress address = asm_address(as, true, !halfword, halfword ? 0xFFu : 0xFFFu);
+    if (translated) {
+        // "[Rn]" reads as "[Rn], #0" here
+        const bool bare = address.pre_indexed && !address.writeback && !address.register_offset && address.offset == 0u;
+        if (bare) address.pre_indexed = false;
+        if (address.pre_indexed) asm_fail(as, "T variants need post-indexed addressing");
+        // W set on a post-indexed transfer selects the user-mode access
+        address.writeback = true;
+    }
+
+    inst |= (address.pre_indexed ? P_MASK : 0u) | (address.up ? U_MASK : 0u) | (address.writeback ? W_MASK : 0u) |
+            (word_t)address.rn << 16;
+    if (halfword) {
+        if (address.register_offset) inst |= address.offset;
+        else inst |= HALFWORD_IMMEDIATE_MASK | (address.offset & 0xF0u) << 4 | (address.offset & 0x0Fu);
+    }
+    else {
+        inst |= (address.register_offset ? SINGLE_REGISTER_MASK : 0u) | address.offset;
+    }
+    asm_emit_inst(as, inst);
+}
+
+/// SWP{B} Rd, Rm, [Rn]
+static inline void asm_swap(Assembler *as, const word_t cond, const bool byte) {
+    static const word_t SWP_PATTERN = 0x01000090;
+
+    const uint8_t rd = asm_register(as);
+    asm_expect(as, ',');
+    const uint8_t rm = asm_register(as);
+    asm_expect(as, ',');
+    asm_expect(as, '[');
+    const uint8_t rn = asm_register(as);
+    asm_expect(as, ']');
+    asm_emit_inst(as, cond << 28 | SWP_PATTERN | (word_t)byte << 22 | (word_t)rn << 16 | (word_t)rd << 12 | rm);
+}
+
+static inline void asm_emit_block(Assembler *as, const word_t cond, const bool load, const word_t pu,
+                                  const bool writeback, const uint8_t rn, const word_t list, const bool user) {
+    static const word_t BLOCK_PATTERN = 0x08000000;
+    if (list == 0u) asm_fail(as, "empty register list");
+    asm_emit_inst(as, cond << 28 | BLOCK_PATTERN | pu << 23 | (word_t)user << 22 | (word_t)writeback << 21 |
+                          (word_t)load << 20 | (word_t)rn << 16 | list);
+}
+
+/// P and U bits (as bits 1:0) of each addressing mode
+#define ASM_BLOCK_IA 0x1u
+#define ASM_BLOCK_IB 0x3u
+#define ASM_BLOCK_DA 0x0u
+#define ASM_BLOCK_DB 0x2u
+
+/// LDM/STM<mode> Rn{!}, {list}{^}
+static inline void asm_block(Assembler *as, const word_t cond, const bool load, const uint8_t suffix) {
+    // Indexed by ASM_SUFFIXES[ASM_SUFFIX_BLOCK], the stack modes depend on the direction
+    static const word_t LOAD_MODES[] = {ASM_BLOCK_IA, ASM_BLOCK_IA, ASM_BLOCK_IB, ASM_BLOCK_DA, ASM_BLOCK_DB,
+                                        ASM_BLOCK_IA, ASM_BLOCK_IB, ASM_BLOCK_DA, ASM_BLOCK_DB};
+    static const word_t STORE_MODES[] = {ASM_BLOCK_IA, ASM_BLOCK_IA, ASM_BLOCK_IB, ASM_BLOCK_DA, ASM_BLOCK_DB,
+                                         ASM_BLOCK_DB, ASM_BLOCK_DA, ASM_BLOCK_IB, ASM_BLOCK_IA};
+
+    const uint8_t rn = asm_register(as);
+    const bool writeback = asm_accept(as, '!');
+    asm_expect(as, ',');
+    const word_t list = asm_register_list(as);
+    const bool user = asm_accept(as, '^');
+    asm_emit_block(as, cond, load, load ? LOAD_MODES[suffix] : STORE_MODES[suffix], writeback, rn, list, user);
+}
+
+/// PUSH {list} = STMDB SP!, {list} and POP {list} = LDMIA SP!, {list}
+static inline void asm_push_pop(Assembler *as, const word_t cond, const bool pop) {
+    static const uint8_t SP_REGISTER_INDEX = 13u;
+    const word_t list = asm_register_list(as);
+    asm_emit_block(as, cond, pop, pop ? ASM_BLOCK_IA : ASM_BLOCK_DB, true, SP_REGISTER_INDEX, list, false);
+}
+
+static inline void asm_software_interrupt(Assembler *as, const word_t cond) {
+    static const word_t SWI_PATTERN = 0x0F000000;
+    asm_emit_inst(as, cond << 28 | SWI_PATTERN | asm_small_const(as, 0x00FFFFFFu, "SWI number"));
+}
+
+/// CDP pN, op1, CRd, CRn, CRm{, op2}
+static inline void asm_coprocessor_data(Assembler *as, const word_t cond) {
+    static const word_t CDP_PATTERN = 0x0E000000;
+
+    const word_t cp = asm_numbered(as, 'p', "a coprocessor");
+    asm_expect(as, ',');
+    const word_t op1 = asm_small_const(as, 0xFu, "opcode");
+    asm_expect(as, ',');
+    const word_t crd = asm_numbered(as, 'c', "a coprocessor register");
+    asm_expect(as, ',');
+    const word_t crn = asm_numbered(as, 'c', "a coprocessor register");
+    asm_expect(as, ',');
+    const word_t crm = asm_numbered(as, 'c', "a coprocessor register");
+    const word_t op2 = asm_accept(as, ',') ? asm_small_const(as, 0x7u, "opcode") : 0u;
+    asm_emit_inst(as, cond << 28 | CDP_PATTERN | op1 << 20 | crn << 16 | crd << 12 | cp << 8 | op2 << 5 | crm);
+}
+
+/// MRC/MCR pN, op1, Rd, CRn, CRm{, op2}
+static inline void asm_coprocessor_register(Assembler *as, const word_t cond, const bool load) {
+    static const word_t TRANSFER_PATTERN = 0x0E000010;
+
+    const word_t cp = asm_numbered(as, 'p', "a coprocessor");
+    asm_expect(as, ',');
+    const word_t op1 = asm_small_const(as, 0x7u, "opcode");
+    asm_expect(as, ',');
+    const word_t rd = asm_register(as);
+    asm_expect(as, ',');
+    const word_t crn = asm_numbered(as, 'c', "a coprocessor register");
+    asm_expect(as, ',');
+    const word_t crm = asm_numbered(as, 'c', "a coprocessor register");
+    const word_t op2 = asm_accept(as, ',') ? asm_small_const(as, 0x7u, "opcode") : 0u;
+    asm_emit_inst(as, cond << 28 | TRANSFER_PATTERN | op1 << 21 | (word_t)load << 20 | crn << 16 | rd << 12 |
+                          cp << 8 | op2 << 5 | crm);
+}
+
+/// LDC/STC{L} pN, CRd, <address>, the immediate offset is in bytes and a multiple of 4
+static inline void asm_coprocessor_transfer(Assembler *as, const word_t cond, const bool load, const bool long_transfer) {
+    static const word_t TRANSFER_PATTERN = 0x0C000000;
+
+    const word_t cp = asm_numbered(as, 'p', "a coprocessor");
+    asm_expect(as, ',');
+    const word_t crd = asm_numbered(as, 'c', "a coprocessor register");
+    asm_expect(as, ',');
+    AsmAddress address = asm_address(as, false, false, 0x3FCu);
+    if ((address.offset & WORD_ALIGN_MASK) != 0u) asm_fail(as, "coprocessor offsets must be multiples of 4");
+    // Post-indexed coprocessor transfers always write back
+    if (!address.pre_indexed) address.writeback = true;
+
+    asm_emit_inst(as, cond << 28 | TRANSFER_PATTERN | (word_t)address.pre_indexed << 24 | (word_t)address.up << 23 |
+                          (word_t)long_transfer << 22 | (word_t)address.writeback << 21 | (word_t)load << 20 |
+                          (word_t)address.rn << 16 | crd << 12 | cp << 8 | address.offset >> 2);
+}
+
+/// MRS Rd, CPSR|SPSR
+static inline void asm_mrs(Assembler *as, const word_t cond) {
+    static const word_t MRS_PATTERN = 0x010F0000;
+    const uint8_t rd = asm_register(as);
+    asm_expect(as, ',');
+    asm_emit_inst(as, cond << 28 | MRS_PATTERN | asm_psr(as, false) | (word_t)rd << 12);
+}
+
+/// MSR <psr>_<fields>, Rm|#imm
+static inline void asm_msr(Assembler *as, const word_t cond) {
+    static const word_t MSR_PATTERN = 0x0120F000;
+    static const word_t I_MASK = 0x02000000;
+
+    const word_t psr = asm_psr(as, true);
+    asm_expect(as, ',');
+    const AsmOperand2 op2 = asm_operand2(as);
+    word_t bits = op2.bits;
+    if (op2.immediate) {
+        if (!asm_encode_imm(op2.value, &bits)) asm_fail(as, "immediate 0x%08x cannot be encoded", op2.value);
+        bits |= I_MASK;
+    }
+    else if (op2.bits > 0xFu) {
+        asm_fail(as, "MSR takes an unshifted register");
+    }
+    asm_emit_inst(as, cond << 28 | MSR_PATTERN | psr | bits);
+}
+
+static inline void asm_instruction(Assembler *as, const AsmToken mnemonic) {
+    static const size_t MAX_MNEMONIC_LENGTH = 16u;
+
+    char name[16];
+    if (mnemonic.length >= MAX_MNEMONIC_LENGTH) {
+        asm_fail(as, "unknown instruction '%.*s'", (int)mnemonic.length, mnemonic.text);
+    }
+    for (size_t i = 0; i < mnemonic.length; ++i) name[i] = (char)tolower((unsigned char)mnemonic.text[i]);
+
+    for (size_t m = 0; m < sizeof(ASM_MNEMONICS) / sizeof(ASM_MNEMONICS[0]); ++m) {
+        const AsmMnemonic *entry = &ASM_MNEMONICS[m];
+        if (entry->name[0] != name[0]) continue;
+        const size_t base_length = strlen(entry->name);
+        if (base_length > mnemonic.length || memcmp(name, entry->name, base_length) != 0) continue;
+
+        uint8_t suffix;
+        CondCode cond;
+        if (!asm_split_suffix(name + base_length, mnemonic.length - base_length, entry->suffixes, &suffix, &cond)) {
+            continue;
+        }
+
+        const bool s = entry->suffixes == ASM_SUFFIX_S && suffix == 1u;
+        switch (entry->kind) {
+        case ASM_KIND_DATA_PROCESSING: asm_data_processing(as, cond, entry->code, s); return;
+        case ASM_KIND_SHIFT: asm_shift_alias(as, cond, entry->code, s); return;
+        case ASM_KIND_NOP: asm_emit_inst(as, (word_t)cond << 28 | 0x01A00000u); return;
+        case ASM_KIND_ADR: asm_adr(as, cond); return;
+        case ASM_KIND_MULTIPLY: asm_multiply(as, cond, entry->code, s); return;
+        case ASM_KIND_MULTIPLY_LONG: asm_multiply_long(as, cond, entry->code, s); return;
+        case ASM_KIND_BRANCH: asm_branch(as, cond, entry->code); return;
+        case ASM_KIND_BRANCH_EXCHANGE: asm_branch_exchange(as, cond); return;
+        case ASM_KIND_TRANSFER: asm_transfer(as, cond, entry->code, suffix); return;
+        case ASM_KIND_SWAP: asm_swap(as, cond, suffix == 1u); return;
+        case ASM_KIND_BLOCK: asm_block(as, cond, entry->code, suffix); return;
+        case ASM_KIND_PUSH_POP: asm_push_pop(as, cond, entry->code); return;
+        case ASM_KIND_SOFTWARE_INTERRUPT: asm_software_interrupt(as, cond); return;
+        case ASM_KIND_COPROCESSOR_DATA: asm_coprocessor_data(as, cond); return;
+        case ASM_KIND_COPROCESSOR_TRANSFER: asm_coprocessor_transfer(as, cond, entry->code, suffix == 1u); return;
+        case ASM_KIND_COPROCESSOR_REGISTER: asm_coprocessor_register(as, cond, entry->code); return;
+        case ASM_KIND_MRS: asm_mrs(as, cond); return;
+        case ASM_KIND_MSR: asm_msr(as, cond); return;
+        }
+    }
+    asm_fail(as, "unknown instruction '%.*s'", (int)mnemonic.length, mnemonic.text);
+}
+
+// -------------------------
+// Directives
+// -------------------------
+
+static inline void asm_define(Assembler *as, const AsmToken name, const word_t value, const bool redefinable) {
+    // Interning may grow the table, index it afterwards
+    const uint32_t id = asm_symbol_intern(&as->program->symbols, name.text, name.length);
+    AsmSymbol *symbol = &as->program->symbols.items[id];
+    if (symbol->defined && !redefinable) asm_fail(as, "symbol '%.*s' is already defined", (int)name.length, name.text);
+    symbol->value = value;
+    symbol->defined = true;
+}
+
+/// One or more comma separated strings, with C escapes
+static inline void asm_strings(Assembler *as, const bool terminate) {
+    do {
+        asm_expect(as, '"');
+        for (;;) {
+            if (as->cursor >= as->line_end) asm_fail(as, "unterminated string");
+            char c = *as->cursor++;
+            if (c == '"') break;
+            if (c == '\\') {
+                if (as->cursor >= as->line_end) asm_fail(as, "unterminated string");
+                switch (*as->cursor++) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case '0': c = '\0'; break;
+                case '\\': c = '\\'; break;
+                case '"': c = '"'; break;
+                case '\'': c = '\''; break;
+                default: asm_fail(as, "unknown escape '\\%c'", as->cursor[-1]);
+                }
+            }
+            *asm_reserve(as, BYTE_SIZE_BYTES) = (byte_t)c;
+        }
+        if (terminate) asm_reserve(as, BYTE_SIZE_BYTES);
+    } while (asm_accept(as, ','));
+}
+
+static inline void asm_directive(Assembler *as, const AsmToken directive) {
+    if (asm_keyword(directive, ".word") || asm_keyword(directive, ".long") || asm_keyword(directive, ".4byte")) {
+        do {
+            const AsmExpr value = asm_expr(as);
+            const word_t address = asm_location(as);
+            asm_emit32(as, 0);
+            asm_reference(as, ASM_FIXUP_WORD, address, value);
+        } while (asm_accept(as, ','));
+    }
+    else if (asm_keyword(directive, ".hword") || asm_keyword(directive, ".short") ||
+             asm_keyword(directive, ".2byte")) {
+        do {
+            const word_t value = asm_const_expr(as);
+            byte_t *bytes = asm_reserve(as, HALFWORD_SIZE_BYTES);
+            bytes[0] = (byte_t)value;
+            bytes[1] = (byte_t)(value >> BYTE_SIZE_BITS);
+        } while (asm_accept(as, ','));
+    }
+    else if (asm_keyword(directive, ".byte")) {
+        do {
+            *asm_reserve(as, BYTE_SIZE_BYTES) = (byte_t)asm_const_expr(as);
+        } while (asm_accept(as, ','));
+    }
+    else if (asm_keyword(directive, ".ascii")) {
+        asm_strings(as, false);
+    }
+    else if (asm_keyword(directive, ".asciz") || asm_keyword(directive, ".string")) {
+        asm_strings(as, true);
+    }
+    else if (asm_keyword(directive, ".space") || asm_keyword(directive, ".skip")) {
+        const word_t size = asm_const_expr(as);
+        const word_t fill = asm_accept(as, ',') ? asm_const_expr(as) : 0u;
+        memset(asm_reserve(as, size), (byte_t)fill, size);
+    }
+    else if (asm_keyword(directive, ".align") || asm_keyword(directive, ".p2align")) {
+        asm_align(as, 1u << asm_small_const(as, 16u, "alignment"));
+    }
+    else if (asm_keyword(directive, ".balign")) {
+        const word_t alignment = asm_const_expr(as);
+        if (alignment == 0u || (alignment & (alignment - 1u)) != 0u) asm_fail(as, "alignment must be a power of 2");
+        asm_align(as, alignment);
+    }
+    else if (asm_keyword(directive, ".org")) {
+        const word_t address = asm_const_expr(as);
+        if (address < asm_location(as)) asm_fail(as, ".org 0x%08x moves backwards", address);
+        asm_reserve(as, address - asm_location(as));
+    }
+    else if (asm_keyword(directive, ".equ") || asm_keyword(directive, ".set")) {
+        const AsmToken name = asm_identifier(as);
+        if (name.length == 0) asm_fail(as, "expected a symbol name");
+        asm_expect(as, ',');
+        asm_define(as, name, asm_const_expr(as), asm_keyword(directive, ".set"));
+    }
+    else if (asm_keyword(directive, ".ltorg") || asm_keyword(directive, ".pool")) {
+        asm_flush_literals(as);
+    }
+    else if (asm_keyword(directive, ".end")) {
+        as->stopped = true;
+    }
+    else if (asm_keyword(directive, ".global") || asm_keyword(directive, ".globl") ||
+             asm_keyword(directive, ".text") || asm_keyword(directive, ".data") ||
+             asm_keyword(directive, ".section") || asm_keyword(directive, ".arm") ||
+             asm_keyword(directive, ".code") || asm_keyword(directive, ".type") ||
+             asm_keyword(directive, ".size") || asm_keyword(directive, ".syntax") ||
+             asm_keyword(directive, ".cpu") || asm_keyword(directive, ".file")) {
+        // Single flat image, nothing to do
+        as->cursor = as->line_end;
+    }
+    else {
+        asm_fail(as, "unknown directive '%.*s'", (int)directive.length, directive.text);
+    }
+}
+
+// -------------------------
+// Driver
+// -------------------------
+
+static inline void asm_statement(Assembler *as) {
+    for (;;) {
+        if (asm_at_end(as)) return;
+
+        const AsmToken token = asm_identifier(as);
+        if (token.length == 0) asm_fail(as, "expected a label, directive or instruction");
+
+        if (asm_accept(as, ':')) {
+            asm_define(as, token, asm_location(as), false);
+            continue;
+        }
+        if (token.text[0] == '.') asm_directive(as, token);
+        else asm_instruction(as, token);
+
+        if (!asm_at_end(as)) asm_fail(as, "unexpected '%c'", asm_current(as));
+        return;
+    }
+}
+
+/// Runs the single pass, the pool flush and the fixup pass
+/// Kept out of construct_asm_program so no local of the caller lives across the setjmp
+static inline bool asm_run(Assembler *as) {
+    if (setjmp(as->on_error)) return false;
+
+    while (as->cursor < as->end && !as->stopped) {
+        const char *newline = memchr(as->cursor, '\n', (size_t)(as->end - as->cursor));
+        as->line_end = newline != NULL ? newline : as->end;
+        ++as->line;
+
+        asm_statement(as);
+        as->cursor = newline != NULL ? newline + 1 : as->end;
+    }
+    asm_flush_literals(as);
+    asm_resolve_fixups(as);
+    return true;
+}
+
+/// Assembles `length` bytes of source text for loading at `base_address`
+/// On error program.ok is false and error/error_line describe the first problem.
+/// The symbol names point into `source`, which must outlive the program.
+static inline AsmProgram construct_asm_program(const char *source, const size_t length, const word_t base_address) {
+    static const size_t INITIAL_CAPACITY = 4096u;
+    assert(source != NULL);
+    assert((base_address & WORD_ALIGN_MASK) == 0);
+
+    AsmProgram program = {
+        .image = malloc(INITIAL_CAPACITY),
+        .size = 0,
+        .capacity = INITIAL_CAPACITY,
+        .base_address = base_address,
+        .entry = base_address,
+        .symbols = construct_asm_symbol_table(),
+    };
+    assert(program.image != NULL);
+
+    Assembler as = {.program = &program, .cursor = source, .line_end = source, .end = source + length};
+    program.ok = asm_run(&as);
+    free(as.fixups);
+    free(as.literals);
+
+    static const char ENTRY_SYMBOL[] = "_start";
+    const AsmSymbol *entry = asm_symbol_find(&program.symbols, ENTRY_SYMBOL, sizeof(ENTRY_SYMBOL) - 1u);
+    if (entry != NULL && entry->defined) program.entry = entry->value;
+    return program;
+}
+
+static inline void destroy_asm_program(AsmProgram *program) {
+    assert(program != NULL);
+    free(program->image);
+    destroy_asm_symbol_table(&program->symbols);
+    *program = (AsmProgram){0};
+}
+
+/// Value of a defined symbol, false when it does not exist
+static inline bool asm_lookup_symbol(const AsmProgram *program, const char *name, word_t *value) {
+    assert(program != NULL);
+    const AsmSymbol *symbol = asm_symbol_find(&program->symbols, name, strlen(name));
+    if (symbol == NULL || !symbol->defined) return false;
+    *value = symbol->value;
+    return true;
+}
+
+/// Copies the assembled image into guest memory at its base address in one bulk copy
+static inline void asm_load_program(const AsmProgram *program, const ProgramMemory *mem) {
+    assert(program != NULL);
+    assert(program->ok);
+    byte_t *const destination = mem_host_ptr(mem, program->base_address, (word_t)program->size);
+    assert(destination != NULL);
+    memcpy(destination, program->image, program->size);
+}
+
+#endif //SIMPLEARM_PARSER_H
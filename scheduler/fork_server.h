@@ -0,0 +1,156 @@
+//
+// Created by valentin on 02/06/26.
+//
+#pragma once
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "scheduler/scheduler.h"
+
+// Fork server
+//
+// A guest is loaded and run up to its pause address once (see Guest.pause_at), then
+// every job is a fork of this process resuming it: the child inherits the warmed-up
+// guest, its memory and its translated blocks through host copy-on-write, runs it to
+// the end and exits with its status. Loading, translation and whatever the guest did
+// before the pause are paid once for all jobs.
+//
+// The protocol follows the AFL fork server, over a pipe pair or a connection:
+//   client -> server   4 bytes, any value: run one job
+//   server -> client   4 bytes: pid of the child (native byte order), right after the fork
+//   server -> client   4 bytes: its wait status (see waitpid), once it is done
+// The client enforces the timeout: it kills a child that hangs, the server then sends
+// the status of that kill.
+// Jobs get their input the way the guest reads it, through semihosting (a file the
+// client rewrites between jobs, for instance).
+//
+// fork copies the calling thread only. The server first stops the block compiler and
+// the I/O pool, children then optimise and do semihosting I/O on their one thread.
+
+typedef struct ForkServer {
+    Scheduler *scheduler;
+    /// Paused guest every job resumes
+    Guest *guest;
+    /// Jobs run so far
+    uint64_t jobs;
+} ForkServer;
+
+/// Fork server resuming `guest`, which must be paused (or not have run yet)
+/// Stops the helper threads of the scheduler. The other guests must have finished.
+static inline ForkServer construct_fork_server(Scheduler *scheduler, Guest *guest) {
+    assert(scheduler != NULL);
+    assert(guest != NULL);
+    assert(guest->status == GUEST_PAUSED || guest->status == GUEST_RUNNABLE);
+
+    destroy_block_compiler(scheduler->compiler);
+    scheduler->compiler = NULL;
+    destroy_io_pool(scheduler->io_pool);
+    scheduler->io_pool = NULL;
+    for (size_t i = 0; i < scheduler->guest_count; ++i) {
+        scheduler->guests[i].compiler = NULL;
+        scheduler->guests[i].semihost.io_pool = NULL;
+    }
+
+    const ForkServer server = {.scheduler = scheduler, .guest = guest};
+    return server;
+}
+
+/// Runs the guest to the end in a child, returns its pid, or -1 when fork failed
+static inline pid_t fork_server_spawn(ForkServer *server) {
+    // Buffered output would be written once more by every child
+    fflush(NULL);
+    const pid_t pid = fork();
+    if (pid != 0) {
+        if (pid > 0) ++server->jobs;
+        return pid;
+    }
+
+    Scheduler *scheduler = server->scheduler;
+    Guest *guest = server->guest;
+    // Every job starts its edges afresh, like an AFL target after its fork
+    guest->coverage_previous = 0;
+    if (guest->status == GUEST_PAUSED) scheduler_resume_guest(scheduler, guest);
+    scheduler_run(scheduler, 1u);
+    // Nothing of the server is torn down, the host reclaims it
+    _exit(guest->status == GUEST_FINISHED ? guest_exit_status(guest) : 1);
+}
+
+static inline bool fork_server_read_word(const int fd, uint32_t *word) {
+    size_t done = 0;
+    while (done < sizeof(*word)) {
+        const ssize_t n = read(fd, (byte_t *)word + done, sizeof(*word) - done);
+        if (n == 0 || (n < 0 && errno != EINTR)) return false;
+        if (n > 0) done += (size_t)n;
+    }
+    return true;
+}
+
+static inline bool fork_server_write_word(const int fd, const uint32_t word) {
+    size_t done = 0;
+    while (done < sizeof(word)) {
+        const ssize_t n = write(fd, (const byte_t *)&word + done, sizeof(word) - done);
+        if (n < 0 && errno != EINTR) return false;
+        if (n > 0) done += (size_t)n;
+    }
+    return true;
+}
+
+/// Serves the requests read from `in`, answering on `out`, until `in` is closed
+/// Returns false when a child cannot be forked or the client went away mid-job.
+static inline bool fork_server_serve(ForkServer *server, const int in, const int out) {
+    uint32_t request;
+    while (fork_server_read_word(in, &request)) {
+        const pid_t pid = fork_server_spawn(server);
+        if (pid < 0) return false;
+        // Nobody would kill a hanging child for a client that is gone
+        const bool sent = fork_server_write_word(out, (uint32_t)pid);
+        if (!sent) kill(pid, SIGKILL);
+
+        int status;
+        while (waitpid(pid, &status, 0) < 0) {
+            if (errno != EINTR) return false;
+        }
+        if (!sent || !fork_server_write_word(out, (uint32_t)status)) return false;
+    }
+    return true;
+}
+
+/// Serves the connections to the Unix socket at `path` one after the other, each with
+/// fork_server_serve. Only returns when the socket cannot be set up or accept fails.
+static inline bool fork_server_listen(ForkServer *server, const char *path) {
+    assert(path != NULL);
+
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path)) return false;
+    strcpy(address.sun_path, path);
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) return false;
+    unlink(path);
+    if (bind(listener, (const struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 1) != 0) {
+        close(listener);
+        return false;
+    }
+
+    for (;;) {
+        const int connection = accept(listener, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR) continue;
+            close(listener);
+            return false;
+        }
+        // A client going away ends its connection, not the server
+        fork_server_serve(server, connection, connection);
+        close(connection);
+    }
+}
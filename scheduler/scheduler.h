@@ -0,0 +1,532 @@
+//
+// Created by valentin on 01/29/26.
+//
+#pragma once
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "memory.h"
+#include "cpu/cpu.h"
+#include "decoder/decoder.h"
+#include "decoder/thumb_decoder.h"
+#include "executor/blocks.h"
+#include "executor/block_store.h"
+#include "executor/compiler.h"
+#include "executor/coverage.h"
+#include "executor/shared_code.h"
+#include "executor/dispatch.h"
+#include "executor/fetch.h"
+#include "faults/fault.h"
+#include "coprocessor/bulk.h"
+#include "coprocessor/coprocessor.h"
+#include "coprocessor/cp15.h"
+#include "mmu/mmu.h"
+#include "semihosting/io_pool.h"
+#include "semihosting/semihost.h"
+
+// Cooperative guest scheduler
+//
+// Guests are time-sliced on a few host threads. A guest runs until it has used
+// its instruction quantum, which is only looked at when control leaves a basic
+// block (a taken branch, an exception, a state switch), so straight-line code
+// pays a decrement and nothing else. A guest waiting on semihosting I/O is
+// parked: it costs nothing until its request completes.
+//
+// A guest keeps no host stack and no trap of its own, the trap lives in the frame
+// of the slice that runs it. Guests sit in one array so walking them stays cheap.
+
+/// Instructions a guest runs before it yields, when the caller asks for 0
+#define SCHEDULER_DEFAULT_QUANTUM 100000u
+#define SCHEDULER_MAX_THREADS 64u
+/// Guest.pause_at of a guest that never pauses, no instruction lives at an odd address
+#define GUEST_NO_PAUSE 0xFFFFFFFFu
+
+typedef enum GuestStatus {
+    /// Waiting in the run queue, or running
+    GUEST_RUNNABLE = 0,
+    /// Waiting for a semihosting call handed to the I/O pool
+    GUEST_PARKED,
+    /// Stopped for good, see fault/exit_status
+    GUEST_FINISHED,
+    /// Reached Guest.pause_at, scheduler_resume_guest lets it go on
+    GUEST_PAUSED,
+} GuestStatus;
+
+typedef struct Guest {
+    CpuState cpu;
+    /// Owned by the caller, it must outlive the scheduler, unless owns_memory
+    ProgramMemory memory;
+    /// Set for clones (scheduler_clone_guest), the memory goes with the scheduler
+    bool owns_memory;
+    Semihost semihost;
+    /// Every guest gets the bulk memory coprocessor, and CP15 for its MMU
+    CoprocessorTable coprocessors;
+    BulkCoprocessor bulk;
+    Coprocessor cp15;
+    /// Off until the guest sets c1.M, the guest's accesses are physical until then
+    Mmu mmu;
+    /// Translated ARM blocks of this guest
+    BlockCache *blocks;
+    /// Shared by every guest, NULL optimises hot blocks on the guest's own thread
+    BlockCompiler *compiler;
+    /// Edge coverage of the guest's taken branches, NULL records none
+    CoverageMap *coverage;
+    /// Location of the last branch target recorded, see coverage_edge
+    uint32_t coverage_previous;
+    /// Valid window for control-flow targets (see FaultTrap)
+    word_t fetch_base;
+    word_t fetch_size;
+    /// PC the guest started at, part of its block store key
+    word_t entry;
+    /// The guest pauses when control reaches this address at a block boundary, GUEST_NO_PAUSE never
+    word_t pause_at;
+
+    GuestStatus status;
+    /// Instructions left in the current slice, updated at block boundaries
+    int64_t slice_left;
+    /// Why the guest finished, and where
+    Fault fault;
+    word_t fault_address;
+
+    /// Intrusive link of the run queue / parked list
+    struct Guest *next;
+} Guest;
+
+typedef struct Scheduler {
+    Guest *guests;
+    size_t guest_count;
+    size_t capacity;
+    /// Instructions per slice
+    int64_t quantum;
+    /// Tier thresholds of the guests added from now on
+    TierConfig tiers;
+    /// Edge coverage map of the guests added from now on, NULL records none. Owned by the caller
+    CoverageMap *coverage;
+    /// Performs the semihosting reads/writes of every guest, NULL keeps them synchronous
+    IoPool *io_pool;
+    /// Optimises the hot blocks of every guest, NULL does it on the guest's thread
+    BlockCompiler *compiler;
+    /// Block code of the guests running the same instructions, NULL with a single guest
+    SharedCode *shared_code;
+
+    pthread_mutex_t lock;
+    /// Signalled when a guest becomes runnable or the last one finishes
+    pthread_cond_t changed;
+    /// FIFO of runnable guests that are not running
+    Guest *run_head;
+    Guest *run_tail;
+    /// Guests waiting on the I/O pool
+    Guest *parked;
+    /// Guests that have not finished
+    size_t live;
+} Scheduler;
+
+/// Scheduler for up to `capacity` guests
+/// With `io_workers` > 0 semihosting reads/writes run on that many host threads and the
+/// guests waiting for them are parked, with 0 they block the thread running the guest
+/// With `background_compile` hot blocks are optimised on a thread of their own
+static inline Scheduler *construct_scheduler(const size_t capacity, const uint64_t quantum, const size_t io_workers,
+                                             const bool background_compile) {
+    assert(capacity > 0u);
+
+    // Guests point into themselves (cpu.semihost, cpu.mmu, semihost.memory), neither moves
+    Scheduler *scheduler = calloc(1, sizeof(Scheduler));
+    if (scheduler == NULL) return NULL;
+    scheduler->guests = calloc(capacity, sizeof(Guest));
+    if (scheduler->guests == NULL) {
+        free(scheduler);
+        return NULL;
+    }
+    scheduler->capacity = capacity;
+    scheduler->quantum = quantum == 0u ? SCHEDULER_DEFAULT_QUANTUM : (int64_t)quantum;
+    scheduler->tiers = construct_tier_config();
+    scheduler->io_pool = io_workers > 0u ? construct_io_pool(io_workers) : NULL;
+    scheduler->compiler = background_compile ? construct_block_compiler() : NULL;
+    scheduler->shared_code = capacity > 1u ? construct_shared_code() : NULL;
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->changed, NULL);
+    return scheduler;
+}
+
+static inline void destroy_scheduler(Scheduler *scheduler) {
+    if (scheduler == NULL) return;
+    // Drains the compile jobs first, they point into the block caches
+    destroy_block_compiler(scheduler->compiler);
+    for (size_t i = 0; i < scheduler->guest_count; ++i) {
+        destroy_semihost(&scheduler->guests[i].semihost);
+        destroy_block_cache(scheduler->guests[i].blocks);
+    }
+    // Clones first, the memory they share their RAM with may belong to a guest before them
+    for (size_t i = scheduler->guest_count; i-- > 0;) {
+        if (scheduler->guests[i].owns_memory) destroy_memory(&scheduler->guests[i].memory);
+    }
+    // Released by the block caches
+    destroy_shared_code(scheduler->shared_code);
+    destroy_io_pool(scheduler->io_pool);
+    pthread_cond_destroy(&scheduler->changed);
+    pthread_mutex_destroy(&scheduler->lock);
+    free(scheduler->guests);
+    free(scheduler);
+}
+
+static inline void scheduler_push_runnable(Scheduler *scheduler, Guest *guest) {
+    guest->next = NULL;
+    if (scheduler->run_tail != NULL) scheduler->run_tail->next = guest;
+    else scheduler->run_head = guest;
+    scheduler->run_tail = guest;
+}
+
+static inline Guest *scheduler_pop_runnable(Scheduler *scheduler) {
+    Guest *guest = scheduler->run_head;
+    if (guest == NULL) return NULL;
+    scheduler->run_head = guest->next;
+    if (scheduler->run_head == NULL) scheduler->run_tail = NULL;
+    return guest;
+}
+
+/// Unmapped accesses of a guest's memory stop it with FAULT_OUT_OF_BOUNDS
+static void guest_memory_unmapped(void *context, const word_t addr) {
+    const CpuState *cpu = context;
+    // Outside a slice (loaders, I/O completions) there is no run loop to leave
+    if (cpu->trap == NULL) abort();
+    trap_raise(cpu->trap, FAULT_OUT_OF_BOUNDS, addr);
+}
+
+/// A guest write to a page holding translated code drops the blocks built from it
+static void guest_code_written(void *context, const word_t page, const word_t size) {
+    Guest *guest = context;
+    block_cache_invalidate(guest->blocks, page, size);
+}
+
+static bool guest_cp15_read(void *context, CpuState *cpu, const CoprocessorCall *call, word_t *value) {
+    Guest *guest = context;
+    return cp15_read(&guest->mmu, cpu, call, value);
+}
+
+/// MCR p15 of a guest, its blocks go with the translations they were fetched through
+static bool guest_cp15_write(void *context, CpuState *cpu, const CoprocessorCall *call, const word_t value) {
+    Guest *guest = context;
+    const bool translated = mmu_enabled(&guest->mmu);
+    if (!cp15_write(&guest->mmu, cpu, call, value)) return false;
+    // Control, table base, domains and TLB maintenance may all remap code
+    const bool remaps = call->crn == 1u || call->crn == 2u || call->crn == 3u || call->crn == 8u;
+    if (remaps && (translated || mmu_enabled(&guest->mmu))) block_cache_flush(guest->blocks);
+    return true;
+}
+
+/// Adds a guest that starts at the PC of `cpu` with semihosting, the bulk coprocessor and CP15
+/// The fetch window is [fetch_base, fetch_base + fetch_size], see FaultTrap
+/// Returns NULL when the scheduler is full or out of memory, must not be called while it runs
+static inline Guest *scheduler_add_guest(Scheduler *scheduler, const CpuState *cpu, const ProgramMemory memory,
+                                         const word_t fetch_base, const word_t fetch_size) {
+    assert(scheduler != NULL);
+    assert(cpu != NULL);
+    if (scheduler->guest_count == scheduler->capacity) return NULL;
+
+    Guest *guest = &scheduler->guests[scheduler->guest_count++];
+    guest->cpu = *cpu;
+    guest->memory = memory;
+    guest->semihost = construct_semihost(&guest->memory);
+    guest->semihost.io_pool = scheduler->io_pool;
+    guest->cpu.semihost = &guest->semihost;
+    guest->cpu.memory = &guest->memory;
+    guest->mmu = construct_mmu(&guest->memory);
+    guest->mmu.privileged = cpu_is_privileged(&guest->cpu);
+    guest->cpu.mmu = &guest->mmu;
+    guest->semihost.mmu = &guest->mmu;
+    construct_bulk_coprocessor(&guest->bulk, &guest->memory);
+    guest->cp15 = (Coprocessor){.read = guest_cp15_read, .write = guest_cp15_write, .context = guest};
+    guest->coprocessors = construct_coprocessor_table();
+    coprocessor_register(&guest->coprocessors, BULK_CP, &guest->bulk.coprocessor);
+    coprocessor_register(&guest->coprocessors, 15u, &guest->cp15);
+    guest->cpu.coprocessors = &guest->coprocessors;
+    guest->cpu.trap = NULL;
+    const MemFaultOps fault = {.unmapped = guest_memory_unmapped, .context = &guest->cpu};
+    mem_set_fault_ops(&guest->memory, fault);
+    guest->blocks = construct_block_cache(&guest->memory, &guest->mmu, scheduler->tiers, scheduler->shared_code);
+    guest->compiler = scheduler->compiler;
+    guest->coverage = scheduler->coverage;
+    if (guest->blocks == NULL) {
+        destroy_semihost(&guest->semihost);
+        --scheduler->guest_count;
+        return NULL;
+    }
+    mem_set_code_write_ops(&guest->memory, (MemWriteOps){.written = guest_code_written, .context = guest});
+    guest->fetch_base = fetch_base;
+    guest->fetch_size = fetch_size;
+    guest->entry = cpu_get_pc(&guest->cpu);
+    guest->pause_at = GUEST_NO_PAUSE;
+    guest->status = GUEST_RUNNABLE;
+
+    scheduler_push_runnable(scheduler, guest);
+    ++scheduler->live;
+    return guest;
+}
+
+/// Adds a guest that continues from the current state of `parent`, its RAM shared copy-on-write
+/// Registers, memory contents, the MMU registers and the fetch window are the parent's,
+/// semihosting state (open files) and the other coprocessors' registers start afresh.
+/// The RAM of the parent's memory becomes the shared source (see mem_clone): whoever owns
+/// it keeps it mapped until the scheduler is destroyed. Returns NULL when the scheduler is
+/// full or out of memory, must not be called while it runs.
+static inline Guest *scheduler_clone_guest(Scheduler *scheduler, Guest *parent) {
+    assert(scheduler != NULL);
+    assert(parent != NULL);
+    if (scheduler->guest_count == scheduler->capacity) return NULL;
+
+    ProgramMemory memory = mem_clone(&parent->memory);
+    if (memory.map == NULL) return NULL;
+    // The parent's TLBs still point at the RAM that is now the shared source
+    mmu_flush_tlbs(&parent->mmu);
+    // `parent` points into the guest array, its fields are read before the new guest is written
+    const CpuState cpu = parent->cpu;
+    const Mmu mmu = parent->mmu;
+    const word_t entry = parent->entry;
+    Guest *guest = scheduler_add_guest(scheduler, &cpu, memory, parent->fetch_base, parent->fetch_size);
+    if (guest == NULL) {
+        destroy_memory(&memory);
+        return NULL;
+    }
+    guest->owns_memory = true;
+    guest->mmu.control = mmu.control;
+    guest->mmu.translation_base = mmu.translation_base;
+    guest->mmu.domain_access = mmu.domain_access;
+    guest->mmu.fault_status = mmu.fault_status;
+    guest->mmu.fault_address = mmu.fault_address;
+    // Same code, same block store key
+    guest->entry = entry;
+    return guest;
+}
+
+/// Fills the block caches of the guests from the block store in `dir` (see block_store.h)
+/// Returns the number of blocks loaded, must not be called while the scheduler runs
+static inline size_t scheduler_load_blocks(Scheduler *scheduler, const char *dir) {
+    assert(scheduler != NULL);
+    size_t loaded = 0;
+    for (size_t i = 0; i < scheduler->guest_count; ++i) {
+        const Guest *guest = &scheduler->guests[i];
+        loaded += block_store_load(guest->blocks, dir, guest->fetch_base, guest->fetch_size, guest->entry);
+    }
+    return loaded;
+}
+
+/// Writes the block caches of the guests to the block store in `dir`, once they ran
+/// Stops the block compiler first, hot blocks are then optimised on the guest's thread.
+/// Returns false when a guest's blocks could not be written.
+static inline bool scheduler_save_blocks(Scheduler *scheduler, const char *dir) {
+    assert(scheduler != NULL);
+    // Drained, every submitted block is stored optimised
+    destroy_block_compiler(scheduler->compiler);
+    scheduler->compiler = NULL;
+
+    bool saved = true;
+    for (size_t i = 0; i < scheduler->guest_count; ++i) {
+        Guest *guest = &scheduler->guests[i];
+        guest->compiler = NULL;
+        saved &= block_store_save(guest->blocks, dir, guest->fetch_base, guest->fetch_size, guest->entry);
+    }
+    return saved;
+}
+
+// -------------------------
+// Slices
+// -------------------------
+// ARM code runs in the tiers of its BlockCache (see blocks.h) and the slice is
+// compared once per block. Thumb code is interpreted, counting down per instruction
+// and comparing only when the next PC is not the sequential one. Faults leave through
+// the trap.
+
+/// Runs ARM code until the slice is used up
+static inline void guest_run_arm(Guest *guest, FaultTrap *trap) {
+    CpuState *cpu = &guest->cpu;
+    BlockCache *cache = guest->blocks;
+    const CoverageMap *coverage = guest->coverage;
+    int64_t left = guest->slice_left;
+    word_t next = cpu_get_pc(cpu);
+    Block *block = block_cache_enter(cache, next, trap);
+    for (;;) {
+        // Address after the last instruction run, leaving anywhere else took a branch
+        word_t sequential;
+        if (block != NULL) {
+            next = block_execute(cpu, block);
+            sequential = block->targets[BLOCK_LINK_NEXT];
+            left -= block->length;
+            if (block_count_run(cache, block) &&
+                (guest->compiler == NULL || !block_compiler_submit(guest->compiler, cache, block))) {
+                block_optimise(cache, block);
+            }
+        }
+        else {
+            int64_t run = 0;
+            const word_t from = next;
+            next = block_interpret(cache, cpu, next, trap, &run);
+            sequential = from + (word_t)run * WORD_SIZE_BYTES;
+            left -= run;
+        }
+        if (__builtin_expect(coverage != NULL, 0) && next != sequential) {
+            coverage_edge(coverage, &guest->coverage_previous, next);
+        }
+        cpu_set_pc(cpu, next);
+        guest->slice_left = left;
+        // Followed first, a call still reaches the return-address stack when the slice ends on it
+        block = block != NULL ? block_follow(cache, block, next, trap) : block_cache_enter(cache, next, trap);
+        if (left <= 0 || next == guest->pause_at) return;
+    }
+}
+
+/// Runs Thumb code until the slice is used up at a block boundary
+static inline void guest_run_thumb(Guest *guest, FaultTrap *trap) {
+    CpuState *cpu = &guest->cpu;
+    int64_t left = guest->slice_left;
+    for (;;) {
+        const word_t pc = cpu_get_pc(cpu);
+        const word_t next = execute_thumb_instruction(cpu, decode_thumb(fetch_thumb_virtual(&guest->mmu, &guest->memory, pc, trap))).next_pc;
+        --left;
+        if (next != pc + HALFWORD_SIZE_BYTES) {
+            if (guest->coverage != NULL) coverage_edge(guest->coverage, &guest->coverage_previous, next);
+            guest->slice_left = left;
+            if (left <= 0 || next == guest->pause_at) return;
+        }
+    }
+}
+
+/// Runs one slice of `guest`, its status tells how the slice ended
+static inline void guest_run_slice(Guest *guest, const int64_t quantum) {
+    assert(guest->status == GUEST_RUNNABLE);
+
+    FaultTrap trap = construct_fault_trap(guest->fetch_base, guest->fetch_size);
+    guest->cpu.trap = &trap;
+    guest->slice_left = quantum;
+
+    if (FAULT_TRAP_ENTER(&trap)) {
+        // Cold path, the slice left was stored at the last block boundary
+        if (trap.fault == FAULT_IO_PENDING) {
+            guest->status = GUEST_PARKED;
+        }
+        else if (trap.fault != FAULT_STATE_SWITCH) {
+            guest->status = GUEST_FINISHED;
+            guest->fault = trap.fault;
+            guest->fault_address = trap.address;
+        }
+        // A state switch is a block boundary like any other, the other instruction set
+        // continues below while the slice lasts
+        if (trap.fault != FAULT_STATE_SWITCH || guest->slice_left <= 0) {
+            guest->cpu.trap = NULL;
+            return;
+        }
+    }
+
+    if (cpsr_get_thumb(&guest->cpu.cpsr)) guest_run_thumb(guest, &trap);
+    else guest_run_arm(guest, &trap);
+    guest->cpu.trap = NULL;
+    if (cpu_get_pc(&guest->cpu) == guest->pause_at) guest->status = GUEST_PAUSED;
+}
+
+// -------------------------
+// Host threads
+// -------------------------
+
+/// Moves the parked guests whose I/O is done to the run queue, the lock must be held
+/// Returns the number of guests moved
+static inline size_t scheduler_wake_parked(Scheduler *scheduler) {
+    size_t woken = 0;
+    Guest **link = &scheduler->parked;
+    while (*link != NULL) {
+        Guest *guest = *link;
+        if (!semihost_io_ready(&guest->semihost)) {
+            link = &guest->next;
+            continue;
+        }
+        *link = guest->next;
+        semihost_io_finish(&guest->semihost, &guest->cpu);
+        guest->status = GUEST_RUNNABLE;
+        scheduler_push_runnable(scheduler, guest);
+        ++woken;
+    }
+    return woken;
+}
+
+/// Body of every host thread, returns once every guest has finished
+static inline void *scheduler_thread(void *argument) {
+    Scheduler *scheduler = argument;
+
+    pthread_mutex_lock(&scheduler->lock);
+    while (scheduler->live > 0u) {
+        Guest *guest = scheduler_pop_runnable(scheduler);
+        if (guest != NULL) {
+            pthread_mutex_unlock(&scheduler->lock);
+            guest_run_slice(guest, scheduler->quantum);
+            pthread_mutex_lock(&scheduler->lock);
+
+            switch (guest->status) {
+            case GUEST_RUNNABLE:
+                scheduler_push_runnable(scheduler, guest);
+                break;
+            case GUEST_PARKED:
+                guest->next = scheduler->parked;
+                scheduler->parked = guest;
+                break;
+            case GUEST_FINISHED:
+            case GUEST_PAUSED:
+                if (--scheduler->live == 0u) pthread_cond_broadcast(&scheduler->changed);
+                break;
+            }
+            continue;
+        }
+
+        if (scheduler->parked != NULL) {
+            // Read the count first, a completion after the scan still wakes the wait
+            const uint64_t seen = io_pool_completions(scheduler->io_pool);
+            if (scheduler_wake_parked(scheduler) > 0u) {
+                pthread_cond_broadcast(&scheduler->changed);
+                continue;
+            }
+            pthread_mutex_unlock(&scheduler->lock);
+            io_pool_wait_completion(scheduler->io_pool, seen);
+            pthread_mutex_lock(&scheduler->lock);
+            continue;
+        }
+
+        // Every live guest is running on another thread
+        pthread_cond_wait(&scheduler->changed, &scheduler->lock);
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    return NULL;
+}
+
+/// Makes a paused guest runnable again, its pause address is cleared
+/// Must not be called while the scheduler runs
+static inline void scheduler_resume_guest(Scheduler *scheduler, Guest *guest) {
+    assert(guest->status == GUEST_PAUSED);
+    guest->pause_at = GUEST_NO_PAUSE;
+    guest->status = GUEST_RUNNABLE;
+    scheduler_push_runnable(scheduler, guest);
+    ++scheduler->live;
+}
+
+/// Runs every guest to completion, or to its pause address, on `thread_count` host threads (the caller is one of them)
+static inline void scheduler_run(Scheduler *scheduler, size_t thread_count) {
+    assert(scheduler != NULL);
+    if (thread_count == 0u) thread_count = 1u;
+    if (thread_count > SCHEDULER_MAX_THREADS) thread_count = SCHEDULER_MAX_THREADS;
+    if (thread_count > scheduler->guest_count) thread_count = scheduler->guest_count > 0u ? scheduler->guest_count : 1u;
+
+    pthread_t threads[SCHEDULER_MAX_THREADS];
+    size_t started = 0;
+    while (started + 1u < thread_count &&
+           pthread_create(&threads[started], NULL, scheduler_thread, scheduler) == 0) {
+        ++started;
+    }
+    scheduler_thread(scheduler);
+    for (size_t i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+}
+
+/// Exit status of a finished guest: its SYS_EXIT status, or the fault that stopped it
+static inline int guest_exit_status(const Guest *guest) {
+    assert(guest->status == GUEST_FINISHED);
+    return guest->semihost.exited ? guest->semihost.exit_status : (int)guest->fault;
+}
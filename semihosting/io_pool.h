@@ -0,0 +1,214 @@
+//
+// Created by valentin on 01/28/26.
+//
+#pragma once
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "memory.h"
+
+// Host I/O worker pool
+//
+// A guest that issues a blocking semihosting read/write does not keep its
+// emulating thread waiting on the host: the request is queued here, one of the
+// workers performs it, and the guest is parked until the request is done. The
+// buffers are the guest's own memory (see semihost_guest_iov), which nothing
+// else touches while the guest is parked.
+
+/// Most host-backed runs a single read/write is split into
+#define IO_REQUEST_MAX_IOV 16u
+/// Workers started when the caller asks for 0
+#define IO_POOL_DEFAULT_WORKERS 4u
+#define IO_POOL_MAX_WORKERS 64u
+
+typedef struct IoRequest {
+    int fd;
+    bool write;
+    struct iovec iov[IO_REQUEST_MAX_IOV];
+    int iov_count;
+
+    /// Bytes transferred, or -1 with `error` set
+    ssize_t transferred;
+    int error;
+    /// Set by the worker once transferred/error are valid (release), read with acquire
+    atomic_bool done;
+
+    struct IoRequest *next;
+} IoRequest;
+
+typedef struct IoPool {
+    pthread_t workers[IO_POOL_MAX_WORKERS];
+    size_t worker_count;
+
+    pthread_mutex_t lock;
+    /// Signalled when a request is queued (or the pool stops)
+    pthread_cond_t queued;
+    /// Broadcast whenever a request is done
+    pthread_cond_t completed;
+
+    /// FIFO of requests waiting for a worker
+    IoRequest *head;
+    IoRequest *tail;
+    /// Bumped on every completion, lets waiters sleep without missing one
+    uint64_t completions;
+    bool stopping;
+} IoPool;
+
+/// Performs the request on the calling thread
+static inline void io_request_perform(IoRequest *request) {
+    struct iovec *iov = request->iov;
+    int count = request->iov_count;
+    ssize_t total = 0;
+
+    if (!request->write) {
+        // A single readv, a short read is a valid answer (end of file, terminal line)
+        do {
+            total = readv(request->fd, iov, count);
+        } while (total < 0 && errno == EINTR);
+        request->error = total < 0 ? errno : 0;
+        request->transferred = total;
+        return;
+    }
+
+    // Writes go out completely unless the host refuses them
+    while (count > 0) {
+        const ssize_t written = writev(request->fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            request->error = errno;
+            request->transferred = -1;
+            return;
+        }
+        total += written;
+        size_t left = (size_t)written;
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = (byte_t *)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    request->error = 0;
+    request->transferred = total;
+}
+
+static inline void *io_pool_worker(void *argument) {
+    IoPool *pool = argument;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->head == NULL && !pool->stopping) pthread_cond_wait(&pool->queued, &pool->lock);
+        if (pool->head == NULL) break;
+
+        IoRequest *request = pool->head;
+        pool->head = request->next;
+        if (pool->head == NULL) pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        io_request_perform(request);
+
+        pthread_mutex_lock(&pool->lock);
+        atomic_store_explicit(&request->done, true, memory_order_release);
+        ++pool->completions;
+        pthread_cond_broadcast(&pool->completed);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/// Starts a pool of `worker_count` threads (0 picks IO_POOL_DEFAULT_WORKERS)
+/// Returns NULL when no worker could be started
+static inline IoPool *construct_io_pool(size_t worker_count) {
+    if (worker_count == 0u) worker_count = IO_POOL_DEFAULT_WORKERS;
+    if (worker_count > IO_POOL_MAX_WORKERS) worker_count = IO_POOL_MAX_WORKERS;
+
+    // The workers keep its address, it is never moved
+    IoPool *pool = calloc(1, sizeof(IoPool));
+    if (pool == NULL) return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->queued, NULL);
+    pthread_cond_init(&pool->completed, NULL);
+
+    while (pool->worker_count < worker_count &&
+           pthread_create(&pool->workers[pool->worker_count], NULL, io_pool_worker, pool) == 0) {
+        ++pool->worker_count;
+    }
+    if (pool->worker_count == 0u) {
+        pthread_cond_destroy(&pool->completed);
+        pthread_cond_destroy(&pool->queued);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/// Finishes every queued request, then stops the workers and frees the pool
+static inline void destroy_io_pool(IoPool *pool) {
+    if (pool == NULL) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->queued);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->worker_count; ++i) pthread_join(pool->workers[i], NULL);
+    pthread_cond_destroy(&pool->completed);
+    pthread_cond_destroy(&pool->queued);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+/// Queues a request, it must stay alive and untouched until io_request_done
+static inline void io_pool_submit(IoPool *pool, IoRequest *request) {
+    assert(pool != NULL);
+    assert(request != NULL);
+
+    atomic_store_explicit(&request->done, false, memory_order_relaxed);
+    request->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail != NULL) pool->tail->next = request;
+    else pool->head = request;
+    pool->tail = request;
+    pthread_cond_signal(&pool->queued);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static inline bool io_request_done(const IoRequest *request) {
+    return atomic_load_explicit(&request->done, memory_order_acquire);
+}
+
+/// Completion count, to be passed to io_pool_wait_completion
+static inline uint64_t io_pool_completions(IoPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    const uint64_t completions = pool->completions;
+    pthread_mutex_unlock(&pool->lock);
+    return completions;
+}
+
+/// Sleeps until some request completes after `seen` (a value of io_pool_completions)
+/// A scheduler with only parked guests reads the count, polls its guests, and waits here
+static inline void io_pool_wait_completion(IoPool *pool, const uint64_t seen) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->completions == seen) pthread_cond_wait(&pool->completed, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/// Sleeps until `request` is done
+static inline void io_pool_wait(IoPool *pool, const IoRequest *request) {
+    pthread_mutex_lock(&pool->lock);
+    while (!io_request_done(request)) pthread_cond_wait(&pool->completed, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,521 @@
+//
+// Created by valentin on 01/27/26.
+//
+#pragma once
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "cpu/cpu.h"
+#include "faults/fault.h"
+#include "semihosting/io_pool.h"
+
+// ARM semihosting
+//
+// A guest asks the host for a service with SWI 0x123456 (ARM) or SWI 0xAB (Thumb),
+// the operation in r0 and a pointer to its parameter block in r1. The result goes
+// back in r0.
+//
+// Guest buffers are never copied: they are cut into host-backed runs of the memory
+// map (normally a single one, one per page under the guest's MMU) and handed to
+// readv/writev as they are, so a read of a large file lands straight in guest RAM.
+// Console output is the exception, it is collected in a buffer and written in large
+// blocks. Guest addresses are virtual: a buffer the MMU would abort on is EFAULT.
+//
+// With an IoPool attached, reads and writes that reach the host are performed by
+// the pool instead: the call only queues them and the guest is parked (see
+// semihost_call) until semihost_io_finish delivers the result.
+
+/// SWI comment fields that select semihosting instead of the SWI exception
+#define SEMIHOST_SWI_ARM 0x123456u
+#define SEMIHOST_SWI_THUMB 0xABu
+
+/// Open guest files at once, including the console handles
+#define SEMIHOST_MAX_HANDLES 64u
+/// Console output is written to the host once this much has been collected
+#define SEMIHOST_CONSOLE_BUFFER_SIZE (64u * 1024u)
+/// Longest path accepted by SYS_OPEN
+#define SEMIHOST_MAX_PATH 1024u
+
+/// Operation numbers (r0)
+typedef enum SemihostOp {
+    SYS_OPEN = 0x01,
+    SYS_CLOSE = 0x02,
+    SYS_WRITEC = 0x03,
+    SYS_WRITE0 = 0x04,
+    SYS_WRITE = 0x05,
+    SYS_READ = 0x06,
+    SYS_READC = 0x07,
+    SYS_ISERROR = 0x08,
+    SYS_ISTTY = 0x09,
+    SYS_SEEK = 0x0A,
+    SYS_FLEN = 0x0C,
+    SYS_REMOVE = 0x0E,
+    SYS_CLOCK = 0x10,
+    SYS_TIME = 0x11,
+    SYS_ERRNO = 0x13,
+    SYS_EXIT = 0x18,
+    SYS_EXIT_EXTENDED = 0x20,
+    SYS_ELAPSED = 0x30,
+    SYS_TICKFREQ = 0x31,
+} SemihostOp;
+
+/// SYS_EXIT reason of a normal application exit (ADP_Stopped_ApplicationExit)
+#define SEMIHOST_EXIT_APPLICATION 0x20026u
+
+/// Returned in r0 by failing operations
+#define SEMIHOST_ERROR ((word_t)-1)
+
+typedef struct Semihost {
+    /// Guest memory the parameter blocks and buffers are in
+    const ProgramMemory *memory;
+    /// Translates their addresses once the guest enables it, NULL when they are physical
+    const Mmu *mmu;
+    /// Host descriptor of each guest handle (handle = index + 1), -1 when free
+    int handles[SEMIHOST_MAX_HANDLES];
+    /// errno of the last failing operation, for SYS_ERRNO
+    int last_errno;
+
+    /// Pending console output, for host stdout
+    byte_t *console;
+    size_t console_used;
+
+    /// Set by SYS_EXIT, the run loop then stops with FAULT_NONE
+    bool exited;
+    int exit_status;
+
+    /// Reference point of SYS_CLOCK and SYS_ELAPSED
+    struct timespec start;
+
+    /// Performs host reads/writes asynchronously, NULL to perform them in the call
+    IoPool *io_pool;
+    /// The read/write in flight, valid while io_pending
+    IoRequest request;
+    /// Length the guest asked for, the result is what is left of it
+    word_t request_length;
+    bool io_pending;
+} Semihost;
+
+static inline Semihost construct_semihost(const ProgramMemory *memory) {
+    assert(memory != NULL);
+
+    Semihost semihost = {0};
+    semihost.memory = memory;
+    for (size_t i = 0; i < SEMIHOST_MAX_HANDLES; ++i) semihost.handles[i] = -1;
+    semihost.console = malloc(SEMIHOST_CONSOLE_BUFFER_SIZE);
+    assert(semihost.console != NULL);
+    clock_gettime(CLOCK_MONOTONIC, &semihost.start);
+    return semihost;
+}
+
+// -------------------------
+// Host side helpers
+// -------------------------
+
+static inline void semihost_flush_console(Semihost *semihost) {
+    if (semihost->console_used == 0u) return;
+    IoRequest flush = {.fd = STDOUT_FILENO, .write = true, .iov_count = 1};
+    flush.iov[0] = (struct iovec){.iov_base = semihost->console, .iov_len = semihost->console_used};
+    io_request_perform(&flush);
+    semihost->console_used = 0;
+}
+
+static inline void destroy_semihost(Semihost *semihost) {
+    assert(semihost != NULL);
+    // The request points into guest memory, it must not outlive it
+    if (semihost->io_pending) io_pool_wait(semihost->io_pool, &semihost->request);
+    semihost_flush_console(semihost);
+    for (size_t i = 0; i < SEMIHOST_MAX_HANDLES; ++i) {
+        if (semihost->handles[i] > STDERR_FILENO) close(semihost->handles[i]);
+    }
+    free(semihost->console);
+    *semihost = (Semihost){0};
+}
+
+/// Host descriptor of a guest handle, -1 when the handle is not open
+static inline int semihost_fd(const Semihost *semihost, const word_t handle) {
+    if (handle == 0u || handle > SEMIHOST_MAX_HANDLES) return -1;
+    return semihost->handles[handle - 1u];
+}
+
+/// Cuts the guest buffer [addr, addr + length) into host-backed runs
+/// Returns the number of runs, -1 when part of it is not guest RAM (ROM too when !writable)
+/// or it needs more than IO_REQUEST_MAX_IOV runs
+static inline int semihost_guest_iov(const Semihost *semihost, word_t addr, uint64_t length, const bool writable,
+                                     struct iovec iov[IO_REQUEST_MAX_IOV]) {
+    int count = 0;
+    while (length > 0u) {
+        if (count == (int)IO_REQUEST_MAX_IOV) return -1;
+        byte_t *host;
+        const uint64_t span = mmu_host_span(semihost->mmu, semihost->memory, addr, length, writable, &host);
+        if (span == 0u) return -1;
+        iov[count++] = (struct iovec){.iov_base = host, .iov_len = (size_t)span};
+        addr += (word_t)span;
+        length -= span;
+    }
+    return count;
+}
+
+/// Copies the guest bytes [addr, addr + length) to `out`, false when part of them is not RAM or ROM
+static inline bool semihost_copy_in(const Semihost *semihost, word_t addr, uint64_t length, byte_t *out) {
+    while (length > 0u) {
+        byte_t *host;
+        const uint64_t span = mmu_host_span(semihost->mmu, semihost->memory, addr, length, false, &host);
+        if (span == 0u) return false;
+        memcpy(out, host, (size_t)span);
+        out += span;
+        addr += (word_t)span;
+        length -= span;
+    }
+    return true;
+}
+
+/// Guest byte or word at `addr`, false when it is not in guest memory
+static inline bool semihost_load(const Semihost *semihost, const word_t addr, const word_t size_bytes,
+                                 word_t *value) {
+    word_t physical;
+    if ((addr & (size_bytes - 1u)) != 0u || !mmu_translate(semihost->mmu, addr, MMU_ACCESS_READ, &physical) ||
+        !mem_in_bounds(semihost->memory, physical, size_bytes)) {
+        return false;
+    }
+    *value = size_bytes == WORD_SIZE_BYTES ? mem_read32(semihost->memory, physical)
+                                           : mem_read8(semihost->memory, physical);
+    return true;
+}
+
+/// Word `index` of the parameter block at `block`, false when the block is not in guest memory
+static inline bool semihost_arg(const Semihost *semihost, const word_t block, const word_t index, word_t *value) {
+    return semihost_load(semihost, block + index * WORD_SIZE_BYTES, WORD_SIZE_BYTES, value);
+}
+
+static inline word_t semihost_fail(Semihost *semihost, const int error) {
+    semihost->last_errno = error;
+    return SEMIHOST_ERROR;
+}
+
+/// SYS_READ/SYS_WRITE result of a finished request: the number of bytes NOT transferred
+static inline word_t semihost_io_result(Semihost *semihost) {
+    const IoRequest *request = &semihost->request;
+    if (request->transferred < 0) {
+        semihost->last_errno = request->error;
+        return semihost->request_length;
+    }
+    return semihost->request_length - (word_t)request->transferred;
+}
+
+/// Performs the prepared request, or hands it to the I/O pool and marks the call pending
+static inline word_t semihost_io_start(Semihost *semihost, const word_t length) {
+    semihost->request_length = length;
+    if (semihost->io_pool != NULL) {
+        semihost->io_pending = true;
+        io_pool_submit(semihost->io_pool, &semihost->request);
+        return 0;
+    }
+    io_request_perform(&semihost->request);
+    return semihost_io_result(semihost);
+}
+
+// -------------------------
+// Operations
+// -------------------------
+
+/// SYS_OPEN {name, mode (fopen mode 0-11), name length}, ":tt" is the console
+static inline word_t semihost_open(Semihost *semihost, const word_t block) {
+    static const int FLAGS[12] = {
+        O_RDONLY, O_RDONLY, O_RDWR, O_RDWR,
+        O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_TRUNC, O_RDWR | O_CREAT | O_TRUNC, O_RDWR | O_CREAT | O_TRUNC,
+        O_WRONLY | O_CREAT | O_APPEND, O_WRONLY | O_CREAT | O_APPEND, O_RDWR | O_CREAT | O_APPEND, O_RDWR | O_CREAT | O_APPEND,
+    };
+    word_t name_addr, mode, length;
+    if (!semihost_arg(semihost, block, 0, &name_addr) || !semihost_arg(semihost, block, 1, &mode) ||
+        !semihost_arg(semihost, block, 2, &length) || mode >= 12u || length >= SEMIHOST_MAX_PATH) {
+        return semihost_fail(semihost, EINVAL);
+    }
+    char path[SEMIHOST_MAX_PATH];
+    if (!semihost_copy_in(semihost, name_addr, length, (byte_t *)path)) return semihost_fail(semihost, EFAULT);
+    path[length] = '\0';
+
+    size_t slot = 0;
+    while (slot < SEMIHOST_MAX_HANDLES && semihost->handles[slot] != -1) ++slot;
+    if (slot == SEMIHOST_MAX_HANDLES) return semihost_fail(semihost, EMFILE);
+
+    int fd;
+    if (strcmp(path, ":tt") == 0) {
+        // Read modes get stdin, write modes stdout, append modes stderr
+        fd = mode < 4u ? STDIN_FILENO : mode < 8u ? STDOUT_FILENO : STDERR_FILENO;
+    }
+    else {
+        fd = open(path, FLAGS[mode] | O_CLOEXEC, 0644);
+        if (fd < 0) return semihost_fail(semihost, errno);
+    }
+    semihost->handles[slot] = fd;
+    return (word_t)(slot + 1u);
+}
+
+/// SYS_CLOSE {handle}
+static inline word_t semihost_close(Semihost *semihost, const word_t block) {
+    word_t handle;
+    if (!semihost_arg(semihost, block, 0, &handle)) return semihost_fail(semihost, EINVAL);
+    const int fd = semihost_fd(semihost, handle);
+    if (fd < 0) return semihost_fail(semihost, EBADF);
+
+    semihost->handles[handle - 1u] = -1;
+    if (fd > STDERR_FILENO && close(fd) != 0) return semihost_fail(semihost, errno);
+    return 0;
+}
+
+/// SYS_WRITE {handle, buffer, length}, returns the number of bytes NOT written
+static inline word_t semihost_write(Semihost *semihost, const word_t block) {
+    word_t handle, buffer, length;
+    if (!semihost_arg(semihost, block, 0, &handle) || !semihost_arg(semihost, block, 1, &buffer) ||
+        !semihost_arg(semihost, block, 2, &length)) {
+        return semihost_fail(semihost, EINVAL);
+    }
+    const int fd = semihost_fd(semihost, handle);
+    if (fd < 0) {
+        semihost->last_errno = EBADF;
+        return length;
+    }
+
+    IoRequest *request = &semihost->request;
+    const int count = semihost_guest_iov(semihost, buffer, length, false, request->iov);
+    if (count < 0) {
+        semihost->last_errno = EFAULT;
+        return length;
+    }
+
+    if (fd == STDOUT_FILENO && length <= SEMIHOST_CONSOLE_BUFFER_SIZE - semihost->console_used) {
+        // Console output is collected, the copy is what turns many small writes into one
+        for (int i = 0; i < count; ++i) {
+            memcpy(semihost->console + semihost->console_used, request->iov[i].iov_base, request->iov[i].iov_len);
+            semihost->console_used += request->iov[i].iov_len;
+        }
+        return 0;
+    }
+    // Keep the order of everything already collected
+    if (fd == STDOUT_FILENO || fd == STDERR_FILENO) semihost_flush_console(semihost);
+
+    request->fd = fd;
+    request->write = true;
+    request->iov_count = count;
+    return semihost_io_start(semihost, length);
+}
+
+/// SYS_READ {handle, buffer, length}, returns the number of bytes NOT read
+static inline word_t semihost_read(Semihost *semihost, const word_t block) {
+    word_t handle, buffer, length;
+    if (!semihost_arg(semihost, block, 0, &handle) || !semihost_arg(semihost, block, 1, &buffer) ||
+        !semihost_arg(semihost, block, 2, &length)) {
+        return semihost_fail(semihost, EINVAL);
+    }
+    const int fd = semihost_fd(semihost, handle);
+    if (fd < 0) {
+        semihost->last_errno = EBADF;
+        return length;
+    }
+
+    IoRequest *request = &semihost->request;
+    const int count = semihost_guest_iov(semihost, buffer, length, true, request->iov);
+    if (count < 0) {
+        semihost->last_errno = EFAULT;
+        return length;
+    }
+    // A prompt must be visible before the guest waits for its answer
+    if (fd == STDIN_FILENO) semihost_flush_console(semihost);
+
+    request->fd = fd;
+    request->write = false;
+    request->iov_count = count;
+    return semihost_io_start(semihost, length);
+}
+
+/// SYS_SEEK {handle, absolute position}
+static inline word_t semihost_seek(Semihost *semihost, const word_t block) {
+    word_t handle, position;
+    if (!semihost_arg(semihost, block, 0, &handle) || !semihost_arg(semihost, block, 1, &position)) {
+        return semihost_fail(semihost, EINVAL);
+    }
+    const int fd = semihost_fd(semihost, handle);
+    if (fd < 0) return semihost_fail(semihost, EBADF);
+    if (lseek(fd, (off_t)position, SEEK_SET) < 0) return semihost_fail(semihost, errno);
+    return 0;
+}
+
+/// SYS_FLEN {handle}
+static inline word_t semihost_flen(Semihost *semihost, const word_t block) {
+    word_t handle;
+    if (!semihost_arg(semihost, block, 0, &handle)) return semihost_fail(semihost, EINVAL);
+    const int fd = semihost_fd(semihost, handle);
+    if (fd < 0) return semihost_fail(semihost, EBADF);
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) return semihost_fail(semihost, errno);
+    return (word_t)info.st_size;
+}
+
+/// Time since the semihost was constructed, in 1/`ticks_per_second`
+static inline uint64_t semihost_elapsed(const Semihost *semihost, const uint64_t ticks_per_second) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const int64_t ns = (int64_t)(now.tv_sec - semihost->start.tv_sec) * 1000000000 + (now.tv_nsec - semihost->start.tv_nsec);
+    return (uint64_t)ns / (1000000000u / ticks_per_second);
+}
+
+/// SYS_EXIT: r1 is the reason (32-bit semihosting), SYS_EXIT_EXTENDED: r1 points to {reason, status}
+__attribute__((noreturn))
+static inline void semihost_exit(Semihost *semihost, CpuState *cpu, const word_t op, const word_t argument) {
+    word_t reason = argument;
+    word_t status = 0;
+    if (op == SYS_EXIT_EXTENDED && (!semihost_arg(semihost, argument, 0, &reason) ||
+                                    !semihost_arg(semihost, argument, 1, &status))) {
+        reason = 0;
+    }
+    semihost_flush_console(semihost);
+    semihost->exited = true;
+    semihost->exit_status = reason == SEMIHOST_EXIT_APPLICATION ? (int)status : 1;
+    trap_raise(cpu->trap, FAULT_NONE, cpu_get_pc(cpu));
+}
+
+/// Performs the semihosting call in r0/r1 and stores its result in r0
+/// Returns false when the call was handed to the I/O pool, the guest must then not run
+/// until semihost_io_ready and semihost_io_finish has stored the result
+static inline bool semihost_call(Semihost *semihost, CpuState *cpu) {
+    assert(semihost != NULL);
+    assert(cpu != NULL);
+    assert(!semihost->io_pending);
+
+    const word_t op = cpu_get_reg(cpu, 0);
+    const word_t argument = cpu_get_reg(cpu, 1);
+    word_t result;
+
+    switch (op) {
+    case SYS_OPEN: result = semihost_open(semihost, argument); break;
+    case SYS_CLOSE: result = semihost_close(semihost, argument); break;
+    case SYS_WRITE: result = semihost_write(semihost, argument); break;
+    case SYS_READ: result = semihost_read(semihost, argument); break;
+    case SYS_SEEK: result = semihost_seek(semihost, argument); break;
+    case SYS_FLEN: result = semihost_flen(semihost, argument); break;
+
+    case SYS_WRITEC: {
+        // r1 points to the character
+        word_t c;
+        if (!semihost_load(semihost, argument, BYTE_SIZE_BYTES, &c)) {
+            result = semihost_fail(semihost, EFAULT);
+            break;
+        }
+        if (semihost->console_used == SEMIHOST_CONSOLE_BUFFER_SIZE) semihost_flush_console(semihost);
+        semihost->console[semihost->console_used++] = (byte_t)c;
+        result = 0;
+        break;
+    }
+    case SYS_WRITE0: {
+        // r1 points to a NUL-terminated string
+        word_t c;
+        for (word_t addr = argument; semihost_load(semihost, addr, BYTE_SIZE_BYTES, &c) && c != '\0'; ++addr) {
+            if (semihost->console_used == SEMIHOST_CONSOLE_BUFFER_SIZE) semihost_flush_console(semihost);
+            semihost->console[semihost->console_used++] = (byte_t)c;
+        }
+        result = 0;
+        break;
+    }
+    case SYS_READC: {
+        semihost_flush_console(semihost);
+        byte_t c;
+        result = read(STDIN_FILENO, &c, 1) == 1 ? c : SEMIHOST_ERROR;
+        break;
+    }
+    case SYS_ISERROR: {
+        // r1 points to the value to test
+        word_t value;
+        result = semihost_arg(semihost, argument, 0, &value) && (int32_t)value < 0;
+        break;
+    }
+    case SYS_ISTTY: {
+        word_t handle;
+        const int fd = semihost_arg(semihost, argument, 0, &handle) ? semihost_fd(semihost, handle) : -1;
+        result = fd >= 0 && isatty(fd);
+        break;
+    }
+    case SYS_REMOVE: {
+        word_t name_addr, length;
+        char path[SEMIHOST_MAX_PATH];
+        if (!semihost_arg(semihost, argument, 0, &name_addr) || !semihost_arg(semihost, argument, 1, &length) ||
+            length >= SEMIHOST_MAX_PATH || !semihost_copy_in(semihost, name_addr, length, (byte_t *)path)) {
+            result = semihost_fail(semihost, EFAULT);
+            break;
+        }
+        path[length] = '\0';
+        result = unlink(path) == 0 ? 0 : semihost_fail(semihost, errno);
+        break;
+    }
+    case SYS_CLOCK:
+        // Centiseconds since start
+        result = (word_t)semihost_elapsed(semihost, 100u);
+        break;
+    case SYS_TIME:
+        result = (word_t)time(NULL);
+        break;
+    case SYS_ERRNO:
+        result = (word_t)semihost->last_errno;
+        break;
+    case SYS_ELAPSED: {
+        // r1 points to a doubleword receiving the tick count (ticks are microseconds)
+        const uint64_t ticks = semihost_elapsed(semihost, 1000000u);
+        // The two words may sit on different pages, both are checked before either is written
+        byte_t *low, *high;
+        if ((argument & WORD_ALIGN_MASK) != 0u ||
+            mmu_host_span(semihost->mmu, semihost->memory, argument, WORD_SIZE_BYTES, true, &low) !=
+                WORD_SIZE_BYTES ||
+            mmu_host_span(semihost->mmu, semihost->memory, argument + WORD_SIZE_BYTES, WORD_SIZE_BYTES, true,
+                          &high) != WORD_SIZE_BYTES) {
+            result = semihost_fail(semihost, EFAULT);
+            break;
+        }
+        mem_host_store(low, (word_t)ticks, WORD_SIZE_BYTES);
+        mem_host_store(high, (word_t)(ticks >> 32), WORD_SIZE_BYTES);
+        result = 0;
+        break;
+    }
+    case SYS_TICKFREQ:
+        result = 1000000u;
+        break;
+    case SYS_EXIT:
+    case SYS_EXIT_EXTENDED:
+        semihost_exit(semihost, cpu, op, argument);
+    default:
+        result = semihost_fail(semihost, ENOSYS);
+        break;
+    }
+    if (semihost->io_pending) return false;
+    cpu_set_reg(cpu, 0, result);
+    return true;
+}
+
+/// True once the parked call can be finished without blocking
+static inline bool semihost_io_ready(const Semihost *semihost) {
+    assert(semihost->io_pending);
+    return io_request_done(&semihost->request);
+}
+
+/// Blocks until the parked call is done
+static inline void semihost_io_wait(const Semihost *semihost) {
+    assert(semihost->io_pending);
+    io_pool_wait(semihost->io_pool, &semihost->request);
+}
+
+/// Stores the result of the parked call in r0, the guest can then run again
+static inline void semihost_io_finish(Semihost *semihost, CpuState *cpu) {
+    assert(semihost_io_ready(semihost));
+    cpu_set_reg(cpu, 0, semihost_io_result(semihost));
+    semihost->io_pending = false;
+}